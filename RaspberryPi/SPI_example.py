@@ -23,6 +23,9 @@ set_direction = io.bcm2835_gpio_fsel
 set_pull = io.bcm2835_gpio_set_pud
 set_pin = io.bcm2835_gpio_write
 
+#SPI_EXTERNAL_NUMBER_OF_SLOTS in spi.h: frames the charger takes in one transfer
+spi_slots = 1
+
 def delay_ms(ms):
     io.bcm2835_delay(ms)
 
@@ -85,10 +88,14 @@ def test_spi():
       print("Do you have the loopback from MOSI to MISO connected?")
       
 def spi_send_receive(data_to_send, number_of_bytes=None):
+    #The bootloader only accepts frames of exactly 64 bytes, so every transfer is padded
+    #to a multiple of 64 bytes. number_of_bytes limits the data returned
     if not number_of_bytes:
-        number_of_bytes = len(data_to_send)    
-    #print('Sending {0} bytes of data: {1}'.format(number_of_bytes, list_to_string(data_to_send)))
-    receive_data =ctypes.create_string_buffer(bytes(data_to_send[:number_of_bytes]), number_of_bytes)
+        number_of_bytes = len(data_to_send)
+    frames = max(1, (len(data_to_send) + 63) // 64)
+    data_to_send = (list(data_to_send) + [0x00]*64*frames)[:64*frames]
+    #print('Sending {0} bytes of data: {1}'.format(len(data_to_send), list_to_string(data_to_send)))
+    receive_data =ctypes.create_string_buffer(bytes(data_to_send), len(data_to_send))
     
     #Wait until there is not activity on the bus
     io.bcm2835_gpio_fsel(pin_sclk, dir_input)
@@ -105,12 +112,39 @@ def spi_send_receive(data_to_send, number_of_bytes=None):
             break
         
     io.bcm2835_spi_begin()
-    io.bcm2835_spi_transfern(receive_data, number_of_bytes)
+    io.bcm2835_spi_transfern(receive_data, len(data_to_send))
     io.bcm2835_spi_end()
     
     receive_data = list(receive_data)
     receive_data = [int.from_bytes(x, byteorder='big') for x in receive_data]
-    return receive_data
+    return receive_data[:number_of_bytes]
+
+def spi_request(data_to_send, number_of_bytes=64, timeout_ms=1000):
+    #Sends a frame and polls with echo requests until its response shows up
+    #The response comes with the next transfer if the bootloader had the time to prepare it
+    #Otherwise the frame received is a status (0x99, reason) and a later transfer carries it
+    #Returns None if there is no response, e.g. because the frame was dropped
+    poll = [0x20] + [0x00]*63
+    spi_send_receive(data_to_send)
+    while timeout_ms > 0:
+        received_data = spi_send_receive(poll)
+        if received_data[0] == data_to_send[0] and received_data[1:3] == [0xC1, 0x25]:
+            return received_data[:number_of_bytes]
+        delay_ms(1)
+        timeout_ms -= 1
+    print('No response to 0x{0:02X}'.format(data_to_send[0]))
+    return None
+
+def spi_send_frames(frames):
+    #Sends up to spi_slots frames back to back in one transfer, 64 bytes each
+    #Returns the responses to the frames sent with an earlier transfer, one per frame
+    #A response starting with 0x99 is a status: 0x99 no frame received in that slot,
+    #0x98 frame rejected (not 64 bytes), 0x97 frame dropped (too many frames), 0x96 not ready yet
+    tx_data = []
+    for frame in frames[:spi_slots]:
+        tx_data += (frame + [0x00]*64)[:64]
+    received_data = spi_send_receive(tx_data)
+    return [received_data[64*cntr:64*cntr+64] for cntr in range(len(frames[:spi_slots]))]
 
 def reboot():
     tx_data = [0x10, 0x20]
@@ -149,11 +183,9 @@ def press_pushbutton():
 
 def get_file_info(file_number):
     tx_data = [0x80, (file_number & 0b00111111)]
-    spi_send_receive(tx_data)
-    tx_data = [0x10]
-    received_data = spi_send_receive(tx_data, 37)
-    if not received_data[:3] == [0x80, 0xC1, 0x25]:
-        print('Signature of data package is incorrect:', received_data[:3])
+    received_data = spi_request(tx_data, 37)
+    if not received_data:
+        return
     print(received_data)
     print('File number: {0}'.format(received_data[3]))
     print('Return code: {0}'.format(received_data[4]))
@@ -166,10 +198,8 @@ def get_file_info(file_number):
 def list_files():
     for file_number in range(1, 63):
         tx_data = [0x80, (file_number & 0b00111111)]
-        spi_send_receive(tx_data)
-        tx_data = [0x10]
-        received_data = spi_send_receive(tx_data, 37)
-        if received_data[4] == 0:
+        received_data = spi_request(tx_data, 37)
+        if received_data and received_data[4] == 0:
             file_name = ''.join([chr(x) for x in received_data[5:13] if not x==0x20])
             extention = ''.join([chr(x) for x in received_data[13:16] if not x==0x20])
             file_size = 2**24*received_data[36] + 2**16*received_data[35] + 2**8*received_data[34] + received_data[33]
@@ -181,6 +211,8 @@ def test_spi_communication(buffer_size, trials):
     print('\nTesting SPI Communication')
     print('-------------------------')
     fails = 0
+    #Frames are always 64 bytes long
+    buffer_size = 64*max(1, (buffer_size + 63) // 64)
     tx_data = [0x20]
     for i in range(buffer_size-1):
         tx_data.append(random.randint(0,255))
@@ -210,11 +242,9 @@ def finish():
 def get_status():
     print('\nStatus Information')
     print('------------------')
-    send_data = [0x10]
-    spi_send_receive(send_data)
-    received_data = spi_send_receive(send_data, 44)
-    if not received_data[:3] == [0x10, 0xC1, 0x25]:
-        print('Signature of data package is incorrect:', received_data[:3])
+    received_data = spi_request([0x10], 44)
+    if not received_data:
+        return
     print('Flash is busy:', bool(received_data[3]))
     print('Bootloader version: {0}.{1}.{2}'.format(received_data[4], received_data[5], received_data[6]))
     print('User interface status: {0}'.format(received_data[7]))
@@ -223,16 +253,16 @@ def get_status():
     print('Time slot: {0}'.format(received_data[10]))
     print('Done: {0}'.format(bool(received_data[11])))
     print('Bootloader mode: {0}'.format(received_data[12]))
-    print('Display mode {0}\n'.format(received_data[13]))
+    print('Display mode {0}'.format(received_data[13]))
+    boot_time = 2**8*received_data[14] + received_data[15]
+    print('Boot time: {0:.2f}ms\n'.format(boot_time*256/12000.0))
     
 def get_bootloader_details():
     print('\nBootloader Details')
     print('------------------')
-    send_data = [0x13]
-    spi_send_receive(send_data)
-    received_data = spi_send_receive(send_data, 64)
-    if not received_data[:3] == [0x13, 0xC1, 0x25]:
-        print('Signature of data package is incorrect:', received_data[:3])
+    received_data = spi_request([0x13], 64)
+    if not received_data:
+        return
     file_size = 2**24*received_data[3] + 2**16*received_data[4] + 2**8*received_data[5] + received_data[6]
     print('File size: {0}'.format(file_size))
     entries = 2**8*received_data[7] + received_data[8]
@@ -242,8 +272,13 @@ def get_bootloader_details():
     print('Error: {0}'.format(received_data[11]))
     pages = 2**8*received_data[12] + received_data[13]
     print('Flash pages written: {0}'.format(pages))
-    pages = 2**8*received_data[12] + received_data[13]
-    print('Flash pages written: {0}'.format(pages))
+    pages = 2**8*received_data[37] + received_data[38]
+    print('Flash pages erased: {0}'.format(pages))
+    blocks = 2**8*received_data[39] + received_data[40]
+    print('Flash blocks (64 bytes) written: {0}'.format(blocks))
+    page = 2**8*received_data[41] + received_data[42]
+    print('Last page failing verification: {0}'.format(page if page else 'none'))
+    print('Pages written again: {0}'.format(received_data[43]))
     data_length = 2**8*received_data[14] + received_data[15]
     print('Length of last record: {0}'.format(data_length))
     address = 2**8*received_data[16] + received_data[17]
@@ -251,22 +286,47 @@ def get_bootloader_details():
     print('Record type of last record: {0}'.format(received_data[18]))
     print('Checksum of last record: {0}'.format(received_data[19]))
     print('Checksum check of last record: {0}'.format(received_data[20]))
-    if data_length>43:
-        data_length = 43
+    if data_length>16:
+        data_length = 16
     print('Data or last record: {0}'.format(received_data[21:21+data_length]))
     
+def get_profiler():
+    print('\nProfiler')
+    print('--------')
+    #One timer tick is 8 instruction cycles at 12MIPS
+    tick = 8/12.0
+    probes = ['Flash read', 'Flash write', 'FAT read', 'Hex parse', 'USB tasks', 'I2C',
+              'FAT write', 'FAT copy', 'FAT format']
+    for probe, name in enumerate(probes):
+        #4 probes per frame. 0x14 returns the first ones, 0x87 any others
+        if probe%4 == 0:
+            if probe == 0:
+                send_data = [0x14]
+            else:
+                send_data = [0x87, probe]
+            received_data = spi_request(send_data)
+            if not received_data:
+                return
+        data = received_data[4+14*(probe%4):18+14*(probe%4)]
+        count = 2**8*data[0] + data[1]
+        minimum = 2**24*data[2] + 2**16*data[3] + 2**8*data[4] + data[5]
+        maximum = 2**24*data[6] + 2**16*data[7] + 2**8*data[8] + data[9]
+        total = 2**24*data[10] + 2**16*data[11] + 2**8*data[12] + data[13]
+        if count:
+            print('{0:12s} {1:5d} calls, min {2:.1f}us, avg {3:.1f}us, max {4:.1f}us'.format(name, count, minimum*tick, total*tick/count, maximum*tick))
+        else:
+            print('{0:12s} no calls'.format(name))
+    
+def reset_profiler():
+    tx_data = [0x10, 0x25]
+    spi_send_receive(tx_data)
+    print('Profiler reset')
+    
 def read_display():
-    send_data = [0x11]
-    spi_send_receive(send_data)
-    send_data = [0x12]
-    delay_ms(20)
-    received_data_1 = spi_send_receive(send_data, 44)
-    if not received_data_1[:3] == [0x11, 0xC1, 0x25]:
-        print('Signature of first data package is incorrect:', received_data_1[:3])
-    delay_ms(20)
-    received_data_2 = spi_send_receive(send_data, 44)
-    if not received_data_2[:3] == [0x12, 0xC1, 0x25]:
-        print('Signature of second data package is incorrect:', received_data_2[:3])    
+    received_data_1 = spi_request([0x11], 44)
+    received_data_2 = spi_request([0x12], 44)
+    if not received_data_1 or not received_data_2:
+        return
     line_1 = ''.join([chr(x) for x in received_data_1[3:23]])
     line_2 = ''.join([chr(x) for x in received_data_1[23:43]])
     line_3 = ''.join([chr(x) for x in received_data_2[3:23]])
@@ -338,6 +398,13 @@ def modify_file(file_number, start_byte, data):
     spi_send_receive(tx_data)
     print('Modified file number {0} starting from byte {1}'.format(file_number, start_byte))
 
+def set_fast_boot(enable):
+    #0x77: Change boot options. Parameters: uint8_t NewBootOptions, 0x3F1C
+    options = 0xFB if enable else 0x00
+    tx_data = [0x10, 0x77, options, 0x3F, 0x1C]
+    spi_send_receive(tx_data)
+    print('Fast boot {0}'.format('enabled' if enable else 'disabled'))
+
 def format_drive():
     tx_data = [0x10, 0x56, 0xDA, 0x22]
     spi_send_receive(tx_data)
@@ -368,6 +435,52 @@ def write_sector(file_number, sector_number, data):
     buffer_to_file_sector(file_number, sector_number)
 
 
+def crc16(data, crc=0xFFFF):
+    #CRC-16 CCITT, same as the bootloader
+    for byte in data:
+        crc ^= byte << 8
+        for bit in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xFFFF
+            else:
+                crc = (crc << 1) & 0xFFFF
+    return crc
+
+def bulk_write_open(file_number, sector_number):
+    #0x5B: Open bulk write. Parameters: uint8_t FileNumber, uint16_t FirstSector, 0xC7E1
+    sector_numbers = [(sector_number>>8)&0xFF, sector_number&0xFF]
+    tx_data = [0x10, 0x5B, file_number] + sector_numbers + [0xC7, 0xE1]
+    spi_send_receive(tx_data)
+
+def bulk_write_sector(sector_number, sequence, data):
+    #0x5C: Bulk write data. Parameters: uint8_t Sequence, uint8_t NumberOfBytes, uint16_t CRC, DATA
+    #0x5D: Commit bulk write sector. Parameters: uint16_t Sector, uint16_t SectorCRC, 0x2A93
+    #Returns the sequence number to continue with or None if the sector has to be sent again
+    frames = []
+    offset = 0
+    while offset < len(data):
+        chunk_data = data[offset:offset+58]
+        header = [sequence & 0xFF, len(chunk_data)]
+        crc = crc16(header + chunk_data)
+        frames.append([0x00, 0x5C] + header + [crc>>8, crc&0xFF] + chunk_data)
+        sequence += 1
+        offset += 58
+    #spi_slots frames per transfer. The bootloader receives the next ones while processing the last ones
+    #A frame that gets dropped shows up as a sequence error when the sector is committed
+    while frames:
+        spi_send_frames(frames[:spi_slots])
+        frames = frames[spi_slots:]
+    crc = crc16(data)
+    sector_numbers = [(sector_number>>8)&0xFF, sector_number&0xFF]
+    #Get response: 0x5D, sector expected next, result, sequence expected next
+    response = spi_request([0x00, 0x5D] + sector_numbers + [crc>>8, crc&0xFF, 0x2A, 0x93], 8)
+    if not response or not response[3] == 0x5D:
+        return None
+    if 256*response[4] + response[5] != sector_number + 1:
+        print('Sector {0} not written, error {1}'.format(sector_number, response[6]))
+        return None
+    return response[7]
+
 def write_file(local_file_name, remote_file_name):
     file_name, extention = remote_file_name.split('.')
     file_name = file_name[:8].upper()
@@ -383,13 +496,27 @@ def write_file(local_file_name, remote_file_name):
     if file_number == 0:
         print('File not found')
         return
-    #Modify content of file
+    #Modify content of file, one sector after the other without reading back
+    bulk_write_open(file_number, 0)
+    sequence = 0
     sector_number = 0
+    retries = 0
     while char_array:
-        write_sector(file_number, sector_number, char_array[:512])
-        delay_ms(20)
+        next_sequence = bulk_write_sector(sector_number, sequence, char_array[:512])
+        if next_sequence is None:
+            retries += 1
+            if retries > 10:
+                print('Giving up on sector {0}'.format(sector_number))
+                return
+            #Start over from the sector expected
+            bulk_write_open(file_number, sector_number)
+            sequence = 0
+            continue
+        retries = 0
+        sequence = next_sequence
         char_array = char_array[512:]
         sector_number += 1
+    print('{0} bytes written to {1}'.format(size, remote_file_name))
 
 
 def print_file(local_file_name, remote_file_name):
@@ -418,20 +545,137 @@ def find_file(file_name):
     tx_data += [ord(c.upper()) for c in extention[:3]]
     while len(tx_data) < 12:
         tx_data.append(ord(' '))
-    received_data = spi_send_receive(tx_data)
-    #print('TX:', tx_data)
-    #print('RX:', received_data)
-    #delay_ms(5)
-    tx_data = [0x20]
-    received_data = spi_send_receive(tx_data, 4)
+    received_data = spi_request(tx_data, 4)
     #print('RX:', received_data)
-    if not received_data[:3] == [0x81, 0xC1, 0x25]:
-        print('Signature of first data package is incorrect:', received_data[:3])
+    if not received_data:
         return 0
     else:
         print('File number of file {0}: {1}'.format(file_name, received_data[3]))
         return received_data[3]
 
+def read_file(file_number, start_byte=0):
+    #0x84: Open read stream and get the first chunk. Parameters: uint8_t FileNumber, uint32_t StartByte
+    #0x85: Get the next chunk. Response: uint8_t Sequence, uint8_t NumberOfBytes, uint8_t Result, DATA
+    #The response to every frame is the chunk requested with an earlier frame, usually the one before
+    #A status (0x99, reason) instead means the chunk is not ready yet. It comes with a later transfer
+    data = []
+    sequence = 0
+    position = start_byte
+    start_bytes = [position>>24, (position>>16)&0xFF, (position>>8)&0xFF, position&0xFF]
+    spi_send_receive([0x84, file_number] + start_bytes)
+    while True:
+        received_data = spi_send_receive([0x85], 64)
+        if received_data[0] == 0x99:
+            continue
+        if not received_data[1:3] == [0xC1, 0x25]:
+            print('Signature of data package is incorrect:', received_data[:3])
+            return data
+        if not received_data[3] == sequence:
+            #A chunk got lost. Start over from where it should have been
+            start_bytes = [position>>24, (position>>16)&0xFF, (position>>8)&0xFF, position&0xFF]
+            spi_send_receive([0x84, file_number] + start_bytes)
+            sequence = 0
+            continue
+        if not received_data[5] == 0:
+            print('Error reading file: {0}'.format(received_data[5]))
+            return data
+        length = received_data[4]
+        data += received_data[6:6+length]
+        position += length
+        sequence = (sequence + 1) & 0xFF
+        if length < 58:
+            return data
+
+def read_file_burst(file_number, start_byte=0):
+    #Same as read_file() but every transfer is spi_slots frames long and carries one chunk of up to
+    #64*spi_slots-6 bytes
+    #0x86: Get the next chunk of the read stream as a burst. The frames after the first one are ignored
+    data = []
+    sequence = 0
+    position = start_byte
+    start_bytes = [position>>24, (position>>16)&0xFF, (position>>8)&0xFF, position&0xFF]
+    spi_send_receive([0x84, file_number] + start_bytes)
+    while True:
+        received_data = spi_send_receive([0x86] + [0x00]*(64*spi_slots-1))
+        if received_data[0] == 0x99:
+            continue
+        if not received_data[1:3] == [0xC1, 0x25]:
+            print('Signature of data package is incorrect:', received_data[:3])
+            return data
+        if not received_data[3] == sequence:
+            #A chunk got lost. Start over from where it should have been
+            start_bytes = [position>>24, (position>>16)&0xFF, (position>>8)&0xFF, position&0xFF]
+            spi_send_receive([0x84, file_number] + start_bytes)
+            sequence = 0
+            continue
+        if not received_data[5] == 0:
+            print('Error reading file: {0}'.format(received_data[5]))
+            return data
+        length = received_data[4]
+        data += received_data[6:6+length]
+        position += length
+        sequence = (sequence + 1) & 0xFF
+        #The response to 0x84 is a single frame, all others take up all frames
+        if length < (58 if received_data[0] == 0x84 else min(64*spi_slots-6, 250)):
+            return data
+
+def file_checksum(file_number, start_byte=0, number_of_bytes=0xFFFFFFFF):
+    #0x5E: Calculate file checksum. Parameters: uint8_t FileNumber, uint32_t StartByte, uint32_t NumberOfBytes, 0x91C3
+    #Returns the CRC-32 (same as zlib.crc32) over the range, which ends at the end of the file at the latest
+    start_bytes = [start_byte>>24, (start_byte>>16)&0xFF, (start_byte>>8)&0xFF, start_byte&0xFF]
+    length_bytes = [number_of_bytes>>24, (number_of_bytes>>16)&0xFF, (number_of_bytes>>8)&0xFF, number_of_bytes&0xFF]
+    tx_data = [0x10, 0x5E, file_number] + start_bytes + length_bytes + [0x91, 0xC3]
+    spi_send_receive(tx_data)
+    #0x16: Poll until done
+    while True:
+        delay_ms(10)
+        received_data = spi_send_receive([0x16], 23)
+        if not received_data[:3] == [0x16, 0xC1, 0x25]:
+            continue
+        if not received_data[3] == 0x01:
+            break
+    if not received_data[3] == 0x02:
+        print('Checksum of file {0} failed: 0x{1:02X}'.format(file_number, received_data[3]))
+        return None
+    length = 2**24*received_data[9] + 2**16*received_data[10] + 2**8*received_data[11] + received_data[12]
+    crc = 2**24*received_data[17] + 2**16*received_data[18] + 2**8*received_data[19] + received_data[20]
+    print('File {0}: {1} bytes, CRC-32 0x{2:08X}'.format(file_number, length, crc))
+    return crc
+
+def queue_command(job_id, command):
+    #0x5F: Queue command. Parameters: uint8_t JobId, 0xE5A7, COMMAND
+    #command is the complete command (0x50-0x53, 0x56-0x58 or 0x5A) including its constant
+    tx_data = [0x00, 0x5F, job_id & 0xFF, 0xE5, 0xA7] + command + [0x99]
+    response = spi_request(tx_data, 6)
+    if not response or not response[3] == 0x5F or not response[4] == job_id & 0xFF:
+        return None
+    return response[5]
+
+def get_queue():
+    #0x17: Command queue status. Returns {JobId: (Command, Status, Result)}
+    received_data = spi_request([0x17])
+    if not received_data:
+        return {}
+    jobs = {}
+    for cntr in range(received_data[3]):
+        job = received_data[5+4*cntr:9+4*cntr]
+        if job[2] != 0x00:
+            jobs[job[0]] = (job[1], job[2], job[3])
+    return jobs
+
+def wait_for_jobs(job_ids, timeout_ms=5000):
+    #Polls the queue until all jobs are done. Returns {JobId: Result}
+    results = {}
+    while timeout_ms > 0:
+        for job_id, (command, status, result) in get_queue().items():
+            if job_id in job_ids and status == 0x02:
+                results[job_id] = result
+        if len(results) == len(job_ids):
+            break
+        delay_ms(10)
+        timeout_ms -= 10
+    return results
+
 def file_sector_to_buffer(file_number, sector_number):
     #0x57: Read file sector to buffer. Parameters: uint8_t file_number, uint16_t sector, 0x1B35
     sector_numbers = [(sector_number>>8)&0xFF, sector_number&0xFF]
@@ -443,11 +687,9 @@ def buffer_to_file_sector(file_number, sector_number):
     #0x58: Write buffer to file sector. Parameters: uint8_t file_number, uint16_t sector, 0x6A6D
     sector_numbers = [(sector_number>>8)&0xFF, sector_number&0xFF]
     tx_data = [0x00, 0x58, file_number] + sector_numbers + [0x6A, 0x6D]
-    spi_send_receive(tx_data)
-    delay_ms(10)
-    #Get response
-    tx_data = [0x00]
-    response = spi_send_receive(tx_data, 8)
+    response = spi_request(tx_data, 8)
+    if not response:
+        return
     print(list_to_string(response))
     print('Buffer copied to sector {0} of file {1}'.format(sector_number, file_number))
 
@@ -466,10 +708,8 @@ def read_buffer(start_byte, length):
     #0x83: Read buffer. Parameters: uint16_t StartByte
     length = min([length, 58])
     send_data = [0x83, (start_byte>>8)&0xFF, start_byte&0xFF]
-    spi_send_receive(send_data)
-    received_data = spi_send_receive(send_data, length+6)
-    if not received_data[:3] == [0x83, 0xC1, 0x25]:
-        print('Signature of data package is incorrect:', received_data[:3])
+    received_data = spi_request(send_data, length+6)
+    if not received_data:
         return []
     echoed_start = 256*received_data[3] + received_data[4]
     echoed_length = received_data[5]
@@ -0,0 +1,743 @@
+"""
+Host library for the API of the solar charger bootloader (see api.h).
+
+Charger implements the protocol on top of a transport. A transport sends one
+frame of at most 64 bytes and returns the 64 byte response to it:
+ SpiTransport: Linux spidev, e.g. /dev/spidev0.0 on a Raspberry Pi
+ HidTransport: Linux hidraw, i.e. the custom HID interface via USB
+ VendorTransport: the vendor specific bulk interface, see usb_vendor.py
+ SimulatedTransport: the firmware built for the host, in-process, see charger_sim.py
+
+Example:
+ charger = Charger(HidTransport(find_hidraw_devices()[0]))
+ print(charger.get_status())
+ charger.write_file('FIRMWARE.HEX', open('SolarCharger_RevE.hex', 'rb').read())
+
+Errors (no or invalid response, file system errors...) raise ChargerError.
+
+The same protocol is available natively for C++ as host/charger.h, with the
+command line tool host/charger_cli.
+"""
+import glob
+import os
+import select
+import time
+import zlib
+
+FRAME_SIZE = 64
+SECTOR_SIZE = 512
+SIGNATURE = [0xC1, 0x25]
+VENDOR_ID = 0x04D8
+PRODUCT_ID = 0xF08E
+
+#Number of root entries, i.e. file numbers 0 to 63
+ROOT_ENTRIES = 64
+FILE_NOT_FOUND = 0xFF
+
+#Data bytes per chunk of a read stream, per frame of a bulk write and read file
+STREAM_CHUNK_SIZE = 58
+BULK_WRITE_CHUNK_SIZE = 58
+READ_FILE_CHUNK_SIZE = 54
+READ_BUFFER_CHUNK_SIZE = 58
+
+#Data requests
+DATAREQUEST_GET_COMMAND_RESPONSE = 0x00
+DATAREQUEST_GET_STATUS = 0x10
+DATAREQUEST_GET_DISPLAY_1 = 0x11
+DATAREQUEST_GET_DISPLAY_2 = 0x12
+DATAREQUEST_GET_BOOTLOADER_DETAILS = 0x13
+DATAREQUEST_GET_PROFILER = 0x14
+DATAREQUEST_GET_CONFIGURATION = 0x15
+DATAREQUEST_GET_CHECKSUM = 0x16
+DATAREQUEST_GET_QUEUE = 0x17
+DATAREQUEST_GET_ECHO = 0x20
+DATAREQUEST_GET_FILE_DETAILS = 0x80
+DATAREQUEST_FIND_FILE = 0x81
+DATAREQUEST_READ_FILE = 0x82
+DATAREQUEST_READ_BUFFER = 0x83
+DATAREQUEST_READ_STREAM_OPEN = 0x84
+DATAREQUEST_READ_STREAM_NEXT = 0x85
+DATAREQUEST_READ_STREAM_BURST = 0x86
+DATAREQUEST_GET_PROFILER_ENTRIES = 0x87
+
+#Commands
+COMMAND_REBOT = 0x20
+COMMAND_REBOT_BOOTLOADER_MODE = 0x21
+COMMAND_REBOT_NORMAL_MODE = 0x22
+COMMAND_JUMP_TO_MAIN_PROGRAM = 0x23
+COMMAND_SUSPEND_BOOTLOADER = 0x24
+COMMAND_RESET_PROFILER = 0x25
+COMMAND_ENCODER_CCW = 0x3C
+COMMAND_ENCODER_CW = 0x3D
+COMMAND_ENCODER_PUSH = 0x3E
+COMMAND_STOP_PARSING = 0x99
+COMMAND_FILE_RESIZE = 0x50
+COMMAND_FILE_DELETE = 0x51
+COMMAND_FILE_CREATE = 0x52
+COMMAND_FILE_RENAME = 0x53
+COMMAND_FILE_APPEND = 0x54
+COMMAND_FILE_MODIFY = 0x55
+COMMAND_FORMAT_DRIVE = 0x56
+COMMAND_SECTOR_TO_BUFFER = 0x57
+COMMAND_BUFFER_TO_SECTOR = 0x58
+COMMAND_WRITE_BUFFER = 0x59
+COMMAND_FILE_COPY = 0x5A
+COMMAND_BULK_WRITE_OPEN = 0x5B
+COMMAND_BULK_WRITE_DATA = 0x5C
+COMMAND_BULK_WRITE_COMMIT = 0x5D
+COMMAND_FILE_CHECKSUM = 0x5E
+COMMAND_QUEUE = 0x5F
+COMMAND_SET_SPI_MODE = 0x70
+COMMAND_SET_SPI_FREQUENCY = 0x71
+COMMAND_SET_SPI_POLARITY = 0x72
+COMMAND_SET_I2C_MODE = 0x73
+COMMAND_SET_I2C_FREQUENCY = 0x74
+COMMAND_SET_I2C_SLAVE_MODE_ADDRESS = 0x75
+COMMAND_SET_I2C_MASTER_MODE_ADDRESS = 0x76
+COMMAND_SET_BOOT_OPTIONS = 0x77
+
+#apiBulkWriteResult_t
+BULK_WRITE_RESULT_OK = 0x00
+BULK_WRITE_RESULT_SEQUENCE = 0x01
+BULK_WRITE_RESULT_CRC_ERROR = 0x02
+BULK_WRITE_RESULT_NOT_OPEN = 0x03
+BULK_WRITE_RESULT_TOO_LONG = 0x04
+BULK_WRITE_RESULT_SECTOR = 0x05
+BULK_WRITE_RESULT_WRITE_ERROR = 0x06
+
+#apiChecksumStatus_t
+CHECKSUM_STATUS_IDLE = 0x00
+CHECKSUM_STATUS_BUSY = 0x01
+CHECKSUM_STATUS_DONE = 0x02
+
+#apiQueueStatus_t
+QUEUE_STATUS_UNKNOWN = 0x00
+QUEUE_STATUS_QUEUED = 0x01
+QUEUE_STATUS_DONE = 0x02
+QUEUE_STATUS_RUNNING = 0x03
+QUEUE_STATUS_FULL = 0x80
+QUEUE_STATUS_INVALID = 0x81
+
+#bootloaderMode_t (os.h)
+BOOTLOADER_MODE_SEARCH = 0x10
+BOOTLOADER_MODE_FILE_FOUND = 0x20
+BOOTLOADER_MODE_FILE_VERIFYING = 0x30
+BOOTLOADER_MODE_CHECK_COMPLETE = 0x40
+BOOTLOADER_MODE_CHECK_FAILED = 0x50
+BOOTLOADER_MODE_PROGRAMMING = 0x60
+BOOTLOADER_MODE_DONE = 0x70
+BOOTLOADER_MODE_SUSPENDED = 0x90
+
+BOOT_OPTIONS_FAST_BOOT = 0xFB
+
+#Probes of the profiler (os.h)
+PROFILER_PROBES = ['flash read', 'flash write', 'fat read', 'hex parse', 'usb tasks', 'i2c',
+                   'fat write', 'fat copy', 'fat format']
+PROFILER_PROBES_PER_FRAME = 4
+
+
+class ChargerError(Exception):
+    pass
+
+
+def crc16(data, crc=0xFFFF):
+    #CRC-16 CCITT, same as the bootloader
+    for byte in data:
+        crc ^= byte << 8
+        for bit in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xFFFF
+            else:
+                crc = (crc << 1) & 0xFFFF
+    return crc
+
+
+def crc32(data):
+    #Same as the file checksum calculated by the device
+    return zlib.crc32(bytes(bytearray(data))) & 0xFFFFFFFF
+
+
+def fletcher16(data):
+    sum1 = 0
+    sum2 = 0
+    for byte in data:
+        sum1 = (sum1 + byte) % 255
+        sum2 = (sum2 + sum1) % 255
+    return (sum2 << 8) | sum1
+
+
+def uint16(value):
+    return [(value >> 8) & 0xFF, value & 0xFF]
+
+
+def uint32(value):
+    return [(value >> 24) & 0xFF, (value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF]
+
+
+def get_uint16(data, index):
+    return (data[index] << 8) | data[index+1]
+
+
+def get_uint32(data, index):
+    return (data[index] << 24) | (data[index+1] << 16) | (data[index+2] << 8) | data[index+3]
+
+
+def split_file_name(file_name):
+    #'firmware.hex' -> 8 + 3 characters as in a root entry
+    if '.' in file_name:
+        name, extension = file_name.upper().rsplit('.', 1)
+    else:
+        name, extension = file_name.upper(), ''
+    return [ord(c) for c in name[:8].ljust(8)], [ord(c) for c in extension[:3].ljust(3)]
+
+
+def join_file_name(name, extension):
+    name = ''.join(chr(c) for c in name).rstrip()
+    extension = ''.join(chr(c) for c in extension).rstrip()
+    if extension:
+        return '{0}.{1}'.format(name, extension)
+    return name
+
+
+def pad_frame(frame, size=FRAME_SIZE):
+    frame = list(frame)
+    if len(frame) > size:
+        raise ValueError('Frame longer than {0} bytes'.format(size))
+    return frame + [0x00] * (size - len(frame))
+
+
+def find_hidraw_devices(vendor_id=VENDOR_ID, product_id=PRODUCT_ID):
+    #Paths of all hidraw nodes that belong to a charger, sorted
+    devices = []
+    hid_id = 'HID_ID=0003:{0:08X}:{1:08X}'.format(vendor_id, product_id)
+    for uevent in sorted(glob.glob('/sys/class/hidraw/hidraw*/device/uevent')):
+        try:
+            with open(uevent) as f:
+                if hid_id not in f.read().upper():
+                    continue
+        except IOError:
+            continue
+        devices.append('/dev/' + uevent.split('/')[4])
+    return devices
+
+
+class Transport(object):
+    #Largest frame the transport can carry
+    frame_size = FRAME_SIZE
+
+    def transfer(self, frame):
+        #Sends one frame and returns the 64 byte response to it
+        raise NotImplementedError
+
+    def close(self):
+        pass
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+
+class SpiTransport(Transport):
+    #The response to a frame is sent back with a later frame, so every frame is
+    #followed by echo requests until the response shows up. The echo request does
+    #nothing, so the last response the device has prepared is always an echo.
+    #Frames are always padded to 64 bytes, the device rejects anything else.
+    #Status frames (0x99, reason) are skipped. A frame the device had to drop
+    #never gets a response and ends in a timeout.
+    POLL_FRAME = [DATAREQUEST_GET_ECHO] + [0x00] * (FRAME_SIZE - 1)
+
+    def __init__(self, bus=0, device=0, speed_hz=2000000, timeout=1.0):
+        import spidev
+        self.spi = spidev.SpiDev()
+        self.spi.open(bus, device)
+        self.spi.max_speed_hz = speed_hz
+        self.spi.mode = 0
+        self.timeout = timeout
+        self.name = '/dev/spidev{0}.{1}'.format(bus, device)
+
+    def close(self):
+        self.spi.close()
+
+    def _is_response(self, frame, response):
+        if frame[0] == DATAREQUEST_GET_ECHO:
+            return response == frame
+        return response[0] == frame[0] and response[1:3] == SIGNATURE
+
+    def transfer(self, frame):
+        frame = pad_frame(frame)
+        self.spi.xfer2(list(frame))
+        deadline = time.time() + self.timeout
+        while True:
+            response = self.spi.xfer2(list(self.POLL_FRAME))
+            if self._is_response(frame, response):
+                return response
+            if time.time() > deadline:
+                raise ChargerError('{0}: no response to 0x{1:02X}'.format(self.name, frame[0]))
+            time.sleep(0.001)
+
+
+class HidTransport(Transport):
+    #Every report sent gets exactly one report back
+    def __init__(self, path, timeout=1.0):
+        self.name = path
+        self.timeout = timeout
+        self.fd = os.open(path, os.O_RDWR)
+        self._drain()
+
+    def close(self):
+        os.close(self.fd)
+
+    def _drain(self):
+        #Throw away reports nobody has picked up
+        while select.select([self.fd], [], [], 0)[0]:
+            os.read(self.fd, FRAME_SIZE)
+
+    def transfer(self, frame):
+        #Report ID 0, i.e. none, followed by the report
+        os.write(self.fd, bytes(bytearray([0x00] + pad_frame(frame))))
+        if not select.select([self.fd], [], [], self.timeout)[0]:
+            raise ChargerError('{0}: no response to 0x{1:02X}'.format(self.name, frame[0]))
+        return list(bytearray(os.read(self.fd, FRAME_SIZE)))
+
+
+class VendorTransport(Transport):
+    #A transfer ends with a short packet, so frames are at most 63 bytes long
+    frame_size = FRAME_SIZE - 1
+
+    def __init__(self):
+        import usb_vendor
+        self.client = usb_vendor.VendorClient()
+        self.name = 'usb vendor'
+
+    def close(self):
+        self.client.close()
+
+    def transfer(self, frame):
+        return self.client.transfer(list(frame))
+
+
+class SimulatedTransport(Transport):
+    #Talks to a SimulatedCharger in this process. latency (in seconds) is added to
+    #every transfer to get somewhat realistic timing
+    def __init__(self, device=None, latency=0.0, name='simulator'):
+        if device is None:
+            import charger_sim
+            device = charger_sim.SimulatedCharger()
+        self.device = device
+        self.latency = latency
+        self.name = name
+
+    def transfer(self, frame):
+        if self.latency:
+            time.sleep(self.latency)
+        return self.device.transfer(list(frame))
+
+
+class Charger(object):
+    def __init__(self, transport):
+        self.transport = transport
+        self.name = getattr(transport, 'name', '')
+
+    def close(self):
+        self.transport.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    #--------------------------------------------------------------------------
+    # Low level
+    #--------------------------------------------------------------------------
+
+    def request(self, frame):
+        #Sends a frame and checks the response's signature
+        response = self.transport.transfer(frame)
+        if not response[:3] == [frame[0]] + SIGNATURE:
+            raise ChargerError('{0}: invalid response to 0x{1:02X}: {2}'.format(self.name, frame[0], response[:3]))
+        return response
+
+    def command(self, command):
+        #Executes a single command and returns its confirmation (without the command byte)
+        response = self.request([DATAREQUEST_GET_COMMAND_RESPONSE] + list(command))
+        if response[3] != command[0]:
+            raise ChargerError('{0}: command 0x{1:02X} not confirmed'.format(self.name, command[0]))
+        return response[4:]
+
+    def send_commands(self, commands):
+        #Executes short commands (encoder etc.) that are not confirmed
+        self.request([DATAREQUEST_GET_STATUS] + list(commands) + [COMMAND_STOP_PARSING])
+
+    def _send_reboot(self, command):
+        #The device may reboot before it responds
+        try:
+            self.transport.transfer([DATAREQUEST_GET_STATUS, command, COMMAND_STOP_PARSING])
+        except (ChargerError, IOError, OSError):
+            pass
+
+    #--------------------------------------------------------------------------
+    # Data requests
+    #--------------------------------------------------------------------------
+
+    def echo(self, data):
+        frame = pad_frame([DATAREQUEST_GET_ECHO] + list(data))
+        return self.transport.transfer(frame) == frame
+
+    def get_status(self):
+        response = self.request([DATAREQUEST_GET_STATUS])
+        return {
+            'flash_busy': bool(response[3]),
+            'version': tuple(response[4:7]),
+            'ui_status': response[7],
+            'encoder_count': response[8],
+            'button_count': response[9],
+            'time_slot': response[10],
+            'done': bool(response[11]),
+            'bootloader_mode': response[12],
+            'display_mode': response[13],
+            'boot_time': get_uint16(response, 14),
+        }
+
+    def get_display(self):
+        #4 lines of 20 characters
+        lines = []
+        for request in (DATAREQUEST_GET_DISPLAY_1, DATAREQUEST_GET_DISPLAY_2):
+            response = self.request([request])
+            lines.append(''.join(chr(c) for c in response[3:23]))
+            lines.append(''.join(chr(c) for c in response[23:43]))
+        return lines
+
+    def get_bootloader_details(self):
+        response = self.request([DATAREQUEST_GET_BOOTLOADER_DETAILS])
+        record_length = get_uint16(response, 14)
+        return {
+            'file_size': get_uint32(response, 3),
+            'entries': get_uint16(response, 7),
+            'total_entries': get_uint16(response, 9),
+            'error': response[11],
+            'pages_written': get_uint16(response, 12),
+            'record_length': record_length,
+            'record_address': get_uint16(response, 16),
+            'record_type': response[18],
+            'record_checksum': response[19],
+            'record_checksum_check': response[20],
+            'record_data': response[21:21+min(record_length, 16)],
+            'pages_erased': get_uint16(response, 37),
+            'blocks_written': get_uint16(response, 39),
+            'verify_failed_page': get_uint16(response, 41),
+            'verify_retries': response[43],
+        }
+
+    def get_profiler(self):
+        #Count, minimum, maximum and total per probe, in Timer3 ticks of 8 instruction cycles
+        probes = {}
+        for first in range(0, len(PROFILER_PROBES), PROFILER_PROBES_PER_FRAME):
+            if first==0:
+                response = self.request([DATAREQUEST_GET_PROFILER])
+            else:
+                response = self.request([DATAREQUEST_GET_PROFILER_ENTRIES, first])
+            for cntr, probe in enumerate(PROFILER_PROBES[first:first+PROFILER_PROBES_PER_FRAME]):
+                index = 4 + 14*cntr
+                probes[probe] = (get_uint16(response, index), get_uint32(response, index+2),
+                                 get_uint32(response, index+6), get_uint32(response, index+10))
+        return probes
+
+    def get_configuration(self):
+        response = self.request([DATAREQUEST_GET_CONFIGURATION])
+        return {
+            'spi_mode': response[3],
+            'spi_frequency': response[4],
+            'spi_polarity': response[5],
+            'i2c_mode': response[6],
+            'i2c_frequency': response[7],
+            'i2c_slave_mode_address': response[8],
+            'i2c_master_mode_address': response[9],
+        }
+
+    def get_checksum(self):
+        response = self.request([DATAREQUEST_GET_CHECKSUM])
+        return {
+            'status': response[3],
+            'file_number': response[4],
+            'start': get_uint32(response, 5),
+            'length': get_uint32(response, 9),
+            'done': get_uint32(response, 13),
+            'crc32': get_uint32(response, 17),
+            'fletcher16': get_uint16(response, 21),
+        }
+
+    def get_queue(self):
+        #List of (job_id, command, status, result), oldest first
+        response = self.request([DATAREQUEST_GET_QUEUE])
+        jobs = []
+        for cntr in range(response[3]):
+            job = tuple(response[5+4*cntr:9+4*cntr])
+            if job[2] != QUEUE_STATUS_UNKNOWN:
+                jobs.append(job)
+        return jobs
+
+    def get_queue_progress(self):
+        #(steps_done, number_of_steps) of the format or copy job running, (0, 0) if none
+        response = self.request([DATAREQUEST_GET_QUEUE])
+        index = 5 + 4*response[3]
+        return (get_uint16(response, index), get_uint16(response, index+2))
+
+    def get_file_details(self, file_number):
+        #None if there is no such file
+        response = self.request([DATAREQUEST_GET_FILE_DETAILS, file_number])
+        if response[4] != 0x00:
+            return None
+        return {
+            'file_number': file_number,
+            'name': join_file_name(response[5:13], response[13:16]),
+            'attributes': response[16],
+            'first_cluster': response[31] | (response[32] << 8),
+            'size': response[33] | (response[34] << 8) | (response[35] << 16) | (response[36] << 24),
+        }
+
+    def list_files(self):
+        files = []
+        for file_number in range(ROOT_ENTRIES):
+            details = self.get_file_details(file_number)
+            if details is not None and not details['attributes'] & 0x08:
+                files.append(details)
+        return files
+
+    def find_file(self, file_name):
+        #File number or None if the file does not exist
+        name, extension = split_file_name(file_name)
+        response = self.request([DATAREQUEST_FIND_FILE] + name + extension)
+        if response[3] == FILE_NOT_FOUND:
+            return None
+        return response[3]
+
+    def read_file_chunk(self, file_number, start_byte):
+        #0x82: up to 54 bytes
+        response = self.request([DATAREQUEST_READ_FILE, file_number] + uint32(start_byte))
+        if response[9] != 0x00:
+            raise ChargerError('{0}: reading file {1} failed: {2}'.format(self.name, file_number, response[9]))
+        return response[10:10+response[8]]
+
+    def read_buffer(self, start_byte=0, length=SECTOR_SIZE):
+        data = []
+        while len(data) < length:
+            response = self.request([DATAREQUEST_READ_BUFFER] + uint16(start_byte + len(data)))
+            if response[5] == 0:
+                break
+            data += response[6:6+response[5]]
+        return data[:length]
+
+    def read_file(self, file_number, start_byte=0):
+        #Read stream: every response carries the next 58 bytes
+        data = []
+        sequence = 0
+        response = self.request([DATAREQUEST_READ_STREAM_OPEN, file_number] + uint32(start_byte))
+        while True:
+            if response[3] != sequence:
+                #A chunk got lost. Start over from where it should have been
+                sequence = 0
+                response = self.request([DATAREQUEST_READ_STREAM_OPEN, file_number] + uint32(start_byte + len(data)))
+                continue
+            if response[5] != 0x00:
+                raise ChargerError('{0}: reading file {1} failed: {2}'.format(self.name, file_number, response[5]))
+            length = response[4]
+            data += response[6:6+length]
+            sequence = (sequence + 1) & 0xFF
+            if length < STREAM_CHUNK_SIZE:
+                return data
+            response = self.request([DATAREQUEST_READ_STREAM_NEXT])
+
+    #--------------------------------------------------------------------------
+    # Commands
+    #--------------------------------------------------------------------------
+
+    def reboot(self):
+        self._send_reboot(COMMAND_REBOT)
+
+    def reboot_bootloader_mode(self):
+        self._send_reboot(COMMAND_REBOT_BOOTLOADER_MODE)
+
+    def reboot_normal_mode(self):
+        self._send_reboot(COMMAND_REBOT_NORMAL_MODE)
+
+    def jump_to_main_program(self):
+        self._send_reboot(COMMAND_JUMP_TO_MAIN_PROGRAM)
+
+    def suspend_bootloader(self):
+        self.send_commands([COMMAND_SUSPEND_BOOTLOADER])
+
+    def reset_profiler(self):
+        self.send_commands([COMMAND_RESET_PROFILER])
+
+    def turn_counter_clockwise(self):
+        self.send_commands([COMMAND_ENCODER_CCW])
+
+    def turn_clockwise(self):
+        self.send_commands([COMMAND_ENCODER_CW])
+
+    def press_button(self):
+        self.send_commands([COMMAND_ENCODER_PUSH])
+
+    def resize_file(self, file_number, new_file_size):
+        return self.command([COMMAND_FILE_RESIZE, file_number] + uint32(new_file_size) + [0x4C, 0xEA])[5]
+
+    def delete_file(self, file_number):
+        return self.command([COMMAND_FILE_DELETE, file_number, 0x66, 0xA0])[1]
+
+    def create_file(self, file_name, file_size):
+        #Returns the new file's number
+        name, extension = split_file_name(file_name)
+        file_number = self.command([COMMAND_FILE_CREATE] + name + extension + uint32(file_size) + [0xBD, 0x4F])[0]
+        if file_number >= ROOT_ENTRIES:
+            raise ChargerError('{0}: creating {1} failed: 0x{2:02X}'.format(self.name, file_name, file_number))
+        return file_number
+
+    def rename_file(self, file_number, file_name):
+        name, extension = split_file_name(file_name)
+        return self.command([COMMAND_FILE_RENAME, file_number] + name + extension + [0x7E, 0x18])[1]
+
+    def append_to_file(self, file_number, data):
+        data = list(data)[:self.transport.frame_size-6]
+        return self.command([COMMAND_FILE_APPEND, file_number, len(data), 0xFE, 0x4B] + data)[3]
+
+    def modify_file(self, file_number, start_byte, data):
+        data = list(data)[:self.transport.frame_size-10]
+        return self.command([COMMAND_FILE_MODIFY, file_number] + uint32(start_byte) + [len(data), 0x0F, 0x9B] + data)[7]
+
+    def format_drive(self):
+        return self.command([COMMAND_FORMAT_DRIVE, 0xDA, 0x22])[0]
+
+    def sector_to_buffer(self, file_number, sector):
+        return self.command([COMMAND_SECTOR_TO_BUFFER, file_number] + uint16(sector) + [0x1B, 0x35])[3]
+
+    def buffer_to_sector(self, file_number, sector):
+        return self.command([COMMAND_BUFFER_TO_SECTOR, file_number] + uint16(sector) + [0x6A, 0x6D])[3]
+
+    def write_buffer(self, start_byte, data):
+        #Writes any amount of data to the buffer, a frame at a time
+        data = list(data)
+        chunk_size = self.transport.frame_size - 7
+        for offset in range(0, len(data), chunk_size):
+            chunk = data[offset:offset+chunk_size]
+            self.command([COMMAND_WRITE_BUFFER] + uint16(start_byte + offset) + [len(chunk), 0xE2, 0x30] + chunk)
+
+    def copy_file(self, file_number, file_name):
+        name, extension = split_file_name(file_name)
+        return self.command([COMMAND_FILE_COPY, file_number] + name + extension + [0x54, 0xD9])[1]
+
+    def set_spi_mode(self, mode):
+        self.command([COMMAND_SET_SPI_MODE, mode, 0x88, 0xE2])
+
+    def set_spi_frequency(self, frequency):
+        self.command([COMMAND_SET_SPI_FREQUENCY, frequency, 0xAE, 0xA8])
+
+    def set_spi_polarity(self, polarity):
+        self.command([COMMAND_SET_SPI_POLARITY, polarity, 0x0D, 0xBB])
+
+    def set_i2c_mode(self, mode):
+        self.command([COMMAND_SET_I2C_MODE, mode, 0xB6, 0xB9])
+
+    def set_i2c_frequency(self, frequency):
+        self.command([COMMAND_SET_I2C_FREQUENCY, frequency, 0x4E, 0x03])
+
+    def set_i2c_slave_mode_address(self, address):
+        self.command([COMMAND_SET_I2C_SLAVE_MODE_ADDRESS, address, 0x88, 0xE2])
+
+    def set_i2c_master_mode_address(self, address):
+        self.command([COMMAND_SET_I2C_MASTER_MODE_ADDRESS, address, 0x54, 0x0D])
+
+    def set_boot_options(self, boot_options):
+        self.command([COMMAND_SET_BOOT_OPTIONS, boot_options, 0x3F, 0x1C])
+
+    def queue_command(self, job_id, command):
+        #Returns the job's apiQueueStatus_t
+        return self.command([COMMAND_QUEUE, job_id, 0xE5, 0xA7] + list(command))[1]
+
+    def wait_for_jobs(self, job_ids, timeout=5.0):
+        #Returns {job_id: result} once all jobs are done
+        deadline = time.time() + timeout
+        while True:
+            jobs = dict((job[0], job) for job in self.get_queue())
+            if all(job_id in jobs and jobs[job_id][2] == QUEUE_STATUS_DONE for job_id in job_ids):
+                return dict((job_id, jobs[job_id][3]) for job_id in job_ids)
+            if time.time() > deadline:
+                raise ChargerError('{0}: jobs not done: {1}'.format(self.name, job_ids))
+            time.sleep(0.01)
+
+    #--------------------------------------------------------------------------
+    # Checksum and bulk write
+    #--------------------------------------------------------------------------
+
+    def file_checksum(self, file_number, start_byte=0, number_of_bytes=0xFFFFFFFF, timeout=10.0):
+        #CRC-32 (as zlib.crc32) and Fletcher-16 over a range of a file
+        status = self.command([COMMAND_FILE_CHECKSUM, file_number] + uint32(start_byte) + uint32(number_of_bytes) + [0x91, 0xC3])[1]
+        deadline = time.time() + timeout
+        while status == CHECKSUM_STATUS_BUSY:
+            if time.time() > deadline:
+                raise ChargerError('{0}: checksum of file {1} timed out'.format(self.name, file_number))
+            time.sleep(0.005)
+            checksum = self.get_checksum()
+            status = checksum['status']
+        if status != CHECKSUM_STATUS_DONE:
+            raise ChargerError('{0}: checksum of file {1} failed: 0x{2:02X}'.format(self.name, file_number, status))
+        return checksum
+
+    def bulk_write_open(self, file_number, sector):
+        self.command([COMMAND_BULK_WRITE_OPEN, file_number] + uint16(sector) + [0xC7, 0xE1])
+
+    def bulk_write_sector(self, sector, sequence, data):
+        #Sends one sector's data and commits it. Returns the sequence number to
+        #continue with, or None if the sector has to be sent again
+        chunk_size = self.transport.frame_size - 6
+        for offset in range(0, len(data), chunk_size):
+            chunk = list(data[offset:offset+chunk_size])
+            header = [sequence & 0xFF, len(chunk)]
+            crc = crc16(header + chunk)
+            #Not confirmed, errors show up when committing
+            self.transport.transfer([DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_BULK_WRITE_DATA] + header + uint16(crc) + chunk)
+            sequence += 1
+        confirmation = self.command([COMMAND_BULK_WRITE_COMMIT] + uint16(sector) + uint16(crc16(data)) + [0x2A, 0x93])
+        if get_uint16(confirmation, 0) != sector + 1:
+            return None
+        return confirmation[3]
+
+    def write_data(self, file_number, data, retries=10, progress=None):
+        #Overwrites an existing file of the right size, a sector at a time
+        data = list(data)
+        sector = 0
+        sequence = 0
+        failures = 0
+        self.bulk_write_open(file_number, 0)
+        while sector * SECTOR_SIZE < len(data):
+            next_sequence = self.bulk_write_sector(sector, sequence, data[sector*SECTOR_SIZE:(sector+1)*SECTOR_SIZE])
+            if next_sequence is None:
+                failures += 1
+                if failures > retries:
+                    raise ChargerError('{0}: giving up on sector {1}'.format(self.name, sector))
+                #Start over from this sector
+                self.bulk_write_open(file_number, sector)
+                sequence = 0
+                continue
+            failures = 0
+            sequence = next_sequence
+            sector += 1
+            if progress is not None:
+                progress(min(sector * SECTOR_SIZE, len(data)), len(data))
+
+    def write_file(self, file_name, data, progress=None):
+        #Replaces the file if it exists. Returns the file number
+        data = list(bytearray(data))
+        file_number = self.find_file(file_name)
+        if file_number is not None:
+            self.delete_file(file_number)
+        file_number = self.create_file(file_name, len(data))
+        self.write_data(file_number, data, progress=progress)
+        return file_number
+
+    def verify_file(self, file_number, data):
+        #Compares the device's CRC-32 of the file with the data's
+        checksum = self.file_checksum(file_number)
+        return checksum['length'] == len(data) and checksum['crc32'] == crc32(data)
@@ -0,0 +1,141 @@
+"""
+In-process charger for testing host tools without hardware.
+
+SimulatedCharger runs the firmware itself: api.c, fat16.c, hex.c, bootloader.c
+and ui.c, built for the host as host/libfirmware.so with the external flash,
+the EEPROM and program memory in RAM (see host/firmware.c). This module is only
+the transport: every frame goes through api_prepare() and api_parse() the way a
+HID report does, followed by one pass through the main loop.
+
+Every device loads its own copy of the library, so several devices can be
+simulated at the same time, also from different threads. A reboot loads a fresh
+copy and keeps only the memories: everything in RAM is lost, as on the device.
+
+Build the library first: make -C host libfirmware.so
+
+Usage:
+ import charger, charger_sim
+ device = charger_sim.SimulatedCharger()
+ c = charger.Charger(charger.SimulatedTransport(device))
+"""
+import _ctypes
+import ctypes
+import os
+import random
+import shutil
+import tempfile
+
+import charger as api
+
+LIBRARY = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'host', 'libfirmware.so')
+
+#Configuration words of the devices, as in SolarCharger_RevE.hex
+CONFIGURATION_WORDS = [0xAC, 0xF7, 0x9D, 0xFF, 0x63, 0xFA, 0x81, 0xF9]
+
+#Memories modelled in RAM (host/firmware.h). They survive a reboot
+MEMORIES = [
+    ('host_flash', 8192 * 512),
+    ('host_eeprom', 0x10000),
+    ('host_program_memory', 0x20000),
+]
+
+
+def load_library():
+    #dlopen() returns the library already loaded for the same file, so each load is from a copy of its own
+    if not os.path.exists(LIBRARY):
+        raise RuntimeError('{0} not found, build it with make -C host libfirmware.so'.format(LIBRARY))
+    handle, path = tempfile.mkstemp(suffix='.so')
+    os.close(handle)
+    try:
+        shutil.copyfile(LIBRARY, path)
+        library = ctypes.CDLL(path)
+    finally:
+        os.remove(path)
+    library.host_boot.restype = ctypes.c_uint8
+    library.host_get_bootloader_mode.restype = ctypes.c_uint8
+    library.host_get_bootloader_file_number.restype = ctypes.c_uint8
+    library.fat_get_file_size.restype = ctypes.c_uint32
+    library.fat_get_file_size.argtypes = [ctypes.c_uint8]
+    library.fat_read_from_file.restype = ctypes.c_uint8
+    library.fat_read_from_file.argtypes = [ctypes.c_uint8, ctypes.c_uint32, ctypes.c_uint32, ctypes.c_void_p]
+    return library
+
+
+class SimulatedCharger(object):
+    def __init__(self, frame_loss=0.0, seed=None, configuration_words=CONFIGURATION_WORDS, write_faults=0):
+        #Share of bulk write data frames that get lost, to exercise retries
+        self.frame_loss = frame_loss
+        self.random = random.Random(seed)
+        #What has been programmed and how often the device has been rebooted
+        self.programmed = None
+        self.programmed_count = 0
+        self.reboots = 0
+        self.application_running = False
+        self.library = load_library()
+        self.library.host_init((ctypes.c_uint8 * len(configuration_words))(*configuration_words))
+        #Program memory page writes that don't take, to exercise readback verification
+        ctypes.c_uint8.in_dll(self.library, 'host_write_faults').value = write_faults
+        self.bootloader_mode = self.library.host_get_bootloader_mode()
+
+    #--------------------------------------------------------------------------
+    # Device
+    #--------------------------------------------------------------------------
+
+    def _memory(self, library, name, size):
+        return (ctypes.c_uint8 * size).in_dll(library, name)
+
+    @property
+    def program_memory(self):
+        return bytes(bytearray(self._memory(self.library, 'host_program_memory', MEMORIES[2][1])))
+
+    def _rebooted(self):
+        return ctypes.c_uint16.in_dll(self.library, 'host_reboots').value != 0
+
+    def reboot(self):
+        #Everything in RAM is lost, the memories are kept
+        library = load_library()
+        for name, size in MEMORIES:
+            ctypes.memmove(self._memory(library, name, size), self._memory(self.library, name, size), size)
+        _ctypes.dlclose(self.library._handle)
+        self.library = library
+        self.reboots += 1
+        self.application_running = self.library.host_boot() != 0
+        self.bootloader_mode = self.library.host_get_bootloader_mode()
+
+    def _lost(self, frame):
+        #A bulk write data frame lost on the way. The device never sees it
+        if frame[0] > 0x7F or frame[1] != api.COMMAND_BULK_WRITE_DATA:
+            return False
+        return self.frame_loss and self.random.random() < self.frame_loss
+
+    def transfer(self, frame):
+        length = len(frame)
+        frame = api.pad_frame(frame)
+        response = (ctypes.c_uint8 * api.FRAME_SIZE)()
+        if not self._lost(frame):
+            self.library.host_transfer((ctypes.c_uint8 * api.FRAME_SIZE)(*frame), length, response)
+            if self._rebooted():
+                self.reboot()
+                return list(response)
+        self.run()
+        return list(response)
+
+    def run(self):
+        #One pass through the main loop
+        self.library.host_main_loop_pass()
+        if self._rebooted():
+            self.reboot()
+            return
+        mode = self.library.host_get_bootloader_mode()
+        if mode == api.BOOTLOADER_MODE_DONE and self.bootloader_mode != api.BOOTLOADER_MODE_DONE:
+            self.programmed = self.read_file(self.library.host_get_bootloader_file_number())
+            self.programmed_count += 1
+        self.bootloader_mode = mode
+
+    def read_file(self, file_number):
+        #Straight from the file system, not via the API
+        size = self.library.fat_get_file_size(file_number)
+        data = (ctypes.c_uint8 * size)()
+        if self.library.fat_read_from_file(file_number, 0, size, data) != 0x00:
+            return None
+        return bytes(bytearray(data))
@@ -0,0 +1,159 @@
+"""
+Command line tool for the charger, based on charger.py.
+
+Usage: python charger_tool.py [TRANSPORT] COMMAND [ARGUMENTS]
+
+Transports (default: the first charger found via hidraw):
+ --hid [PATH]       custom HID interface via /dev/hidrawN
+ --spi BUS.DEVICE   spidev, e.g. --spi 0.0
+ --vendor           vendor specific bulk interface (pyusb)
+ --sim              simulated device, starts out empty
+
+Commands:
+ status                    general status information
+ details                   bootloader details
+ config                    external communication configuration
+ display                   display content
+ ls                        list files
+ read REMOTE [LOCAL]       read a file, print it or save it to LOCAL
+ write LOCAL REMOTE        write a file (replaces REMOTE if it exists)
+ rm REMOTE                 delete a file
+ checksum REMOTE           CRC-32 and Fletcher-16 of a file
+ push                      press the push button
+ reboot [normal|bootloader]
+ bench [SIZE] [ROUNDS]     measure latency and throughput with a file of SIZE bytes
+"""
+import argparse
+import os
+import sys
+import time
+
+import charger
+
+
+def open_transport(args):
+    if args.sim:
+        return charger.SimulatedTransport(latency=args.latency)
+    if args.spi:
+        bus, device = args.spi.split('.')
+        return charger.SpiTransport(int(bus), int(device), speed_hz=args.speed)
+    if args.vendor:
+        return charger.VendorTransport()
+    path = args.hid
+    if path is None or path == 'auto':
+        devices = charger.find_hidraw_devices()
+        if not devices:
+            raise charger.ChargerError('No charger found')
+        path = devices[0]
+    return charger.HidTransport(path)
+
+
+def print_dictionary(dictionary):
+    for key in sorted(dictionary):
+        value = dictionary[key]
+        if isinstance(value, int) and not isinstance(value, bool):
+            print('{0:<24} {1} (0x{1:02X})'.format(key, value))
+        else:
+            print('{0:<24} {1}'.format(key, value))
+
+
+def find_file(device, remote_file_name):
+    file_number = device.find_file(remote_file_name)
+    if file_number is None:
+        raise charger.ChargerError('File not found: {0}'.format(remote_file_name))
+    return file_number
+
+
+def bench(device, size, rounds):
+    #Round trip time of a single frame, then write, read and checksum of a file
+    start = time.time()
+    for cntr in range(100):
+        device.get_status()
+    elapsed = time.time() - start
+    print('Round trip: {0:.2f}ms per frame'.format(elapsed * 10))
+
+    data = bytearray(os.urandom(size))
+    for cntr in range(rounds):
+        start = time.time()
+        file_number = device.write_file('BENCH.BIN', data)
+        write_time = time.time() - start
+        start = time.time()
+        read = device.read_file(file_number)
+        read_time = time.time() - start
+        start = time.time()
+        checksum = device.file_checksum(file_number)
+        checksum_time = time.time() - start
+        if bytearray(read) != data or checksum['crc32'] != charger.crc32(data):
+            raise charger.ChargerError('Data read back does not match')
+        print('Round {0}: write {1:.1f}kB/s, read {2:.1f}kB/s, checksum {3:.1f}kB/s'.format(
+            cntr + 1, size / write_time / 1024, size / read_time / 1024, size / checksum_time / 1024))
+    device.delete_file(file_number)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--hid', nargs='?', const='auto')
+    parser.add_argument('--spi')
+    parser.add_argument('--speed', type=int, default=2000000)
+    parser.add_argument('--vendor', action='store_true')
+    parser.add_argument('--sim', action='store_true')
+    parser.add_argument('--latency', type=float, default=0.0)
+    parser.add_argument('command')
+    parser.add_argument('arguments', nargs='*')
+    args = parser.parse_args()
+
+    with charger.Charger(open_transport(args)) as device:
+        if args.command == 'status':
+            print_dictionary(device.get_status())
+        elif args.command == 'details':
+            print_dictionary(device.get_bootloader_details())
+        elif args.command == 'config':
+            print_dictionary(device.get_configuration())
+        elif args.command == 'display':
+            print('\n'.join(device.get_display()))
+        elif args.command == 'ls':
+            for details in device.list_files():
+                print('#{0:<3} {1:<12} {2:>8} bytes'.format(details['file_number'], details['name'], details['size']))
+        elif args.command == 'read':
+            data = bytearray(device.read_file(find_file(device, args.arguments[0])))
+            if len(args.arguments) > 1:
+                with open(args.arguments[1], 'wb') as f:
+                    f.write(data)
+            else:
+                sys.stdout.write(data.decode('latin-1'))
+        elif args.command == 'write':
+            with open(args.arguments[0], 'rb') as f:
+                data = f.read()
+            file_number = device.write_file(args.arguments[1], data)
+            print('{0} bytes written to file #{1}'.format(len(data), file_number))
+        elif args.command == 'rm':
+            device.delete_file(find_file(device, args.arguments[0]))
+        elif args.command == 'checksum':
+            checksum = device.file_checksum(find_file(device, args.arguments[0]))
+            print('{0} bytes, CRC-32 0x{1:08X}, Fletcher-16 0x{2:04X}'.format(checksum['length'], checksum['crc32'], checksum['fletcher16']))
+        elif args.command == 'push':
+            device.press_button()
+        elif args.command == 'reboot':
+            mode = args.arguments[0] if args.arguments else ''
+            if mode == 'normal':
+                device.reboot_normal_mode()
+            elif mode == 'bootloader':
+                device.reboot_bootloader_mode()
+            else:
+                device.reboot()
+        elif args.command == 'bench':
+            size = int(args.arguments[0]) if args.arguments else 65536
+            rounds = int(args.arguments[1]) if len(args.arguments) > 1 else 3
+            bench(device, size, rounds)
+        else:
+            print(__doc__)
+            return 1
+    return 0
+
+
+if __name__ == '__main__':
+    try:
+        sys.exit(main())
+    except charger.ChargerError as e:
+        print(e)
+        sys.exit(1)
@@ -0,0 +1,254 @@
+"""
+Converts FIRMWARE.HEX into a compressed image (FIRMWARE.LZB) for the bootloader.
+The bootloader uses the compressed image if there is no FIRMWARE.HEX on the drive.
+
+Usage: python compress_firmware.py FIRMWARE.HEX [FIRMWARE.LZB]
+
+Image format (see bootloader.c):
+ 28 byte header: magic 0x4C5A, version 3, configuration bits present (one bit
+ per byte), start address (4 bytes), image length (4 bytes), CRC-16 CCITT of
+ the image (2 bytes), 2 bytes reserved, configuration bits 0x1FFF8 to 0x1FFFF
+ (8 bytes), 3 bytes reserved, checksum.
+ All values most significant byte first. All 28 bytes add up to zero.
+ The bootloader refuses an image whose configuration bits differ from the
+ device's configuration words.
+ Compressed data: 0b0LLLLLLL followed by L+1 literal bytes or
+ 0b1LLLLLDD DDDDDDDD to copy L+3 bytes from D+1 bytes back.
+"""
+import os
+import sys
+
+MINIMUM_ADDRESS_ALLOWED = 0x0A000
+PROG_START = 0x0C000
+MAXIMUM_ADDRESS_ALLOWED = 0x1FFF7
+CONFIGURATIONBITS_ADDRESS_MIN = 0x1FFF8
+CONFIGURATIONBITS_ADDRESS_MAX = 0x1FFFF
+PAGE_SIZE = 1024
+
+IMAGE_MAGIC = 0x4C5A
+IMAGE_VERSION = 0x03
+IMAGE_HEADER_SIZE = 28
+CONFIGURATIONBITS_SIZE = 8
+
+WINDOW_SIZE = 1024
+MINIMUM_COPY = 3
+MAXIMUM_COPY = 34
+MAXIMUM_LITERALS = 128
+MAXIMUM_CHAIN = 256
+
+
+def read_hex_file(file_name):
+    #Returns a dictionary address: data byte
+    memory = {}
+    base_address = 0
+    with open(file_name, 'r') as f:
+        for line_number, line in enumerate(f, 1):
+            line = line.strip()
+            if not line:
+                continue
+            if line[0] != ':':
+                raise ValueError('Line {0}: Missing start code'.format(line_number))
+            record = bytearray.fromhex(line[1:])
+            if (sum(record) & 0xFF) != 0 or len(record) != record[0] + 5:
+                raise ValueError('Line {0}: Checksum error'.format(line_number))
+            length = record[0]
+            address = (record[1] << 8) | record[2]
+            record_type = record[3]
+            data = record[4:4+length]
+            if record_type == 0x00:
+                for cntr in range(length):
+                    memory[base_address + address + cntr] = data[cntr]
+            elif record_type == 0x01:
+                break
+            elif record_type == 0x02:
+                base_address = ((data[0] << 8) | data[1]) << 4
+            elif record_type == 0x04:
+                base_address = ((data[0] << 8) | data[1]) << 16
+    return memory
+
+
+def build_image(memory):
+    #Returns start address and contiguous image, gaps filled with 0xFF
+    addresses = []
+    for address in memory:
+        if CONFIGURATIONBITS_ADDRESS_MIN <= address <= CONFIGURATIONBITS_ADDRESS_MAX:
+            #Configuration bits are never programmed by the bootloader, see configuration_bits()
+            continue
+        if not MINIMUM_ADDRESS_ALLOWED <= address <= MAXIMUM_ADDRESS_ALLOWED:
+            raise ValueError('Address 0x{0:05X} outside allowed range'.format(address))
+        if address < PROG_START:
+            #Allowed in the hex file but the bootloader never writes there
+            continue
+        addresses.append(address)
+    if not addresses:
+        raise ValueError('No data in hex file')
+    #Image must start at a page
+    start = min(addresses) - (min(addresses) % PAGE_SIZE)
+    end = max(addresses) + 1
+    image = bytearray([0xFF] * (end - start))
+    for address in addresses:
+        image[address - start] = memory[address]
+    return start, image
+
+
+def configuration_bits(memory):
+    #Returns the mask of configuration bytes given and the bytes, 0xFF where not given
+    mask = 0
+    configuration = bytearray([0xFF] * CONFIGURATIONBITS_SIZE)
+    for cntr in range(CONFIGURATIONBITS_SIZE):
+        address = CONFIGURATIONBITS_ADDRESS_MIN + cntr
+        if address in memory:
+            mask |= 1 << cntr
+            configuration[cntr] = memory[address]
+    return mask, configuration
+
+
+def crc16(data, crc=0xFFFF):
+    #CRC-16 CCITT, same as the bootloader
+    for byte in data:
+        crc ^= byte << 8
+        for bit in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xFFFF
+            else:
+                crc = (crc << 1) & 0xFFFF
+    return crc
+
+
+class CopyFinder:
+    #Finds the longest earlier occurrence of the bytes at a position, at most WINDOW_SIZE back
+    def __init__(self, image):
+        self.image = image
+        self.chains = {}
+
+    def index(self, position):
+        key = bytes(self.image[position:position+MINIMUM_COPY])
+        if len(key) == MINIMUM_COPY:
+            self.chains.setdefault(key, []).append(position)
+
+    def unindex(self, position):
+        self.chains[bytes(self.image[position:position+MINIMUM_COPY])].pop()
+
+    def longest(self, position):
+        image = self.image
+        best_length = 0
+        best_distance = 0
+        key = bytes(image[position:position+MINIMUM_COPY])
+        if len(key) < MINIMUM_COPY:
+            return 0, 0
+        maximum = min(MAXIMUM_COPY, len(image) - position)
+        for candidate in reversed(self.chains.get(key, [])[-MAXIMUM_CHAIN:]):
+            distance = position - candidate
+            if distance > WINDOW_SIZE:
+                break
+            length = 0
+            #Copies may overlap the bytes being produced
+            while length < maximum and image[candidate+length] == image[position+length]:
+                length += 1
+            if length > best_length:
+                best_length = length
+                best_distance = distance
+                if length == maximum:
+                    break
+        return best_length, best_distance
+
+
+def append_literals(output, literals, maximum_literals=MAXIMUM_LITERALS):
+    while literals:
+        run = literals[:maximum_literals]
+        output.append(len(run) - 1)
+        output.extend(run)
+        del literals[:maximum_literals]
+
+
+def append_copy(output, length, distance):
+    output.append(0x80 | ((length - MINIMUM_COPY) << 2) | ((distance - 1) >> 8))
+    output.append((distance - 1) & 0xFF)
+
+
+def compress(image):
+    output = bytearray()
+    literals = bytearray()
+    finder = CopyFinder(image)
+
+    position = 0
+    while position < len(image):
+        length, distance = finder.longest(position)
+        #Lazy matching: Take a literal if the next position gives a longer copy
+        if length >= MINIMUM_COPY and position + 1 < len(image):
+            finder.index(position)
+            next_length, next_distance = finder.longest(position + 1)
+            finder.unindex(position)
+            if next_length > length + 1:
+                length = 0
+        if length >= MINIMUM_COPY:
+            append_literals(output, literals)
+            append_copy(output, length, distance)
+            for cntr in range(length):
+                finder.index(position + cntr)
+            position += length
+        else:
+            literals.append(image[position])
+            finder.index(position)
+            position += 1
+    append_literals(output, literals)
+    return output
+
+
+def decompress(data, length):
+    #Reference decoder, used to check the compressor's output
+    image = bytearray()
+    position = 0
+    while len(image) < length:
+        token = data[position]
+        position += 1
+        if token & 0x80:
+            distance = (((token & 0x03) << 8) | data[position]) + 1
+            position += 1
+            for cntr in range(((token >> 2) & 0x1F) + MINIMUM_COPY):
+                image.append(image[-distance])
+        else:
+            image.extend(data[position:position+token+1])
+            position += token + 1
+    return image
+
+
+def build_header(start, image, memory, version=IMAGE_VERSION, source_crc=0xFFFF):
+    mask, configuration = configuration_bits(memory)
+    header = bytearray()
+    header += bytearray([IMAGE_MAGIC >> 8, IMAGE_MAGIC & 0xFF, version, mask])
+    header += bytearray([(start >> shift) & 0xFF for shift in (24, 16, 8, 0)])
+    header += bytearray([(len(image) >> shift) & 0xFF for shift in (24, 16, 8, 0)])
+    crc = crc16(image)
+    header += bytearray([crc >> 8, crc & 0xFF, source_crc >> 8, source_crc & 0xFF])
+    header += configuration
+    header += bytearray([0xFF, 0xFF, 0xFF])
+    header.append((-sum(header)) & 0xFF)
+    return header
+
+
+def compress_firmware(hex_file_name, image_file_name):
+    memory = read_hex_file(hex_file_name)
+    start, image = build_image(memory)
+    data = compress(image)
+    if decompress(data, len(image)) != image:
+        raise RuntimeError('Compressed image does not decompress correctly')
+    with open(image_file_name, 'wb') as f:
+        f.write(build_header(start, image, memory))
+        f.write(data)
+    size = len(data) + IMAGE_HEADER_SIZE
+    print('Image 0x{0:05X} to 0x{1:05X}: {2} bytes'.format(start, start + len(image) - 1, len(image)))
+    #The binary image is what a compressed image has to be compared with, not the hex file
+    print('Compressed to {0} bytes, {1:.2f}x smaller than the binary image'.format(size, float(len(image)) / size))
+    print('({0:.2f}x smaller than the hex file)'.format(float(os.path.getsize(hex_file_name)) / size))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 2:
+        print(__doc__)
+        sys.exit(1)
+    if len(sys.argv) > 2:
+        output_file_name = sys.argv[2]
+    else:
+        output_file_name = sys.argv[1].rsplit('.', 1)[0] + '.LZB'
+    compress_firmware(sys.argv[1], output_file_name)
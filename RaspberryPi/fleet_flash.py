@@ -0,0 +1,307 @@
+"""
+Updates the firmware of many chargers at once via USB (custom HID).
+
+Usage: python fleet_flash.py FIRMWARE.HEX [options]
+
+Every charger found by VID/PID 04D8:F08E that answers with the bootloader
+signature 0xC125 goes through the same steps as an update by hand:
+ upload     write FIRMWARE.HEX (bulk write)
+ check      compare the device's CRC-32 of the file with the local file
+ found      wait until the bootloader has found the file
+ verify     press the button, wait until the file has been checked
+ program    press the button, wait until the bootloader is done
+ confirm    no error and pages written (bootloader details)
+ reboot     reboot in normal mode (0x22)
+Devices are handled by a pool of worker threads, one device per worker at a
+time. A line of progress is printed every second, a summary at the end.
+
+Options:
+ --workers N        number of devices updated at the same time (default 8)
+ --device PATH      use this hidraw node (may be repeated) instead of searching
+ --timeout SECONDS  maximum time for the bootloader to verify and program
+ --no-reboot        leave the devices in the bootloader when done
+ --sim N            update N simulated devices instead
+ --latency SECONDS  delay per frame of a simulated device (default 0.001)
+ --frame-loss P     share of bulk write frames simulated devices lose
+ --write-faults N   page writes that don't take on each simulated device. They
+                    have to be written again after reading back
+"""
+import argparse
+import sys
+import threading
+import time
+
+try:
+    from concurrent.futures import ThreadPoolExecutor
+except ImportError:
+    ThreadPoolExecutor = None
+
+import charger
+
+#Steps of an update, in order
+STATE_CONNECT = 'connect'
+STATE_UPLOAD = 'upload'
+STATE_CHECK = 'check'
+STATE_FOUND = 'found'
+STATE_VERIFY = 'verify'
+STATE_PROGRAM = 'program'
+STATE_CONFIRM = 'confirm'
+STATE_REBOOT = 'reboot'
+STATE_DONE = 'done'
+STATE_FAILED = 'failed'
+STATES = [STATE_CONNECT, STATE_UPLOAD, STATE_CHECK, STATE_FOUND, STATE_VERIFY, STATE_PROGRAM,
+          STATE_CONFIRM, STATE_REBOOT, STATE_DONE, STATE_FAILED]
+
+FIRMWARE_FILE_NAME = 'FIRMWARE.HEX'
+
+#Bootloader modes that may be left alone when an update starts
+IDLE_MODES = [charger.BOOTLOADER_MODE_SEARCH, charger.BOOTLOADER_MODE_FILE_FOUND,
+              charger.BOOTLOADER_MODE_CHECK_FAILED, charger.BOOTLOADER_MODE_DONE]
+
+
+class FlashJob(object):
+    #State machine for one device. step() does the work of the current state and
+    #moves on to the next one, errors end in STATE_FAILED
+    def __init__(self, name, open_transport, data, timeout=300.0, reboot=True, poll_interval=0.05):
+        self.name = name
+        self.open_transport = open_transport
+        self.data = bytearray(data)
+        self.timeout = timeout
+        self.reboot = reboot
+        self.poll_interval = poll_interval
+        self.state = STATE_CONNECT
+        self.message = ''
+        self.bytes_uploaded = 0
+        self.verify_retries = 0
+        self.started = None
+        self.finished = None
+        self.device = None
+        self.file_number = None
+        self.deadline = None
+
+    def finished_ok(self):
+        return self.state == STATE_DONE
+
+    def run(self):
+        self.started = time.time()
+        try:
+            while self.state not in (STATE_DONE, STATE_FAILED):
+                self.step()
+        except (charger.ChargerError, IOError, OSError) as e:
+            self.message = '{0}: {1}'.format(self.state, e)
+            self.state = STATE_FAILED
+        finally:
+            if self.device is not None:
+                self.device.close()
+            self.finished = time.time()
+        return self
+
+    def _fail(self, message):
+        self.message = '{0}: {1}'.format(self.state, message)
+        self.state = STATE_FAILED
+
+    def _wait_for_mode(self, modes):
+        #Returns the bootloader mode once it is one of modes, None on timeout
+        while time.time() < self.deadline:
+            mode = self.device.get_status()['bootloader_mode']
+            if mode in modes:
+                return mode
+            time.sleep(self.poll_interval)
+        return None
+
+    def _progress(self, done, total):
+        self.bytes_uploaded = done
+
+    def step(self):
+        if self.state == STATE_CONNECT:
+            self.device = charger.Charger(self.open_transport())
+            mode = self.device.get_status()['bootloader_mode']
+            if mode == charger.BOOTLOADER_MODE_SUSPENDED:
+                #The button resumes the search
+                self.device.press_button()
+            elif mode not in IDLE_MODES:
+                return self._fail('bootloader busy (mode 0x{0:02X})'.format(mode))
+            self.state = STATE_UPLOAD
+
+        elif self.state == STATE_UPLOAD:
+            self.file_number = self.device.write_file(FIRMWARE_FILE_NAME, self.data, progress=self._progress)
+            self.state = STATE_CHECK
+
+        elif self.state == STATE_CHECK:
+            if not self.device.verify_file(self.file_number, self.data):
+                return self._fail('file on the device does not match')
+            self.deadline = time.time() + self.timeout
+            self.state = STATE_FOUND
+
+        elif self.state == STATE_FOUND:
+            if self._wait_for_mode([charger.BOOTLOADER_MODE_FILE_FOUND]) is None:
+                return self._fail('bootloader has not found the file')
+            self.device.press_button()
+            self.state = STATE_VERIFY
+
+        elif self.state == STATE_VERIFY:
+            mode = self._wait_for_mode([charger.BOOTLOADER_MODE_CHECK_COMPLETE, charger.BOOTLOADER_MODE_CHECK_FAILED])
+            if mode is None:
+                return self._fail('timeout')
+            if mode == charger.BOOTLOADER_MODE_CHECK_FAILED:
+                return self._fail('file rejected, error 0x{0:X}'.format(self.device.get_bootloader_details()['error']))
+            self.device.press_button()
+            self.state = STATE_PROGRAM
+
+        elif self.state == STATE_PROGRAM:
+            mode = self._wait_for_mode([charger.BOOTLOADER_MODE_DONE, charger.BOOTLOADER_MODE_CHECK_FAILED])
+            if mode is None:
+                return self._fail('timeout')
+            if mode == charger.BOOTLOADER_MODE_CHECK_FAILED:
+                return self._fail('programming failed, error 0x{0:X}'.format(self.device.get_bootloader_details()['error']))
+            self.state = STATE_CONFIRM
+
+        elif self.state == STATE_CONFIRM:
+            details = self.device.get_bootloader_details()
+            if details['error'] != 0x00:
+                return self._fail('error 0x{0:X}'.format(details['error']))
+            if details['pages_written'] == 0:
+                return self._fail('nothing programmed')
+            self.verify_retries = details['verify_retries']
+            self.message = '{0} pages written'.format(details['pages_written'])
+            if self.verify_retries:
+                self.message += ', {0} written again'.format(self.verify_retries)
+            self.state = STATE_REBOOT if self.reboot else STATE_DONE
+
+        elif self.state == STATE_REBOOT:
+            self.device.reboot_normal_mode()
+            self.state = STATE_DONE
+
+
+def find_devices():
+    #hidraw nodes of all chargers that answer with the bootloader signature
+    devices = []
+    for path in charger.find_hidraw_devices():
+        try:
+            with charger.Charger(charger.HidTransport(path)) as device:
+                device.get_status()
+            devices.append(path)
+        except (charger.ChargerError, IOError, OSError) as e:
+            print('Skipping {0}: {1}'.format(path, e))
+    return devices
+
+
+class Report(object):
+    #Prints the aggregate progress of all jobs once a second
+    def __init__(self, jobs, interval=1.0):
+        self.jobs = jobs
+        self.interval = interval
+        self.started = time.time()
+        self.stop = threading.Event()
+        self.thread = threading.Thread(target=self._run)
+        self.thread.daemon = True
+
+    def __enter__(self):
+        self.thread.start()
+        return self
+
+    def __exit__(self, *args):
+        self.stop.set()
+        self.thread.join()
+        self.print_line()
+
+    def _run(self):
+        while not self.stop.wait(self.interval):
+            self.print_line()
+
+    def print_line(self):
+        elapsed = time.time() - self.started
+        uploaded = sum(job.bytes_uploaded for job in self.jobs)
+        counts = []
+        for state in STATES:
+            count = sum(1 for job in self.jobs if job.state == state)
+            if count:
+                counts.append('{0} {1}'.format(state, count))
+        print('[{0:6.1f}s] {1} | {2:.1f}kB uploaded, {3:.1f}kB/s'.format(
+            elapsed, ', '.join(counts), uploaded / 1024.0, uploaded / 1024.0 / max(elapsed, 0.001)))
+        sys.stdout.flush()
+
+
+def run_jobs(jobs, workers):
+    if ThreadPoolExecutor is not None:
+        with ThreadPoolExecutor(max_workers=workers) as executor:
+            list(executor.map(FlashJob.run, jobs))
+        return
+    #Python 2 without the futures backport: threads taking jobs from a list
+    pending = list(jobs)
+    lock = threading.Lock()
+
+    def worker():
+        while True:
+            with lock:
+                if not pending:
+                    return
+                job = pending.pop(0)
+            job.run()
+    threads = [threading.Thread(target=worker) for cntr in range(workers)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+
+def print_summary(jobs):
+    print('')
+    for job in jobs:
+        print('{0:<16} {1:<7} {2:6.1f}s  {3}'.format(job.name, job.state, job.finished - job.started, job.message))
+    done = sum(1 for job in jobs if job.finished_ok())
+    print('{0} of {1} devices updated'.format(done, len(jobs)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('hex_file')
+    parser.add_argument('--workers', type=int, default=8)
+    parser.add_argument('--device', action='append')
+    parser.add_argument('--timeout', type=float, default=300.0)
+    parser.add_argument('--no-reboot', action='store_true')
+    parser.add_argument('--sim', type=int, default=0)
+    parser.add_argument('--latency', type=float, default=0.001)
+    parser.add_argument('--frame-loss', type=float, default=0.0)
+    parser.add_argument('--write-faults', type=int, default=0)
+    args = parser.parse_args()
+
+    with open(args.hex_file, 'rb') as f:
+        data = f.read()
+
+    jobs = []
+    if args.sim:
+        import charger_sim
+        for cntr in range(args.sim):
+            device = charger_sim.SimulatedCharger(frame_loss=args.frame_loss, seed=cntr, write_faults=args.write_faults)
+            name = 'sim{0}'.format(cntr)
+            open_transport = lambda device=device, name=name: charger.SimulatedTransport(device, args.latency, name)
+            jobs.append(FlashJob(name, open_transport, data, args.timeout, not args.no_reboot, poll_interval=0.0))
+    else:
+        for path in args.device or find_devices():
+            open_transport = lambda path=path: charger.HidTransport(path)
+            jobs.append(FlashJob(path, open_transport, data, args.timeout, not args.no_reboot))
+    if not jobs:
+        print('No chargers found')
+        return 1
+
+    print('Updating {0} devices with {1} ({2} bytes), {3} at a time'.format(len(jobs), args.hex_file, len(data), args.workers))
+    with Report(jobs):
+        run_jobs(jobs, max(1, args.workers))
+    print_summary(jobs)
+
+    if args.sim:
+        #The simulated devices know what has actually been programmed
+        for job in jobs:
+            device = job.open_transport().device
+            if job.finished_ok() and device.programmed != bytes(job.data):
+                print('{0}: programmed image does not match'.format(job.name))
+                return 1
+            if job.finished_ok() and job.verify_retries != args.write_faults:
+                print('{0}: {1} pages written again, {2} writes failed'.format(job.name, job.verify_retries, args.write_faults))
+                return 1
+    return 0 if all(job.finished_ok() for job in jobs) else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
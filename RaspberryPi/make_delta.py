@@ -0,0 +1,200 @@
+"""
+Makes a delta image (FIRMWARE.LZB, format version 4) that turns the firmware
+currently installed into a new one. Most of the new image is copied from the
+installed image, so the file is much smaller than a full image.
+
+Usage: python make_delta.py INSTALLED.HEX NEW.HEX [FIRMWARE.LZB]
+
+INSTALLED.HEX must be exactly what has been programmed last. The bootloader
+checks this (CRC over all bytes copied) before it writes anything. If it
+doesn't match, or if applying the delta gets interrupted, use a full image.
+
+Delta format (see bootloader.c):
+ 28 byte header: as the compressed image with version 4, bytes 14-15 hold the
+ CRC over all bytes copied from the installed image. Includes the new image's
+ configuration bits, which must match the device's.
+ 0b00LLLLLL followed by L+1 literal bytes
+ 0b01LLLLLL LLLLLLLL OOOOOOOO OOOOOOOO to copy L+1 bytes from the installed
+ image at the current address plus O (signed)
+ 0b1LLLLLDD DDDDDDDD to copy L+3 bytes from D+1 bytes back in the new image
+Pages are written in ascending order. A copy from the installed image never
+reaches below the page being assembled so the delta can be applied in place.
+"""
+import bisect
+import sys
+
+import compress_firmware as image_format
+
+IMAGE_VERSION_DELTA = 0x04
+
+#The bootloader never writes below PROG_START nor the configuration bits' page
+INSTALLED_START = image_format.PROG_START
+INSTALLED_END = 0x1FC00
+
+MAXIMUM_LITERALS = 64
+MAXIMUM_INSTALLED_COPY = 16384
+MINIMUM_INSTALLED_COPY = 5
+MAXIMUM_OFFSET = 32767
+MINIMUM_OFFSET = -32768
+INSTALLED_KEY_SIZE = 4
+MAXIMUM_CANDIDATES = 64
+
+
+def installed_image(memory):
+    #Only bytes that are known to be in flash can be copied
+    return dict((address, data) for address, data in memory.items() if INSTALLED_START <= address < INSTALLED_END)
+
+
+def index_installed(installed):
+    index = {}
+    for address in sorted(installed):
+        key = tuple(installed.get(address + cntr) for cntr in range(INSTALLED_KEY_SIZE))
+        if None not in key:
+            index.setdefault(key, []).append(address)
+    return index
+
+
+def copy_length(installed, image, start, position, source):
+    #Number of bytes that can be copied from source onwards
+    length = 0
+    while position + length < len(image) and length < MAXIMUM_INSTALLED_COPY:
+        address = start + position + length
+        #Must not read from a page that has been written already
+        if source + length < address - (address % image_format.PAGE_SIZE):
+            break
+        if installed.get(source + length) != image[position + length]:
+            break
+        length += 1
+    return length
+
+
+def longest_installed_copy(installed, index, image, start, position, last_offset):
+    address = start + position
+    page_start = address - (address % image_format.PAGE_SIZE)
+    #Unchanged code is most likely where it was, or moved as much as the last copy
+    best_length = 0
+    best_offset = 0
+    for offset in (last_offset, 0):
+        length = copy_length(installed, image, start, position, address + offset)
+        if length > best_length:
+            best_length, best_offset = length, offset
+    key = tuple(image[position:position+INSTALLED_KEY_SIZE])
+    candidates = index.get(key, [])
+    first = bisect.bisect_left(candidates, max(page_start, address + MINIMUM_OFFSET))
+    for source in candidates[first:first+MAXIMUM_CANDIDATES]:
+        if source - address > MAXIMUM_OFFSET:
+            break
+        length = copy_length(installed, image, start, position, source)
+        if length > best_length:
+            best_length, best_offset = length, source - address
+    return best_length, best_offset
+
+
+def make_delta(installed, start, image):
+    output = bytearray()
+    literals = bytearray()
+    finder = image_format.CopyFinder(image)
+    index = index_installed(installed)
+    source_crc = 0xFFFF
+    last_offset = 0
+
+    position = 0
+    while position < len(image):
+        length, offset = longest_installed_copy(installed, index, image, start, position, last_offset)
+        window_length, distance = finder.longest(position)
+        if length >= MINIMUM_INSTALLED_COPY and length >= window_length:
+            image_format.append_literals(output, literals, MAXIMUM_LITERALS)
+            output.append(0x40 | ((length - 1) >> 8))
+            output.append((length - 1) & 0xFF)
+            output.append((offset >> 8) & 0xFF)
+            output.append(offset & 0xFF)
+            copied = bytearray(installed[start + position + offset + cntr] for cntr in range(length))
+            source_crc = image_format.crc16(copied, source_crc)
+            last_offset = offset
+        elif window_length >= image_format.MINIMUM_COPY:
+            image_format.append_literals(output, literals, MAXIMUM_LITERALS)
+            image_format.append_copy(output, window_length, distance)
+            length = window_length
+        else:
+            literals.append(image[position])
+            length = 1
+        for cntr in range(length):
+            finder.index(position + cntr)
+        position += length
+    image_format.append_literals(output, literals, MAXIMUM_LITERALS)
+    return output, source_crc
+
+
+def apply_delta(flash, data, start, length):
+    #Reference decoder. Works on flash in place, a page at a time, just like the bootloader
+    image = bytearray()
+    page = bytearray()
+    position = 0
+    while len(image) < length:
+        token = data[position]
+        position += 1
+        if token & 0x80:
+            distance = (((token & 0x03) << 8) | data[position]) + 1
+            position += 1
+            for cntr in range(((token >> 2) & 0x1F) + image_format.MINIMUM_COPY):
+                image.append(image[-distance])
+                page.append(image[-1])
+                page = _flush(flash, start, image, page)
+        elif token & 0x40:
+            copy = (((token & 0x3F) << 8) | data[position]) + 1
+            offset = (data[position+1] << 8) | data[position+2]
+            if offset & 0x8000:
+                offset -= 0x10000
+            position += 3
+            for cntr in range(copy):
+                image.append(flash[start + len(image) + offset])
+                page.append(image[-1])
+                page = _flush(flash, start, image, page)
+        else:
+            for data_byte in data[position:position+token+1]:
+                image.append(data_byte)
+                page.append(data_byte)
+                page = _flush(flash, start, image, page)
+            position += token + 1
+    return image
+
+
+def _flush(flash, start, image, page):
+    #Write a complete page back to flash
+    if len(page) < image_format.PAGE_SIZE:
+        return page
+    page_start = start + len(image) - image_format.PAGE_SIZE
+    if INSTALLED_START <= page_start < INSTALLED_END:
+        flash[page_start:page_start+image_format.PAGE_SIZE] = page
+    return bytearray()
+
+
+def make_delta_file(installed_file_name, new_file_name, image_file_name):
+    installed = installed_image(image_format.read_hex_file(installed_file_name))
+    memory = image_format.read_hex_file(new_file_name)
+    start, image = image_format.build_image(memory)
+    data, source_crc = make_delta(installed, start, image)
+
+    #Apply it to what's known of the installed image to make sure it works in place
+    flash = bytearray([0xFF] * (INSTALLED_END + image_format.PAGE_SIZE))
+    for address, data_byte in installed.items():
+        flash[address] = data_byte
+    if apply_delta(flash, data, start, len(image)) != image:
+        raise RuntimeError('Delta image does not produce the new image')
+
+    with open(image_file_name, 'wb') as f:
+        f.write(image_format.build_header(start, image, memory, IMAGE_VERSION_DELTA, source_crc))
+        f.write(data)
+    print('Image 0x{0:05X} to 0x{1:05X}: {2} bytes'.format(start, start + len(image) - 1, len(image)))
+    print('Delta image: {0} bytes'.format(len(data) + image_format.IMAGE_HEADER_SIZE))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 3:
+        print(__doc__)
+        sys.exit(1)
+    if len(sys.argv) > 3:
+        output_file_name = sys.argv[3]
+    else:
+        output_file_name = 'FIRMWARE.LZB'
+    make_delta_file(sys.argv[1], sys.argv[2], output_file_name)
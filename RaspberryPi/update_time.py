@@ -0,0 +1,133 @@
+"""
+Measures the time a firmware update takes from FIRMWARE.HEX and from the
+compressed image FIRMWARE.LZB (compress_firmware.py), end to end.
+
+Usage: python update_time.py FIRMWARE.HEX [options]
+
+Both files go through the same steps on a simulated charger (charger_sim.py)
+as with fleet_flash.py: upload, check, wait until the bootloader has found the
+file, verify, program. What is counted is the work the device does:
+ frames     API frames exchanged (upload, check and the button presses)
+ timeslots  passes through the main loop while the bootloader searches,
+            verifies and programs without any frames being exchanged
+ pages      program memory pages written
+The device time is frames * frame time + timeslots * 8ms + pages * page time.
+The frame time is that of a full speed HID report every millisecond in each
+direction. The simulator writes program memory instantly, the page time stands
+in for erasing a page and writing it 64 bytes at a time. It is a lower bound:
+the bootloader's work is assumed to fit in its 8ms time slot, the host's time
+is not counted at all.
+
+Options:
+ --frame-ms MS   time per frame (default 1.0, 2.0 if the host waits for every
+                 response before sending the next frame)
+ --page-ms MS    time to erase and write a page of program memory (default 50)
+"""
+import argparse
+import os
+import shutil
+import sys
+import tempfile
+
+import charger
+import charger_sim
+import compress_firmware
+
+TIMESLOT_MS = 8.0
+
+
+class CountingTransport(charger.SimulatedTransport):
+    def __init__(self, device):
+        charger.SimulatedTransport.__init__(self, device)
+        self.frames = 0
+
+    def transfer(self, frame):
+        self.frames += 1
+        return charger.SimulatedTransport.transfer(self, frame)
+
+
+def run_until(device, modes, limit=1000000):
+    #Passes through the main loop until the bootloader is in one of modes
+    timeslots = 0
+    while device.bootloader_mode not in modes:
+        if timeslots >= limit:
+            raise charger.ChargerError('bootloader stuck in mode 0x{0:02X}'.format(device.bootloader_mode))
+        device.run()
+        timeslots += 1
+    return timeslots
+
+
+def measure(file_name, data):
+    device = charger_sim.SimulatedCharger()
+    transport = CountingTransport(device)
+    c = charger.Charger(transport)
+    result = {'file': file_name, 'bytes': len(data)}
+
+    file_number = c.write_file(file_name, data)
+    if not c.verify_file(file_number, data):
+        raise charger.ChargerError('{0}: file on the device does not match'.format(file_name))
+    result['upload_frames'] = transport.frames
+
+    result['search'] = run_until(device, [charger.BOOTLOADER_MODE_FILE_FOUND])
+    c.press_button()
+    result['verify'] = run_until(device, [charger.BOOTLOADER_MODE_CHECK_COMPLETE, charger.BOOTLOADER_MODE_CHECK_FAILED])
+    if device.bootloader_mode == charger.BOOTLOADER_MODE_CHECK_FAILED:
+        raise charger.ChargerError('{0}: file rejected'.format(file_name))
+    c.press_button()
+    result['program'] = run_until(device, [charger.BOOTLOADER_MODE_DONE, charger.BOOTLOADER_MODE_CHECK_FAILED])
+    if device.bootloader_mode == charger.BOOTLOADER_MODE_CHECK_FAILED:
+        raise charger.ChargerError('{0}: programming failed'.format(file_name))
+
+    result['frames'] = transport.frames
+    result['pages'] = c.get_bootloader_details()['pages_written']
+    result['timeslots'] = result['search'] + result['verify'] + result['program']
+    result['program_memory'] = device.program_memory
+    return result
+
+
+def device_ms(result, frame_ms, page_ms):
+    return result['frames'] * frame_ms + result['timeslots'] * TIMESLOT_MS + result['pages'] * page_ms
+
+
+def print_result(result, frame_ms, page_ms):
+    print('{0:<13} {1:6} bytes  {2:5} frames  {3:5} timeslots (search {4}, verify {5}, program {6})  {7:3} pages  {8:7.0f}ms'.format(
+        result['file'], result['bytes'], result['frames'], result['timeslots'],
+        result['search'], result['verify'], result['program'], result['pages'], device_ms(result, frame_ms, page_ms)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('hex_file')
+    parser.add_argument('--frame-ms', type=float, default=1.0)
+    parser.add_argument('--page-ms', type=float, default=50.0)
+    args = parser.parse_args()
+
+    directory = tempfile.mkdtemp()
+    try:
+        image_file_name = os.path.join(directory, 'FIRMWARE.LZB')
+        compress_firmware.compress_firmware(args.hex_file, image_file_name)
+        with open(image_file_name, 'rb') as f:
+            image = f.read()
+    finally:
+        shutil.rmtree(directory)
+    with open(args.hex_file, 'rb') as f:
+        hex_data = f.read()
+
+    hex_result = measure('FIRMWARE.HEX', hex_data)
+    image_result = measure('FIRMWARE.LZB', image)
+    if hex_result['program_memory'] != image_result['program_memory']:
+        print('Program memory differs between FIRMWARE.HEX and FIRMWARE.LZB')
+        return 1
+
+    print('Device time at {0}ms per frame, {1}ms per timeslot and {2}ms per page:'.format(args.frame_ms, TIMESLOT_MS, args.page_ms))
+    print_result(hex_result, args.frame_ms, args.page_ms)
+    print_result(image_result, args.frame_ms, args.page_ms)
+    print('Upload {0:.2f}x, verify and program timeslots {1:.2f}x, end to end {2:.2f}x faster from FIRMWARE.LZB'.format(
+        float(hex_result['upload_frames']) / image_result['upload_frames'],
+        float(hex_result['verify'] + hex_result['program']) / (image_result['verify'] + image_result['program']),
+        device_ms(hex_result, args.frame_ms, args.page_ms) / device_ms(image_result, args.frame_ms, args.page_ms)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,112 @@
+"""
+Host client for the vendor specific bulk interface (interface 2, endpoint 3).
+Uses pyusb, i.e. libusb, so it runs on Linux without a kernel driver.
+The firmware only has this interface when built with
+USB_VENDOR_INTERFACE_AVAILABLE defined in usb_config.h.
+
+Usage: python usb_vendor.py LOCAL_FILE REMOTE_NAME.EXT
+
+A message is one bulk transfer: any number of 64 byte packets of data that
+go to the buffer starting at byte 0, followed by an API frame of at most 63
+bytes. Being a short packet, the frame ends the transfer. It is handled just
+like a HID report or an SPI frame and the response comes back as one 64 byte
+packet. Trailing zeros of a frame need not be sent. A sector is written with a single
+transfer: 512 bytes of data followed by command 0x58.
+"""
+import sys
+
+import usb.core
+import usb.util
+
+VENDOR_ID = 0x04D8
+PRODUCT_ID = 0xF08E
+INTERFACE = 2
+ENDPOINT_OUT = 0x03
+ENDPOINT_IN = 0x83
+PACKET_SIZE = 64
+SECTOR_SIZE = 512
+SIGNATURE = [0xC1, 0x25]
+
+
+class VendorClient:
+    def __init__(self):
+        self.device = usb.core.find(idVendor=VENDOR_ID, idProduct=PRODUCT_ID)
+        if self.device is None:
+            raise RuntimeError('Device not found')
+        if self.device.is_kernel_driver_active(INTERFACE):
+            self.device.detach_kernel_driver(INTERFACE)
+        usb.util.claim_interface(self.device, INTERFACE)
+
+    def close(self):
+        usb.util.release_interface(self.device, INTERFACE)
+
+    def transfer(self, frame, data=None):
+        #Sends data (a multiple of 64 bytes, at most 512) and a frame, returns the response
+        if data is None:
+            data = []
+        if len(data) % PACKET_SIZE or len(data) > SECTOR_SIZE:
+            raise ValueError('Data must be a multiple of 64 bytes, at most 512')
+        frame = list(frame)
+        while len(frame) > 1 and frame[-1] == 0x00:
+            frame.pop()
+        if not 0 < len(frame) < PACKET_SIZE:
+            raise ValueError('Frame must be 1 to 63 bytes')
+        self.device.write(ENDPOINT_OUT, bytearray(data) + bytearray(frame), timeout=1000)
+        return list(self.device.read(ENDPOINT_IN, PACKET_SIZE, timeout=1000))
+
+    def get_status(self):
+        return self.transfer([0x10])
+
+    def find_file(self, file_name):
+        #0x81: Find file. Parameter: char[8] FileName, char[3] FileExtention
+        name, extention = file_name.upper().split('.')
+        frame = [0x81] + [ord(c) for c in name[:8].ljust(8)] + [ord(c) for c in extention[:3].ljust(3)]
+        response = self.transfer(frame)
+        if not response[:3] == [0x81] + SIGNATURE:
+            return 0
+        return response[3]
+
+    def create_file(self, file_name, size):
+        #0x52: Create file. Parameters: char[8] FileName, char[3] FileExtention, uint32_t FileSize, 0xBD4F
+        name, extention = file_name.upper().split('.')
+        frame = [0x00, 0x52] + [ord(c) for c in name[:8].ljust(8)] + [ord(c) for c in extention[:3].ljust(3)]
+        frame += [(size >> shift) & 0xFF for shift in (24, 16, 8, 0)] + [0xBD, 0x4F]
+        response = self.transfer(frame)
+        if not response[:4] == [0x00] + SIGNATURE + [0x52]:
+            return 0
+        return response[4]
+
+    def write_sector(self, file_number, sector_number, data):
+        #0x58: Write buffer to file sector. Parameters: uint8_t file_number, uint16_t sector, 0x6A6D
+        data = list(data[:SECTOR_SIZE])
+        data += [0x00] * (SECTOR_SIZE - len(data))
+        frame = [0x00, 0x58, file_number, (sector_number >> 8) & 0xFF, sector_number & 0xFF, 0x6A, 0x6D]
+        response = self.transfer(frame, data)
+        if not response[:4] == [0x00] + SIGNATURE + [0x58]:
+            return None
+        #file_number, sector, return value
+        return response[7]
+
+    def write_file(self, local_file_name, remote_file_name):
+        with open(local_file_name, 'rb') as f:
+            data = list(f.read())
+        self.create_file(remote_file_name, len(data))
+        file_number = self.find_file(remote_file_name)
+        if file_number == 0:
+            print('File not found')
+            return
+        for sector_number in range(0, (len(data) + SECTOR_SIZE - 1) // SECTOR_SIZE):
+            result = self.write_sector(file_number, sector_number, data[SECTOR_SIZE*sector_number:SECTOR_SIZE*(sector_number+1)])
+            if result != 0:
+                print('Writing sector {0} failed: {1}'.format(sector_number, result))
+                return
+        print('{0} bytes written to {1}'.format(len(data), remote_file_name))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 3:
+        print(__doc__)
+        sys.exit(1)
+    client = VendorClient()
+    client.write_file(sys.argv[1], sys.argv[2])
+    client.close()
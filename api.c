@@ -11,6 +11,75 @@
 #include "fat16.h"
 #include "flash.h"
 
+//Data bytes per bulk write frame: 64 bytes minus data request and 5 bytes of command
+#define API_BULK_WRITE_MAXIMUM_DATA 58
+//Data bytes per read stream chunk: 64 bytes minus 6 bytes of header
+#define API_READ_STREAM_CHUNK_SIZE 58
+//Data bytes per read stream burst at most, the length has to fit into one byte
+#define API_READ_STREAM_BURST_MAXIMUM 250
+//File checksum. Bytes read at a time and per call to api_run()
+#define API_CHECKSUM_CHUNK_SIZE 16
+#define API_CHECKSUM_BYTES_PER_CALL 128
+//Command queue. Number of jobs and longest command that can be queued
+#define API_QUEUE_SIZE 2
+#define API_QUEUE_COMMAND_SIZE 18
+//Profiler entries per frame: 64 bytes minus 4 bytes of header, 14 bytes each
+#define API_PROFILER_PROBES_PER_FRAME 4
+
+/******************************************************************************
+ * Variables
+ ******************************************************************************/
+
+//Bulk write. Sector being filled, position within it and CRC of the data so far
+uint8_t bulk_write_open = 0;
+uint8_t bulk_write_file_number;
+uint16_t bulk_write_sector;
+uint16_t bulk_write_offset;
+uint16_t bulk_write_crc;
+//Sequence number expected next and the one the current sector started with
+uint8_t bulk_write_sequence;
+uint8_t bulk_write_sector_sequence;
+
+//Read stream. Position of the next chunk and the cluster the last chunk ended in
+uint8_t read_stream_open = 0;
+uint8_t read_stream_sequence;
+uint32_t read_stream_position;
+uint32_t read_stream_file_size;
+uint16_t read_stream_cluster;
+uint16_t read_stream_cluster_number;
+
+//File checksum. Range to cover, position of the next byte and checksums so far
+apiChecksumStatus_t checksum_status = CHECKSUM_STATUS_IDLE;
+uint8_t checksum_file_number;
+uint32_t checksum_start;
+uint32_t checksum_end;
+uint32_t checksum_position;
+uint16_t checksum_cluster;
+uint16_t checksum_cluster_number;
+uint32_t checksum_crc;
+uint16_t checksum_fletcher;
+
+//Command queue. Jobs are added at queue_next_free and executed from queue_next_run
+//Jobs done stay in the queue until their slot is needed again
+uint8_t queue_id[API_QUEUE_SIZE];
+uint8_t queue_command[API_QUEUE_SIZE][API_QUEUE_COMMAND_SIZE];
+apiQueueStatus_t queue_status[API_QUEUE_SIZE];
+uint8_t queue_result[API_QUEUE_SIZE];
+uint8_t queue_next_free = 0;
+uint8_t queue_next_run = 0;
+//Format and copy jobs are executed one sector per main loop pass
+uint16_t queue_step;
+uint16_t queue_steps;
+uint8_t queue_copy_file_number;
+uint8_t queue_copy_new_file_number;
+
+//CRC-32 (as zlib) lookup table, one nibble at a time
+const uint32_t crc32_table[16] = 
+{
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
 
 
 /******************************************************************************
@@ -20,12 +89,18 @@
 static void _fill_buffer_get_status(uint8_t *outBuffer);
 static void _fill_buffer_get_display(uint8_t *outBuffer, uint8_t secondHalf);
 static void _fill_buffer_get_bootloader_details(uint8_t *outBuffer);
+static void _fill_buffer_get_profiler(uint8_t *outBuffer, apiDataRequest_t command, uint8_t first_probe);
 static void _fill_buffer_get_configuration(uint8_t *outBuffer);
+static void _fill_buffer_get_checksum(uint8_t *outBuffer);
+static void _fill_buffer_get_queue(uint8_t *outBuffer);
 
 static void _fill_buffer_get_file_details(uint8_t *inBuffer, uint8_t *outBuffer);
 static void _fill_buffer_find_file(uint8_t *inBuffer, uint8_t *outBuffer);
 static void _fill_buffer_read_file(uint8_t *inBuffer, uint8_t *outBuffer);
 static void _fill_buffer_read_buffer(uint8_t *inBuffer, uint8_t *outBuffer);
+static void _fill_buffer_read_stream_open(uint8_t *inBuffer, uint8_t *outBuffer);
+static void _fill_buffer_read_stream_next(uint8_t *outBuffer, apiDataRequest_t command, uint16_t chunk_size);
+static void _fill_buffer_read_stream_chunk(uint8_t *outBuffer, uint16_t chunk_size);
 
 static void _parse_command_short(uint8_t cmd);
 static uint8_t _parse_command_long(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr);
@@ -41,6 +116,16 @@ static uint8_t _parse_sector_to_buffer(uint8_t *data, uint8_t *out_buffer, uint8
 static uint8_t _parse_buffer_to_sector(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr);
 static uint8_t _parse_write_buffer(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr);
 static uint8_t _parse_file_copy(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr);
+static uint8_t _parse_bulk_write_open(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr);
+static uint8_t _parse_bulk_write_data(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr);
+static uint8_t _parse_bulk_write_commit(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr);
+static uint8_t _parse_file_checksum(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr);
+static void _checksum_update(uint8_t *data, uint8_t length);
+static void _checksum_run(void);
+static uint8_t _parse_queue_command(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr);
+static uint8_t _queue_command_length(uint8_t command);
+static void _queue_run(void);
+static uint8_t _queue_start(void);
 
 static uint8_t _parse_settings_spi_mode(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr);
 static uint8_t _parse_settings_spi_frequency(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr);
@@ -49,6 +134,7 @@ static uint8_t _parse_settings_i2c_mode(uint8_t *data, uint8_t *out_buffer, uint
 static uint8_t _parse_settings_i2c_frequency(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr);
 static uint8_t _parse_settings_i2c_slaveModeSlaveAddress(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr);
 static uint8_t _parse_settings_i2c_masterModeSlaveAddress(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr);
+static uint8_t _parse_settings_boot_options(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr);
 
 /******************************************************************************
  * Public functions implementation
@@ -92,6 +178,26 @@ void api_prepare(uint8_t *inBuffer, uint8_t *outBuffer)
                 _fill_buffer_read_buffer(inBuffer, outBuffer);
                 break;
                 
+            case DATAREQUEST_READ_STREAM_OPEN:
+                //Start reading a file and get the first chunk
+                _fill_buffer_read_stream_open(inBuffer, outBuffer);
+                break;
+                
+            case DATAREQUEST_READ_STREAM_NEXT:
+                //Get the next chunk
+                _fill_buffer_read_stream_next(outBuffer, DATAREQUEST_READ_STREAM_NEXT, API_READ_STREAM_CHUNK_SIZE);
+                break;
+                
+            case DATAREQUEST_READ_STREAM_BURST:
+                //Only one frame available, same as getting the next chunk
+                _fill_buffer_read_stream_next(outBuffer, DATAREQUEST_READ_STREAM_BURST, API_READ_STREAM_CHUNK_SIZE);
+                break;
+                
+            case DATAREQUEST_GET_PROFILER_ENTRIES:
+                //Execution time statistics, starting at the probe requested
+                _fill_buffer_get_profiler(outBuffer, DATAREQUEST_GET_PROFILER_ENTRIES, inBuffer[1]);
+                break;
+                
             default:
                 outBuffer[0] = 0x99;
                 outBuffer[1] = 0x99;
@@ -125,12 +231,27 @@ void api_prepare(uint8_t *inBuffer, uint8_t *outBuffer)
                 //Call function to fill the buffer with bootloader details
                 _fill_buffer_get_bootloader_details(outBuffer);
                 break;
+                
+            case DATAREQUEST_GET_PROFILER:
+                //Call function to fill the buffer with execution time statistics
+                _fill_buffer_get_profiler(outBuffer, DATAREQUEST_GET_PROFILER, 0);
+                break;
             
             case DATAREQUEST_GET_CONFIGURATION:
                 //Call function to fill the buffer with configuration details
                 _fill_buffer_get_configuration(outBuffer);
                 break;
                 
+            case DATAREQUEST_GET_CHECKSUM:
+                //Call function to fill the buffer with the file checksum status
+                _fill_buffer_get_checksum(outBuffer);
+                break;
+                
+            case DATAREQUEST_GET_QUEUE:
+                //Call function to fill the buffer with the command queue status
+                _fill_buffer_get_queue(outBuffer);
+                break;
+                
             case DATAREQUEST_GET_ECHO:
                 //Copy received data to outBuffer
                 memcpy(outBuffer, inBuffer, 64);
@@ -143,6 +264,30 @@ void api_prepare(uint8_t *inBuffer, uint8_t *outBuffer)
     }
 }
 
+//Same as api_prepare() but the response may take up this frame and the ones that follow
+//outBuffer must be followed by the buffers of these frames. Returns number of frames used
+uint8_t api_prepare_frames(uint8_t *inBuffer, uint8_t *outBuffer, uint8_t frames)
+{
+    uint16_t chunk_size;
+    
+    if((inBuffer[0]==DATAREQUEST_READ_STREAM_BURST) && (frames>1))
+    {
+        //Read as much as fits into all frames, with one header only
+        chunk_size = frames;
+        chunk_size <<= 6;
+        chunk_size -= 6;
+        if(chunk_size>API_READ_STREAM_BURST_MAXIMUM)
+        {
+            chunk_size = API_READ_STREAM_BURST_MAXIMUM;
+        }
+        _fill_buffer_read_stream_next(outBuffer, DATAREQUEST_READ_STREAM_BURST, chunk_size);
+        return frames;
+    }
+    
+    api_prepare(inBuffer, outBuffer);
+    return 1;
+}
+
 void api_parse(uint8_t *inBuffer, uint8_t receivedDataLength, uint8_t *outBuffer)
 {
     //Check if the host expects us to do anything else
@@ -206,6 +351,10 @@ void api_parse(uint8_t *inBuffer, uint8_t receivedDataLength, uint8_t *outBuffer
                 in_idx += _parse_command_long(&inBuffer[in_idx], outBuffer, out_idx_ptr);
                 break;
                 
+            case 0x70:
+                in_idx += _parse_command_long(&inBuffer[in_idx], outBuffer, out_idx_ptr);
+                break;
+                
             default:
                 //We should never end up here
                 //If we still do, stop parsing this buffer
@@ -214,6 +363,16 @@ void api_parse(uint8_t *inBuffer, uint8_t receivedDataLength, uint8_t *outBuffer
     }
 }
 
+//Background work for the API. Called once per main loop pass, so keep it short
+void api_run(void)
+{
+    //Execute the next queued command, if any
+    _queue_run();
+    
+    //Continue calculating the file checksum, if any
+    _checksum_run();
+}
+
 
 /******************************************************************************
  * Static functions implementation
@@ -247,6 +406,10 @@ static void _fill_buffer_get_status(uint8_t *outBuffer)
     outBuffer[11] = os.done;
     outBuffer[12] = os.bootloader_mode;
     outBuffer[13] = os.display_mode;
+    
+    //Time from reset until bootloader mode was entered (in units of 256 instruction cycles)
+    outBuffer[14] = HIGH_BYTE(os.bootTime);
+    outBuffer[15] = LOW_BYTE(os.bootTime);
 }
 
 //Fill buffer with display content
@@ -340,15 +503,76 @@ static void _fill_buffer_get_bootloader_details(uint8_t *outBuffer)
     outBuffer[20] = bootloader_get_rec_checksumCheck();
 
     data_length = (uint8_t) bootloader_get_rec_dataLength();
-    if(data_length>43)
+    if(data_length>16)
     {
-        //More will not fit into our 64byte buffer
-        data_length = 43;
+        //Bytes 37 and up are used for programming statistics
+        data_length = 16;
     }
     for(cntr=0; cntr<data_length; ++cntr)
     {
         outBuffer[21+cntr] = bootloader_get_rec_data(cntr);
     }
+    
+    //Programming statistics
+    buffer_small = bootloader_get_flashPagesErased();
+    outBuffer[37] = HIGH_BYTE(buffer_small);
+    outBuffer[38] = LOW_BYTE(buffer_small);
+    
+    buffer_small = bootloader_get_flashBlocksWritten();
+    outBuffer[39] = HIGH_BYTE(buffer_small);
+    outBuffer[40] = LOW_BYTE(buffer_small);
+    
+    //Readback verification. Last page that failed (0 if none) and number of pages written again
+    buffer_small = bootloader_get_verifyFailedPage();
+    outBuffer[41] = HIGH_BYTE(buffer_small);
+    outBuffer[42] = LOW_BYTE(buffer_small);
+    outBuffer[43] = bootloader_get_verifyRetries();
+}
+
+static void _fill_buffer_get_profiler(uint8_t *outBuffer, apiDataRequest_t command, uint8_t first_probe)
+{
+    uint8_t probe;
+    uint8_t *ptr;
+    profilerEntry_t *entry;
+    
+    //Echo back to the host PC the command we are fulfilling in the first uint8_t
+    outBuffer[0] = command;
+    
+    //Bootloader signature
+    outBuffer[1] = HIGH_BYTE(BOOTLOADER_SIGNATURE); //MSB
+    outBuffer[2] = LOW_BYTE(BOOTLOADER_SIGNATURE); //LSB
+    
+    //First probe in this frame
+    outBuffer[3] = first_probe;
+    
+    //14 bytes per probe: count (16 bit), minimum, maximum and total (32 bit each)
+    //All in Timer3 ticks of 8 instruction cycles. Minimum and maximum are kept in 16 bits
+    //Probes that don't exist are all zero
+    ptr = &outBuffer[4];
+    for(probe=first_probe; probe<first_probe+API_PROFILER_PROBES_PER_FRAME; ++probe)
+    {
+        if(probe>=PROFILER_NUMBER_OF_PROBES)
+        {
+            memset(ptr, 0, 14);
+            ptr += 14;
+            continue;
+        }
+        entry = system_profiler_get((profilerProbe_t) probe);
+        *ptr++ = HIGH_BYTE(entry->count);
+        *ptr++ = LOW_BYTE(entry->count);
+        *ptr++ = 0x00;
+        *ptr++ = 0x00;
+        *ptr++ = HIGH_BYTE(entry->minimum);
+        *ptr++ = LOW_BYTE(entry->minimum);
+        *ptr++ = 0x00;
+        *ptr++ = 0x00;
+        *ptr++ = HIGH_BYTE(entry->maximum);
+        *ptr++ = LOW_BYTE(entry->maximum);
+        *ptr++ = HIGH_BYTE(HIGH_WORD(entry->total));
+        *ptr++ = LOW_BYTE(HIGH_WORD(entry->total));
+        *ptr++ = HIGH_BYTE(LOW_WORD(entry->total));
+        *ptr++ = LOW_BYTE(LOW_WORD(entry->total));
+    }
 }
 
 static void _fill_buffer_get_configuration(uint8_t *outBuffer)
@@ -372,6 +596,100 @@ static void _fill_buffer_get_configuration(uint8_t *outBuffer)
     outBuffer[9] = os.communicationSettings.i2cMasterModeSlaveAddress;
 }
 
+static void _fill_buffer_get_checksum(uint8_t *outBuffer)
+{
+    uint32_t buffer_large;
+    
+    //Echo back to the host PC the command we are fulfilling in the first uint8_t
+    outBuffer[0] = DATAREQUEST_GET_CHECKSUM;
+    
+    //Bootloader signature
+    outBuffer[1] = HIGH_BYTE(BOOTLOADER_SIGNATURE); //MSB
+    outBuffer[2] = LOW_BYTE(BOOTLOADER_SIGNATURE); //LSB
+    
+    outBuffer[3] = (uint8_t) checksum_status;
+    outBuffer[4] = checksum_file_number;
+    
+    //Range
+    outBuffer[5] = HIGH_BYTE(HIGH_WORD(checksum_start));
+    outBuffer[6] = LOW_BYTE(HIGH_WORD(checksum_start));
+    outBuffer[7] = HIGH_BYTE(LOW_WORD(checksum_start));
+    outBuffer[8] = LOW_BYTE(LOW_WORD(checksum_start));
+    buffer_large = checksum_end - checksum_start;
+    outBuffer[9] = HIGH_BYTE(HIGH_WORD(buffer_large));
+    outBuffer[10] = LOW_BYTE(HIGH_WORD(buffer_large));
+    outBuffer[11] = HIGH_BYTE(LOW_WORD(buffer_large));
+    outBuffer[12] = LOW_BYTE(LOW_WORD(buffer_large));
+    
+    //Progress
+    buffer_large = checksum_position - checksum_start;
+    outBuffer[13] = HIGH_BYTE(HIGH_WORD(buffer_large));
+    outBuffer[14] = LOW_BYTE(HIGH_WORD(buffer_large));
+    outBuffer[15] = HIGH_BYTE(LOW_WORD(buffer_large));
+    outBuffer[16] = LOW_BYTE(LOW_WORD(buffer_large));
+    
+    //Checksums, only valid once done
+    outBuffer[17] = HIGH_BYTE(HIGH_WORD(checksum_crc));
+    outBuffer[18] = LOW_BYTE(HIGH_WORD(checksum_crc));
+    outBuffer[19] = HIGH_BYTE(LOW_WORD(checksum_crc));
+    outBuffer[20] = LOW_BYTE(LOW_WORD(checksum_crc));
+    outBuffer[21] = HIGH_BYTE(checksum_fletcher);
+    outBuffer[22] = LOW_BYTE(checksum_fletcher);
+}
+
+static void _fill_buffer_get_queue(uint8_t *outBuffer)
+{
+    uint8_t cntr;
+    uint8_t slot;
+    uint8_t waiting;
+    
+    //Echo back to the host PC the command we are fulfilling in the first uint8_t
+    outBuffer[0] = DATAREQUEST_GET_QUEUE;
+    
+    //Bootloader signature
+    outBuffer[1] = HIGH_BYTE(BOOTLOADER_SIGNATURE); //MSB
+    outBuffer[2] = LOW_BYTE(BOOTLOADER_SIGNATURE); //LSB
+    
+    outBuffer[3] = API_QUEUE_SIZE;
+    
+    //All jobs, oldest first. The oldest one is where the next job will go
+    waiting = 0;
+    slot = queue_next_free;
+    for(cntr=0; cntr<API_QUEUE_SIZE; ++cntr)
+    {
+        if((queue_status[slot]==QUEUE_STATUS_QUEUED) || (queue_status[slot]==QUEUE_STATUS_RUNNING))
+        {
+            ++waiting;
+        }
+        outBuffer[5+4*cntr] = queue_id[slot];
+        outBuffer[6+4*cntr] = queue_command[slot][0];
+        outBuffer[7+4*cntr] = (uint8_t) queue_status[slot];
+        outBuffer[8+4*cntr] = queue_result[slot];
+        ++slot;
+        if(slot==API_QUEUE_SIZE)
+        {
+            slot = 0;
+        }
+    }
+    outBuffer[4] = waiting;
+    
+    //Progress of the job being executed
+    if(queue_status[queue_next_run]==QUEUE_STATUS_RUNNING)
+    {
+        outBuffer[5+4*API_QUEUE_SIZE] = HIGH_BYTE(queue_step);
+        outBuffer[6+4*API_QUEUE_SIZE] = LOW_BYTE(queue_step);
+        outBuffer[7+4*API_QUEUE_SIZE] = HIGH_BYTE(queue_steps);
+        outBuffer[8+4*API_QUEUE_SIZE] = LOW_BYTE(queue_steps);
+    }
+    else
+    {
+        outBuffer[5+4*API_QUEUE_SIZE] = 0x00;
+        outBuffer[6+4*API_QUEUE_SIZE] = 0x00;
+        outBuffer[7+4*API_QUEUE_SIZE] = 0x00;
+        outBuffer[8+4*API_QUEUE_SIZE] = 0x00;
+    }
+}
+
 static void _fill_buffer_get_file_details(uint8_t *inBuffer, uint8_t *outBuffer)
 {
     uint8_t file_number = inBuffer[1];
@@ -494,6 +812,97 @@ static void _fill_buffer_read_buffer(uint8_t *inBuffer, uint8_t *outBuffer)
     fat_read_from_buffer(start, data_length, &outBuffer[6]);
 }
 
+static void _fill_buffer_read_stream_open(uint8_t *inBuffer, uint8_t *outBuffer)
+{
+    rootEntry_t root;
+    uint8_t return_value;
+    
+    //Echo command
+    outBuffer[0] = DATAREQUEST_READ_STREAM_OPEN;
+   
+    //Bootloader signature
+    outBuffer[1] = HIGH_BYTE(BOOTLOADER_SIGNATURE); //MSB
+    outBuffer[2] = LOW_BYTE(BOOTLOADER_SIGNATURE); //LSB
+    
+    //Calculate start
+    read_stream_position = inBuffer[2];
+    read_stream_position <<= 8;
+    read_stream_position |= inBuffer[3];
+    read_stream_position <<= 8;
+    read_stream_position |= inBuffer[4];
+    read_stream_position <<= 8;
+    read_stream_position |= inBuffer[5];
+    read_stream_sequence = 0;
+    
+    //Read root entry once. From now on the cursor moves forward from the first cluster
+    return_value = fat_get_file_information(inBuffer[1], &root);
+    if(return_value!=0x00)
+    {
+        //No valid file
+        read_stream_open = 0;
+        outBuffer[3] = read_stream_sequence;
+        outBuffer[4] = 0;
+        outBuffer[5] = return_value;
+        return;
+    }
+    read_stream_file_size = root.fileSize;
+    read_stream_cluster = root.firstCluster;
+    read_stream_cluster_number = 0;
+    read_stream_open = 1;
+    
+    _fill_buffer_read_stream_chunk(outBuffer, API_READ_STREAM_CHUNK_SIZE);
+}
+
+static void _fill_buffer_read_stream_next(uint8_t *outBuffer, apiDataRequest_t command, uint16_t chunk_size)
+{
+    //Echo command
+    outBuffer[0] = command;
+   
+    //Bootloader signature
+    outBuffer[1] = HIGH_BYTE(BOOTLOADER_SIGNATURE); //MSB
+    outBuffer[2] = LOW_BYTE(BOOTLOADER_SIGNATURE); //LSB
+    
+    if(!read_stream_open)
+    {
+        outBuffer[3] = read_stream_sequence;
+        outBuffer[4] = 0;
+        outBuffer[5] = 0xFE;
+        return;
+    }
+    
+    _fill_buffer_read_stream_chunk(outBuffer, chunk_size);
+}
+
+//Sequence, number of bytes, result and data of the next chunk of the read stream
+static void _fill_buffer_read_stream_chunk(uint8_t *outBuffer, uint16_t chunk_size)
+{
+    uint32_t data_length;
+    
+    outBuffer[3] = read_stream_sequence;
+    
+    //Calculate number of bytes to get. None at the end of the file
+    if(read_stream_position>=read_stream_file_size)
+    {
+        outBuffer[4] = 0;
+        outBuffer[5] = (read_stream_position==read_stream_file_size) ? 0x00 : 0xFF;
+        return;
+    }
+    data_length = read_stream_file_size - read_stream_position;
+    if(data_length>chunk_size)
+    {
+        //More will not fit into the buffer
+        data_length = chunk_size;
+    }
+    outBuffer[4] = (uint8_t) data_length;
+    
+    //Read data from file, starting from the cluster the last chunk ended in
+    outBuffer[5] = fat_read_from_file_fast(read_stream_position, data_length, &outBuffer[6], &read_stream_cluster, &read_stream_cluster_number);
+    
+    //Move on
+    read_stream_position += data_length;
+    ++read_stream_sequence;
+}
+
 
 static void _parse_command_short(uint8_t cmd)
 {
@@ -501,26 +910,26 @@ static void _parse_command_short(uint8_t cmd)
     {
         case COMMAND_REBOT:
             i2c_eeprom_writeByte(EEPROM_BOOTLOADER_BYTE_ADDRESS, 0x00); //0x00 is a neutral value
-            system_delay_ms(10); //ensure data has been written before rebooting
+            i2c_eeprom_wait_write_complete(); //ensure data has been written before rebooting
             reboot();
             break;
             
         case COMMAND_REBOT_BOOTLOADER_MODE:
             i2c_eeprom_writeByte(EEPROM_BOOTLOADER_BYTE_ADDRESS, BOOTLOADER_BYTE_FORCE_BOOTLOADER_MODE);
-            system_delay_ms(10); //ensure data has been written before rebooting
+            i2c_eeprom_wait_write_complete(); //ensure data has been written before rebooting
             reboot();
             break;
                 
         case COMMAND_REBOT_NORMAL_MODE:
             i2c_eeprom_writeByte(EEPROM_BOOTLOADER_BYTE_ADDRESS, BOOTLOADER_BYTE_FORCE_NORMAL_MODE);
-            system_delay_ms(10); //ensure data has been written before rebooting
+            i2c_eeprom_wait_write_complete(); //ensure data has been written before rebooting
             reboot();
             break;
             
         case COMMAND_JUMP_TO_MAIN_PROGRAM:
             //We can't just jump there. We need a proper reset first
             i2c_eeprom_writeByte(EEPROM_BOOTLOADER_BYTE_ADDRESS, BOOTLOADER_BYTE_FORCE_NORMAL_MODE);
-            system_delay_ms(10); //ensure data has been written before rebooting
+            i2c_eeprom_wait_write_complete(); //ensure data has been written before rebooting
             reboot();
             break;
             
@@ -528,6 +937,10 @@ static void _parse_command_short(uint8_t cmd)
             os.bootloader_mode = BOOTLOADER_MODE_SUSPENDED;
             os.display_mode = DISPLAY_MODE_BOOTLOADER_SUSPENDED;
             break;
+            
+        case COMMAND_RESET_PROFILER:
+            system_profiler_reset();
+            break;
                 
         case COMMAND_ENCODER_CCW:
             --os.encoderCount;
@@ -592,6 +1005,26 @@ static uint8_t _parse_command_long(uint8_t *data, uint8_t *out_buffer, uint8_t *
         case COMMAND_FILE_COPY:
             length = _parse_file_copy(data, out_buffer, out_idx_ptr);
             break;
+            
+        case COMMAND_BULK_WRITE_OPEN:
+            length = _parse_bulk_write_open(data, out_buffer, out_idx_ptr);
+            break;
+            
+        case COMMAND_BULK_WRITE_DATA:
+            length = _parse_bulk_write_data(data, out_buffer, out_idx_ptr);
+            break;
+            
+        case COMMAND_BULK_WRITE_COMMIT:
+            length = _parse_bulk_write_commit(data, out_buffer, out_idx_ptr);
+            break;
+            
+        case COMMAND_FILE_CHECKSUM:
+            length = _parse_file_checksum(data, out_buffer, out_idx_ptr);
+            break;
+            
+        case COMMAND_QUEUE:
+            length = _parse_queue_command(data, out_buffer, out_idx_ptr);
+            break;
 
         case COMMAND_SET_SPI_MODE:
             length = _parse_settings_spi_mode(data, out_buffer, out_idx_ptr);
@@ -620,6 +1053,10 @@ static uint8_t _parse_command_long(uint8_t *data, uint8_t *out_buffer, uint8_t *
         case COMMAND_SET_I2C_MASTER_MODE_ADDRESS:
             length = _parse_settings_i2c_masterModeSlaveAddress(data, out_buffer, out_idx_ptr);
             break; 
+          
+        case COMMAND_SET_BOOT_OPTIONS:
+            length = _parse_settings_boot_options(data, out_buffer, out_idx_ptr);
+            break; 
     }    
     
     return length;
@@ -1002,6 +1439,538 @@ static uint8_t _parse_file_copy(uint8_t *data, uint8_t *out_buffer, uint8_t *out
     return 15;
 }
 
+static uint8_t _parse_bulk_write_open(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr)
+{
+    //0x5B: Open bulk write. Parameters: uint8_t FileNumber, uint16_t FirstSector, 0xC7E1
+    
+    if((data[0]!=COMMAND_BULK_WRITE_OPEN) || (data[4]!=0xC7) || (data[5]!=0xE1))
+    {
+        return 6;
+    }
+    
+    //Save file number
+    bulk_write_file_number = data[1];
+    
+    //Calculate sector
+    bulk_write_sector = data[2];
+    bulk_write_sector <<= 8;
+    bulk_write_sector |= data[3];
+    
+    //Start with an empty sector
+    bulk_write_offset = 0;
+    bulk_write_crc = 0xFFFF;
+    bulk_write_sequence = 0;
+    bulk_write_sector_sequence = 0;
+    bulk_write_open = 1;
+    
+    //Return confirmation if desired
+    if(((*out_idx_ptr)>0) && ((*out_idx_ptr)<61))
+    {
+        out_buffer[(*out_idx_ptr)++] = COMMAND_BULK_WRITE_OPEN;
+        out_buffer[(*out_idx_ptr)++] = bulk_write_file_number;
+        out_buffer[(*out_idx_ptr)++] = HIGH_BYTE(bulk_write_sector);
+        out_buffer[(*out_idx_ptr)++] = LOW_BYTE(bulk_write_sector);
+    }
+    
+    return 6;
+}
+
+static uint8_t _parse_bulk_write_data(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr)
+{
+    //0x5C: Bulk write data. Parameters: uint8_t Sequence, uint8_t NumberOfBytes, uint16_t CRC, DATA
+    uint8_t number_of_bytes;
+    uint16_t crc;
+    apiBulkWriteResult_t result;
+    
+    if(data[0]!=COMMAND_BULK_WRITE_DATA)
+    {
+        //Can't trust the number of bytes in this case
+        return 65;
+    }
+    
+    //Get number of bytes and CRC
+    number_of_bytes = data[2];
+    crc = data[3];
+    crc <<= 8;
+    crc |= data[4];
+    
+    if(number_of_bytes>API_BULK_WRITE_MAXIMUM_DATA)
+    {
+        result = BULK_WRITE_RESULT_TOO_LONG;
+    }
+    else if(bootloader_crc(&data[5], number_of_bytes, bootloader_crc(&data[1], 2, 0xFFFF))!=crc)
+    {
+        result = BULK_WRITE_RESULT_CRC_ERROR;
+    }
+    else if(!bulk_write_open)
+    {
+        result = BULK_WRITE_RESULT_NOT_OPEN;
+    }
+    else if(data[1]!=bulk_write_sequence)
+    {
+        //Repeated or out of order. Ignore it, the host carries on with the sequence we return
+        result = BULK_WRITE_RESULT_SEQUENCE;
+    }
+    else if((bulk_write_offset+number_of_bytes)>BYTES_PER_SECTOR)
+    {
+        result = BULK_WRITE_RESULT_TOO_LONG;
+    }
+    else
+    {
+        //Append data to buffer 2
+        fat_write_to_buffer(bulk_write_offset, number_of_bytes, &data[5]);
+        bulk_write_offset += number_of_bytes;
+        bulk_write_crc = bootloader_crc(&data[5], number_of_bytes, bulk_write_crc);
+        ++bulk_write_sequence;
+        result = BULK_WRITE_RESULT_OK;
+    }
+    
+    //Return result if desired
+    if(((*out_idx_ptr)>0) && ((*out_idx_ptr)<62))
+    {
+        out_buffer[(*out_idx_ptr)++] = COMMAND_BULK_WRITE_DATA;
+        out_buffer[(*out_idx_ptr)++] = bulk_write_sequence;
+        out_buffer[(*out_idx_ptr)++] = (uint8_t) result;
+    }
+    
+    if((result==BULK_WRITE_RESULT_TOO_LONG) || (result==BULK_WRITE_RESULT_CRC_ERROR))
+    {
+        //Can't trust the number of bytes in this case
+        return 65;
+    }
+    
+    //Return actual command length
+    return number_of_bytes + 5;
+}
+
+static uint8_t _parse_bulk_write_commit(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr)
+{
+    //0x5D: Commit bulk write sector. Parameters: uint16_t Sector, uint16_t SectorCRC, 0x2A93
+    uint16_t sector;
+    uint16_t crc;
+    apiBulkWriteResult_t result;
+    
+    if((data[0]!=COMMAND_BULK_WRITE_COMMIT) || (data[5]!=0x2A) || (data[6]!=0x93))
+    {
+        return 7;
+    }
+    
+    //Calculate sector and CRC
+    sector = data[1];
+    sector <<= 8;
+    sector |= data[2];
+    crc = data[3];
+    crc <<= 8;
+    crc |= data[4];
+    
+    if(!bulk_write_open)
+    {
+        result = BULK_WRITE_RESULT_NOT_OPEN;
+    }
+    else if(sector!=bulk_write_sector)
+    {
+        //I.e. a repeated commit. The sector expected next tells the host where we are
+        result = BULK_WRITE_RESULT_SECTOR;
+    }
+    else
+    {
+        if(crc!=bulk_write_crc)
+        {
+            result = BULK_WRITE_RESULT_CRC_ERROR;
+        }
+        else if(fat_write_sector_from_buffer(bulk_write_file_number, bulk_write_sector))
+        {
+            result = BULK_WRITE_RESULT_WRITE_ERROR;
+        }
+        else
+        {
+            //Move on to the next sector
+            ++bulk_write_sector;
+            bulk_write_sector_sequence = bulk_write_sequence;
+            result = BULK_WRITE_RESULT_OK;
+        }
+        
+        //Start this sector over if it has not been written
+        bulk_write_offset = 0;
+        bulk_write_crc = 0xFFFF;
+        bulk_write_sequence = bulk_write_sector_sequence;
+    }
+    
+    //Return result if desired
+    if(((*out_idx_ptr)>0) && ((*out_idx_ptr)<59))
+    {
+        out_buffer[(*out_idx_ptr)++] = COMMAND_BULK_WRITE_COMMIT;
+        out_buffer[(*out_idx_ptr)++] = HIGH_BYTE(bulk_write_sector);
+        out_buffer[(*out_idx_ptr)++] = LOW_BYTE(bulk_write_sector);
+        out_buffer[(*out_idx_ptr)++] = (uint8_t) result;
+        out_buffer[(*out_idx_ptr)++] = bulk_write_sequence;
+    }
+    
+    return 7;
+}
+
+static uint8_t _parse_file_checksum(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr)
+{
+    //0x5E: Calculate file checksum. Parameters: uint8_t FileNumber, uint32_t StartByte, uint32_t NumberOfBytes, 0x91C3
+    rootEntry_t root;
+    uint32_t length;
+    
+    if((data[0]!=COMMAND_FILE_CHECKSUM) || (data[10]!=0x91) || (data[11]!=0xC3))
+    {
+        return 12;
+    }
+    
+    //Save file number
+    checksum_file_number = data[1];
+    
+    //Calculate start byte and length
+    checksum_start = data[2];
+    checksum_start <<= 8;
+    checksum_start |= data[3];
+    checksum_start <<= 8;
+    checksum_start |= data[4];
+    checksum_start <<= 8;
+    checksum_start |= data[5];
+    length = data[6];
+    length <<= 8;
+    length |= data[7];
+    length <<= 8;
+    length |= data[8];
+    length <<= 8;
+    length |= data[9];
+    
+    //Start from nothing
+    checksum_position = checksum_start;
+    checksum_end = checksum_start;
+    checksum_crc = 0xFFFFFFFF;
+    checksum_fletcher = 0x0000;
+    
+    if(fat_get_file_information(checksum_file_number, &root))
+    {
+        checksum_status = CHECKSUM_STATUS_NO_FILE;
+    }
+    else if(checksum_start>root.fileSize)
+    {
+        checksum_status = CHECKSUM_STATUS_RANGE_ERROR;
+    }
+    else
+    {
+        //Do not read past file end
+        if(length>(root.fileSize-checksum_start))
+        {
+            length = root.fileSize - checksum_start;
+        }
+        checksum_end = checksum_start + length;
+        checksum_cluster = root.firstCluster;
+        checksum_cluster_number = 0;
+        
+        //The actual work is done by api_run()
+        checksum_status = CHECKSUM_STATUS_BUSY;
+    }
+    
+    //Return confirmation if desired
+    if(((*out_idx_ptr)>0) && ((*out_idx_ptr)<61))
+    {
+        out_buffer[(*out_idx_ptr)++] = COMMAND_FILE_CHECKSUM;
+        out_buffer[(*out_idx_ptr)++] = checksum_file_number;
+        out_buffer[(*out_idx_ptr)++] = (uint8_t) checksum_status;
+    }
+    
+    return 12;
+}
+
+//Adds data to CRC-32 and Fletcher-16 of the file checksum
+static void _checksum_update(uint8_t *data, uint8_t length)
+{
+    uint8_t cntr;
+    uint8_t sum1;
+    uint8_t sum2;
+    uint16_t sum;
+    
+    sum1 = LOW_BYTE(checksum_fletcher);
+    sum2 = HIGH_BYTE(checksum_fletcher);
+    
+    for(cntr=0; cntr<length; ++cntr)
+    {
+        checksum_crc = (checksum_crc>>4) ^ crc32_table[(LOW_BYTE(checksum_crc) ^ data[cntr]) & 0x0F];
+        checksum_crc = (checksum_crc>>4) ^ crc32_table[(LOW_BYTE(checksum_crc) ^ (data[cntr]>>4)) & 0x0F];
+        
+        //Sums modulo 255
+        sum = sum1 + data[cntr];
+        if(sum>=255)
+        {
+            sum -= 255;
+        }
+        sum1 = (uint8_t) sum;
+        sum = sum2 + sum1;
+        if(sum>=255)
+        {
+            sum -= 255;
+        }
+        sum2 = (uint8_t) sum;
+    }
+    
+    checksum_fletcher = sum2;
+    checksum_fletcher <<= 8;
+    checksum_fletcher |= sum1;
+}
+
+//Reads the next few bytes of the file checksum range. Called by api_run()
+static void _checksum_run(void)
+{
+    uint8_t data[API_CHECKSUM_CHUNK_SIZE];
+    uint8_t length;
+    uint8_t cntr;
+    
+    if(checksum_status!=CHECKSUM_STATUS_BUSY)
+    {
+        return;
+    }
+    
+    //Calculate file checksum a few bytes at a time
+    for(cntr=0; cntr<(API_CHECKSUM_BYTES_PER_CALL/API_CHECKSUM_CHUNK_SIZE); ++cntr)
+    {
+        if(checksum_position>=checksum_end)
+        {
+            //Final XOR as zlib's crc32
+            checksum_crc ^= 0xFFFFFFFF;
+            checksum_status = CHECKSUM_STATUS_DONE;
+            return;
+        }
+        
+        length = API_CHECKSUM_CHUNK_SIZE;
+        if((checksum_end-checksum_position)<length)
+        {
+            length = (uint8_t) (checksum_end-checksum_position);
+        }
+        
+        if(fat_read_from_file_fast(checksum_position, length, data, &checksum_cluster, &checksum_cluster_number))
+        {
+            checksum_status = CHECKSUM_STATUS_READ_ERROR;
+            return;
+        }
+        _checksum_update(data, length);
+        checksum_position += length;
+    }
+}
+
+static uint8_t _parse_queue_command(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr)
+{
+    //0x5F: Queue command. Parameters: uint8_t JobId, 0xE5A7, COMMAND
+    uint8_t job_id;
+    uint8_t length;
+    uint8_t cntr;
+    apiQueueStatus_t status;
+    
+    if((data[0]!=COMMAND_QUEUE) || (data[2]!=0xE5) || (data[3]!=0xA7))
+    {
+        //Length of the queued command unknown, stop parsing
+        return 65;
+    }
+    
+    //Save job id
+    job_id = data[1];
+    
+    //Only commands of known length without data can be queued
+    length = _queue_command_length(data[4]);
+    
+    if(length==0)
+    {
+        status = QUEUE_STATUS_INVALID;
+    }
+    else
+    {
+        //Check if we've seen this job before. The host may have missed the response
+        status = QUEUE_STATUS_UNKNOWN;
+        for(cntr=0; cntr<API_QUEUE_SIZE; ++cntr)
+        {
+            if((queue_status[cntr]!=QUEUE_STATUS_UNKNOWN) && (queue_id[cntr]==job_id))
+            {
+                status = queue_status[cntr];
+            }
+        }
+        
+        if(status==QUEUE_STATUS_UNKNOWN)
+        {
+            if((queue_status[queue_next_free]==QUEUE_STATUS_QUEUED) || (queue_status[queue_next_free]==QUEUE_STATUS_RUNNING))
+            {
+                //Oldest slot still waiting to be executed
+                status = QUEUE_STATUS_FULL;
+            }
+            else
+            {
+                //Add job. The actual work is done by api_run()
+                queue_id[queue_next_free] = job_id;
+                memcpy(queue_command[queue_next_free], &data[4], length);
+                queue_result[queue_next_free] = 0xFF;
+                queue_status[queue_next_free] = QUEUE_STATUS_QUEUED;
+                ++queue_next_free;
+                if(queue_next_free==API_QUEUE_SIZE)
+                {
+                    queue_next_free = 0;
+                }
+                status = QUEUE_STATUS_QUEUED;
+            }
+        }
+    }
+    
+    //Return confirmation if desired
+    if(((*out_idx_ptr)>0) && ((*out_idx_ptr)<61))
+    {
+        out_buffer[(*out_idx_ptr)++] = COMMAND_QUEUE;
+        out_buffer[(*out_idx_ptr)++] = job_id;
+        out_buffer[(*out_idx_ptr)++] = (uint8_t) status;
+    }
+    
+    if(length==0)
+    {
+        //Length of the queued command unknown, stop parsing
+        return 65;
+    }
+    
+    return 4 + length;
+}
+
+//Length of a command that can be queued, 0 if the command can't be queued
+static uint8_t _queue_command_length(uint8_t command)
+{
+    uint8_t length = 0;
+    
+    switch(command)
+    {
+        case COMMAND_FILE_RESIZE:
+            length = 8;
+            break;
+            
+        case COMMAND_FILE_DELETE:
+            length = 4;
+            break;
+            
+        case COMMAND_FILE_CREATE:
+            length = 18;
+            break;
+            
+        case COMMAND_FILE_RENAME:
+            length = 15;
+            break;
+            
+        case COMMAND_FORMAT_DRIVE:
+            length = 3;
+            break;
+            
+        case COMMAND_SECTOR_TO_BUFFER:
+            length = 6;
+            break;
+            
+        case COMMAND_BUFFER_TO_SECTOR:
+            length = 6;
+            break;
+            
+        case COMMAND_FILE_COPY:
+            length = 15;
+            break;
+    }
+    
+    return length;
+}
+
+//Executes the oldest queued command. Called by api_run()
+//Format and copy write one sector per call, everything else is done at once
+static void _queue_run(void)
+{
+    //Room for the longest confirmation a queued command returns
+    uint8_t response[8];
+    uint8_t response_idx;
+    uint8_t *command;
+    uint8_t return_value;
+    
+    command = queue_command[queue_next_run];
+    
+    if(queue_status[queue_next_run]==QUEUE_STATUS_QUEUED)
+    {
+        if(_queue_start())
+        {
+            //Steps are taken from the next call on
+            return;
+        }
+        
+        //Start at 1 so that the command returns its confirmation
+        response_idx = 1;
+        _parse_command_long(command, response, &response_idx);
+        
+        //Last byte of the confirmation is the result
+        if(response_idx>1)
+        {
+            queue_result[queue_next_run] = response[response_idx-1];
+        }
+    }
+    else if(queue_status[queue_next_run]==QUEUE_STATUS_RUNNING)
+    {
+        if(queue_step<queue_steps)
+        {
+            if(command[0]==COMMAND_FORMAT_DRIVE)
+            {
+                return_value = fat_format_step(queue_step);
+            }
+            else
+            {
+                return_value = fat_copy_file_sector(queue_copy_file_number, queue_copy_new_file_number, queue_step);
+            }
+            ++queue_step;
+            if((return_value==0x00) && (queue_step<queue_steps))
+            {
+                //More to do
+                return;
+            }
+            queue_result[queue_next_run] = return_value;
+        }
+        //Otherwise there was nothing to copy. The result is that of fat_copy_file_open()
+    }
+    else
+    {
+        return;
+    }
+    
+    queue_status[queue_next_run] = QUEUE_STATUS_DONE;
+    
+    ++queue_next_run;
+    if(queue_next_run==API_QUEUE_SIZE)
+    {
+        queue_next_run = 0;
+    }
+}
+
+//Starts a queued format or copy job. Returns 1 if the job now runs step by step
+static uint8_t _queue_start(void)
+{
+    uint8_t *command;
+    
+    command = queue_command[queue_next_run];
+    queue_step = 0;
+    
+    if((command[0]==COMMAND_FORMAT_DRIVE) && (command[1]==0xDA) && (command[2]==0x22))
+    {
+        queue_steps = FAT_FORMAT_NUMBER_OF_STEPS;
+    }
+    else if((command[0]==COMMAND_FILE_COPY) && (command[13]==0x54) && (command[14]==0xD9))
+    {
+        queue_copy_file_number = command[1];
+        queue_result[queue_next_run] = fat_copy_file_open(queue_copy_file_number, (char *) &command[2], (char *) &command[10], &queue_copy_new_file_number, &queue_steps);
+        if(queue_result[queue_next_run]!=0x00)
+        {
+            //Copy could not be started. Done on the next call
+            queue_steps = 0;
+        }
+    }
+    else
+    {
+        return 0;
+    }
+    
+    queue_status[queue_next_run] = QUEUE_STATUS_RUNNING;
+    return 1;
+}
+
 static uint8_t _parse_settings_spi_mode(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr)
 {
     //0x70: Change SPI mode. Parameters: uint8_t NewMode, 0x88E2
@@ -1157,3 +2126,24 @@ static uint8_t _parse_settings_i2c_masterModeSlaveAddress(uint8_t *data, uint8_t
     return 4;
 }
 
+static uint8_t _parse_settings_boot_options(uint8_t *data, uint8_t *out_buffer, uint8_t *out_idx_ptr)
+{
+    //0x77: Change boot options. Parameters: uint8_t NewBootOptions, 0x3F1C
+    
+    if((data[0]!=COMMAND_SET_BOOT_OPTIONS) || (data[2]!=0x3F) || (data[3]!=0x1C))
+    {
+        return 4;
+    }
+    
+    //Save new setting in the boot control record
+    i2c_eeprom_writeByte(EEPROM_BOOT_OPTIONS_ADDRESS, data[1]);
+    
+    //Return confirmation if desired
+    if(((*out_idx_ptr)>0) && ((*out_idx_ptr)<63))
+    {
+        out_buffer[(*out_idx_ptr)++] = COMMAND_SET_BOOT_OPTIONS;
+        out_buffer[(*out_idx_ptr)++] = data[1];
+    }
+    
+    return 4;
+}
@@ -17,7 +17,10 @@
  *  0x11: First 2 lines of display content
  *  0x12: Last 2 lines of display content
  *  0x13: Bootloader details
+ *  0x14: Profiler (execution time statistics)
  *  0x15: External communication configuration
+ *  0x16: File checksum status and result
+ *  0x17: Command queue status
  *  0x20: Echo (i.e. send back) all data received. Used to test connection.
  * 
  * Extended data requests. Only parameters may follow
@@ -25,6 +28,31 @@
  *  0x81: Find file. Parameter: char[8] FileName, char[3] FileExtention
  *  0x82: Read file. Parameters: uint8_t FileNumber, uint32_t StartByte
  *  0x83: Read buffer. Parameters: uint16_t StartByte
+ *  0x84: Open read stream and get the first chunk. Parameters: uint8_t FileNumber, uint32_t StartByte
+ *  0x85: Get the next chunk of the read stream. Parameters: none
+ *  0x86: Get the next chunk of the read stream as a burst. Parameters: none
+ *  0x87: Profiler entries. Parameter: uint8_t FirstProbe
+ * 
+ * Profiler
+ *  0x14 returns probes 0 to 3, 0x87 the 4 probes from FirstProbe on:
+ *  uint8_t FirstProbe, then for every probe uint16_t Count, uint32_t Minimum,
+ *  uint32_t Maximum, uint32_t Total. Times are in Timer3 ticks of 8
+ *  instruction cycles. Minimum and maximum saturate at 0xFFFF (43.7ms).
+ *  Probes beyond the last one (see os.h) are all zero.
+ * 
+ * Read stream
+ *  Every response to 0x84 or 0x85 carries the next 58 bytes of the file:
+ *  uint8_t Sequence, uint8_t NumberOfBytes, uint8_t Result, DATA
+ *  The sequence number starts at 0 with 0x84 and tells the host if a chunk got
+ *  lost. If so, open the stream again at the position of the missing chunk.
+ *  The file is read on from where the last chunk ended, without walking the
+ *  FAT from the first cluster every time.
+ *  Via external SPI, the response to 0x86 takes up its own frame and all frames
+ *  that follow it in the same transfer. The chunk is read from flash straight
+ *  into the transmit buffer in one go and the header is sent only once, i.e.
+ *  with 2 frames of 64 bytes, every transfer carries 122 bytes of the file.
+ *  The frames after the one with 0x86 are ignored. Via USB, 0x86 is the same
+ *  as 0x85.
  * 
  * Single byte commands
  *  0x20: Reboot
@@ -32,6 +60,7 @@
  *  0x22: Reboot in normal mode
  *  0x23: Jump to main program
  *  0x24: Suspend bootloader
+ *  0x25: Reset profiler
  *  0x3C: Turn encoder CCW
  *  0x3D: Turn encoder CW
  *  0x3E: Press push button
@@ -49,6 +78,13 @@
  *  0x58: Write buffer to file sector. Parameters: uint8_t file_number, uint16_t sector, 0x6A6D
  *  0x59: Modify buffer. Parameters: uint16_t StartByte, uint8_t NumerOfBytes, 0xE230, DATA
  *  0x5A: Copy file. PParameters: uint8_t FileNumber, char[8] NewFileName, char[3] NewFileExtention, 0x54D9
+ *  0x5B: Open bulk write. Parameters: uint8_t FileNumber, uint16_t FirstSector, 0xC7E1
+ *  0x5C: Bulk write data. Parameters: uint8_t Sequence, uint8_t NumberOfBytes, uint16_t CRC, DATA
+ *        The CRC covers Sequence, NumberOfBytes and DATA and replaces the constant
+ *  0x5D: Commit bulk write sector. Parameters: uint16_t Sector, uint16_t SectorCRC, 0x2A93
+ *  0x5E: Calculate file checksum. Parameters: uint8_t FileNumber, uint32_t StartByte, uint32_t NumberOfBytes, 0x91C3
+ *  0x5F: Queue command. Parameters: uint8_t JobId, 0xE5A7, COMMAND
+ *        COMMAND is one of 0x50-0x53, 0x56-0x58 or 0x5A including its parameters
  *  0x70: Change SPI mode. Parameters: uint8_t NewMode, 0x88E2
  *  0x71: Change SPI frequency. Parameters: uint8_t NewFrequency, 0xAEA8
  *  0x72: Change SPI polarity. Parameters: uint8_t NewPolarity, 0x0DBB
@@ -56,6 +92,53 @@
  *  0x74: Change I2C frequency. Parameters: uint8_t NewFrequency, 0x4E03
  *  0x75: Change I2C slave mode slave address. Parameters: uint8_t NewAddress, 0x88E2
  *  0x76: Change I2C master mode slave address. Parameters: uint8_t NewAddress, 0x540D
+ *  0x77: Change boot options. Parameters: uint8_t NewBootOptions, 0x3F1C
+ * 
+ * Bulk write
+ *  Uploads a file a sector (512 bytes) at a time without reading anything back.
+ *  0x5B selects the file and the first sector. Data frames (0x5C) fill the
+ *  buffer in order, each one carrying the next sequence number. Frames that
+ *  are out of sequence or fail their CRC are ignored. 0x5D checks the CRC over
+ *  all data received for that sector and writes the buffer to the sector.
+ *  If the CRC does not match, the sector starts over with the sequence number
+ *  returned. Responses (if requested with data request 0x00):
+ *  0x5C: Sequence expected next, apiBulkWriteResult_t
+ *  0x5D: Sector expected next, apiBulkWriteResult_t, Sequence expected next
+ * 
+ * File checksum
+ *  0x5E starts calculating a CRC-32 (as zlib's crc32) and a Fletcher-16 sum
+ *  over a range of a file. The range ends at the end of the file at the latest.
+ *  The file is read a few bytes at a time in the main loop, so poll 0x16 until
+ *  the status is no longer busy:
+ *  apiChecksumStatus_t, uint8_t FileNumber, uint32_t StartByte,
+ *  uint32_t NumberOfBytes, uint32_t BytesDone, uint32_t CRC32, uint16_t Fletcher16
+ * 
+ * Vendor specific bulk interface (USB interface 2, endpoint 3)
+ *  Only built with USB_VENDOR_INTERFACE_AVAILABLE (usb_config.h), it is off by default.
+ *  Carries the same frames as HID and SPI. A message is one bulk transfer:
+ *  Any number of 64 byte packets of data, written to the buffer from byte 0
+ *  on, followed by a frame. A frame of at most 63 bytes ends the transfer, a
+ *  frame of 64 bytes must be followed by a zero length packet. The
+ *  response is one 64 byte packet. 512 bytes of data followed by command 0x58
+ *  write a complete sector with a single transfer. A message interrupted for
+ *  more than 256ms is dropped.
+ * 
+ * Command queue
+ *  Commands that take long (copy, format, sector writes...) can be queued with
+ *  0x5F instead of being executed while the host waits. api_run() executes one
+ *  queued command per main loop pass, in the order received. Format and copy
+ *  jobs write one sector per pass instead and are RUNNING until done. The
+ *  drive must not be used by other commands meanwhile. The host picks
+ *  the JobId and must not reuse it while the job is still listed by 0x17.
+ *  Queuing the same JobId again only returns its status, so a frame can be
+ *  repeated safely. Responses (if requested with data request 0x00):
+ *  0x5F: JobId, apiQueueStatus_t
+ *  0x17 lists all jobs, oldest first: uint8_t QueueSize, uint8_t JobsWaiting,
+ *  then for every job uint8_t JobId, uint8_t Command, apiQueueStatus_t, uint8_t Result
+ *  followed by uint16_t StepsDone, uint16_t NumberOfSteps of the RUNNING job
+ *  (zero if there is none). JobsWaiting includes the RUNNING job.
+ *  Result is the last byte the command would have returned on its own
+ *  (usually its return value) or 0xFF if the command was not recognized.
  *  
  ******************************************************************************/
 
@@ -70,12 +153,19 @@ typedef enum
     DATAREQUEST_GET_DISPLAY_1 = 0x11,
     DATAREQUEST_GET_DISPLAY_2 = 0x12,
     DATAREQUEST_GET_BOOTLOADER_DETAILS = 0x13,
+    DATAREQUEST_GET_PROFILER = 0x14,
     DATAREQUEST_GET_CONFIGURATION = 0x15,
+    DATAREQUEST_GET_CHECKSUM = 0x16,
+    DATAREQUEST_GET_QUEUE = 0x17,
     DATAREQUEST_GET_ECHO = 0x20,
     DATAREQUEST_GET_FILE_DETAILS = 0x80,
     DATAREQUEST_FIND_FILE = 0x81,
     DATAREQUEST_READ_FILE = 0x82,
-    DATAREQUEST_READ_BUFFER = 0x83
+    DATAREQUEST_READ_BUFFER = 0x83,
+    DATAREQUEST_READ_STREAM_OPEN = 0x84,
+    DATAREQUEST_READ_STREAM_NEXT = 0x85,
+    DATAREQUEST_READ_STREAM_BURST = 0x86,
+    DATAREQUEST_GET_PROFILER_ENTRIES = 0x87
 } apiDataRequest_t;
 
 typedef enum
@@ -85,6 +175,7 @@ typedef enum
     COMMAND_REBOT_NORMAL_MODE = 0x22,
     COMMAND_JUMP_TO_MAIN_PROGRAM = 0x23,
     COMMAND_SUSPEND_BOOTLOADER = 0x24,
+    COMMAND_RESET_PROFILER = 0x25,
     COMMAND_ENCODER_CCW = 0x3C,
     COMMAND_ENCODER_CW = 0x3D,
     COMMAND_ENCODER_PUSH = 0x3E,
@@ -100,22 +191,61 @@ typedef enum
     COMMAND_BUFFER_TO_SECTOR = 0x58,
     COMMAND_WRITE_BUFFER = 0x59,
     COMMAND_FILE_COPY = 0x5A,    
+    COMMAND_BULK_WRITE_OPEN = 0x5B,
+    COMMAND_BULK_WRITE_DATA = 0x5C,
+    COMMAND_BULK_WRITE_COMMIT = 0x5D,
+    COMMAND_FILE_CHECKSUM = 0x5E,
+    COMMAND_QUEUE = 0x5F,
     COMMAND_SET_SPI_MODE = 0x70,
     COMMAND_SET_SPI_FREQUENCY = 0x71,
     COMMAND_SET_SPI_POLARITY = 0x72,
     COMMAND_SET_I2C_MODE = 0x73,
     COMMAND_SET_I2C_FREQUENCY = 0x74,
     COMMAND_SET_I2C_SLAVE_MODE_ADDRESS = 0x75,
-    COMMAND_SET_I2C_MASTER_MODE_ADDRESS = 0x76       
+    COMMAND_SET_I2C_MASTER_MODE_ADDRESS = 0x76,
+    COMMAND_SET_BOOT_OPTIONS = 0x77
 } apiCommand_t;
 
+typedef enum
+{
+    BULK_WRITE_RESULT_OK = 0x00,
+    BULK_WRITE_RESULT_SEQUENCE = 0x01,
+    BULK_WRITE_RESULT_CRC_ERROR = 0x02,
+    BULK_WRITE_RESULT_NOT_OPEN = 0x03,
+    BULK_WRITE_RESULT_TOO_LONG = 0x04,
+    BULK_WRITE_RESULT_SECTOR = 0x05,
+    BULK_WRITE_RESULT_WRITE_ERROR = 0x06
+} apiBulkWriteResult_t;
+
+typedef enum
+{
+    CHECKSUM_STATUS_IDLE = 0x00,
+    CHECKSUM_STATUS_BUSY = 0x01,
+    CHECKSUM_STATUS_DONE = 0x02,
+    CHECKSUM_STATUS_NO_FILE = 0x80,
+    CHECKSUM_STATUS_RANGE_ERROR = 0x81,
+    CHECKSUM_STATUS_READ_ERROR = 0x82
+} apiChecksumStatus_t;
+
+typedef enum
+{
+    QUEUE_STATUS_UNKNOWN = 0x00,
+    QUEUE_STATUS_QUEUED = 0x01,
+    QUEUE_STATUS_DONE = 0x02,
+    QUEUE_STATUS_RUNNING = 0x03,
+    QUEUE_STATUS_FULL = 0x80,
+    QUEUE_STATUS_INVALID = 0x81
+} apiQueueStatus_t;
+
 
 /******************************************************************************
  * Function prototypes
  ******************************************************************************/
 
 void api_prepare(uint8_t *inBuffer, uint8_t *outBuffer);
+uint8_t api_prepare_frames(uint8_t *inBuffer, uint8_t *outBuffer, uint8_t frames);
 void api_parse(uint8_t *inBuffer, uint8_t receivedDataLength, uint8_t *outBuffer);
+void api_run(void);
 
 
 #endif	/* API_H */
@@ -23,13 +23,38 @@ please contact mla_licensing@microchip.com
 #include <string.h>
 #include "system.h"
 #include "api.h"
+#include "fat16.h"
+#include "os.h"
 
 /** VARIABLES ******************************************************/
-unsigned char ReceivedDataBuffer[64];
-unsigned char ToSendDataBuffer[64];
+//One buffer per ping-pong buffer descriptor and direction. With both OUT
+//buffers armed, the host can send the next report while we process one.
+//Reports complete in the order they have been armed, even buffer first.
+unsigned char ReceivedDataBuffer[2][64];
+unsigned char ToSendDataBuffer[2][64];
 
-volatile USB_HANDLE USBOutHandle;    
-volatile USB_HANDLE USBInHandle;
+volatile USB_HANDLE USBOutHandle[2];    
+volatile USB_HANDLE USBInHandle[2];
+
+//Buffers to be used next
+uint8_t USBOutIndex;
+uint8_t USBInIndex;
+
+#ifdef USB_VENDOR_INTERFACE_AVAILABLE
+//Vendor specific bulk interface. See APP_DeviceVendorTasks()
+//Full packets are data and frames are shorter, so one OUT buffer will do
+unsigned char VendorReceivedDataBuffer[VENDOR_EP_SIZE];
+unsigned char VendorToSendDataBuffer[VENDOR_EP_SIZE];
+
+volatile USB_HANDLE VendorOutHandle;
+volatile USB_HANDLE VendorInHandle;
+
+//Number of data bytes received with the current message
+uint16_t VendorDataLength;
+
+//Timeslot of the last packet received
+uint8_t VendorLastTimeSlot;
+#endif
 
 /*********************************************************************
 * Function: void APP_DeviceCustomHIDInitialize(void);
@@ -45,15 +70,19 @@ volatile USB_HANDLE USBInHandle;
 ********************************************************************/
 void APP_DeviceCustomHIDInitialize()
 {
-    //initialize the variable holding the handle for the last
-    // transmission
-    USBInHandle = 0;
+    //initialize the variables holding the handles for the last
+    // transmissions
+    USBInHandle[0] = 0;
+    USBInHandle[1] = 0;
+    USBOutIndex = 0;
+    USBInIndex = 0;
 
     //enable the HID endpoint
     USBEnableEndpoint(CUSTOM_DEVICE_HID_EP, USB_IN_ENABLED|USB_OUT_ENABLED|USB_HANDSHAKE_ENABLED|USB_DISALLOW_SETUP);
 
-    //Re-arm the OUT endpoint for the next packet
-    USBOutHandle = (volatile USB_HANDLE)HIDRxPacket(CUSTOM_DEVICE_HID_EP,(uint8_t*)&ReceivedDataBuffer,64);
+    //Arm both OUT ping-pong buffers for the next packets
+    USBOutHandle[0] = (volatile USB_HANDLE)HIDRxPacket(CUSTOM_DEVICE_HID_EP,(uint8_t*)&ReceivedDataBuffer[0][0],64);
+    USBOutHandle[1] = (volatile USB_HANDLE)HIDRxPacket(CUSTOM_DEVICE_HID_EP,(uint8_t*)&ReceivedDataBuffer[1][0],64);
 }
 
 /*********************************************************************
@@ -72,7 +101,7 @@ void APP_DeviceCustomHIDInitialize()
 ********************************************************************/
 void APP_DeviceCustomHIDTasks()
 {   
-    uint8_t idx;
+    uint8_t cntr;
     
     /* If the USB device isn't configured yet, we can't really do anything
      * else since we don't have a host to talk to.  So jump back to the
@@ -91,26 +120,155 @@ void APP_DeviceCustomHIDTasks()
         return;
     }
     
-    //Check if we have received an OUT data packet from the host
-    if(HIDRxHandleBusy(USBOutHandle) == false)
-    {   
-        //We just received a packet of data from the USB host.
-        //Let the API handle it 
+    //Handle up to one packet per ping-pong buffer
+    for(cntr=0; cntr<2; ++cntr)
+    {
+        //Check if we have received an OUT data packet from the host
+        if(HIDRxHandleBusy(USBOutHandle[USBOutIndex]))
+        {
+            return;
+        }
         
-        //Prepare the data to send next if the buffer is not currently in use
-        if(!HIDTxHandleBusy(USBInHandle))
+        //Every packet gets a response. If both IN buffers are still waiting
+        //for the host, leave the packet where it is. Once both OUT buffers
+        //are full, the host is NAKed until we catch up.
+        if(HIDTxHandleBusy(USBInHandle[USBInIndex]))
         {
-            //Prepare the data
-            api_prepare((uint8_t*) ReceivedDataBuffer, (uint8_t*) ToSendDataBuffer);
-            //Prepare the USB module to send the data packet to the host
-            USBInHandle = HIDTxPacket(CUSTOM_DEVICE_HID_EP, (uint8_t*)&ToSendDataBuffer[0], 64);
+            return;
         }
         
+        //We just received a packet of data from the USB host.
+        //Let the API handle it 
+        api_prepare(&ReceivedDataBuffer[USBOutIndex][0], &ToSendDataBuffer[USBInIndex][0]);
+        
         //Perform any other tasks the host may want us to do
-        api_parse(ReceivedDataBuffer, 64, ToSendDataBuffer);
+        //This may add to the response so do it before sending it
+        api_parse(&ReceivedDataBuffer[USBOutIndex][0], 64, &ToSendDataBuffer[USBInIndex][0]);
+        
+        //Prepare the USB module to send the data packet to the host
+        USBInHandle[USBInIndex] = HIDTxPacket(CUSTOM_DEVICE_HID_EP, (uint8_t*)&ToSendDataBuffer[USBInIndex][0], 64);
+
+        //Re-arm this OUT buffer, so we can receive the packet after the next one
+        USBOutHandle[USBOutIndex] = HIDRxPacket(CUSTOM_DEVICE_HID_EP, (uint8_t*)&ReceivedDataBuffer[USBOutIndex][0], 64);
+        
+        //Continue with the other ping-pong buffers
+        USBOutIndex ^= 1;
+        USBInIndex ^= 1;
+    }
+}
+
+#ifdef USB_VENDOR_INTERFACE_AVAILABLE
+/*********************************************************************
+* Function: void APP_DeviceVendorInitialize(void);
+*
+* Overview: Initializes the vendor specific bulk interface
+*
+* PreCondition: None
+*
+* Input: None
+*
+* Output: None
+*
+********************************************************************/
+void APP_DeviceVendorInitialize()
+{
+    //Called again after every bus reset. Any message in progress is dropped
+    VendorInHandle = 0;
+    VendorDataLength = 0;
+
+    //enable the vendor endpoint
+    USBEnableEndpoint(VENDOR_DATA_EP, USB_IN_ENABLED|USB_OUT_ENABLED|USB_HANDSHAKE_ENABLED|USB_DISALLOW_SETUP);
+
+    //Arm the OUT endpoint for the first packet
+    VendorOutHandle = (volatile USB_HANDLE)USBRxOnePacket(VENDOR_DATA_EP,(uint8_t*)&VendorReceivedDataBuffer[0],VENDOR_EP_SIZE);
+}
+
+/*********************************************************************
+* Function: void APP_DeviceVendorTasks(void);
+*
+* Overview: Handles API messages received via the vendor specific
+*   bulk interface. A message is one bulk transfer:
+*   Any number of full packets (64 bytes) of data, followed by an API
+*   frame of at most 63 bytes. Being a short packet, the frame ends the
+*   transfer. A zero length packet ends a transfer of data only, which
+*   gets no response.
+*   The data is written to the buffer (as with command 0x59), starting
+*   at byte 0. Anything beyond the buffer's 512 bytes is ignored.
+*   The API frame is then handled exactly as a HID report and its
+*   response is sent back as one 64 byte packet. So a frame with
+*   command 0x58 writes a complete sector with a single transfer.
+*   A message the host abandons halfway is dropped after
+*   VENDOR_MESSAGE_TIMEOUT timeslots without a packet, or by a bus reset.
+*
+* PreCondition: APP_DeviceVendorInitialize() has been called
+*
+* Input: None
+*
+* Output: None
+*
+********************************************************************/
+void APP_DeviceVendorTasks()
+{
+    uint8_t length;
+    
+    if( USBGetDeviceState() < CONFIGURED_STATE )
+    {
+        return;
+    }
 
-        //Re-arm the OUT endpoint, so we can receive the next OUT data packet 
-        //that the host may try to send us.
-        USBOutHandle = HIDRxPacket(CUSTOM_DEVICE_HID_EP, (uint8_t*)&ReceivedDataBuffer, 64);
+    if( USBIsDeviceSuspended()== true )
+    {
+        return;
+    }
+    
+    //Check if we have received an OUT data packet from the host
+    if(USBHandleBusy(VendorOutHandle))
+    {
+        //Drop a message the host has given up on, so the next one starts at byte 0
+        //os.timeSlot wraps after 2s, but we get here far more often than that
+        if((VendorDataLength>0) && ((uint8_t) (os.timeSlot-VendorLastTimeSlot)>VENDOR_MESSAGE_TIMEOUT))
+        {
+            VendorDataLength = 0;
+        }
+        return;
+    }
+    length = (uint8_t) USBHandleGetLength(VendorOutHandle);
+    
+    if(length==VENDOR_EP_SIZE)
+    {
+        //Data. Write it to the buffer
+        if(VendorDataLength<512)
+        {
+            fat_write_to_buffer(VendorDataLength, VENDOR_EP_SIZE, (uint8_t*) VendorReceivedDataBuffer);
+            VendorDataLength += VENDOR_EP_SIZE;
+        }
     }
+    else
+    {
+        //API frame. Wait until the last response has been sent
+        //The host is NAKed in the meantime
+        if(USBHandleBusy(VendorInHandle))
+        {
+            return;
+        }
+        
+        //Let the API handle it, just like a HID report
+        //A zero length packet carries no frame and gets no response
+        if(length>0)
+        {
+            //The bytes the host left out are zeros, not what the last data packet left there
+            memset(&VendorReceivedDataBuffer[length], 0, VENDOR_EP_SIZE-length);
+            api_prepare((uint8_t*) VendorReceivedDataBuffer, (uint8_t*) VendorToSendDataBuffer);
+            api_parse((uint8_t*) VendorReceivedDataBuffer, length, (uint8_t*) VendorToSendDataBuffer);
+            VendorInHandle = USBTxOnePacket(VENDOR_DATA_EP, (uint8_t*)&VendorToSendDataBuffer[0], VENDOR_EP_SIZE);
+        }
+        
+        //Next message
+        VendorDataLength = 0;
+    }
+    VendorLastTimeSlot = os.timeSlot;
+    
+    //Re-arm the OUT endpoint for the next packet
+    VendorOutHandle = USBRxOnePacket(VENDOR_DATA_EP, (uint8_t*)&VendorReceivedDataBuffer[0], VENDOR_EP_SIZE);
 }
+#endif /* USB_VENDOR_INTERFACE_AVAILABLE */
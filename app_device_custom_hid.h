@@ -62,3 +62,36 @@ void APP_DeviceCustomHIDStart();
 *
 ********************************************************************/
 void APP_DeviceCustomHIDTasks();
+
+#ifdef USB_VENDOR_INTERFACE_AVAILABLE
+/*********************************************************************
+* Function: void APP_DeviceVendorInitialize(void);
+*
+* Overview: Initializes the vendor specific bulk interface that carries
+*   the same API as the custom HID interface
+*
+* PreCondition: None
+*
+* Input: None
+*
+* Output: None
+*
+********************************************************************/
+void APP_DeviceVendorInitialize();
+
+/*********************************************************************
+* Function: void APP_DeviceVendorTasks(void);
+*
+* Overview: Handles API messages received via the vendor specific
+*   bulk interface. Full packets are data, the frame of at most 63
+*   bytes that ends the transfer is handled as a HID report
+*
+* PreCondition: APP_DeviceVendorInitialize() has been called
+*
+* Input: None
+*
+* Output: None
+*
+********************************************************************/
+void APP_DeviceVendorTasks();
+#endif
@@ -29,9 +29,70 @@
 #define NUMBER_OF_TIMESLOTS 8
 #define TIMESLOT_MASK 0b00000111
 
+/*
+ * Boot control record in EEPROM. Read in one go at every reset
+ *  Byte 0: Bootloader byte (force bootloader or normal mode once)
+ *  Byte 1: Boot options
+ */
+
+#define EEPROM_BOOT_CONTROL_ADDRESS 0x100
+#define EEPROM_BOOT_CONTROL_SIZE 2
 #define EEPROM_BOOTLOADER_BYTE_ADDRESS 0x100
 #define BOOTLOADER_BYTE_FORCE_BOOTLOADER_MODE 0x94
 #define BOOTLOADER_BYTE_FORCE_NORMAL_MODE 0x78
+#define EEPROM_BOOT_OPTIONS_ADDRESS 0x101
+#define BOOT_OPTIONS_FAST_BOOT 0xFB
+
+/*
+ * Time from reset until the main program is started, in units of 256
+ * instruction cycles (21.3us), 0xFFFF if longer than 1.4s. Left in the last two
+ * bytes of general purpose RAM, at the top of bank 14 (0xE00-0xEAF). There is no
+ * RAM from 0xEB0 on. The main program must declare a persistent uint16_t at the
+ * same address in order to read it
+ */
+
+#define BOOT_TIME_RAM_ADDRESS 0xEAE
+
+/*
+ * Application image descriptor in EEPROM. Written when programming starts
+ * and again, with the image CRCs, once programming is complete
+ *  Bytes 0-1: Magic
+ *  Byte 2: Image state
+ *  Bytes 3-5: Image start address
+ *  Bytes 6-8: Image end address (first address after the image)
+ *  Bytes 9-10: CRC over the entire image
+ *  Bytes 11-12: CRC over the last block of every page of the image
+ *  Bytes 13-14: Reserved
+ *  Byte 15: Checksum. All 16 bytes add up to zero
+ */
+
+#define EEPROM_IMAGE_DESCRIPTOR_ADDRESS 0x110
+#define EEPROM_IMAGE_DESCRIPTOR_SIZE 16
+#define IMAGE_DESCRIPTOR_MAGIC 0x1A6E
+#define IMAGE_STATE_PROGRAMMING 0x50
+#define IMAGE_STATE_VALID 0xA5
+
+/*
+ * Programming journal in EEPROM. Updated after every flash page written
+ * Allows programming to resume after a power failure
+ *  Byte 0: Magic
+ *  Bytes 1-11: File identity (number, first cluster, size, modified date and time)
+ *  Bytes 12-30: Programming progress
+ *  Byte 31: Checksum. All 32 bytes add up to zero
+ */
+
+#define EEPROM_PROGRAMMING_JOURNAL_ADDRESS 0x120
+#define EEPROM_PROGRAMMING_JOURNAL_SIZE 32
+#define PROGRAMMING_JOURNAL_MAGIC 0x4A
+
+/*
+ * Start-up delays
+ */
+
+//Board voltage only, enough to talk to the EEPROM
+#define BOOT_SETTLE_DELAY_BOARD_MS 1
+//Display unit (pushbutton and display) needs much longer
+#define BOOT_SETTLE_DELAY_DISPLAY_UNIT_MS 50
 
 #endif	/* APPLICATION_CONFIG_H */
 
@@ -4,6 +4,8 @@
 #include "fat16.h"
 #include "hex.h"
 #include "internal_flash.h"
+#include "i2c.h"
+#include "hardware_config.h"
 
 #define BOOTLOADER_CHARACTER_BUFFER_SIZE 50
 #define BOOTLOADER_NUMBER_OF_RECORDS_PER_CALL 16
@@ -11,6 +13,50 @@
 #define BOOTLOADER_MAXIMUM_ADDRESS_ALLOWED 0x1FFF7
 #define BOOTLOADER_CONFIGURATIONBITS_ADDRESS_MIN 0x1FFF8
 #define BOOTLOADER_CONFIGURATIONBITS_ADDRESS_MAX 0x1FFFF
+#define BOOTLOADER_CONFIGURATIONBITS_SIZE 8
+#define BOOTLOADER_CRC_SAMPLE_SIZE 64
+#define BOOTLOADER_FIRST_PAGE (BOOTLOADER_MINIMUM_ADDRESS_ALLOWED>>10)
+#define BOOTLOADER_PAGE_MAP_SIZE 11
+#define BOOTLOADER_MAXIMUM_PAGE_REVISITS 4
+#define BOOTLOADER_MAXIMUM_VERIFY_RETRIES 3
+
+/*
+ * Compressed image (FIRMWARE.LZB). A 28 byte header followed by the compressed data
+ *  Bytes 0-1: Magic
+ *  Byte 2: Format version
+ *  Byte 3: Configuration bits present. Bit n is set if byte 16+n is given
+ *  Bytes 4-7: Image start address. Must be at the start of a page
+ *  Bytes 8-11: Image length
+ *  Bytes 12-13: CRC over the image
+ *  Bytes 14-15: Reserved
+ *  Bytes 16-23: Configuration bits (0x1FFF8 to 0x1FFFF) the image has been built for
+ *  Bytes 24-26: Reserved
+ *  Byte 27: Checksum. All 28 bytes add up to zero
+ * Multi byte values are most significant byte first. The configuration bits
+ * present must match the device's configuration words, just as in a hex file. The image is contiguous,
+ * gaps are filled with 0xFF. The compressed data is a sequence of
+ *  0b0LLLLLLL: L+1 literal bytes follow
+ *  0b1LLLLLDD DDDDDDDD: Copy L+3 bytes from D+1 bytes back in the image
+ * A copy reaches back 1024 bytes at most so the page buffer holds all we need
+ *
+ * Delta image (version 4). Builds the new image from the one currently installed
+ *  Bytes 0-27: As above, except for
+ *  Bytes 14-15: CRC over all bytes copied from the installed image, in the order they are used
+ * The compressed data is a sequence of
+ *  0b00LLLLLL: L+1 literal bytes follow
+ *  0b01LLLLLL LLLLLLLL OOOOOOOO OOOOOOOO: Copy L+1 bytes from the installed image
+ *   at the current address plus O (signed)
+ *  0b1LLLLLDD DDDDDDDD: As above
+ * Pages are written in ascending order. Copies from the installed image must not
+ * reach below the page being assembled, these pages have been overwritten already
+ */
+#define BOOTLOADER_IMAGE_HEADER_SIZE 28
+#define BOOTLOADER_IMAGE_MAGIC 0x4C5A
+#define BOOTLOADER_IMAGE_VERSION 0x03
+#define BOOTLOADER_IMAGE_VERSION_DELTA 0x04
+#define BOOTLOADER_IMAGE_CONFIGURATION_MASK 3
+#define BOOTLOADER_IMAGE_CONFIGURATION 16
+#define BOOTLOADER_IMAGE_WINDOW_MASK 0x3FF
 
 uint8_t file_number = 0xFF;
 uint8_t file_buffer[BOOTLOADER_CHARACTER_BUFFER_SIZE];
@@ -22,13 +68,79 @@ uint32_t hex_file_offset = 0;
 uint32_t hex_file_size = 0;
 HexFileEntry_t hex_file_entry;
 ShortRecordError_t last_error;
+//Extended linear or extended segment address, whichever has been given last
 uint32_t extended_linear_address;
 uint8_t start_from_byte_next = 0;
+//Window of up to 16 data bytes within the current record
+uint8_t record_window = 0;
+//Offset of the record whose first characters are in file_buffer
+uint32_t file_buffer_record = 0xFFFFFFFF;
+//File is a compressed image rather than a hex file
+uint8_t file_compressed = 0;
 
+uint16_t file_first_cluster;
 uint16_t fast_read_cluster;
 uint16_t fast_read_cluster_number;
 
 uint16_t flash_pages_written;
+uint16_t flash_pages_erased;
+uint16_t flash_blocks_written;
+
+//CRC calculation after programming
+uint8_t image_crc_pending = 0;
+uint16_t image_crc_page;
+uint16_t image_crc;
+uint16_t image_sample_crc;
+
+//Programming journal
+uint8_t resume_pending = 0;
+
+//Page index. One bit per internal flash page
+uint8_t pages_seen[BOOTLOADER_PAGE_MAP_SIZE];
+uint8_t pages_done[BOOTLOADER_PAGE_MAP_SIZE];
+uint8_t pages_not_coalesced[BOOTLOADER_PAGE_MAP_SIZE];
+uint16_t index_previous_page;
+
+//Records that return to a page after the file has moved on to another page
+//File offset and base address take 3 bytes each, as in the programming journal
+typedef struct
+{
+    uint8_t offset[3];
+    uint8_t baseAddress[3];
+    uint8_t window;
+    uint8_t page;
+} pageRevisit_t;
+
+pageRevisit_t page_revisits[BOOTLOADER_MAXIMUM_PAGE_REVISITS];
+uint8_t page_revisit_count;
+
+//Readback verification. Last page that did not read back as written and number of times a page has been written again
+uint16_t verify_failed_page;
+uint8_t verify_retries;
+
+//Decompression. file_buffer holds the compressed data, the page buffer the last 1024 bytes of the image
+uint32_t image_length;
+uint32_t image_output;
+uint16_t image_file_crc;
+uint16_t image_output_crc;
+uint16_t image_copy_distance;
+uint16_t image_copy_length;
+//Delta image. Copies from the installed image
+uint8_t image_delta;
+uint8_t image_copy_installed;
+int16_t image_copy_offset;
+uint16_t image_file_source_crc;
+uint16_t image_source_crc;
+uint8_t image_literals;
+uint8_t image_input_index;
+uint8_t image_input_length;
+
+//CRC-16 (CCITT) lookup table, one nibble at a time
+const uint16_t crc_table[16] = 
+{
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
 
 typedef enum
 {
@@ -42,6 +154,13 @@ typedef enum
     COMPARE_RESULT_DATA_DOES_NOT_MATCH
 } compareResult_t;
 
+typedef enum
+{
+    PROGRAM_RUN_PAGE_END,
+    PROGRAM_RUN_END_OF_FILE,
+    PROGRAM_RUN_ERROR
+} programRunResult_t;
+
 typedef enum
 {
     ADDRESS_CHECK_RESULT_OK = 0x00,       
@@ -54,8 +173,45 @@ static addressCheckResult_t _bootloader_check_address(uint32_t address,  uint8_t
 static void _bootloader_find_file(void);
 static void _bootloader_verify_file(void);
 static void _bootloader_program(void);
+static void _bootloader_read_record(void);
+static void _bootloader_read_file(uint32_t position, uint8_t *buffer, uint8_t length);
+static uint32_t _bootloader_parse_record(void);
+static void _bootloader_next_record(uint32_t return_value);
+static void _bootloader_update_base_address(void);
+static programRunResult_t _bootloader_program_run(uint16_t *page, uint8_t sequential);
+static void _bootloader_program_revisits(uint16_t page);
+static void _bootloader_index_record(uint32_t address, uint8_t length);
+static uint8_t _bootloader_get_page_flag(uint8_t *map, uint16_t page);
+static void _bootloader_set_page_flag(uint8_t *map, uint16_t page);
+static void _bootloader_verify_complete(void);
+
+static ShortRecordError_t _bootloader_image_start_decompression(void);
+static compareResult_t _bootloader_image_verify_configuration_bits(void);
+static uint8_t _bootloader_image_read_byte(uint8_t *data);
+static programRunResult_t _bootloader_image_decompress(void);
+static uint16_t _bootloader_image_page_length(programRunResult_t result);
+static void _bootloader_verify_image(void);
+static programRunResult_t _bootloader_image_run(uint16_t *page);
 
 static compareResult_t _bootloader_verify_program_memory(uint32_t addressOffset, HexFileEntry_t *hexFileEntry);
+static compareResult_t _bootloader_verify_configuration_bits(uint32_t address);
+static void _bootloader_commit_page(uint16_t page);
+static uint8_t _bootloader_verify_page(uint16_t page);
+
+static uint32_t _bootloader_image_start(void);
+static uint32_t _bootloader_image_end(void);
+static void _bootloader_write_image_descriptor(uint8_t state);
+static void _bootloader_save_image_descriptor(uint8_t *descriptor);
+static imageCheckResult_t _bootloader_read_image_descriptor(uint8_t *descriptor, uint32_t *start, uint32_t *end);
+static void _bootloader_image_crc_step(void);
+
+static uint8_t _bootloader_checksum(uint8_t *data, uint8_t length);
+static void _bootloader_put_bytes(uint8_t *destination, uint32_t value, uint8_t length);
+static uint32_t _bootloader_get_bytes(uint8_t *source, uint8_t length);
+static void _bootloader_journal_identity(uint8_t *journal, rootEntry_t *root);
+static void _bootloader_journal_save(void);
+static uint8_t _bootloader_journal_resume(void);
+static void _bootloader_journal_clear(void);
 
 
 
@@ -126,7 +282,7 @@ static addressCheckResult_t _bootloader_check_address(uint32_t address, uint8_t
             byte_status = ADDRESS_CHECK_RESULT_OK;
         }
         //Configuration bits. Don't program but allowed in file
-        //These will be checked to ensure they match
+        //These are checked against the device's configuration words when verifying
         else if(((address+cntr)>=BOOTLOADER_CONFIGURATIONBITS_ADDRESS_MIN) && ((address+cntr)<=BOOTLOADER_CONFIGURATIONBITS_ADDRESS_MAX))
         {
             byte_status = ADDRESS_CHECK_RESULT_CONFIGURATION_BITS;
@@ -156,6 +312,14 @@ static void _bootloader_find_file(void)
 {
     //Try to locate file
     file_number = fat_find_file(bootloader_filename, bootloader_extension);
+    file_compressed = 0;
+    
+    //No hex file. Try the compressed image instead
+    if(file_number==0xFF)
+    {
+        file_number = fat_find_file(bootloader_filename, bootloader_compressed_extension);
+        file_compressed = 1;
+    }
     
     //File has been found
     if(file_number!=0xFF)
@@ -165,9 +329,25 @@ static void _bootloader_find_file(void)
         //Let user decide if the file is to be used
         hex_file_entries = 0;
         hex_file_offset = 0;
+        record_window = 0;
         file_minimum_address = 0xFFFFFFFF;
         file_maximum_address = 0x00000000;
         extended_linear_address = 0x00000000;
+        
+        //Programming of this very file has been interrupted
+        //Verify it again to rebuild the page index, then continue where we left off
+        if(_bootloader_journal_resume())
+        {
+            hex_file_entries = 0;
+            hex_file_offset = 0;
+            record_window = 0;
+            extended_linear_address = 0x00000000;
+            resume_pending = 1;
+            os.bootloader_mode = BOOTLOADER_MODE_FILE_VERIFYING;
+            os.display_mode = DISPLAY_MODE_BOOTLOADER_FILE_VERIFYING;
+            return;
+        }
+        
         os.bootloader_mode = BOOTLOADER_MODE_FILE_FOUND;
         os.display_mode = DISPLAY_MODE_BOOTLOADER_FILE_FOUND;
     }
@@ -189,48 +369,70 @@ static void _bootloader_verify_file(void)
     uint32_t address32;
     rootEntry_t root;
     
+    uint8_t cntr;
+    
     if(hex_file_offset==0)
     {
         //We are just getting started with this file
         fat_get_file_information(file_number, &root);
+        file_first_cluster = root.firstCluster;
         fast_read_cluster = root.firstCluster;
         fast_read_cluster_number = 0;
+        file_buffer_record = 0xFFFFFFFF;
+        
+        //Start a new page index
+        for(cntr=0; cntr<BOOTLOADER_PAGE_MAP_SIZE; ++cntr)
+        {
+            pages_seen[cntr] = 0x00;
+            pages_not_coalesced[cntr] = 0x00;
+            pages_done[cntr] = 0x00;
+        }
+        verify_failed_page = 0;
+        verify_retries = 0;
+        page_revisit_count = 0;
+        index_previous_page = 0;
+        
+        //Check the compressed image's header
+        if(file_compressed)
+        {
+            last_error = _bootloader_image_start_decompression();
+            if(last_error!=ShortRecordErrorNoError)
+            {
+                os.bootloader_mode = BOOTLOADER_MODE_CHECK_FAILED;
+                os.display_mode = DISPLAY_MODE_BOOTLOADER_CHECK_FAILED;
+                return;
+            }
+        }
     }
     
     //Find file size
     hex_file_size = fat_get_file_size(file_number);
     
+    //Compressed image. Decompress it without writing anything
+    if(file_compressed)
+    {
+        _bootloader_verify_image();
+        return;
+    }
+    
     //Loop through a pre-defined number of records
     for(rec_counter=0; rec_counter<BOOTLOADER_NUMBER_OF_RECORDS_PER_CALL; ++rec_counter)
     {
         //Read an entry
-        if((hex_file_size-hex_file_offset)>=BOOTLOADER_CHARACTER_BUFFER_SIZE)
-        {
-            //fat_read_from_file(file_number, hex_file_offset, BOOTLOADER_CHARACTER_BUFFER_SIZE, file_buffer);
-            fat_read_from_file_fast(hex_file_offset, BOOTLOADER_CHARACTER_BUFFER_SIZE, file_buffer, &fast_read_cluster, &fast_read_cluster_number);
-        }
-        else
-        {
-            //fat_read_from_file(file_number, hex_file_offset, (hex_file_size-hex_file_offset), file_buffer);
-            fat_read_from_file_fast(hex_file_offset, (hex_file_size-hex_file_offset), file_buffer, &fast_read_cluster, &fast_read_cluster_number);
-        }
+        _bootloader_read_record();
             
         //Check that entry
-        return_value = parseHexFileEntry(file_buffer, 0, &hex_file_entry);
+        return_value = _bootloader_parse_record();
         
         //Keep track of number of records
-        ++hex_file_entries;
-        
-        //Keep track of extended linear address
-        if(hex_file_entry.recordType==RecordTypeExtendedLinearAddress)
+        if(return_value!=RecordContinues)
         {
-            extended_linear_address = hex_file_entry.data[0];
-            extended_linear_address <<= 8;
-            extended_linear_address |= hex_file_entry.data[1];
-            extended_linear_address <<= 8;
-            extended_linear_address <<= 8;
+            ++hex_file_entries;
         }
         
+        //Keep track of extended linear or segment address
+        _bootloader_update_base_address();
+        
         //Keep track of address range
         if(hex_file_entry.recordType==RecordTypeData)
         {
@@ -242,9 +444,9 @@ static void _bootloader_verify_file(void)
             {
                 file_minimum_address = address32;
             }
-            if(address32>file_maximum_address)
+            if((hex_file_entry.dataLength>0) && ((address32+hex_file_entry.dataLength-1)>file_maximum_address))
             {
-                file_maximum_address = address32;
+                file_maximum_address = address32 + hex_file_entry.dataLength - 1;
             }
             
             //Check if address is valid
@@ -257,21 +459,27 @@ static void _bootloader_verify_file(void)
                 os.display_mode = DISPLAY_MODE_BOOTLOADER_CHECK_FAILED;
                 break;
             }
+            
+            //Configuration bits can't be programmed. The file must have been built for the same settings
+            if(_bootloader_verify_configuration_bits(address32) == COMPARE_RESULT_DATA_DOES_NOT_MATCH)
+            {
+                last_error = ShortRecordErrorConfigurationBits;
+                os.bootloader_mode = BOOTLOADER_MODE_CHECK_FAILED;
+                os.display_mode = DISPLAY_MODE_BOOTLOADER_CHECK_FAILED;
+                break;
+            }
+            
+            //Keep track of which pages this record contributes to
+            if(_bootloader_check_address(address32, hex_file_entry.dataLength) == ADDRESS_CHECK_RESULT_OK)
+            {
+                _bootloader_index_record(address32, hex_file_entry.dataLength);
+            }
         }
 
         if(return_value==0)
         {
             //Last record has been reached without an error
-            //Prepare variables for programming and change mode
-            total_hex_file_entries = hex_file_entries;
-            hex_file_entries = 0;
-            hex_file_offset = 0;
-            extended_linear_address = 0;
-            flash_pages_written = 0;
-            start_from_byte_next = 0;
-            
-            os.bootloader_mode = BOOTLOADER_MODE_CHECK_COMPLETE;
-            os.display_mode = DISPLAY_MODE_BOOTLOADER_CHECK_COMPLETE;
+            _bootloader_verify_complete();
             break;
         }
         else if(return_value>0xFFFFFFF0)
@@ -286,204 +494,1202 @@ static void _bootloader_verify_file(void)
         else
         {
             //No error but end of file has not yet been reached
-            hex_file_offset += return_value;
+            _bootloader_next_record(return_value);
         } 
     }
 }
 
+//Prepares variables for programming and changes mode
+static void _bootloader_verify_complete(void)
+{
+    total_hex_file_entries = hex_file_entries;
+    hex_file_entries = 0;
+    hex_file_offset = 0;
+    extended_linear_address = 0;
+    flash_pages_written = 0;
+    flash_pages_erased = 0;
+    flash_blocks_written = 0;
+    start_from_byte_next = 0;
+    record_window = 0;
+    
+    //Continue where we left off if programming of this file has been interrupted
+    if(resume_pending)
+    {
+        resume_pending = 0;
+        if(_bootloader_journal_resume())
+        {
+            os.bootloader_mode = BOOTLOADER_MODE_PROGRAMMING;
+            os.display_mode = DISPLAY_MODE_BOOTLOADER_PROGRAMMING;
+            return;
+        }
+    }
+    
+    os.bootloader_mode = BOOTLOADER_MODE_CHECK_COMPLETE;
+    os.display_mode = DISPLAY_MODE_BOOTLOADER_CHECK_COMPLETE;
+}
+
 static void _bootloader_program(void)
 {
-    uint16_t cntr;
-    uint8_t* buffer;
-    uint16_t entry_page;
     uint16_t page_to_write = 0;
-    uint8_t start_from_byte;
-    uint32_t address32;
-    uint32_t return_value = 0;
-    uint16_t address_within_page;
+    programRunResult_t result;
     rootEntry_t root;
     
+    //All data has been written. Calculate image CRC one page at a time
+    if(image_crc_pending)
+    {
+        _bootloader_image_crc_step();
+        return;
+    }
+    
     if(hex_file_offset==0)
     {
         //We are just getting started with this file
         fat_get_file_information(file_number, &root);
+        file_first_cluster = root.firstCluster;
         fast_read_cluster = root.firstCluster;
         fast_read_cluster_number = 0;
-    }
-
-    //Loop through records
-    while(1)
-    {
-        //This may take a while. Clear WDT first
-        //ClrWdt();
+        file_buffer_record = 0xFFFFFFFF;
         
-        //Read an entry
-        if((hex_file_size-hex_file_offset)>=BOOTLOADER_CHARACTER_BUFFER_SIZE)
+        //Mark image as incomplete until programming has finished
+        _bootloader_write_image_descriptor(IMAGE_STATE_PROGRAMMING);
+        
+        if(file_compressed)
         {
-            //fat_read_from_file(file_number, hex_file_offset, BOOTLOADER_CHARACTER_BUFFER_SIZE, file_buffer);
-            fat_read_from_file_fast(hex_file_offset, BOOTLOADER_CHARACTER_BUFFER_SIZE, file_buffer, &fast_read_cluster, &fast_read_cluster_number);
+            //Decompression can only start from the beginning, so can a resumed run
+            //Pages that have been written before are found unchanged and skipped
+            //Not so for a delta image. The image it refers to has changed, the check will fail
+            _bootloader_journal_save();
+            _bootloader_image_start_decompression();
         }
-        else
+    }
+    
+    if(file_compressed)
+    {
+        //Decompress the next page
+        result = _bootloader_image_run(&page_to_write);
+    }
+    else
+    {
+        //Assemble the next page that has not yet been written, in file order
+        result = _bootloader_program_run(&page_to_write, 1);
+    }
+    if(result==PROGRAM_RUN_ERROR)
+    {
+        //An error has occurred
+        os.bootloader_mode = BOOTLOADER_MODE_CHECK_FAILED;
+        os.display_mode = DISPLAY_MODE_BOOTLOADER_CHECK_FAILED;
+        return;
+    }
+    
+    if(page_to_write!=0)
+    {
+        //Add records further down the file that belong to the same page
+        if(!file_compressed)
         {
-            //fat_read_from_file(file_number, hex_file_offset, (hex_file_size-hex_file_offset), file_buffer);
-            fat_read_from_file_fast(hex_file_offset, (hex_file_size-hex_file_offset), file_buffer, &fast_read_cluster, &fast_read_cluster_number);
+            _bootloader_program_revisits(page_to_write);
         }
         
-        //Parse that entry
-        return_value = parseHexFileEntry(file_buffer, 0, &hex_file_entry);
-        
-        //Keep track of number of records
-        ++hex_file_entries;
-        
-        //Handle return value
-        if(return_value>RecordErrorNoError)
+        //Page is complete. Write data to flash and read it back
+        _bootloader_commit_page(page_to_write);
+        if(!_bootloader_verify_page(page_to_write))
         {
-            //An error has occurred
             os.bootloader_mode = BOOTLOADER_MODE_CHECK_FAILED;
             os.display_mode = DISPLAY_MODE_BOOTLOADER_CHECK_FAILED;
             return;
         }
-        else
+        if(!_bootloader_get_page_flag(pages_not_coalesced, page_to_write))
         {
-            //No error and end of file has not yet been reached
-            hex_file_offset += return_value;
-        } 
-        
-        switch(hex_file_entry.recordType)
+            _bootloader_set_page_flag(pages_done, page_to_write);
+        }
+    }
+    
+    if(result==PROGRAM_RUN_PAGE_END)
+    {
+        //Record progress in case power fails
+        if(!file_compressed)
         {
-            //Extended linear address
-            case RecordTypeExtendedLinearAddress:
-                //Keep track of extended linear address
-                //After that we are done with this record
-                extended_linear_address = hex_file_entry.data[0];
-                extended_linear_address <<= 8;
-                extended_linear_address |= hex_file_entry.data[1];
-                extended_linear_address <<= 8;
-                extended_linear_address <<= 8;
-                continue;
-                break;
-                
-            //Data
-            case RecordTypeData:                
-                //Recall where we should start
-                start_from_byte = start_from_byte_next;
-                //Remember where to start from next time (default, may be changed below)
-                start_from_byte_next = 0;
-                
-                //Calculate 32-bit address and corresponding page
-                address32 = extended_linear_address + hex_file_entry.address;
-                entry_page = internalFlash_pageFromAddress(address32 + start_from_byte);
-                
-                //Check address range
-                if(_bootloader_check_address(address32+start_from_byte, hex_file_entry.dataLength-start_from_byte) != ADDRESS_CHECK_RESULT_OK)
-                {
-                    break;
-                }
-                
-                if(page_to_write==0)
-                {
-                    //This is the first data record
-                    //Prepare the buffer
-                    //Obtain a handle to a 1024 byte buffer
-                    page_to_write = entry_page;
-                    internalFlash_readPage(page_to_write);
-                    buffer = internalFlash_getBuffer();
-                }
-
-                for(cntr=start_from_byte; cntr<hex_file_entry.dataLength; ++cntr)
-                {
-                    //Make sure that byte is still on the same page
-                    //Hex file entries often span across page boundaries
-                    if(internalFlash_pageFromAddress(address32+cntr) == page_to_write)
-                    {
-                        address_within_page = internalFlash_addressWithinPage(address32+cntr, page_to_write);
-                        buffer[address_within_page] = hex_file_entry.data[cntr];
-                    }
-                    else
-                    {
-                        //Make sure we re-visit this hex file entry
-                        hex_file_offset -= return_value;
-                        --hex_file_entries;
-                        //Remember where to start from next time
-                        start_from_byte_next = cntr;
-                        //Write data to flash
-                        internalFlash_erasePage(page_to_write);
-                        internalFlash_writePage(page_to_write);
-                        ++flash_pages_written;
-                        //Return from function
-                        return;
-                    }
-                }
-                    
-                break;
-                
-            case RecordTypeEndOfFile:
-                //Only write if data has been prepared before
-                if(page_to_write!=0)
-                {
-                    //Write data to flash
-                    internalFlash_erasePage(page_to_write);
-                    internalFlash_writePage(page_to_write);
-                    ++flash_pages_written;
-                    //Change mode
-                    os.bootloader_mode = BOOTLOADER_MODE_DONE;
-                    os.display_mode = DISPLAY_MODE_BOOTLOADER_DONE;
-                }
-                //Return from function
-                return;
-                break;
+            _bootloader_journal_save();
         }
     }
+    else
+    {
+        //End of file. Calculate image CRC before we are done
+        image_crc_page = internalFlash_pageFromAddress(_bootloader_image_start());
+        image_crc = 0xFFFF;
+        image_sample_crc = 0xFFFF;
+        image_crc_pending = 1;
+    }
 }
 
-static compareResult_t _bootloader_verify_program_memory(uint32_t addressOffset, HexFileEntry_t *hexFileEntry)
+//Reads and checks the compressed image's header and resets the decompressor
+static ShortRecordError_t _bootloader_image_start_decompression(void)
 {
-    uint8_t buffer[16];
-    uint32_t address; 
-    uint8_t cntr;
+    uint32_t start;
     
-    //Calculate address
-    address = addressOffset + hexFileEntry->address;
+    if(hex_file_size<BOOTLOADER_IMAGE_HEADER_SIZE)
+    {
+        return ShortRecordErrorImage;
+    }
+    _bootloader_read_file(0, file_buffer, BOOTLOADER_IMAGE_HEADER_SIZE);
+    if(_bootloader_get_bytes(&file_buffer[0], 2)!=BOOTLOADER_IMAGE_MAGIC)
+    {
+        return ShortRecordErrorImage;
+    }
+    switch(file_buffer[2])
+    {
+        case BOOTLOADER_IMAGE_VERSION:
+            image_delta = 0;
+            break;
+            
+        case BOOTLOADER_IMAGE_VERSION_DELTA:
+            image_delta = 1;
+            break;
+            
+        default:
+            return ShortRecordErrorImage;
+    }
+    if(_bootloader_checksum(file_buffer, BOOTLOADER_IMAGE_HEADER_SIZE)!=0)
+    {
+        return ShortRecordErrorChecksum;
+    }
     
-    //Read from internal flash into buffer
-    internalFlash_read(address, hexFileEntry->dataLength, buffer);
+    //Configuration bits can't be programmed. The image must have been built for the same settings
+    if(_bootloader_image_verify_configuration_bits()==COMPARE_RESULT_DATA_DOES_NOT_MATCH)
+    {
+        return ShortRecordErrorConfigurationBits;
+    }
     
-    for(cntr=0; cntr<hexFileEntry->dataLength; ++cntr)
+    start = _bootloader_get_bytes(&file_buffer[4], 4);
+    image_length = _bootloader_get_bytes(&file_buffer[8], 4);
+    image_file_crc = (uint16_t) _bootloader_get_bytes(&file_buffer[12], 2);
+    image_file_source_crc = (uint16_t) _bootloader_get_bytes(&file_buffer[14], 2);
+    
+    //Image must start at a page and fit into the allowed range
+    if((start&BOOTLOADER_IMAGE_WINDOW_MASK) || (start<BOOTLOADER_MINIMUM_ADDRESS_ALLOWED) || (start>BOOTLOADER_MAXIMUM_ADDRESS_ALLOWED) || (image_length==0) || (image_length>(BOOTLOADER_MAXIMUM_ADDRESS_ALLOWED+1-start)))
     {
-        if(hexFileEntry->data[cntr] != buffer[cntr])
+        return ShortRecordErrorAddressRange;
+    }
+    file_minimum_address = start;
+    file_maximum_address = start + image_length - 1;
+    
+    //Compressed data follows the header
+    hex_file_offset = BOOTLOADER_IMAGE_HEADER_SIZE;
+    image_input_index = 0;
+    image_input_length = 0;
+    image_output = 0;
+    image_output_crc = 0xFFFF;
+    image_source_crc = 0xFFFF;
+    image_literals = 0;
+    image_copy_length = 0;
+    image_copy_installed = 0;
+    
+    return ShortRecordErrorNoError;
+}
+
+//Compares the configuration bits in the image's header, if any, with the device's
+static compareResult_t _bootloader_image_verify_configuration_bits(void)
+{
+    uint8_t cntr;
+    uint8_t device_configuration[BOOTLOADER_CONFIGURATIONBITS_SIZE];
+    
+    //Device's configuration words
+    internalFlash_read(BOOTLOADER_CONFIGURATIONBITS_ADDRESS_MIN, BOOTLOADER_CONFIGURATIONBITS_SIZE, device_configuration);
+    for(cntr=0; cntr<BOOTLOADER_CONFIGURATIONBITS_SIZE; ++cntr)
+    {
+        if(!(file_buffer[BOOTLOADER_IMAGE_CONFIGURATION_MASK] & (1<<cntr)))
+        {
+            continue;
+        }
+        if(file_buffer[BOOTLOADER_IMAGE_CONFIGURATION+cntr] != device_configuration[cntr])
         {
             return COMPARE_RESULT_DATA_DOES_NOT_MATCH;
         }
     }
     
-    //If we get to here, all bytes match
     return COMPARE_RESULT_DATA_MATCHES;
 }
 
-uint32_t bootloader_get_file_size(void)
-{
-    return hex_file_size;
-}
-
-uint16_t bootloader_get_entries(void)
+//Takes the next byte of compressed data, reading file_buffer full again when needed
+//Returns 0 if the file has ended
+static uint8_t _bootloader_image_read_byte(uint8_t *data)
 {
-    return hex_file_entries;
+    if(image_input_index==image_input_length)
+    {
+        if(hex_file_offset>=hex_file_size)
+        {
+            return 0;
+        }
+        image_input_length = BOOTLOADER_CHARACTER_BUFFER_SIZE;
+        if((hex_file_size-hex_file_offset)<image_input_length)
+        {
+            image_input_length = (uint8_t) (hex_file_size-hex_file_offset);
+        }
+        _bootloader_read_file(hex_file_offset, file_buffer, image_input_length);
+        hex_file_offset += image_input_length;
+        image_input_index = 0;
+    }
+    
+    *data = file_buffer[image_input_index];
+    ++image_input_index;
+    return 1;
 }
 
-uint16_t bootloader_get_total_entries(void)
+//Decompresses into the page buffer until a page is complete or the image has ended
+//Literal runs and copies may continue on the next page
+static programRunResult_t _bootloader_image_decompress(void)
 {
-    return total_hex_file_entries;
+    uint8_t *buffer;
+    uint8_t token;
+    uint8_t data;
+    uint8_t parameters[3];
+    uint8_t cntr;
+    uint32_t address;
+    uint32_t source;
+    
+    buffer = internalFlash_getBuffer();
+    
+    while(image_output<image_length)
+    {
+        //Start the next literal run or copy
+        if((image_literals==0) && (image_copy_length==0))
+        {
+            if(!_bootloader_image_read_byte(&token))
+            {
+                return PROGRAM_RUN_ERROR;
+            }
+            if(token&0x80)
+            {
+                if(!_bootloader_image_read_byte(&data))
+                {
+                    return PROGRAM_RUN_ERROR;
+                }
+                image_copy_length = ((token>>2) & 0x1F) + 3;
+                image_copy_distance = ((uint16_t) (token&0x03) << 8) | data;
+                ++image_copy_distance;
+                image_copy_installed = 0;
+                //Can't copy from before the start of the image
+                if(image_copy_distance>image_output)
+                {
+                    return PROGRAM_RUN_ERROR;
+                }
+            }
+            else if(image_delta && (token&0x40))
+            {
+                for(cntr=0; cntr<3; ++cntr)
+                {
+                    if(!_bootloader_image_read_byte(&parameters[cntr]))
+                    {
+                        return PROGRAM_RUN_ERROR;
+                    }
+                }
+                image_copy_length = ((uint16_t) (token&0x3F) << 8) | parameters[0];
+                ++image_copy_length;
+                image_copy_offset = (int16_t) _bootloader_get_bytes(&parameters[1], 2);
+                image_copy_installed = 1;
+            }
+            else
+            {
+                image_literals = token + 1;
+            }
+        }
+        
+        if(image_literals)
+        {
+            if(!_bootloader_image_read_byte(&data))
+            {
+                return PROGRAM_RUN_ERROR;
+            }
+            --image_literals;
+        }
+        else if(image_copy_installed)
+        {
+            address = file_minimum_address + image_output;
+            source = address + (int32_t) image_copy_offset;
+            //Pages below the one being assembled have been overwritten already
+            if(source<(address & ~((uint32_t) BOOTLOADER_IMAGE_WINDOW_MASK)))
+            {
+                return PROGRAM_RUN_ERROR;
+            }
+            if(!internalFlash_read(source, 1, &data))
+            {
+                return PROGRAM_RUN_ERROR;
+            }
+            image_source_crc = bootloader_crc(&data, 1, image_source_crc);
+            --image_copy_length;
+        }
+        else
+        {
+            data = buffer[(uint16_t) (image_output-image_copy_distance) & BOOTLOADER_IMAGE_WINDOW_MASK];
+            --image_copy_length;
+        }
+        buffer[(uint16_t) image_output & BOOTLOADER_IMAGE_WINDOW_MASK] = data;
+        ++image_output;
+        
+        if(((uint16_t) image_output & BOOTLOADER_IMAGE_WINDOW_MASK)==0)
+        {
+            return PROGRAM_RUN_PAGE_END;
+        }
+    }
+    
+    //A literal run or copy must not go beyond the end of the image
+    if(image_literals || image_copy_length)
+    {
+        return PROGRAM_RUN_ERROR;
+    }
+    return PROGRAM_RUN_END_OF_FILE;
 }
 
-ShortRecordError_t bootloader_get_error(void)
+//Number of image bytes in the page buffer after decompression
+static uint16_t _bootloader_image_page_length(programRunResult_t result)
 {
-    return last_error;
+    if(result==PROGRAM_RUN_PAGE_END)
+    {
+        return 1024;
+    }
+    return (uint16_t) image_output & BOOTLOADER_IMAGE_WINDOW_MASK;
 }
 
-uint16_t bootloader_get_rec_dataLength(void)
+//Decompresses one page per call and checks the image CRC at the end
+static void _bootloader_verify_image(void)
 {
-    return hex_file_entry.dataLength;
-}
+    programRunResult_t result;
+    uint16_t length;
+    
+    result = _bootloader_image_decompress();
+    if(result==PROGRAM_RUN_ERROR)
+    {
+        last_error = ShortRecordErrorImage;
+        os.bootloader_mode = BOOTLOADER_MODE_CHECK_FAILED;
+        os.display_mode = DISPLAY_MODE_BOOTLOADER_CHECK_FAILED;
+        return;
+    }
+    
+    //Pages take the place of records
+    length = _bootloader_image_page_length(result);
+    if(length)
+    {
+        image_output_crc = bootloader_crc(internalFlash_getBuffer(), length, image_output_crc);
+        ++hex_file_entries;
+    }
+    
+    if(result==PROGRAM_RUN_END_OF_FILE)
+    {
+        //Delta image doesn't fit the image currently installed
+        if(image_delta && (image_source_crc!=image_file_source_crc))
+        {
+            last_error = ShortRecordErrorBaseImage;
+            os.bootloader_mode = BOOTLOADER_MODE_CHECK_FAILED;
+            os.display_mode = DISPLAY_MODE_BOOTLOADER_CHECK_FAILED;
+            return;
+        }
+        if(image_output_crc!=image_file_crc)
+        {
+            last_error = ShortRecordErrorChecksum;
+            os.bootloader_mode = BOOTLOADER_MODE_CHECK_FAILED;
+            os.display_mode = DISPLAY_MODE_BOOTLOADER_CHECK_FAILED;
+            return;
+        }
+        _bootloader_verify_complete();
+    }
+}
+
+//Decompresses the next page. *page is left at zero if there is nothing to write
+static programRunResult_t _bootloader_image_run(uint16_t *page)
+{
+    programRunResult_t result;
+    uint16_t length;
+    uint16_t image_page;
+    uint8_t *buffer;
+    
+    image_page = internalFlash_pageFromAddress(file_minimum_address+image_output);
+    result = _bootloader_image_decompress();
+    if(result==PROGRAM_RUN_ERROR)
+    {
+        last_error = ShortRecordErrorImage;
+        return result;
+    }
+    
+    length = _bootloader_image_page_length(result);
+    if(length==0)
+    {
+        return result;
+    }
+    ++hex_file_entries;
+    
+    //Page has been written already. Keep decompressing, we need the data as a reference
+    if(_bootloader_get_page_flag(pages_done, image_page))
+    {
+        return result;
+    }
+    
+    //Image ends within this page. Leave the rest of the page as it is
+    buffer = internalFlash_getBuffer();
+    if(length<1024)
+    {
+        internalFlash_read(internalFlash_addressFromPage(image_page)+length, 1024-length, &buffer[length]);
+    }
+    internalFlash_compareBuffer(image_page);
+    (*page) = image_page;
+    
+    return result;
+}
+
+//Reads the current window of the record at hex_file_offset into file_buffer
+//The first 9 characters (start code, length, address, type) are followed by the window's characters
+static void _bootloader_read_record(void)
+{
+    uint32_t position;
+    uint8_t *buffer;
+    uint8_t length;
+    
+    position = hex_file_offset;
+    buffer = file_buffer;
+    length = BOOTLOADER_CHARACTER_BUFFER_SIZE;
+    
+    //Following windows of a long record. Read the first characters only if we don't have them yet
+    if(record_window>0)
+    {
+        if(file_buffer_record!=hex_file_offset)
+        {
+            _bootloader_read_file(position, buffer, 9);
+            //Starting in the middle of a record. Its checksum can't be checked
+            hex_file_entry.windowsChecked = 0xFF;
+        }
+        position += 9 + ((uint16_t) record_window << 5);
+        buffer += 9;
+        length -= 9;
+    }
+    
+    file_buffer_record = hex_file_offset;
+    _bootloader_read_file(position, buffer, length);
+}
+
+static void _bootloader_read_file(uint32_t position, uint8_t *buffer, uint8_t length)
+{
+    //The fast read cursor can only move forward. Start over if we need to go back
+    if((uint16_t) (position>>9) < fast_read_cluster_number)
+    {
+        fast_read_cluster = file_first_cluster;
+        fast_read_cluster_number = 0;
+    }
+    
+    if((hex_file_size-position)<length)
+    {
+        length = (uint8_t) (hex_file_size-position);
+    }
+    fat_read_from_file_fast(position, length, buffer, &fast_read_cluster, &fast_read_cluster_number);
+}
+
+//Parses the current window of the record in the file buffer
+static uint32_t _bootloader_parse_record(void)
+{
+    uint32_t return_value;
+    uint32_t profile_start;
+    
+    profile_start = system_profiler_start();
+    return_value = parseHexFileEntry(file_buffer, record_window, &hex_file_entry);
+    system_profiler_stop(PROFILER_PROBE_HEX_PARSE, profile_start);
+    
+    return return_value;
+}
+
+//Moves on to the next window or, after the last one, to the next record
+static void _bootloader_next_record(uint32_t return_value)
+{
+    if(return_value==RecordContinues)
+    {
+        ++record_window;
+    }
+    else
+    {
+        record_window = 0;
+        hex_file_offset += return_value;
+    }
+}
+
+static void _bootloader_update_base_address(void)
+{
+    switch(hex_file_entry.recordType)
+    {
+        //Upper 16 bits of the address
+        case RecordTypeExtendedLinearAddress:
+            extended_linear_address = hex_file_entry.data[0];
+            extended_linear_address <<= 8;
+            extended_linear_address |= hex_file_entry.data[1];
+            extended_linear_address <<= 16;
+            break;
+            
+        //Segment, i.e. bits 4 to 19 of the address
+        case RecordTypeExtendedSegmentAddress:
+            extended_linear_address = hex_file_entry.data[0];
+            extended_linear_address <<= 8;
+            extended_linear_address |= hex_file_entry.data[1];
+            extended_linear_address <<= 4;
+            break;
+    }
+}
+
+//Copies record data from the current file position into the page buffer
+//In file order (sequential), the first byte for a page not yet written selects the page
+//and bytes for pages already written are skipped. Otherwise *page must be given and
+//leading bytes for other pages are skipped
+//Stops at the first byte that belongs to yet another page
+static programRunResult_t _bootloader_program_run(uint16_t *page, uint8_t sequential)
+{
+    uint16_t cntr;
+    uint16_t byte_page;
+    uint8_t applied = 0;
+    uint32_t address32;
+    uint32_t return_value;
+    
+    //Loop through records
+    while(1)
+    {
+        //Read and parse an entry
+        _bootloader_read_record();
+        return_value = _bootloader_parse_record();
+        if(return_value>RecordErrorNoError)
+        {
+            return PROGRAM_RUN_ERROR;
+        }
+        
+        switch(hex_file_entry.recordType)
+        {
+            //Extended linear or segment address
+            case RecordTypeExtendedLinearAddress:
+            case RecordTypeExtendedSegmentAddress:
+                _bootloader_update_base_address();
+                break;
+                
+            //Data
+            case RecordTypeData:
+                //Calculate 32-bit address
+                address32 = extended_linear_address + hex_file_entry.address;
+                
+                //Check address range
+                if(_bootloader_check_address(address32+start_from_byte_next, hex_file_entry.dataLength-start_from_byte_next) != ADDRESS_CHECK_RESULT_OK)
+                {
+                    break;
+                }
+                
+                for(cntr=start_from_byte_next; cntr<hex_file_entry.dataLength; ++cntr)
+                {
+                    //Hex file entries often span across page boundaries
+                    byte_page = internalFlash_pageFromAddress(address32+cntr);
+                    if(byte_page==(*page))
+                    {
+                        internalFlash_setBufferByte(internalFlash_addressWithinPage(address32+cntr, byte_page), hex_file_entry.data[cntr]);
+                        applied = 1;
+                        continue;
+                    }
+                    if(sequential)
+                    {
+                        //This page is complete already
+                        if(_bootloader_get_page_flag(pages_done, byte_page))
+                        {
+                            continue;
+                        }
+                        //This is the first byte. Prepare the buffer
+                        if((*page)==0)
+                        {
+                            (*page) = byte_page;
+                            internalFlash_readPage(byte_page);
+                            internalFlash_setBufferByte(internalFlash_addressWithinPage(address32+cntr, byte_page), hex_file_entry.data[cntr]);
+                            continue;
+                        }
+                    }
+                    else if(!applied)
+                    {
+                        continue;
+                    }
+                    
+                    //Make sure we re-visit this hex file entry, starting from this byte
+                    start_from_byte_next = (uint8_t) cntr;
+                    return PROGRAM_RUN_PAGE_END;
+                }
+                break;
+                
+            case RecordTypeEndOfFile:
+                return PROGRAM_RUN_END_OF_FILE;
+                break;
+        }
+        
+        //We are done with this record (or window)
+        //Start addresses (types 03 and 05) are of no interest to us
+        start_from_byte_next = 0;
+        if(sequential && (return_value!=RecordContinues))
+        {
+            //Keep track of number of records
+            ++hex_file_entries;
+        }
+        _bootloader_next_record(return_value);
+    }
+}
+
+//Applies all later runs of records to a page, as found when verifying the file
+static void _bootloader_program_revisits(uint16_t page)
+{
+    uint8_t cntr;
+    uint32_t offset;
+    uint32_t address;
+    uint8_t start_byte;
+    uint8_t window;
+    
+    //Remember where we are in the file
+    offset = hex_file_offset;
+    address = extended_linear_address;
+    start_byte = start_from_byte_next;
+    window = record_window;
+    
+    for(cntr=0; cntr<page_revisit_count; ++cntr)
+    {
+        if(page_revisits[cntr].page==page)
+        {
+            hex_file_offset = _bootloader_get_bytes(page_revisits[cntr].offset, 3);
+            extended_linear_address = _bootloader_get_bytes(page_revisits[cntr].baseAddress, 3);
+            record_window = page_revisits[cntr].window;
+            start_from_byte_next = 0;
+            if(_bootloader_program_run(&page, 0)==PROGRAM_RUN_ERROR)
+            {
+                break;
+            }
+        }
+    }
+    
+    //Continue in file order
+    hex_file_offset = offset;
+    extended_linear_address = address;
+    start_from_byte_next = start_byte;
+    record_window = window;
+}
+
+//Keeps track of pages that are written to again after the file has moved on to another page
+static void _bootloader_index_record(uint32_t address, uint8_t length)
+{
+    uint16_t page;
+    uint16_t last_page;
+    
+    last_page = internalFlash_pageFromAddress(address+length-1);
+    for(page=internalFlash_pageFromAddress(address); page<=last_page; ++page)
+    {
+        //Same run of records
+        if(page==index_previous_page)
+        {
+            continue;
+        }
+        index_previous_page = page;
+        
+        //First time we see this page
+        if(!_bootloader_get_page_flag(pages_seen, page))
+        {
+            _bootloader_set_page_flag(pages_seen, page);
+            continue;
+        }
+        
+        //Page is revisited
+        if(page_revisit_count<BOOTLOADER_MAXIMUM_PAGE_REVISITS)
+        {
+            _bootloader_put_bytes(page_revisits[page_revisit_count].offset, hex_file_offset, 3);
+            _bootloader_put_bytes(page_revisits[page_revisit_count].baseAddress, extended_linear_address, 3);
+            page_revisits[page_revisit_count].window = record_window;
+            page_revisits[page_revisit_count].page = (uint8_t) page;
+            ++page_revisit_count;
+        }
+        else
+        {
+            //Too many. This page will be erased and written more than once
+            _bootloader_set_page_flag(pages_not_coalesced, page);
+        }
+    }
+}
+
+static uint8_t _bootloader_get_page_flag(uint8_t *map, uint16_t page)
+{
+    page -= BOOTLOADER_FIRST_PAGE;
+    return (map[page>>3] >> (page&0x07)) & 0x01;
+}
+
+static void _bootloader_set_page_flag(uint8_t *map, uint16_t page)
+{
+    page -= BOOTLOADER_FIRST_PAGE;
+    map[page>>3] |= (1 << (page&0x07));
+}
+
+static void _bootloader_commit_page(uint16_t page)
+{
+    //Erasing is slow. Skip it if the new data can be written by clearing bits only
+    if(internalFlash_pageNeedsErase(page))
+    {
+        internalFlash_erasePage(page);
+        ++flash_pages_erased;
+    }
+    flash_blocks_written += internalFlash_writePage(page);
+    ++flash_pages_written;
+}
+
+//Reads a page back right after it has been written. The page buffer still holds the data,
+//so blocks that did not take are written again from there. Returns 0 if that does not help either
+static uint8_t _bootloader_verify_page(uint16_t page)
+{
+    uint32_t address;
+    
+    //The flash driver leaves pages outside the image alone, see _bootloader_image_start()
+    address = internalFlash_addressFromPage(page);
+    if((address<_bootloader_image_start()) || (address>=_bootloader_image_end()))
+    {
+        return 1;
+    }
+    
+    while(internalFlash_compareBuffer(page))
+    {
+        verify_failed_page = page;
+        if(verify_retries>=BOOTLOADER_MAXIMUM_VERIFY_RETRIES)
+        {
+            //Give up. Image remains marked as incomplete
+            last_error = ShortRecordErrorVerify;
+            return 0;
+        }
+        ++verify_retries;
+        _bootloader_commit_page(page);
+    }
+    return 1;
+}
+
+static compareResult_t _bootloader_verify_program_memory(uint32_t addressOffset, HexFileEntry_t *hexFileEntry)
+{
+    uint8_t buffer[16];
+    uint32_t address; 
+    uint8_t cntr;
+    
+    //Calculate address
+    address = addressOffset + hexFileEntry->address;
+    
+    //Read from internal flash into buffer
+    internalFlash_read(address, hexFileEntry->dataLength, buffer);
+    
+    for(cntr=0; cntr<hexFileEntry->dataLength; ++cntr)
+    {
+        if(hexFileEntry->data[cntr] != buffer[cntr])
+        {
+            return COMPARE_RESULT_DATA_DOES_NOT_MATCH;
+        }
+    }
+    
+    //If we get to here, all bytes match
+    return COMPARE_RESULT_DATA_MATCHES;
+}
+
+//Compares the configuration bits in the current record, if any, with the device's
+static compareResult_t _bootloader_verify_configuration_bits(uint32_t address)
+{
+    uint8_t cntr;
+    uint8_t device_configuration[BOOTLOADER_CONFIGURATIONBITS_SIZE];
+    
+    //Device's configuration words
+    internalFlash_read(BOOTLOADER_CONFIGURATIONBITS_ADDRESS_MIN, BOOTLOADER_CONFIGURATIONBITS_SIZE, device_configuration);
+    for(cntr=0; cntr<hex_file_entry.dataLength; ++cntr)
+    {
+        if(((address+cntr)<BOOTLOADER_CONFIGURATIONBITS_ADDRESS_MIN) || ((address+cntr)>BOOTLOADER_CONFIGURATIONBITS_ADDRESS_MAX))
+        {
+            continue;
+        }
+        if(hex_file_entry.data[cntr] != device_configuration[(uint8_t) (address+cntr-BOOTLOADER_CONFIGURATIONBITS_ADDRESS_MIN)])
+        {
+            return COMPARE_RESULT_DATA_DOES_NOT_MATCH;
+        }
+    }
+    
+    return COMPARE_RESULT_DATA_MATCHES;
+}
+
+//CRC-16 (CCITT), also used by the API to check data received
+uint16_t bootloader_crc(uint8_t *data, uint16_t length, uint16_t crc)
+{
+    uint16_t cntr;
+    
+    for(cntr=0; cntr<length; ++cntr)
+    {
+        crc = (crc<<4) ^ crc_table[(crc>>12) ^ (data[cntr]>>4)];
+        crc = (crc<<4) ^ crc_table[(crc>>12) ^ (data[cntr]&0x0F)];
+    }
+    
+    return crc;
+}
+
+static uint32_t _bootloader_image_start(void)
+{
+    uint32_t address;
+    
+    //Image covers entire pages
+    address = internalFlash_addressFromPage(internalFlash_pageFromAddress(file_minimum_address));
+    if(address<PROG_START)
+    {
+        address = PROG_START;
+    }
+    return address;
+}
+
+static uint32_t _bootloader_image_end(void)
+{
+    uint32_t address;
+    uint32_t limit;
+    
+    //Image covers entire pages but never the configuration bits' page
+    address = internalFlash_addressFromPage(internalFlash_pageFromAddress(file_maximum_address)+1);
+    limit = internalFlash_addressFromPage(internalFlash_pageFromAddress(BOOTLOADER_CONFIGURATIONBITS_ADDRESS_MIN));
+    if(address>limit)
+    {
+        address = limit;
+    }
+    return address;
+}
+
+static void _bootloader_write_image_descriptor(uint8_t state)
+{
+    uint32_t start;
+    uint32_t end;
+    uint8_t descriptor[EEPROM_IMAGE_DESCRIPTOR_SIZE];
+    
+    start = _bootloader_image_start();
+    end = _bootloader_image_end();
+    
+    descriptor[0] = HIGH_BYTE(IMAGE_DESCRIPTOR_MAGIC);
+    descriptor[1] = LOW_BYTE(IMAGE_DESCRIPTOR_MAGIC);
+    descriptor[2] = state;
+    descriptor[3] = (uint8_t) (start>>16);
+    descriptor[4] = (uint8_t) (start>>8);
+    descriptor[5] = (uint8_t) start;
+    descriptor[6] = (uint8_t) (end>>16);
+    descriptor[7] = (uint8_t) (end>>8);
+    descriptor[8] = (uint8_t) end;
+    descriptor[9] = HIGH_BYTE(image_crc);
+    descriptor[10] = LOW_BYTE(image_crc);
+    descriptor[11] = HIGH_BYTE(image_sample_crc);
+    descriptor[12] = LOW_BYTE(image_sample_crc);
+    descriptor[13] = 0xFF;
+    descriptor[14] = 0xFF;
+    
+    _bootloader_save_image_descriptor(descriptor);
+}
+
+static void _bootloader_save_image_descriptor(uint8_t *descriptor)
+{
+    descriptor[EEPROM_IMAGE_DESCRIPTOR_SIZE-1] = _bootloader_checksum(descriptor, EEPROM_IMAGE_DESCRIPTOR_SIZE-1);
+    
+    //Descriptor occupies exactly one EEPROM page
+    i2c_eeprom_write(EEPROM_IMAGE_DESCRIPTOR_ADDRESS, descriptor, EEPROM_IMAGE_DESCRIPTOR_SIZE);
+}
+
+//Returns the image check result as far as it can be decided from the descriptor alone
+static imageCheckResult_t _bootloader_read_image_descriptor(uint8_t *descriptor, uint32_t *start, uint32_t *end)
+{
+    i2c_eeprom_read(EEPROM_IMAGE_DESCRIPTOR_ADDRESS, descriptor, EEPROM_IMAGE_DESCRIPTOR_SIZE);
+    
+    //Erased EEPROM. Image has not been programmed by this bootloader
+    if((descriptor[0]==0xFF) && (descriptor[1]==0xFF))
+    {
+        return IMAGE_CHECK_RESULT_NO_DESCRIPTOR;
+    }
+    
+    //Corrupt descriptor or programming has been interrupted
+    if((_bootloader_checksum(descriptor, EEPROM_IMAGE_DESCRIPTOR_SIZE)!=0) || (descriptor[0]!=HIGH_BYTE(IMAGE_DESCRIPTOR_MAGIC)) || (descriptor[1]!=LOW_BYTE(IMAGE_DESCRIPTOR_MAGIC)))
+    {
+        return IMAGE_CHECK_RESULT_INCOMPLETE;
+    }
+    if(descriptor[2]!=IMAGE_STATE_VALID)
+    {
+        return IMAGE_CHECK_RESULT_INCOMPLETE;
+    }
+    
+    *start = descriptor[3];
+    *start <<= 8;
+    *start |= descriptor[4];
+    *start <<= 8;
+    *start |= descriptor[5];
+    *end = descriptor[6];
+    *end <<= 8;
+    *end |= descriptor[7];
+    *end <<= 8;
+    *end |= descriptor[8];
+    
+    return IMAGE_CHECK_RESULT_OK;
+}
+
+static void _bootloader_image_crc_step(void)
+{
+    uint8_t *buffer;
+    
+    //One page per call so that USB and user interface keep running
+    internalFlash_readPage(image_crc_page);
+    buffer = internalFlash_getBuffer();
+    image_crc = bootloader_crc(buffer, 1024, image_crc);
+    image_sample_crc = bootloader_crc(&buffer[1024-BOOTLOADER_CRC_SAMPLE_SIZE], BOOTLOADER_CRC_SAMPLE_SIZE, image_sample_crc);
+    ++image_crc_page;
+    
+    if(internalFlash_addressFromPage(image_crc_page) >= _bootloader_image_end())
+    {
+        //Image is complete. Save descriptor
+        _bootloader_write_image_descriptor(IMAGE_STATE_VALID);
+        image_crc_pending = 0;
+        //Nothing left to resume
+        _bootloader_journal_clear();
+        //Change mode
+        os.bootloader_mode = BOOTLOADER_MODE_DONE;
+        os.display_mode = DISPLAY_MODE_BOOTLOADER_DONE;
+    }
+}
+
+uint8_t bootloader_normal_mode(void)
+{
+    uint8_t boot_control[EEPROM_BOOT_CONTROL_SIZE];
+    
+    //Read the entire boot control record at once
+    i2c_eeprom_read(EEPROM_BOOT_CONTROL_ADDRESS, boot_control, EEPROM_BOOT_CONTROL_SIZE);
+    
+    if(boot_control[0]==BOOTLOADER_BYTE_FORCE_BOOTLOADER_MODE)
+    {
+        //Change value so we don't start in bootloader mode indefinitely
+        i2c_eeprom_writeByte(EEPROM_BOOTLOADER_BYTE_ADDRESS, 0x00);
+        //But start in bootloader mode this time
+        return 0;
+    }
+    else if(boot_control[0]==BOOTLOADER_BYTE_FORCE_NORMAL_MODE)
+    {
+        //Change value so we don't start in normal mode indefinitely
+        i2c_eeprom_writeByte(EEPROM_BOOTLOADER_BYTE_ADDRESS, 0x00);
+        //But start in normal mode this time
+        return 1;
+    }
+    
+    //Fast boot: Don't wait for the display unit, don't check the pushbutton
+    //Bootloader mode can then only be entered via the bootloader byte
+    if(boot_control[1]==BOOT_OPTIONS_FAST_BOOT)
+    {
+        return 1;
+    }
+    
+    //The pushbutton is on the display unit. Wait for it to be powered up
+    system_wait_for_display_unit();
+    
+    //A poor man's pull-up resistor
+    //Force the pushbutton pin high for just an instant before reading it
+    //This has no effect if a display unit is connected 
+    //But it makes sure we start in normal mode if the pin is left floating
+    PUSHBUTTON_LAT = 1;
+    PUSHBUTTON_TRIS = PIN_OUTPUT;
+    PUSHBUTTON_TRIS = PIN_INPUT;
+    
+    if(!PUSHBUTTON_PIN) //Button is pressed
+    {
+        //Bootloader mode if pushbutton is pressed
+        return 0;
+    }
+    else
+    {
+        //Normal program
+        return 1;
+    }
+}
+
+imageCheckResult_t bootloader_check_image(void)
+{
+    imageCheckResult_t result;
+    uint32_t start;
+    uint32_t end;
+    uint32_t address;
+    uint16_t crc;
+    uint16_t sample_crc;
+    uint8_t *buffer;
+    uint8_t sample[BOOTLOADER_CRC_SAMPLE_SIZE];
+    uint8_t descriptor[EEPROM_IMAGE_DESCRIPTOR_SIZE];
+    
+    result = _bootloader_read_image_descriptor(descriptor, &start, &end);
+    if(result!=IMAGE_CHECK_RESULT_OK)
+    {
+        return result;
+    }
+    
+    //Cheap check first: Only the last block of every page
+    //Pages are written front to back so this also catches a partially written page
+    sample_crc = 0xFFFF;
+    for(address=start; address<end; address+=1024)
+    {
+        internalFlash_read(address+1024-BOOTLOADER_CRC_SAMPLE_SIZE, BOOTLOADER_CRC_SAMPLE_SIZE, sample);
+        sample_crc = bootloader_crc(sample, BOOTLOADER_CRC_SAMPLE_SIZE, sample_crc);
+    }
+    if((descriptor[11]==HIGH_BYTE(sample_crc)) && (descriptor[12]==LOW_BYTE(sample_crc)))
+    {
+        return IMAGE_CHECK_RESULT_OK;
+    }
+    
+    //Sampled CRC doesn't match. Check the entire image
+    crc = 0xFFFF;
+    buffer = internalFlash_getBuffer();
+    for(address=start; address<end; address+=1024)
+    {
+        internalFlash_readPage(internalFlash_pageFromAddress(address));
+        crc = bootloader_crc(buffer, 1024, crc);
+    }
+    if((descriptor[9]!=HIGH_BYTE(crc)) || (descriptor[10]!=LOW_BYTE(crc)))
+    {
+        return IMAGE_CHECK_RESULT_CRC_ERROR;
+    }
+    
+    //Image is fine after all. Update the cached sample CRC for next time
+    descriptor[11] = HIGH_BYTE(sample_crc);
+    descriptor[12] = LOW_BYTE(sample_crc);
+    _bootloader_save_image_descriptor(descriptor);
+    
+    return IMAGE_CHECK_RESULT_OK;
+}
+
+//Two's complement checksum, just like in a hex file
+//Returns zero when run over data that includes a valid checksum
+static uint8_t _bootloader_checksum(uint8_t *data, uint8_t length)
+{
+    uint8_t cntr;
+    uint8_t checksum = 0;
+    
+    for(cntr=0; cntr<length; ++cntr)
+    {
+        checksum += data[cntr];
+    }
+    
+    return (~checksum) + 1;
+}
+
+//Big endian, most significant byte first
+static void _bootloader_put_bytes(uint8_t *destination, uint32_t value, uint8_t length)
+{
+    while(length)
+    {
+        --length;
+        destination[length] = (uint8_t) value;
+        value >>= 8;
+    }
+}
+
+static uint32_t _bootloader_get_bytes(uint8_t *source, uint8_t length)
+{
+    uint8_t cntr;
+    uint32_t value = 0;
+    
+    for(cntr=0; cntr<length; ++cntr)
+    {
+        value <<= 8;
+        value |= source[cntr];
+    }
+    
+    return value;
+}
+
+//The first 12 bytes of the journal. They tell which file it belongs to
+static void _bootloader_journal_identity(uint8_t *journal, rootEntry_t *root)
+{
+    journal[0] = PROGRAMMING_JOURNAL_MAGIC;
+    journal[1] = file_number;
+    _bootloader_put_bytes(&journal[2], root->firstCluster, 2);
+    _bootloader_put_bytes(&journal[4], root->fileSize, 4);
+    _bootloader_put_bytes(&journal[8], root->modifiedDate, 2);
+    _bootloader_put_bytes(&journal[10], root->modifiedTime, 2);
+}
+
+static void _bootloader_journal_save(void)
+{
+    uint8_t journal[EEPROM_PROGRAMMING_JOURNAL_SIZE];
+    rootEntry_t root;
+    
+    fat_get_file_information(file_number, &root);
+    _bootloader_journal_identity(journal, &root);
+    
+    //Everything needed to pick up at the next page
+    _bootloader_put_bytes(&journal[12], hex_file_offset, 3);
+    journal[15] = (record_window<<4) | start_from_byte_next;
+    _bootloader_put_bytes(&journal[16], extended_linear_address, 3);
+    _bootloader_put_bytes(&journal[19], hex_file_entries, 2);
+    _bootloader_put_bytes(&journal[21], total_hex_file_entries, 2);
+    _bootloader_put_bytes(&journal[23], flash_pages_written, 2);
+    _bootloader_put_bytes(&journal[25], file_minimum_address, 3);
+    _bootloader_put_bytes(&journal[28], file_maximum_address, 3);
+    journal[31] = _bootloader_checksum(journal, EEPROM_PROGRAMMING_JOURNAL_SIZE-1);
+    
+    i2c_eeprom_write(EEPROM_PROGRAMMING_JOURNAL_ADDRESS, journal, EEPROM_PROGRAMMING_JOURNAL_SIZE);
+}
+
+//Returns 1 if an interrupted programming run of the current file can be resumed
+static uint8_t _bootloader_journal_resume(void)
+{
+    uint8_t journal[EEPROM_PROGRAMMING_JOURNAL_SIZE];
+    uint8_t journal_file[12];
+    uint8_t cntr;
+    rootEntry_t root;
+    
+    i2c_eeprom_read(EEPROM_PROGRAMMING_JOURNAL_ADDRESS, journal, EEPROM_PROGRAMMING_JOURNAL_SIZE);
+    
+    //No (valid) journal
+    if((journal[0]!=PROGRAMMING_JOURNAL_MAGIC) || (_bootloader_checksum(journal, EEPROM_PROGRAMMING_JOURNAL_SIZE)!=0))
+    {
+        return 0;
+    }
+    
+    //Journal must belong to the file we have just found
+    fat_get_file_information(file_number, &root);
+    _bootloader_journal_identity(journal_file, &root);
+    for(cntr=0; cntr<12; ++cntr)
+    {
+        if(journal_file[cntr]!=journal[cntr])
+        {
+            return 0;
+        }
+    }
+    
+    //Restore progress
+    hex_file_offset = _bootloader_get_bytes(&journal[12], 3);
+    record_window = journal[15] >> 4;
+    start_from_byte_next = journal[15] & 0x0F;
+    extended_linear_address = _bootloader_get_bytes(&journal[16], 3);
+    hex_file_entries = (uint16_t) _bootloader_get_bytes(&journal[19], 2);
+    total_hex_file_entries = (uint16_t) _bootloader_get_bytes(&journal[21], 2);
+    flash_pages_written = (uint16_t) _bootloader_get_bytes(&journal[23], 2);
+    file_minimum_address = _bootloader_get_bytes(&journal[25], 3);
+    file_maximum_address = _bootloader_get_bytes(&journal[28], 3);
+    
+    //Start reading the file from its beginning again
+    fast_read_cluster = root.firstCluster;
+    fast_read_cluster_number = 0;
+    
+    return 1;
+}
+
+static void _bootloader_journal_clear(void)
+{
+    i2c_eeprom_writeByte(EEPROM_PROGRAMMING_JOURNAL_ADDRESS, 0x00);
+}
+
+uint32_t bootloader_get_file_size(void)
+{
+    return hex_file_size;
+}
+
+uint16_t bootloader_get_entries(void)
+{
+    return hex_file_entries;
+}
+
+uint16_t bootloader_get_total_entries(void)
+{
+    return total_hex_file_entries;
+}
+
+ShortRecordError_t bootloader_get_error(void)
+{
+    return last_error;
+}
+
+uint16_t bootloader_get_rec_dataLength(void)
+{
+    return hex_file_entry.dataLength;
+}
 
 uint16_t bootloader_get_rec_address(void)
 {
@@ -514,4 +1720,24 @@ uint8_t bootloader_get_rec_checksumCheck(void)
 uint16_t bootloader_get_flashPagesWritten(void)
 {
     return flash_pages_written;
-}
\ No newline at end of file
+}
+
+uint16_t bootloader_get_flashPagesErased(void)
+{
+    return flash_pages_erased;
+}
+
+uint16_t bootloader_get_flashBlocksWritten(void)
+{
+    return flash_blocks_written;
+}
+
+uint16_t bootloader_get_verifyFailedPage(void)
+{
+    return verify_failed_page;
+}
+
+uint8_t bootloader_get_verifyRetries(void)
+{
+    return verify_retries;
+}
\ No newline at end of file
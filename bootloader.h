@@ -17,11 +17,26 @@ typedef enum ShortRecordError
 	ShortRecordErrorNoNextRecord = 0xD,
 	ShortRecordErrorDataTooLong = 0xC,
     ShortRecordErrorAddressRange = 0xB,        
+    ShortRecordErrorVerify = 0xA,
+    ShortRecordErrorInvalidCharacter = 0x9,
+    ShortRecordErrorImage = 0x8,
+    ShortRecordErrorBaseImage = 0x7,
+    ShortRecordErrorConfigurationBits = 0x6,
 	ShortRecordErrorNoError = 0x0
 } ShortRecordError_t;
 
+typedef enum
+{
+    IMAGE_CHECK_RESULT_OK = 0x00,
+    IMAGE_CHECK_RESULT_NO_DESCRIPTOR = 0x01,
+    IMAGE_CHECK_RESULT_INCOMPLETE = 0x02,
+    IMAGE_CHECK_RESULT_CRC_ERROR = 0x03
+} imageCheckResult_t;
+
 const char bootloader_filename[9] = "FIRMWARE";
 const char bootloader_extension[4] = "HEX";
+//Compressed image, used if there is no hex file
+const char bootloader_compressed_extension[4] = "LZB";
 
 void bootloader_run(uint8_t timeslot);
 uint32_t bootloader_get_file_size(void);
@@ -29,6 +44,20 @@ uint16_t bootloader_get_entries(void);
 uint16_t bootloader_get_total_entries(void);
 ShortRecordError_t bootloader_get_error(void);
 uint16_t bootloader_get_flashPagesWritten(void);
+uint16_t bootloader_get_flashPagesErased(void);
+uint16_t bootloader_get_flashBlocksWritten(void);
+uint16_t bootloader_get_verifyFailedPage(void);
+uint8_t bootloader_get_verifyRetries(void);
+
+//Decides if we should start in bootloader mode or not, from the boot control
+//record in EEPROM and the pushbutton. Returns 0 for bootloader mode, 1 for normal program
+uint8_t bootloader_normal_mode(void);
+
+//Decides if the application image in flash can be started
+imageCheckResult_t bootloader_check_image(void);
+
+//CRC-16 (CCITT). Start with crc=0xFFFF
+uint16_t bootloader_crc(uint8_t *data, uint16_t length, uint16_t crc);
 
 //Functions that give access to last record
 uint16_t bootloader_get_rec_dataLength(void);
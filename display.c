@@ -41,6 +41,11 @@ const char failed_line3_noNextRecord[] = "No next record";
 const char failed_line3_checksum[] = "Checksum error";
 const char failed_line3_dataTooLong[] = "Data too long";
 const char failed_line3_addressRange[] = "Addr. outside range";
+const char failed_line3_verify[] = "Flash verify failed";
+const char failed_line3_invalidCharacter[] = "Invalid character";
+const char failed_line3_image[] = "Invalid image";
+const char failed_line3_baseImage[] = "Wrong base image";
+const char failed_line3_configurationBits[] = "Config bits differ";
 const char failed_line4[] = "Record ";
 
 const char programming_line1[] = "Bootloader Mode";
@@ -62,6 +67,13 @@ const char reboot_line1[] = "Rebooting...";
 
 char display_content[4][20];
 
+//What the LCD is currently showing. Used to only send what has changed
+char display_shadow[4][20];
+
+//Unchanged characters between two changed runs that are still sent along
+//Setting the cursor costs about as much bus time as writing 4 characters
+#define DISPLAY_RUN_MERGE_GAP 4
+
 static void _display_start(void);
 static void _display_search(void);
 static void _display_found(void);
@@ -73,6 +85,8 @@ static void _display_done(void);
 static void _display_rebooting(void);
 static void _display_suspended(void);
 
+static void _display_update_line(uint8_t line);
+
 uint8_t display_get_character(uint8_t line, uint8_t position)
 {
     return display_content[line][position];
@@ -484,6 +498,32 @@ static void _display_failed(void)
             _display_itoa_u32(bootloader_get_rec_address(), &display_content[3][14]);
             break;
             
+        case ShortRecordErrorInvalidCharacter:
+            while(failed_line3_invalidCharacter[cntr])
+            display_content[2][cntr] = failed_line3_invalidCharacter[cntr++];
+            break;
+            
+        case ShortRecordErrorVerify:
+            while(failed_line3_verify[cntr])
+            display_content[2][cntr] = failed_line3_verify[cntr++];
+            break;
+            
+        case ShortRecordErrorImage:
+            while(failed_line3_image[cntr])
+            display_content[2][cntr] = failed_line3_image[cntr++];
+            break;
+            
+        case ShortRecordErrorBaseImage:
+            while(failed_line3_baseImage[cntr])
+            display_content[2][cntr] = failed_line3_baseImage[cntr++];
+            break;
+            
+        case ShortRecordErrorConfigurationBits:
+            while(failed_line3_configurationBits[cntr])
+            display_content[2][cntr] = failed_line3_configurationBits[cntr++];
+            _display_itoa_u32(bootloader_get_rec_address(), &display_content[3][14]);
+            break;
+            
     }
     //Display record number
     cntr = 0;
@@ -564,14 +604,74 @@ static void _display_suspended(void)
         display_content[3][cntr] = suspended_line4[cntr++]; 
 }
 
+//Forget what the LCD is showing so that the next update rewrites everything
+//Needs to be called whenever the display has been cleared or re-initialized
+void display_invalidate(void)
+{
+    uint8_t row;
+    uint8_t col;
+    for(row=0;row<4;++row)
+    {
+        for(col=0;col<20;++col)
+        {
+            //No printable character, never matches display_content
+            display_shadow[row][col] = 0x00;
+        }
+    }
+}
+
+//Send only those parts of a line that differ from what the LCD shows
+static void _display_update_line(uint8_t line)
+{
+    uint8_t pos;
+    uint8_t start;
+    uint8_t end;
+    uint8_t gap;
+    
+    pos = 0;
+    while(pos<20)
+    {
+        //Skip characters that are already on the display
+        if(display_content[line][pos]==display_shadow[line][pos])
+        {
+            ++pos;
+            continue;
+        }
+        
+        //A changed run starts here. Find where it ends
+        start = pos;
+        end = pos;
+        gap = 0;
+        for(++pos; pos<20; ++pos)
+        {
+            if(display_content[line][pos]!=display_shadow[line][pos])
+            {
+                end = pos;
+                gap = 0;
+            }
+            else if(++gap>=DISPLAY_RUN_MERGE_GAP)
+            {
+                //Gap is large enough to justify a new cursor command
+                break;
+            }
+        }
+        
+        //Send cursor plus data for this run only
+        i2c_display_cursor(line, start);
+        i2c_display_write_fixed(&display_content[line][start], end-start+1);
+        
+        //Remember what is now on the display
+        for(; start<=end; ++start)
+        {
+            display_shadow[line][start] = display_content[line][start];
+        }
+    }
+}
+
 void display_update(void)
 {
-    i2c_display_cursor(0, 0);
-    i2c_display_write_fixed(&display_content[0][0], 20);
-    i2c_display_cursor(1, 0);
-    i2c_display_write_fixed(&display_content[1][0], 20);
-    i2c_display_cursor(2, 0);
-    i2c_display_write_fixed(&display_content[2][0], 20);
-    i2c_display_cursor(3, 0);
-    i2c_display_write_fixed(&display_content[3][0], 20);
-}
\ No newline at end of file
+    _display_update_line(0);
+    _display_update_line(1);
+    _display_update_line(2);
+    _display_update_line(3);
+}
@@ -10,6 +10,7 @@
 
 void display_prepare(uint8_t mode);
 void display_update(void);
+void display_invalidate(void);
 
 uint8_t display_get_character(uint8_t line, uint8_t position);
 
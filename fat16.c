@@ -201,10 +201,12 @@ static uint16_t _find_nth_cluster(uint16_t cluster, uint16_t n)
         if(sector != sector_in_buffer)
         {
             flash_sector_read(sector, buffer);
+            sector_in_buffer = sector;
         }
 
         //Read next cluster
         cluster = _read_value_from_offset(offset, buffer);
+        --n;
     }
 
     return cluster;
@@ -792,6 +794,10 @@ uint8_t fat_read_from_file_fast(uint32_t start_byte, uint32_t length, uint8_t *d
     uint16_t read_length;
     uint16_t working_cluster;
     uint16_t needed_cluster;
+    uint8_t return_code;
+    uint32_t profile_start;
+    
+    profile_start = system_profiler_start();
     
     //Calculate number of needed cluster
     needed_cluster = (uint16_t) (start_byte>>9);
@@ -799,66 +805,93 @@ uint8_t fat_read_from_file_fast(uint32_t start_byte, uint32_t length, uint8_t *d
     //Return an error if the provided cluster is already past what we need
     if((*cluster_number) > needed_cluster)
     {
-        return 0xFF;
+        return_code = 0xFF;
     }
+    else
+    {
+        //Find needed cluster
+        (*cluster) = _find_nth_cluster((*cluster), (needed_cluster-(*cluster_number)));
     
-    //Find needed cluster
-    (*cluster) = _find_nth_cluster((*cluster), (needed_cluster-(*cluster_number)));
-    
-    //Update cluster number
-    (*cluster_number) = needed_cluster;
+        //Update cluster number
+        (*cluster_number) = needed_cluster;
 
-    //Only use working cluster from now on
-    //Do no longer update pointers *cluster and *cluster_number
-    working_cluster = (*cluster);
+        //Only use working cluster from now on
+        //Do no longer update pointers *cluster and *cluster_number
+        working_cluster = (*cluster);
     
-    //Calculate offset
-    position = (needed_cluster << 9);    
-    offset = start_byte - position;
+        //Calculate offset
+        position = (needed_cluster << 9);    
+        offset = start_byte - position;
 
-    //Now we know where to start reading data
-    position = 0;
-    while(position < length)
-    {
-        //Do we need another cluster first?
-        if(offset==512)
+        //Now we know where to start reading data
+        position = 0;
+        while(position < length)
         {
-            //Need to get the next cluster cluster
-            working_cluster  = _read_fat(working_cluster);
-            offset = 0;
-        }
+            //Do we need another cluster first?
+            if(offset==512)
+            {
+                //Need to get the next cluster cluster
+                working_cluster  = _read_fat(working_cluster);
+                offset = 0;
+            }
         
-        //Get physical flash sector from logical cluster address
-        sector = _data_sector_from_cluster(working_cluster);
+            //Get physical flash sector from logical cluster address
+            sector = _data_sector_from_cluster(working_cluster);
         
-        //How much data can we/should we write to the current cluster?
-        read_length = 512 - offset; //Maximum we can read from this cluster
-        if(read_length > (length-position))
-        {
-            //Just read all remaining bytes
-            read_length = length - position;
-        }
+            //How much data can we/should we write to the current cluster?
+            read_length = 512 - offset; //Maximum we can read from this cluster
+            if(read_length > (length-position))
+            {
+                //Just read all remaining bytes
+                read_length = length - position;
+            }
         
-        //Read that data
-        flash_partial_read(sector, offset, read_length, &data[position]);
+            //Read that data
+            flash_partial_read(sector, offset, read_length, &data[position]);
         
-        //Update position and offset
-        position += read_length;
-        offset += read_length;
+            //Update position and offset
+            position += read_length;
+            offset += read_length;
+        }
+        return_code = 0x00;
     }
     
-    //Indicate success
-    return 0x00;
+    //Failed calls are measured as well
+    system_profiler_stop(PROFILER_PROBE_FAT_READ, profile_start);
+    return return_code;
 }
 
 uint8_t fat_copy_file(uint8_t file_number, char *name, char *extension)
 {
-    uint32_t file_size;
     uint8_t new_file_number;
-    uint16_t number_of_clusters;
+    uint16_t number_of_sectors;
     uint16_t sector;
     uint8_t return_value;
     
+    return_value = fat_copy_file_open(file_number, name, extension, &new_file_number, &number_of_sectors);
+    if(return_value!=0x00)
+    {
+        return return_value;
+    }
+    
+    //Copy sectors, one by one
+    for(sector=0; sector<number_of_sectors; ++sector)
+    {
+        return_value = fat_copy_file_sector(file_number, new_file_number, sector);
+        if(return_value!=0x00)
+        {
+            return return_value;
+        }
+    }
+    
+    return 0x00;
+}
+
+//Creates the copy of a file. Its content is copied by fat_copy_file_sector(), one sector at a time
+uint8_t fat_copy_file_open(uint8_t file_number, char *name, char *extension, uint8_t *new_file_number, uint16_t *number_of_sectors)
+{
+    uint32_t file_size;
+    
     //Make sure we have a valid file number
     if(file_number>=FBR_ROOT_ENTRIES)
     {
@@ -877,34 +910,44 @@ uint8_t fat_copy_file(uint8_t file_number, char *name, char *extension)
     file_size = fat_get_file_size(file_number);
     
     //Try to create a file
-    new_file_number = fat_create_file(name, extension, file_size);
+    *new_file_number = fat_create_file(name, extension, file_size);
     
     //Make sure we have a valid new file number
-    if(new_file_number>=FBR_ROOT_ENTRIES)
+    if(*new_file_number>=FBR_ROOT_ENTRIES)
     {
         //Return an error
         return 0xFD;
     }
     
     //Calculate number of clusters
-    number_of_clusters = (file_size + BYTES_PER_SECTOR - 1) >> 9;
+    *number_of_sectors = (file_size + BYTES_PER_SECTOR - 1) >> 9;
     
-    //Copy sectors, one by one
-    for(sector=0; sector<number_of_clusters; ++sector)
+    return 0x00;
+}
+
+uint8_t fat_copy_file_sector(uint8_t file_number, uint8_t new_file_number, uint16_t sector)
+{
+    uint8_t return_value;
+    uint32_t profile_start;
+    
+    profile_start = system_profiler_start();
+    
+    if(fat_copy_sector_to_buffer(file_number, sector)!=0x00)
     {
-        return_value = fat_copy_sector_to_buffer(file_number, sector);
-        if(return_value!=0x00)
-        {
-            return 0xFC;
-        }
-        return_value = fat_write_sector_from_buffer(new_file_number, sector);
-        if(return_value!=0x00)
-        {
-            return 0xFB;
-        }
+        return_value = 0xFC;
+    }
+    else if(fat_write_sector_from_buffer(new_file_number, sector)!=0x00)
+    {
+        return_value = 0xFB;
+    }
+    else
+    {
+        return_value = 0x00;
     }
     
-    return 0x00;
+    //Failed calls are measured as well
+    system_profiler_stop(PROFILER_PROBE_FAT_COPY, profile_start);
+    return return_value;
 }
 
 uint8_t fat_resize_file(uint8_t file_number, uint32_t new_file_size)
@@ -968,69 +1011,73 @@ uint8_t fat_modify_file(uint8_t file_number, uint32_t start_byte, uint16_t lengt
     uint16_t sector;
     uint16_t number_of_bytes;
     uint8_t return_code;
+    uint32_t profile_start;
+    
+    profile_start = system_profiler_start();
     
     //Read root entry
     return_code = fat_get_file_information(file_number, &root);
     if(return_code!=0x00)
     {
-        //No valid file, return
-        return return_code;
+        //No valid file, return its error code
     }
-    
-    //Make sure we do not write past file end
-    if(start_byte>root.fileSize)
+    else if(start_byte>root.fileSize)
     {
         //User wants to write at a position beyond end of file
-        return 0xF0;
+        return_code = 0xF0;
     }
-    
-    if((start_byte+length) > root.fileSize)
+    else
     {
-        //User wants to write past end of file. Only write until end of file.
-        length = root.fileSize - start_byte;
-    }
+        if((start_byte+length) > root.fileSize)
+        {
+            //User wants to write past end of file. Only write until end of file.
+            length = root.fileSize - start_byte;
+        }
     
-    //Find first relevant cluster
-    cluster = _find_nth_cluster(root.firstCluster, (start_byte>>9));
+        //Find first relevant cluster
+        cluster = _find_nth_cluster(root.firstCluster, (start_byte>>9));
     
-    //Calculate position. Just blank out the last 9 bits
-    position = start_byte & 0xFFFFFE00;
+        //Calculate position. Just blank out the last 9 bits
+        position = start_byte & 0xFFFFFE00;
     
-    //Calculate offset
-    offset = (uint16_t) (start_byte-position);
+        //Calculate offset
+        offset = (uint16_t) (start_byte-position);
     
-    //Now we know where to start writing data
-    position = 0;
-    while(position < length)
-    {
-        //Do we need another cluster first?
-        if(offset==512)
+        //Now we know where to start writing data
+        position = 0;
+        while(position < length)
         {
-            //Find the next cluster
-            cluster = _read_fat(cluster);
-            //Reset offset
-            offset = 0;
-        }
+            //Do we need another cluster first?
+            if(offset==512)
+            {
+                //Find the next cluster
+                cluster = _read_fat(cluster);
+                //Reset offset
+                offset = 0;
+            }
         
-        //Get physical flash sector from logical cluster address
-        sector = _data_sector_from_cluster(cluster);
+            //Get physical flash sector from logical cluster address
+            sector = _data_sector_from_cluster(cluster);
         
-        //How much data can we/should we write to the current cluster?
-        number_of_bytes = 512 - offset;
-        if(number_of_bytes > (length-position))
-        {
-            number_of_bytes = length - position;
-        }
+            //How much data can we/should we write to the current cluster?
+            number_of_bytes = 512 - offset;
+            if(number_of_bytes > (length-position))
+            {
+                number_of_bytes = length - position;
+            }
         
-        //Write that data
-        flash_partial_write(sector, offset, number_of_bytes, &data[position]);
+            //Write that data
+            flash_partial_write(sector, offset, number_of_bytes, &data[position]);
         
-        //Update position and offset
-        position += number_of_bytes;
-        offset += number_of_bytes;
+            //Update position and offset
+            position += number_of_bytes;
+            offset += number_of_bytes;
+        }
     }
     
-    return 0x00;
+    //Failed calls are measured as well
+    system_profiler_stop(PROFILER_PROBE_FAT_WRITE, profile_start);
+    return return_code;
 }
 
 
@@ -1319,62 +1366,66 @@ formatStatus_t fat_get_format_status(void)
 
 uint8_t fat_format(void)
 {
-    uint16_t cntr;
-    
-    //Write MBR
-    for(cntr=0; cntr<BYTES_PER_SECTOR; ++cntr)
-    {
-        buffer[cntr] = _get_mbr(cntr);
-    }
-    flash_sector_write(MBR_SECTOR, buffer);
+    uint16_t step;
     
-    //Write FBR
-    for(cntr=0; cntr<BYTES_PER_SECTOR; ++cntr)
+    for(step=0; step<FAT_FORMAT_NUMBER_OF_STEPS; ++step)
     {
-        buffer[cntr] = _get_fbr(cntr);
+        fat_format_step(step);
     }
-    flash_sector_write(FBR_SECTOR, buffer);
     
-    //Write first FAT sector
-    for(cntr=0; cntr<BYTES_PER_SECTOR; ++cntr)
-    {
-        buffer[cntr] = _get_fat(cntr);
-    }
-    flash_sector_write(FAT_FIRST_SECTOR, buffer);
+    return 0x00;
+}
+
+//Writes one of the sectors of a freshly formated drive
+//The root directory goes first so that no files are found on a partly formated drive
+uint8_t fat_format_step(uint16_t step)
+{
+    uint16_t cntr;
+    uint16_t sector;
+    uint32_t profile_start;
     
-    //Fill remaining FAT sectors (all zeros)
-    for(cntr=0; cntr<BYTES_PER_SECTOR; ++cntr)
-    {
-        buffer[cntr] = 0x00;
-    }
-    for(cntr=FAT_FIRST_SECTOR+1; cntr<=FAT_LAST_SECTOR; ++cntr)
-    {
-        flash_sector_write(cntr, buffer);
-    }
+    profile_start = system_profiler_start();
     
-    //Write first root sector
-    for(cntr=0; cntr<BYTES_PER_SECTOR; ++cntr)
+    if(step<(ROOT_LAST_SECTOR-ROOT_FIRST_SECTOR+1))
     {
-        buffer[cntr] = _get_root(cntr);
+        sector = ROOT_FIRST_SECTOR + step;
     }
-    flash_sector_write(ROOT_FIRST_SECTOR, buffer);
-    
-    //Fill remaining root sectors (all zeros)
-    for(cntr=0; cntr<BYTES_PER_SECTOR; ++cntr)
-    {
-        buffer[cntr] = 0x00;
-    }
-    for(cntr=ROOT_FIRST_SECTOR+1; cntr<=ROOT_LAST_SECTOR; ++cntr)
+    else
     {
-        flash_sector_write(cntr, buffer);
+        sector = step - (ROOT_LAST_SECTOR-ROOT_FIRST_SECTOR+1);
+        if(sector>=ROOT_FIRST_SECTOR)
+        {
+            sector += ROOT_LAST_SECTOR-ROOT_FIRST_SECTOR+1;
+        }
     }
     
-    //Write Data of hello world file
     for(cntr=0; cntr<BYTES_PER_SECTOR; ++cntr)
     {
-        buffer[cntr] = _get_data(cntr);
+        switch(sector)
+        {
+            case MBR_SECTOR:
+                buffer[cntr] = _get_mbr(cntr);
+                break;
+            case FBR_SECTOR:
+                buffer[cntr] = _get_fbr(cntr);
+                break;
+            case FAT_FIRST_SECTOR:
+                buffer[cntr] = _get_fat(cntr);
+                break;
+            case ROOT_FIRST_SECTOR:
+                buffer[cntr] = _get_root(cntr);
+                break;
+            case DATA_FIRST_SECTOR:
+                //Data of hello world file
+                buffer[cntr] = _get_data(cntr);
+                break;
+            default:
+                //Remaining FAT and root sectors (all zeros)
+                buffer[cntr] = 0x00;
+        }
     }
-    flash_sector_write(DATA_FIRST_SECTOR, buffer);
+    flash_sector_write(sector, buffer);
+    system_profiler_stop(PROFILER_PROBE_FAT_FORMAT, profile_start);
     
     return 0x00;
 }
@@ -1462,37 +1513,45 @@ uint8_t fat_write_sector_from_buffer(uint8_t file_number, uint16_t sector)
     uint16_t number_of_clusters;
     uint16_t cluster;
     uint16_t physical_sector;
+    uint8_t return_code;
+    uint32_t profile_start;
+    
+    profile_start = system_profiler_start();
     
     //Check if we have a valid file
     if(_root_is_available(file_number))
     {
-        //Return an error
-        return 0xFF;
+        return_code = 0xFF;
     }
-    
-    //Get file size
-    file_size = fat_get_file_size(file_number);
-    
-    //Check if sector is valid
-    number_of_clusters = (file_size + BYTES_PER_SECTOR - 1) >> 9;
-    if(sector >= number_of_clusters)
+    else
     {
-        //Return an error
-        return 0xFE;
-    }
+        //Get file size
+        file_size = fat_get_file_size(file_number);
     
-    //Get the right cluster
-    cluster = _get_first_cluster(file_number);
-    //cluster = _find_nth_cluster(cluster, sector);
+        //Check if sector is valid
+        number_of_clusters = (uint16_t) ((file_size + BYTES_PER_SECTOR - 1) >> 9);
+        if(sector >= number_of_clusters)
+        {
+            return_code = 0xFE;
+        }
+        else
+        {
+            //Get the right cluster
+            cluster = _get_first_cluster(file_number);
+            cluster = _find_nth_cluster(cluster, sector);
     
-    //Find physical sector
-    //physical_sector = _data_sector_from_cluster(cluster);
+            //Find physical sector
+            physical_sector = _data_sector_from_cluster(cluster);
     
-    //Write buffer to that sector
-    //flash_write_page_from_buffer(physical_sector);
+            //Write buffer to that sector
+            flash_write_page_from_buffer(physical_sector);
+            return_code = 0x00;
+        }
+    }
     
-    //Return success
-    return 0x00;
+    //Failed calls are measured as well
+    system_profiler_stop(PROFILER_PROBE_FAT_WRITE, profile_start);
+    return return_code;
 }
 
 void fat_read_from_buffer(uint16_t start, uint16_t length, uint8_t *data)
@@ -1503,4 +1562,4 @@ void fat_read_from_buffer(uint16_t start, uint16_t length, uint8_t *data)
 void fat_write_to_buffer(uint16_t start, uint16_t length, uint8_t *data)
 {
     flash_write_to_buffer(start, length, data);
-}
\ No newline at end of file
+}
\ No newline at end of file
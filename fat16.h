@@ -33,6 +33,8 @@
 #define DATA_NUMBER_OF_SECTORS 8154
 #define BYTES_PER_SECTOR 512
 #define CLUSTERS_PER_FAT_SECTOR 256
+//Formating writes all sectors up to and including the first data sector, one per step
+#define FAT_FORMAT_NUMBER_OF_STEPS (DATA_FIRST_SECTOR+1)
 
 //MBR specifics
 #define MRB_PARTITION_STATUS 0x80
@@ -99,6 +101,7 @@ typedef enum
 void fat_init(void);
 formatStatus_t fat_get_format_status(void);
 uint8_t fat_format(void);
+uint8_t fat_format_step(uint16_t step);
 uint8_t fat_find_file(char *name, char *extension);
 uint8_t fat_get_file_information(uint8_t file_number, rootEntry_t *data);
 uint32_t fat_get_file_size(uint8_t file_number);
@@ -111,6 +114,8 @@ uint8_t fat_rename_file(uint8_t file_number, char *name, char *extension);
 uint8_t fat_read_from_file(uint8_t file_number, uint32_t start_byte, uint32_t length, uint8_t *data);
 uint8_t fat_read_from_file_fast(uint32_t start_byte, uint32_t length, uint8_t *data, uint16_t *cluster, uint16_t *cluster_number);
 uint8_t fat_copy_file(uint8_t file_number, char *name, char *extension);
+uint8_t fat_copy_file_open(uint8_t file_number, char *name, char *extension, uint8_t *new_file_number, uint16_t *number_of_sectors);
+uint8_t fat_copy_file_sector(uint8_t file_number, uint8_t new_file_number, uint16_t sector);
 
 //Read or write access via FLASH_BUFFER_2
 uint8_t fat_copy_sector_to_buffer(uint8_t file_number, uint16_t sector);
@@ -442,6 +442,10 @@ void flash_set_power_state(flashPowerState_t new_power_state)
 //Reads one full 512byte page from flash
 void flash_sector_read(uint16_t page, uint8_t *data)
 {
+    uint32_t profile_start;
+    
+    profile_start = system_profiler_start();
+    
     //Set configuration
     spi_set_configuration(SPI_CONFIGURATION_INTERNAL);
     
@@ -450,6 +454,8 @@ void flash_sector_read(uint16_t page, uint8_t *data)
     
     //Reset configuration
     spi_set_configuration(SPI_CONFIGURATION_EXTERNAL);
+    
+    system_profiler_stop(PROFILER_PROBE_FLASH_READ, profile_start);
 }
 
 //Writes one full 512 byte page to flash
@@ -457,6 +463,9 @@ void flash_sector_read(uint16_t page, uint8_t *data)
 void flash_sector_write(uint16_t page, uint8_t *data)
 {
     flashMatchResult_t match;
+    uint32_t profile_start;
+    
+    profile_start = system_profiler_start();
     
     //Set configuration
     spi_set_configuration(SPI_CONFIGURATION_INTERNAL);
@@ -475,11 +484,17 @@ void flash_sector_write(uint16_t page, uint8_t *data)
     
     //Reset configuration
     spi_set_configuration(SPI_CONFIGURATION_EXTERNAL);
+    
+    system_profiler_stop(PROFILER_PROBE_FLASH_WRITE, profile_start);
 }
 
 //Reads a partial page from flash
 void flash_partial_read(uint16_t page, uint16_t start, uint16_t length, uint8_t *data)
 {
+    uint32_t profile_start;
+    
+    profile_start = system_profiler_start();
+    
     //Set configuration
     spi_set_configuration(SPI_CONFIGURATION_INTERNAL);
     
@@ -488,6 +503,8 @@ void flash_partial_read(uint16_t page, uint16_t start, uint16_t length, uint8_t
     
     //Reset configuration
     spi_set_configuration(SPI_CONFIGURATION_EXTERNAL);
+    
+    system_profiler_stop(PROFILER_PROBE_FLASH_READ, profile_start);
 }
 
 //Writes a partial page to flash
@@ -495,6 +512,9 @@ void flash_partial_read(uint16_t page, uint16_t start, uint16_t length, uint8_t
 void flash_partial_write(uint16_t page, uint16_t start, uint16_t length, uint8_t *data)
 {
     flashMatchResult_t match;
+    uint32_t profile_start;
+    
+    profile_start = system_profiler_start();
     
     //Set configuration
     spi_set_configuration(SPI_CONFIGURATION_INTERNAL);
@@ -519,6 +539,8 @@ void flash_partial_write(uint16_t page, uint16_t start, uint16_t length, uint8_t
     
     //Reset configuration
     spi_set_configuration(SPI_CONFIGURATION_EXTERNAL);
+    
+    system_profiler_stop(PROFILER_PROBE_FLASH_WRITE, profile_start);
 }
 
 void flash_copy_page_to_buffer(uint16_t page)
@@ -3,106 +3,142 @@
 #include <stdint.h>
 #include "hex.h"
 
-static uint8_t hexCharToUint8(char c);
-static uint8_t hexCharsToUint8(char c1, char c2);
-static uint16_t hexCharsToUint16(char c1, char c2, char c3, char c4);
+#define HEX_INVALID_CHARACTER 0xFF
 
-//Takes a single hexadecimal character and returns the corresponding value in the range [0,15]
-static uint8_t hexCharToUint8(char c)
+static uint8_t hexDecodeBytes(char *data, uint8_t *bytes, uint8_t count, uint8_t *checksum);
+
+//Value of every ASCII character as a hexadecimal digit. HEX_INVALID_CHARACTER if it isn't one
+const uint8_t hexDigitTable[256] =
+{
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+//Decodes pairs of hexadecimal characters into bytes and adds them to the checksum
+//Returns HEX_INVALID_CHARACTER if any of the characters is not a hexadecimal digit
+static uint8_t hexDecodeBytes(char *data, uint8_t *bytes, uint8_t count, uint8_t *checksum)
 {
-	uint8_t ascii = (uint8_t)c;
+	uint8_t i;
+	uint8_t high;
+	uint8_t low;
 
-	//a,b,c,d,e,f
-	if (ascii >= 97)
-	{
-		ascii -= 87;
-	}
-	//A,B,C,D,E,F
-	else if (ascii >= 65)
-	{
-		ascii -= 55;
-	}
-	//0,1,2,3,4,5,6,7,8,9
-	else
-	{
-		ascii -= 48;
-	}
-		
-	if (ascii > 15)
+	for (i = 0; i < count; ++i)
 	{
-		return 0;
+		high = hexDigitTable[(uint8_t) data[i + i]];
+		low = hexDigitTable[(uint8_t) data[i + i + 1]];
+		if ((high | low) == HEX_INVALID_CHARACTER)
+		{
+			return HEX_INVALID_CHARACTER;
+		}
+		bytes[i] = (high << 4) | low;
+		*checksum += bytes[i];
 	}
-	else
-	{
-		return ascii;
-	}	
-}
-
-//Takes 2 single hexadecimal character and returns the corresponding value in the range [0,255]
-static uint8_t hexCharsToUint8(char c1, char c2)
-{
-	uint8_t retVal = (hexCharToUint8(c1) << 4);
-	retVal |= hexCharToUint8(c2);
-	return retVal;
+	return 0;
 }
 
-static uint16_t hexCharsToUint16(char c1, char c2, char c3, char c4)
-{
-	uint16_t retVal = (hexCharToUint8(c1) << 12);
-	retVal |= (hexCharToUint8(c2) << 8);
-	retVal |= (hexCharToUint8(c3) << 4);
-	retVal |= hexCharToUint8(c4);
-	return retVal;
-}
-
-//Parses the entry of a hex file starting at a given offset
-uint32_t parseHexFileEntry(char *data, uint32_t offset, HexFileEntry_t *hexEntry)
+//Parses one window of a hex file entry
+//data[0] to data[8] hold start code, length, address and record type of the entry
+//data[9] onwards hold the characters of the requested window, i.e. those
+//starting 32*window characters after the first data character
+//Returns RecordContinues if there are more windows, otherwise the offset of the next entry
+uint32_t parseHexFileEntry(char *data, uint8_t window, HexFileEntry_t *hexEntry)
 {
 	uint8_t i;
+	uint8_t sum;
+	uint8_t windows;
+	uint8_t header[4];
+	uint16_t offset;
 
 	//Check for start code
-	if (data[offset] != ':')
+	if (data[0] != ':')
 	{
 		return (uint32_t) RecordErrorStartCode;
 	}
 
-	//Get data length
-	hexEntry->dataLength = hexCharsToUint8(data[offset + 1], data[offset + 2]);
-	if (hexEntry->dataLength > 16)
+	//Get data length, address and record type
+	sum = 0;
+	if (hexDecodeBytes(&data[1], header, 4, &sum))
+	{
+		return (uint32_t) RecordErrorInvalidCharacter;
+	}
+	hexEntry->recordLength = header[0];
+	hexEntry->recordType = (RecordType_t) header[3];
+	hexEntry->window = window;
+	windows = (header[0] + 15) >> 4;
+	if (windows == 0)
+	{
+		windows = 1;
+	}
+	if (window >= windows)
 	{
 		return (uint32_t) RecordErrorDataTooLong;
 	}
-	
-	//Get address
-	hexEntry->address = hexCharsToUint16(data[offset + 3], data[offset + 4], data[offset + 5], data[offset + 6]);
+	hexEntry->address = (((uint16_t) header[1] << 8) | header[2]) + (window << 4);
+	i = header[0] - (window << 4);
+	if (i > 16)
+	{
+		i = 16;
+	}
+	hexEntry->dataLength = i;
 
-	//Get record type
-	hexEntry->recordType = (RecordType_t)hexCharsToUint8(data[offset + 7], data[offset + 8]);
+	//The checksum covers the entire record
+	//It can only be checked if all windows have been parsed in order, each of them once
+	if (window == 0)
+	{
+		hexEntry->checksumCheck = sum;
+		hexEntry->windowsChecked = 0;
+	}
 
 	//Get data
-	for (i = 0; i < hexEntry->dataLength; ++i)
+	sum = 0;
+	if (hexDecodeBytes(&data[9], hexEntry->data, i, &sum))
 	{
-		hexEntry->data[i] = hexCharsToUint8(data[offset + 9 + i + i], data[offset + 10 + i + i]);
+		return (uint32_t) RecordErrorInvalidCharacter;
+	}
+	if (hexEntry->windowsChecked == window)
+	{
+		hexEntry->checksumCheck += sum;
+		++hexEntry->windowsChecked;
+	}
+	else
+	{
+		//Don't check again if the same window is parsed a second time
+		hexEntry->windowsChecked = 0xFF;
+	}
+	if (window + 1 < windows)
+	{
+		return RecordContinues;
 	}
-	
-	//Get checksum
-	hexEntry->checksum = hexCharsToUint8(data[offset + 9 + i + i], data[offset + 10 + i + i]);
 
-	//Calculate checksum check
-	hexEntry->checksumCheck = hexEntry->dataLength;
-	hexEntry->checksumCheck += (hexEntry->address >> 8);
-	hexEntry->checksumCheck += (hexEntry->address & 0xFF);
-	hexEntry->checksumCheck += hexEntry->recordType;
-	for (i = 0; i < hexEntry->dataLength; ++i)
+	//Get checksum
+	sum = 0;
+	if (hexDecodeBytes(&data[9 + i + i], &hexEntry->checksum, 1, &sum))
 	{
-		hexEntry->checksumCheck += hexEntry->data[i];
+		return (uint32_t) RecordErrorInvalidCharacter;
 	}
-	hexEntry->checksumCheck += hexEntry->checksum;
 
 	//Throw an error if checksum does not match
-	if (hexEntry->checksumCheck != 0)
+	if (hexEntry->windowsChecked == windows)
 	{
-		return (uint32_t) RecordErrorChecksum;
+		hexEntry->checksumCheck += sum;
+		if (hexEntry->checksumCheck != 0)
+		{
+			return (uint32_t) RecordErrorChecksum;
+		}
 	}
 
 	//Find offset of the next entry
@@ -113,24 +149,18 @@ uint32_t parseHexFileEntry(char *data, uint32_t offset, HexFileEntry_t *hexEntry
 	}
 	else
 	{
-		offset += 11 + i + i;
-		if (data[++offset] == ':')
-		{
-			return offset;
-		}
-		else if (data[++offset] == ':')
+		offset = 11 + i + i;
+		if (data[++offset] != ':')
 		{
-			return offset;
-		}
-		else if (data[++offset] == ':')
-		{
-			return offset;
-		}
-		else
-		{
-			//There should be another record but there is not
-			return (uint32_t) RecordErrorNoNextRecord;
+			if (data[++offset] != ':')
+			{
+				if (data[++offset] != ':')
+				{
+					//There should be another record but there is not
+					return (uint32_t) RecordErrorNoNextRecord;
+				}
+			}
 		}
+		return offset + ((uint16_t) window << 5);
 	}
 }
-
@@ -26,6 +26,7 @@ typedef enum RecordError
 	RecordErrorChecksum = 0xFFFFFFFE,
 	RecordErrorNoNextRecord = 0xFFFFFFFD,
 	RecordErrorDataTooLong = 0xFFFFFFFC,
+	RecordErrorInvalidCharacter = 0xFFFFFFF9,
 	RecordErrorNoError = 0xFFFFFFF0
 } RecordError_t;
 
@@ -35,6 +36,12 @@ typedef struct FileCheckResult
 	RecordError_t error;
 } FileCheckResult_t;
 
+//Returned while there are more windows of the same record to come
+#define RecordContinues 0xFFFFFFE0
+
+//Records can hold up to 255 data bytes
+//They are parsed in windows of up to 16 data bytes each
+//dataLength, address and data refer to the current window
 typedef struct HexFileEntry
 {
 	uint16_t dataLength;
@@ -43,11 +50,14 @@ typedef struct HexFileEntry
 	uint8_t data[16];
 	uint8_t checksum;
 	uint8_t checksumCheck;
+	uint8_t recordLength;
+	uint8_t window;
+	uint8_t windowsChecked;
 } HexFileEntry_t;
 
 
 //Functions
-uint32_t parseHexFileEntry(char *data, uint32_t offset, HexFileEntry_t *hexEntry);
+uint32_t parseHexFileEntry(char *data, uint8_t window, HexFileEntry_t *hexEntry);
 //void checkFile(char *data, FileCheckResult_t *checkResult);
 
 #endif	/* HEX_H */
@@ -0,0 +1,740 @@
+/*
+ * File:   api_loopback.c
+ *
+ * Replays frames through api_prepare()/api_parse() of the host build of the
+ * firmware (firmware.c) and checks the responses, the way a host talks to the
+ * device via HID or SPI. The main loop is run between frames where the device
+ * would have done so, so queued jobs and checksums progress as on the device.
+ *
+ * Usage: api_loopback
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "api.h"
+#include "application_config.h"
+#include "fat16.h"
+#include "firmware.h"
+
+#define FILE_SIZE 1300
+#define FILE_SECTORS ((FILE_SIZE+511)/512)
+//PROFILER_PROBE_FAT_WRITE and PROFILER_PROBE_FAT_COPY in os.h, whose globals firmware.c defines
+#define PROBE_FAT_WRITE 6
+#define PROBE_FAT_COPY 7
+//BOOTLOADER_MODE_FILE_FOUND and BOOTLOADER_MODE_CHECK_FAILED in os.h, ShortRecordErrorConfigurationBits in bootloader.h
+#define MODE_FILE_FOUND 0x20
+#define MODE_CHECK_FAILED 0x50
+#define ERROR_CONFIGURATION_BITS 0x6
+
+//Budget of the fast boot path. Raise these only on purpose
+#define FAST_BOOT_DELAY_MS 1
+#define FAST_BOOT_EEPROM_READS 2
+
+//Configuration words of the host build's program memory
+static const uint8_t configuration_words[8] = {0xAC, 0xF7, 0xBF, 0xF7, 0xFF, 0xFB, 0xFF, 0xF7};
+
+static uint8_t file_data[FILE_SECTORS*512];
+static uint8_t frame[64];
+static uint8_t response[64];
+static uint32_t frames;
+
+#define CHECK(condition) _check((condition), #condition, __LINE__)
+
+static void _check(int condition, const char *text, int line)
+{
+    int cntr;
+
+    if(!condition)
+    {
+        fprintf(stderr, "Line %d, frame %u: %s\n", line, frames, text);
+        fprintf(stderr, "Response:");
+        for(cntr=0; cntr<64; ++cntr)
+        {
+            fprintf(stderr, " %02X", response[cntr]);
+        }
+        fprintf(stderr, "\n");
+        exit(1);
+    }
+}
+
+//Sends the frame built from the arguments, padded with zeros to 64 bytes
+static void _send(uint8_t length, const uint8_t *data)
+{
+    memset(frame, 0, sizeof(frame));
+    memcpy(frame, data, length);
+    host_transfer(frame, 64, response);
+    ++frames;
+}
+
+#define SEND(...) do { const uint8_t data_[] = {__VA_ARGS__}; _send(sizeof(data_), data_); } while(0)
+
+static void _check_confirmation(uint8_t command, uint8_t index, uint8_t value)
+{
+    CHECK((response[0]==DATAREQUEST_GET_COMMAND_RESPONSE) && (response[1]==0xC1) && (response[2]==0x25));
+    CHECK(response[3]==command);
+    CHECK(response[index]==value);
+}
+
+static uint32_t _get_uint32(uint8_t index)
+{
+    return ((uint32_t) response[index] << 24) | ((uint32_t) response[index+1] << 16) | ((uint32_t) response[index+2] << 8) | response[index+3];
+}
+
+static uint16_t _get_uint16(uint8_t index)
+{
+    return ((uint16_t) response[index] << 8) | response[index+1];
+}
+
+//CRC-16 (CCITT) as bootloader_crc(), computed independently
+static uint16_t _crc16(const uint8_t *data, uint16_t length, uint16_t crc)
+{
+    uint16_t cntr;
+    uint8_t bit;
+
+    for(cntr=0; cntr<length; ++cntr)
+    {
+        crc ^= (uint16_t) data[cntr] << 8;
+        for(bit=0; bit<8; ++bit)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+//CRC-32 as zlib's crc32
+static uint32_t _crc32(const uint8_t *data, uint32_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    uint32_t cntr;
+    uint8_t bit;
+
+    for(cntr=0; cntr<length; ++cntr)
+    {
+        crc ^= data[cntr];
+        for(bit=0; bit<8; ++bit)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+//Fletcher-16, sums modulo 255. Second sum in the high byte
+static uint16_t _fletcher16(const uint8_t *data, uint32_t length)
+{
+    uint32_t cntr;
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+
+    for(cntr=0; cntr<length; ++cntr)
+    {
+        sum1 = (sum1 + data[cntr]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (sum2 << 8) | sum1;
+}
+
+static uint8_t _find_file(const char *name)
+{
+    memset(frame, 0, sizeof(frame));
+    frame[0] = DATAREQUEST_FIND_FILE;
+    memcpy(&frame[1], name, 11);
+    host_transfer(frame, 64, response);
+    ++frames;
+    CHECK(response[0]==DATAREQUEST_FIND_FILE);
+    return response[3];
+}
+
+static uint8_t _create_file(const char *name, uint32_t size)
+{
+    uint8_t file_number;
+
+    memset(frame, 0, sizeof(frame));
+    frame[0] = DATAREQUEST_GET_COMMAND_RESPONSE;
+    frame[1] = COMMAND_FILE_CREATE;
+    memcpy(&frame[2], name, 11);
+    frame[13] = size >> 24;
+    frame[14] = size >> 16;
+    frame[15] = size >> 8;
+    frame[16] = size;
+    frame[17] = 0xBD;
+    frame[18] = 0x4F;
+    host_transfer(frame, 64, response);
+    ++frames;
+    //The confirmation carries the new file's number
+    CHECK(response[3]==COMMAND_FILE_CREATE);
+    file_number = response[4];
+    CHECK(file_number<FBR_ROOT_ENTRIES);
+    CHECK(_find_file(name)==file_number);
+    return file_number;
+}
+
+//Writes sector 0 via the buffer (0x59, 0x58) and the others via bulk write (0x5B-0x5D)
+static void _write_file(uint8_t file_number)
+{
+    uint16_t offset;
+    uint16_t sector;
+    uint16_t sector_crc;
+    uint8_t length;
+    uint8_t sequence;
+
+    for(offset=0; offset<512; offset+=length)
+    {
+        length = (512-offset>56) ? 56 : 512-offset;
+        memset(frame, 0, sizeof(frame));
+        frame[0] = DATAREQUEST_GET_COMMAND_RESPONSE;
+        frame[1] = COMMAND_WRITE_BUFFER;
+        frame[2] = offset >> 8;
+        frame[3] = offset;
+        frame[4] = length;
+        frame[5] = 0xE2;
+        frame[6] = 0x30;
+        memcpy(&frame[7], &file_data[offset], length);
+        host_transfer(frame, 64, response);
+        ++frames;
+        CHECK(response[3]==COMMAND_WRITE_BUFFER);
+    }
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_BUFFER_TO_SECTOR, file_number, 0x00, 0x00, 0x6A, 0x6D);
+    _check_confirmation(COMMAND_BUFFER_TO_SECTOR, 7, 0x00);
+
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_BULK_WRITE_OPEN, file_number, 0x00, 0x01, 0xC7, 0xE1);
+    CHECK(response[3]==COMMAND_BULK_WRITE_OPEN);
+    //Sequence numbers carry on from sector to sector
+    sequence = 0;
+    for(sector=1; sector<FILE_SECTORS; ++sector)
+    {
+        for(offset=0; offset<512; offset+=length)
+        {
+            length = (512-offset>58) ? 58 : 512-offset;
+            memset(frame, 0, sizeof(frame));
+            frame[0] = DATAREQUEST_GET_STATUS;
+            frame[1] = COMMAND_BULK_WRITE_DATA;
+            frame[2] = sequence;
+            frame[3] = length;
+            memcpy(&frame[6], &file_data[512*sector+offset], length);
+            sector_crc = _crc16(&frame[2], 2, 0xFFFF);
+            sector_crc = _crc16(&frame[6], length, sector_crc);
+            frame[4] = sector_crc >> 8;
+            frame[5] = sector_crc;
+            //No confirmation requested, just like SPI_example.py does
+            host_transfer(frame, 64, response);
+            ++frames;
+            ++sequence;
+        }
+        sector_crc = _crc16(&file_data[512*sector], 512, 0xFFFF);
+        SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_BULK_WRITE_COMMIT, sector >> 8, sector, sector_crc >> 8, sector_crc, 0x2A, 0x93);
+        CHECK(response[3]==COMMAND_BULK_WRITE_COMMIT);
+        CHECK(_get_uint16(4)==sector+1);
+        CHECK(response[6]==BULK_WRITE_RESULT_OK);
+    }
+}
+
+//Reads the whole file via the read stream (0x84, 0x85) and compares it
+static void _check_file(uint8_t file_number, const uint8_t *data, uint32_t size)
+{
+    uint32_t position;
+    uint8_t sequence;
+
+    SEND(DATAREQUEST_READ_STREAM_OPEN, file_number, 0x00, 0x00, 0x00, 0x00);
+    position = 0;
+    sequence = 0;
+    while(1)
+    {
+        CHECK(response[0]==DATAREQUEST_READ_STREAM_OPEN || response[0]==DATAREQUEST_READ_STREAM_NEXT);
+        CHECK(response[3]==sequence);
+        CHECK(position+response[4]<=size);
+        CHECK(memcmp(&response[6], &data[position], response[4])==0);
+        position += response[4];
+        if(position==size)
+        {
+            break;
+        }
+        CHECK(response[4]>0);
+        ++sequence;
+        SEND(DATAREQUEST_READ_STREAM_NEXT);
+    }
+}
+
+//Opens the read stream (0x84) at a position of the file
+static void _read_stream_open(uint8_t file_number, uint32_t start)
+{
+    SEND(DATAREQUEST_READ_STREAM_OPEN, file_number, start >> 24, start >> 16, start >> 8, start);
+    CHECK((response[0]==DATAREQUEST_READ_STREAM_OPEN) && (response[1]==0xC1) && (response[2]==0x25));
+}
+
+//Read stream edges: a start within a sector, a chunk lost on the way, the end of the file and invalid files
+static void _check_read_stream_edges(uint8_t file_number)
+{
+    uint32_t position;
+    uint8_t sequence;
+
+    //From the middle of the first sector to the end. Chunks cross sector boundaries, the last one is short
+    position = 500;
+    _read_stream_open(file_number, position);
+    for(sequence=0; position<FILE_SIZE; ++sequence)
+    {
+        if(sequence>0)
+        {
+            SEND(DATAREQUEST_READ_STREAM_NEXT);
+        }
+        CHECK((response[3]==sequence) && (response[5]==0x00));
+        CHECK(response[4]==((FILE_SIZE-position>58) ? 58 : FILE_SIZE-position));
+        CHECK(memcmp(&response[6], &file_data[position], response[4])==0);
+        position += response[4];
+    }
+    //Nothing more at the end of the file, the sequence number stays
+    SEND(DATAREQUEST_READ_STREAM_NEXT);
+    CHECK((response[3]==sequence) && (response[4]==0) && (response[5]==0x00));
+
+    //The host misses chunk 2 and opens the stream again where it started
+    _read_stream_open(file_number, 0);
+    SEND(DATAREQUEST_READ_STREAM_NEXT);
+    SEND(DATAREQUEST_READ_STREAM_NEXT);
+    CHECK(response[3]==2);
+    _read_stream_open(file_number, 2*58);
+    CHECK((response[3]==0) && (response[4]==58));
+    CHECK(memcmp(&response[6], &file_data[2*58], 58)==0);
+    SEND(DATAREQUEST_READ_STREAM_NEXT);
+    CHECK((response[3]==1) && (memcmp(&response[6], &file_data[3*58], 58)==0));
+
+    //Opened at the end of the file or beyond it
+    _read_stream_open(file_number, FILE_SIZE);
+    CHECK((response[3]==0) && (response[4]==0) && (response[5]==0x00));
+    _read_stream_open(file_number, FILE_SIZE+1);
+    CHECK((response[3]==0) && (response[4]==0) && (response[5]==0xFF));
+
+    //No such file. The stream is closed until opened again
+    _read_stream_open(FBR_ROOT_ENTRIES, 0);
+    CHECK((response[4]==0) && (response[5]==0x01));
+    SEND(DATAREQUEST_READ_STREAM_NEXT);
+    CHECK((response[0]==DATAREQUEST_READ_STREAM_NEXT) && (response[4]==0) && (response[5]==0xFE));
+}
+
+//A read stream burst (0x86) answered the way main.c does via external SPI: the response
+//takes up the frame and the ones after it. Returns the number of frames used
+static uint8_t _read_stream_burst(uint8_t number_of_frames, uint8_t *responses)
+{
+    uint8_t used;
+
+    memset(frame, 0, sizeof(frame));
+    frame[0] = DATAREQUEST_READ_STREAM_BURST;
+    memset(responses, 0, number_of_frames*64);
+    used = api_prepare_frames(frame, responses, number_of_frames);
+    api_parse(frame, 64, responses);
+    ++frames;
+    memcpy(response, responses, 64);
+    CHECK((response[0]==DATAREQUEST_READ_STREAM_BURST) && (response[1]==0xC1) && (response[2]==0x25));
+    return used;
+}
+
+//Read stream bursts of 1 to 5 frames: one header, then as much of the file as fits, 250 bytes at most
+static void _check_read_stream_burst(uint8_t file_number)
+{
+    static const uint8_t burst_frames[] = {2, 4, 5, 1, 3};
+    uint8_t responses[5*64];
+    uint32_t position;
+    uint16_t expected;
+    uint8_t number_of_frames;
+    uint8_t sequence;
+
+    _read_stream_open(file_number, 0);
+    position = response[4];
+    for(sequence=1; position<FILE_SIZE; ++sequence)
+    {
+        number_of_frames = burst_frames[sequence%sizeof(burst_frames)];
+        CHECK(_read_stream_burst(number_of_frames, responses)==number_of_frames);
+        expected = 64*number_of_frames - 6;
+        if(expected>250)
+        {
+            expected = 250;
+        }
+        if(expected>FILE_SIZE-position)
+        {
+            expected = FILE_SIZE - position;
+        }
+        CHECK((response[3]==sequence) && (response[4]==expected) && (response[5]==0x00));
+        CHECK(memcmp(&responses[6], &file_data[position], expected)==0);
+        position += expected;
+    }
+    _read_stream_burst(2, responses);
+    CHECK((response[3]==sequence) && (response[4]==0) && (response[5]==0x00));
+
+    //Anything else only takes up its own frame
+    memset(frame, 0, sizeof(frame));
+    frame[0] = DATAREQUEST_GET_STATUS;
+    CHECK(api_prepare_frames(frame, responses, 3)==1);
+
+    //No stream open
+    _read_stream_open(FBR_ROOT_ENTRIES, 0);
+    _read_stream_burst(2, responses);
+    CHECK((response[4]==0) && (response[5]==0xFE));
+}
+
+//Sends a bulk write data frame (0x5C) and asks for its result. With crc_error, the CRC doesn't match
+static void _bulk_write_data(uint8_t sequence, uint8_t length, const uint8_t *data, uint8_t crc_error)
+{
+    uint8_t copy;
+    uint16_t crc;
+
+    //An oversized frame is cut off at the end of the frame, it is refused before its CRC is checked
+    copy = (length>58) ? 58 : length;
+    memset(frame, 0, sizeof(frame));
+    frame[0] = DATAREQUEST_GET_COMMAND_RESPONSE;
+    frame[1] = COMMAND_BULK_WRITE_DATA;
+    frame[2] = sequence;
+    frame[3] = length;
+    memcpy(&frame[6], data, copy);
+    crc = _crc16(&frame[2], 2, 0xFFFF);
+    crc = _crc16(&frame[6], copy, crc) + crc_error;
+    frame[4] = crc >> 8;
+    frame[5] = crc;
+    host_transfer(frame, 64, response);
+    ++frames;
+    CHECK(response[3]==COMMAND_BULK_WRITE_DATA);
+}
+
+//Sends a sector's data from the given offset on, the sequence numbers counting up from first_sequence
+static uint8_t _bulk_write_rest(const uint8_t *data, uint16_t offset, uint8_t first_sequence)
+{
+    uint8_t sequence;
+    uint8_t length;
+
+    for(sequence=first_sequence; offset<512; offset+=length)
+    {
+        length = (512-offset>58) ? 58 : 512-offset;
+        _bulk_write_data(sequence, length, &data[offset], 0);
+        CHECK(response[5]==BULK_WRITE_RESULT_OK);
+        CHECK(response[4]==++sequence);
+    }
+    return sequence;
+}
+
+//Bulk write errors: sector 1 is rewritten with new data, with bad frames thrown in and a failed commit
+static void _check_bulk_write_errors(uint8_t file_number)
+{
+    uint8_t *sector_data;
+    uint16_t sector_crc;
+    uint8_t sequence;
+    uint16_t cntr;
+
+    sector_data = &file_data[512];
+    for(cntr=0; cntr<512; ++cntr)
+    {
+        sector_data[cntr] ^= 0xA5;
+    }
+    sector_crc = _crc16(sector_data, 512, 0xFFFF);
+
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_BULK_WRITE_OPEN, file_number, 0x00, 0x01, 0xC7, 0xE1);
+    CHECK((response[3]==COMMAND_BULK_WRITE_OPEN) && (response[4]==file_number) && (_get_uint16(5)==1));
+
+    //A frame that fails its CRC is ignored
+    _bulk_write_data(0, 58, sector_data, 1);
+    CHECK((response[4]==0) && (response[5]==BULK_WRITE_RESULT_CRC_ERROR));
+    _bulk_write_data(0, 58, sector_data, 0);
+    CHECK((response[4]==1) && (response[5]==BULK_WRITE_RESULT_OK));
+    //So is a repeated one and one with more data than fits into a frame
+    _bulk_write_data(0, 58, sector_data, 0);
+    CHECK((response[4]==1) && (response[5]==BULK_WRITE_RESULT_SEQUENCE));
+    _bulk_write_data(1, 59, &sector_data[58], 0);
+    CHECK((response[4]==1) && (response[5]==BULK_WRITE_RESULT_TOO_LONG));
+    sequence = _bulk_write_rest(sector_data, 58, 1);
+
+    //A commit with the wrong CRC leaves the sector as it is. It starts over with the sequence number returned
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_BULK_WRITE_COMMIT, 0x00, 0x01, sector_crc >> 8, (sector_crc+1), 0x2A, 0x93);
+    CHECK((response[3]==COMMAND_BULK_WRITE_COMMIT) && (_get_uint16(4)==1));
+    CHECK((response[6]==BULK_WRITE_RESULT_CRC_ERROR) && (response[7]==0));
+    sequence = _bulk_write_rest(sector_data, 0, 0);
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_BULK_WRITE_COMMIT, 0x00, 0x01, sector_crc >> 8, sector_crc, 0x2A, 0x93);
+    CHECK((_get_uint16(4)==2) && (response[6]==BULK_WRITE_RESULT_OK) && (response[7]==sequence));
+
+    //A repeated commit only tells the host which sector is expected next
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_BULK_WRITE_COMMIT, 0x00, 0x01, sector_crc >> 8, sector_crc, 0x2A, 0x93);
+    CHECK((_get_uint16(4)==2) && (response[6]==BULK_WRITE_RESULT_SECTOR) && (response[7]==sequence));
+
+    _check_file(file_number, file_data, FILE_SIZE);
+}
+
+//Starts a checksum with 0x5E and polls 0x16 until it is no longer busy. Returns the status
+static uint8_t _checksum_range(uint8_t file_number, uint32_t start, uint32_t length)
+{
+    uint32_t passes;
+
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_FILE_CHECKSUM, file_number, start >> 24, start >> 16, start >> 8, start,
+         length >> 24, length >> 16, length >> 8, length, 0x91, 0xC3);
+    CHECK(response[3]==COMMAND_FILE_CHECKSUM);
+    for(passes=0; passes<100000; ++passes)
+    {
+        host_main_loop_pass();
+        SEND(DATAREQUEST_GET_CHECKSUM);
+        if(response[3]!=CHECKSUM_STATUS_BUSY)
+        {
+            break;
+        }
+    }
+    CHECK((response[4]==file_number) && (_get_uint32(5)==start));
+    return response[3];
+}
+
+//Waits for the checksum over the whole file and returns its CRC-32
+static uint32_t _checksum(uint8_t file_number, uint32_t size)
+{
+    CHECK(_checksum_range(file_number, 0, size)==CHECKSUM_STATUS_DONE);
+    CHECK(_get_uint32(13)==size);
+    CHECK(_get_uint16(21)==_fletcher16(file_data, size));
+    return _get_uint32(17);
+}
+
+//Checksum ranges: within the file, beyond its end, at its end, after it and of no file at all
+static void _check_checksum_ranges(uint8_t file_number)
+{
+    CHECK(_checksum_range(file_number, 100, 700)==CHECKSUM_STATUS_DONE);
+    CHECK((_get_uint32(9)==700) && (_get_uint32(13)==700));
+    CHECK(_get_uint32(17)==_crc32(&file_data[100], 700));
+    CHECK(_get_uint16(21)==_fletcher16(&file_data[100], 700));
+
+    //The range ends at the end of the file
+    CHECK(_checksum_range(file_number, 1000, 1000)==CHECKSUM_STATUS_DONE);
+    CHECK((_get_uint32(9)==FILE_SIZE-1000) && (_get_uint32(13)==FILE_SIZE-1000));
+    CHECK(_get_uint32(17)==_crc32(&file_data[1000], FILE_SIZE-1000));
+    CHECK(_get_uint16(21)==_fletcher16(&file_data[1000], FILE_SIZE-1000));
+
+    //Nothing left to check: the checksums of no data at all
+    CHECK(_checksum_range(file_number, FILE_SIZE, 10)==CHECKSUM_STATUS_DONE);
+    CHECK((_get_uint32(9)==0) && (_get_uint32(17)==0) && (_get_uint16(21)==0));
+
+    CHECK(_checksum_range(file_number, FILE_SIZE+1, 10)==CHECKSUM_STATUS_RANGE_ERROR);
+    CHECK(_checksum_range(FBR_ROOT_ENTRIES, 0, 10)==CHECKSUM_STATUS_NO_FILE);
+}
+
+//Runs the main loop until the bootloader is in the given mode
+static void _run_bootloader(uint8_t mode)
+{
+    uint32_t passes;
+
+    for(passes=0; passes<1000; ++passes)
+    {
+        if(host_get_bootloader_mode()==mode)
+        {
+            break;
+        }
+        host_main_loop_pass();
+    }
+    SEND(DATAREQUEST_GET_STATUS);
+    CHECK(response[12]==mode);
+}
+
+//Queue full and invalid commands: rename, resize and delete a file as three jobs with two slots
+static void _check_queue_errors(void)
+{
+    uint8_t file_number;
+
+    file_number = _create_file("QUEUE   BIN", 0);
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_QUEUE, 0x10, 0xE5, 0xA7, COMMAND_FILE_RENAME, file_number,
+         'Q', 'U', 'E', 'U', 'E', '2', ' ', ' ', 'B', 'I', 'N', 0x7E, 0x18);
+    _check_confirmation(COMMAND_QUEUE, 5, QUEUE_STATUS_QUEUED);
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_QUEUE, 0x11, 0xE5, 0xA7, COMMAND_FILE_RESIZE, file_number, 0x00, 0x00, 0x00, 100, 0x4C, 0xEA);
+    _check_confirmation(COMMAND_QUEUE, 5, QUEUE_STATUS_QUEUED);
+
+    //Both slots are waiting
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_QUEUE, 0x12, 0xE5, 0xA7, COMMAND_FILE_DELETE, file_number, 0x66, 0xA0);
+    _check_confirmation(COMMAND_QUEUE, 4, 0x12);
+    CHECK(response[5]==QUEUE_STATUS_FULL);
+    //Commands with data can't be queued
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_QUEUE, 0x13, 0xE5, 0xA7, COMMAND_FILE_APPEND, file_number, 0x01, 0xFE, 0x4B, 0x00);
+    _check_confirmation(COMMAND_QUEUE, 5, QUEUE_STATUS_INVALID);
+    //Without the constant, the frame is not parsed any further
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_QUEUE, 0x14, 0xE5, 0xA8, COMMAND_FILE_DELETE, file_number, 0x66, 0xA0);
+    CHECK(response[3]==0x00);
+
+    SEND(DATAREQUEST_GET_QUEUE);
+    CHECK((response[3]==2) && (response[4]==2));
+    CHECK((response[5]==0x10) && (response[6]==COMMAND_FILE_RENAME) && (response[7]==QUEUE_STATUS_QUEUED) && (response[8]==0xFF));
+    CHECK((response[9]==0x11) && (response[10]==COMMAND_FILE_RESIZE) && (response[11]==QUEUE_STATUS_QUEUED) && (response[12]==0xFF));
+
+    //One job per pass. Once the rename is done, its slot takes the delete
+    host_main_loop_pass();
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_QUEUE, 0x12, 0xE5, 0xA7, COMMAND_FILE_DELETE, file_number, 0x66, 0xA0);
+    _check_confirmation(COMMAND_QUEUE, 5, QUEUE_STATUS_QUEUED);
+    SEND(DATAREQUEST_GET_QUEUE);
+    CHECK(response[4]==2);
+    CHECK((response[5]==0x11) && (response[7]==QUEUE_STATUS_QUEUED));
+    CHECK((response[9]==0x12) && (response[10]==COMMAND_FILE_DELETE) && (response[11]==QUEUE_STATUS_QUEUED));
+
+    //Executed in the order received: every job succeeds
+    host_main_loop_pass();
+    host_main_loop_pass();
+    SEND(DATAREQUEST_GET_QUEUE);
+    CHECK(response[4]==0);
+    CHECK((response[7]==QUEUE_STATUS_DONE) && (response[8]==0x00));
+    CHECK((response[11]==QUEUE_STATUS_DONE) && (response[12]==0x00));
+    CHECK(_find_file("QUEUE   BIN")>=FBR_ROOT_ENTRIES);
+    CHECK(_find_file("QUEUE2  BIN")>=FBR_ROOT_ENTRIES);
+}
+
+//Runs the main loop until all queued jobs are done, checking the progress reported by 0x17
+static void _run_queue(uint16_t expected_steps)
+{
+    uint32_t passes;
+    uint16_t steps_done;
+    uint16_t steps_seen;
+
+    steps_seen = 0;
+    for(passes=0; passes<1000; ++passes)
+    {
+        SEND(DATAREQUEST_GET_QUEUE);
+        CHECK(response[0]==DATAREQUEST_GET_QUEUE);
+        if(response[4]==0)
+        {
+            break;
+        }
+        steps_done = _get_uint16(5+4*response[3]);
+        if(_get_uint16(7+4*response[3])!=0)
+        {
+            CHECK(_get_uint16(7+4*response[3])==expected_steps);
+            CHECK(steps_done>=steps_seen);
+            steps_seen = steps_done;
+        }
+        host_main_loop_pass();
+    }
+    CHECK(response[4]==0);
+    CHECK(steps_seen==expected_steps-1);
+}
+
+int main(void)
+{
+    uint8_t file_number;
+    uint8_t copy_number;
+    uint8_t image[28];
+    uint16_t writes;
+    uint32_t cntr;
+
+    host_init(configuration_words);
+    for(cntr=0; cntr<sizeof(file_data); ++cntr)
+    {
+        file_data[cntr] = (uint8_t) (cntr*7 + (cntr>>9));
+    }
+
+    //Connectivity: a full 64 byte frame comes back unchanged
+    for(cntr=0; cntr<64; ++cntr)
+    {
+        frame[cntr] = (uint8_t) (DATAREQUEST_GET_ECHO + cntr);
+    }
+    host_transfer(frame, 64, response);
+    ++frames;
+    CHECK(memcmp(frame, response, 64)==0);
+
+    SEND(DATAREQUEST_GET_STATUS);
+    CHECK((response[0]==DATAREQUEST_GET_STATUS) && (response[1]==0xC1) && (response[2]==0x25));
+
+    //Write a file, read it back and check its checksum
+    file_number = _create_file("LOOPBACKBIN", FILE_SIZE);
+    CHECK(file_number<FBR_ROOT_ENTRIES);
+    _write_file(file_number);
+    _check_file(file_number, file_data, FILE_SIZE);
+    CHECK(_checksum(file_number, FILE_SIZE)==_crc32(file_data, FILE_SIZE));
+    printf("Write, read and checksum: %u bytes\n", FILE_SIZE);
+
+    _check_bulk_write_errors(file_number);
+    printf("Bulk write: bad frames ignored, sector written again after a failed commit\n");
+
+    _check_read_stream_edges(file_number);
+    printf("Read stream: unaligned start, lost chunk, end of file and invalid file\n");
+
+    _check_checksum_ranges(file_number);
+    printf("Checksum: CRC-32 and Fletcher-16 over ranges, range and file errors\n");
+
+    _check_read_stream_burst(file_number);
+    printf("Read stream burst: 1 to 5 frames per response, 250 bytes at most\n");
+
+    //Queued copy, one sector per main loop pass
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_QUEUE, 0x01, 0xE5, 0xA7, COMMAND_FILE_COPY, file_number,
+         'C', 'O', 'P', 'Y', ' ', ' ', ' ', ' ', 'B', 'I', 'N', 0x54, 0xD9);
+    _check_confirmation(COMMAND_QUEUE, 5, QUEUE_STATUS_QUEUED);
+    _run_queue(FILE_SECTORS);
+    SEND(DATAREQUEST_GET_QUEUE);
+    CHECK((response[1+4*response[3]]==0x01) && (response[3+4*response[3]]==QUEUE_STATUS_DONE) && (response[4+4*response[3]]==0x00));
+    copy_number = _find_file("COPY    BIN");
+    CHECK(copy_number!=file_number);
+    _check_file(copy_number, file_data, FILE_SIZE);
+    printf("Queued copy: %u sectors\n", FILE_SECTORS);
+
+    //Queuing the same job again only returns its status
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_QUEUE, 0x01, 0xE5, 0xA7, COMMAND_FILE_COPY, file_number,
+         'C', 'O', 'P', 'Y', ' ', ' ', ' ', ' ', 'B', 'I', 'N', 0x54, 0xD9);
+    _check_confirmation(COMMAND_QUEUE, 5, QUEUE_STATUS_DONE);
+
+    //Profiler: the copy has been measured sector by sector
+    SEND(DATAREQUEST_GET_PROFILER_ENTRIES, PROBE_FAT_WRITE);
+    CHECK((response[0]==DATAREQUEST_GET_PROFILER_ENTRIES) && (response[3]==PROBE_FAT_WRITE));
+    CHECK(_get_uint16(4+14*(PROBE_FAT_COPY-PROBE_FAT_WRITE))==FILE_SECTORS);
+
+    //Failed calls are measured as well: a modification beyond the end of the file
+    writes = _get_uint16(4);
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_FILE_MODIFY, file_number, 0x00, 0x00, 0x10, 0x00, 0x01, 0x0F, 0x9B, 0x00);
+    _check_confirmation(COMMAND_FILE_MODIFY, 11, 0xF0);
+    SEND(DATAREQUEST_GET_PROFILER_ENTRIES, PROBE_FAT_WRITE);
+    CHECK(_get_uint16(4)==writes+1);
+    printf("Profiler: %u sectors copied, failed write measured\n", FILE_SECTORS);
+
+    _check_queue_errors();
+    printf("Queue: full with 2 jobs waiting, invalid commands refused\n");
+
+    //Queued format, then the files are gone
+    SEND(DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_QUEUE, 0x02, 0xE5, 0xA7, COMMAND_FORMAT_DRIVE, 0xDA, 0x22);
+    _check_confirmation(COMMAND_QUEUE, 5, QUEUE_STATUS_QUEUED);
+    _run_queue(FAT_FORMAT_NUMBER_OF_STEPS);
+    CHECK(_find_file("LOOPBACKBIN")>=FBR_ROOT_ENTRIES);
+    CHECK(_find_file("COPY    BIN")>=FBR_ROOT_ENTRIES);
+    printf("Queued format: %u sectors\n", FAT_FORMAT_NUMBER_OF_STEPS);
+
+    //A compressed image built for other configuration bits is refused before anything is programmed
+    memset(image, 0, sizeof(image));
+    image[0] = 0x4C;
+    image[1] = 0x5A;
+    image[2] = 0x03;
+    image[3] = 0x01;
+    image[6] = 0xC0;
+    image[10] = 0x04;
+    image[16] = configuration_words[0] ^ 0x01;
+    for(cntr=0; cntr<27; ++cntr)
+    {
+        image[27] -= image[cntr];
+    }
+    file_number = _create_file("FIRMWARELZB", 0);
+    memset(frame, 0, sizeof(frame));
+    frame[0] = DATAREQUEST_GET_COMMAND_RESPONSE;
+    frame[1] = COMMAND_FILE_APPEND;
+    frame[2] = file_number;
+    frame[3] = sizeof(image);
+    frame[4] = 0xFE;
+    frame[5] = 0x4B;
+    memcpy(&frame[6], image, sizeof(image));
+    host_transfer(frame, 64, response);
+    ++frames;
+    _check_confirmation(COMMAND_FILE_APPEND, 5, 0x00);
+    _run_bootloader(MODE_FILE_FOUND);
+    SEND(DATAREQUEST_GET_STATUS, COMMAND_ENCODER_PUSH);
+    _run_bootloader(MODE_CHECK_FAILED);
+    SEND(DATAREQUEST_GET_BOOTLOADER_DETAILS);
+    CHECK(response[11]==ERROR_CONFIGURATION_BITS);
+    printf("Compressed image for other configuration bits: error 0x%X\n", response[11]);
+
+    //Fast boot: nothing but the board's settle delay, the boot control record and the image descriptor
+    host_eeprom[EEPROM_BOOT_OPTIONS_ADDRESS] = BOOT_OPTIONS_FAST_BOOT;
+    CHECK(host_boot()==1);
+    CHECK(host_boot_delay_ms==FAST_BOOT_DELAY_MS);
+    CHECK(host_eeprom_reads==FAST_BOOT_EEPROM_READS);
+    //Without it, the display unit is waited for
+    host_eeprom[EEPROM_BOOT_OPTIONS_ADDRESS] = 0x00;
+    CHECK(host_boot()==1);
+    CHECK(host_boot_delay_ms==FAST_BOOT_DELAY_MS+BOOT_SETTLE_DELAY_DISPLAY_UNIT_MS);
+    CHECK(host_eeprom_reads==FAST_BOOT_EEPROM_READS);
+    printf("Fast boot: %ums settle delay, %u EEPROM reads\n", FAST_BOOT_DELAY_MS, FAST_BOOT_EEPROM_READS);
+
+    printf("%u frames, all responses as expected\n", frames);
+    return 0;
+}
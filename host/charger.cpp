@@ -0,0 +1,930 @@
+/*
+ * File:   charger.cpp
+ *
+ * The protocol of api.h, see charger.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+#include "charger.h"
+
+namespace charger
+{
+
+const char *const PROFILER_PROBES[PROFILER_NUMBER_OF_PROBES] =
+{
+    "flash read", "flash write", "fat read", "hex parse", "usb tasks", "i2c",
+    "fat write", "fat copy", "fat format"
+};
+
+/*****************************************************************************
+ * Utility functions                                                         *
+ *****************************************************************************/
+
+uint16_t crc16(const uint8_t *data, size_t length, uint16_t crc)
+{
+    size_t cntr;
+    uint8_t bit;
+
+    for(cntr=0; cntr<length; ++cntr)
+    {
+        crc ^= data[cntr] << 8;
+        for(bit=0; bit<8; ++bit)
+        {
+            if(crc & 0x8000)
+            {
+                crc = (crc << 1) ^ 0x1021;
+            }
+            else
+            {
+                crc <<= 1;
+            }
+        }
+    }
+    return crc;
+}
+
+uint32_t crc32(const uint8_t *data, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    size_t cntr;
+    uint8_t bit;
+
+    for(cntr=0; cntr<length; ++cntr)
+    {
+        crc ^= data[cntr];
+        for(bit=0; bit<8; ++bit)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+uint16_t fletcher16(const uint8_t *data, size_t length)
+{
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+    size_t cntr;
+
+    for(cntr=0; cntr<length; ++cntr)
+    {
+        sum1 = (sum1 + data[cntr]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (sum2 << 8) | sum1;
+}
+
+Bytes pad_frame(const Bytes &frame, size_t size)
+{
+    Bytes padded(frame);
+
+    if(padded.size()>size)
+    {
+        throw std::invalid_argument("Frame longer than " + std::to_string(size) + " bytes");
+    }
+    padded.resize(size, 0x00);
+    return padded;
+}
+
+static void _append_uint16(Bytes &frame, uint16_t value)
+{
+    frame.push_back(value >> 8);
+    frame.push_back(value & 0xFF);
+}
+
+static void _append_uint32(Bytes &frame, uint32_t value)
+{
+    frame.push_back(value >> 24);
+    frame.push_back((value >> 16) & 0xFF);
+    frame.push_back((value >> 8) & 0xFF);
+    frame.push_back(value & 0xFF);
+}
+
+static uint16_t _get_uint16(const Bytes &data, size_t index)
+{
+    return (data.at(index) << 8) | data.at(index+1);
+}
+
+static uint32_t _get_uint32(const Bytes &data, size_t index)
+{
+    return ((uint32_t) data.at(index) << 24) | ((uint32_t) data.at(index+1) << 16) | (data.at(index+2) << 8) | data.at(index+3);
+}
+
+//'firmware.hex' -> 8 + 3 characters as in a root entry
+static void _append_file_name(Bytes &frame, const std::string &file_name)
+{
+    std::string name(file_name);
+    std::string extension;
+    size_t dot;
+    size_t cntr;
+
+    dot = file_name.rfind('.');
+    if(dot!=std::string::npos)
+    {
+        name = file_name.substr(0, dot);
+        extension = file_name.substr(dot+1);
+    }
+    for(cntr=0; cntr<8; ++cntr)
+    {
+        frame.push_back(cntr<name.size() ? toupper((unsigned char) name[cntr]) : ' ');
+    }
+    for(cntr=0; cntr<3; ++cntr)
+    {
+        frame.push_back(cntr<extension.size() ? toupper((unsigned char) extension[cntr]) : ' ');
+    }
+}
+
+static std::string _join_file_name(const Bytes &data, size_t index)
+{
+    std::string name(data.begin()+index, data.begin()+index+8);
+    std::string extension(data.begin()+index+8, data.begin()+index+11);
+
+    name.erase(name.find_last_not_of(' ')+1);
+    extension.erase(extension.find_last_not_of(' ')+1);
+    if(extension.empty())
+    {
+        return name;
+    }
+    return name + "." + extension;
+}
+
+static std::string _hex(uint8_t value)
+{
+    char text[8];
+
+    snprintf(text, sizeof(text), "0x%02X", value);
+    return text;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static Clock::time_point _deadline(double timeout)
+{
+    return Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(timeout));
+}
+
+static void _sleep_ms(unsigned ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+/*****************************************************************************
+ * Charger                                                                   *
+ *****************************************************************************/
+
+Charger::Charger(Transport *transport) : _transport(transport)
+{
+}
+
+Charger::~Charger()
+{
+    delete _transport;
+}
+
+std::string Charger::_error(const std::string &message) const
+{
+    return name() + ": " + message;
+}
+
+/*****************************************************************************
+ * Low level                                                                 *
+ *****************************************************************************/
+
+Bytes Charger::request(const Bytes &frame)
+{
+    Bytes response;
+
+    response = _transport->transfer(frame);
+    if((response.size()<FRAME_SIZE) || (response[0]!=frame[0]) || (response[1]!=SIGNATURE[0]) || (response[2]!=SIGNATURE[1]))
+    {
+        throw ChargerError(_error("invalid response to " + _hex(frame[0])));
+    }
+    return response;
+}
+
+Bytes Charger::command(const Bytes &command)
+{
+    Bytes frame;
+    Bytes response;
+
+    frame.push_back(DATAREQUEST_GET_COMMAND_RESPONSE);
+    frame.insert(frame.end(), command.begin(), command.end());
+    response = request(frame);
+    if(response[3]!=command[0])
+    {
+        throw ChargerError(_error("command " + _hex(command[0]) + " not confirmed"));
+    }
+    return Bytes(response.begin()+4, response.end());
+}
+
+void Charger::send_commands(const Bytes &commands)
+{
+    Bytes frame;
+
+    frame.push_back(DATAREQUEST_GET_STATUS);
+    frame.insert(frame.end(), commands.begin(), commands.end());
+    frame.push_back(COMMAND_STOP_PARSING);
+    request(frame);
+}
+
+//The device may reboot before it responds
+void Charger::_send_reboot(uint8_t command)
+{
+    Bytes frame;
+
+    frame.push_back(DATAREQUEST_GET_STATUS);
+    frame.push_back(command);
+    frame.push_back(COMMAND_STOP_PARSING);
+    try
+    {
+        _transport->transfer(frame);
+    }
+    catch(const ChargerError &)
+    {
+    }
+}
+
+/*****************************************************************************
+ * Data requests                                                             *
+ *****************************************************************************/
+
+bool Charger::echo(const Bytes &data)
+{
+    Bytes frame;
+
+    frame.push_back(DATAREQUEST_GET_ECHO);
+    frame.insert(frame.end(), data.begin(), data.end());
+    frame = pad_frame(frame);
+    return _transport->transfer(frame)==frame;
+}
+
+Status Charger::get_status()
+{
+    Bytes response;
+    Status status;
+
+    response = request(Bytes(1, DATAREQUEST_GET_STATUS));
+    status.flash_busy = response[3]!=0;
+    memcpy(status.version, &response[4], 3);
+    status.ui_status = response[7];
+    status.encoder_count = response[8];
+    status.button_count = response[9];
+    status.time_slot = response[10];
+    status.done = response[11]!=0;
+    status.bootloader_mode = response[12];
+    status.display_mode = response[13];
+    status.boot_time = _get_uint16(response, 14);
+    return status;
+}
+
+std::vector<std::string> Charger::get_display()
+{
+    std::vector<std::string> lines;
+    Bytes response;
+
+    response = request(Bytes(1, DATAREQUEST_GET_DISPLAY_1));
+    lines.push_back(std::string(response.begin()+3, response.begin()+23));
+    lines.push_back(std::string(response.begin()+23, response.begin()+43));
+    response = request(Bytes(1, DATAREQUEST_GET_DISPLAY_2));
+    lines.push_back(std::string(response.begin()+3, response.begin()+23));
+    lines.push_back(std::string(response.begin()+23, response.begin()+43));
+    return lines;
+}
+
+BootloaderDetails Charger::get_bootloader_details()
+{
+    Bytes response;
+    BootloaderDetails details;
+
+    response = request(Bytes(1, DATAREQUEST_GET_BOOTLOADER_DETAILS));
+    details.file_size = _get_uint32(response, 3);
+    details.entries = _get_uint16(response, 7);
+    details.total_entries = _get_uint16(response, 9);
+    details.error = response[11];
+    details.pages_written = _get_uint16(response, 12);
+    details.record_length = _get_uint16(response, 14);
+    details.record_address = _get_uint16(response, 16);
+    details.record_type = response[18];
+    details.record_checksum = response[19];
+    details.record_checksum_check = response[20];
+    details.record_data.assign(response.begin()+21, response.begin()+21+std::min<uint16_t>(details.record_length, 16));
+    details.pages_erased = _get_uint16(response, 37);
+    details.blocks_written = _get_uint16(response, 39);
+    details.verify_failed_page = _get_uint16(response, 41);
+    details.verify_retries = response[43];
+    return details;
+}
+
+std::vector<ProfilerProbe> Charger::get_profiler()
+{
+    std::vector<ProfilerProbe> probes;
+    ProfilerProbe probe;
+    Bytes frame;
+    Bytes response;
+    size_t first;
+    size_t cntr;
+    size_t index;
+
+    for(first=0; first<PROFILER_NUMBER_OF_PROBES; first+=PROFILER_PROBES_PER_FRAME)
+    {
+        if(first==0)
+        {
+            response = request(Bytes(1, DATAREQUEST_GET_PROFILER));
+        }
+        else
+        {
+            frame.clear();
+            frame.push_back(DATAREQUEST_GET_PROFILER_ENTRIES);
+            frame.push_back(first);
+            response = request(frame);
+        }
+        for(cntr=0; (cntr<PROFILER_PROBES_PER_FRAME) && (first+cntr<PROFILER_NUMBER_OF_PROBES); ++cntr)
+        {
+            index = 4 + 14*cntr;
+            probe.count = _get_uint16(response, index);
+            probe.minimum = _get_uint32(response, index+2);
+            probe.maximum = _get_uint32(response, index+6);
+            probe.total = _get_uint32(response, index+10);
+            probes.push_back(probe);
+        }
+    }
+    return probes;
+}
+
+Configuration Charger::get_configuration()
+{
+    Bytes response;
+    Configuration configuration;
+
+    response = request(Bytes(1, DATAREQUEST_GET_CONFIGURATION));
+    configuration.spi_mode = response[3];
+    configuration.spi_frequency = response[4];
+    configuration.spi_polarity = response[5];
+    configuration.i2c_mode = response[6];
+    configuration.i2c_frequency = response[7];
+    configuration.i2c_slave_mode_address = response[8];
+    configuration.i2c_master_mode_address = response[9];
+    return configuration;
+}
+
+Checksum Charger::get_checksum()
+{
+    Bytes response;
+    Checksum checksum;
+
+    response = request(Bytes(1, DATAREQUEST_GET_CHECKSUM));
+    checksum.status = response[3];
+    checksum.file_number = response[4];
+    checksum.start = _get_uint32(response, 5);
+    checksum.length = _get_uint32(response, 9);
+    checksum.done = _get_uint32(response, 13);
+    checksum.crc32 = _get_uint32(response, 17);
+    checksum.fletcher16 = _get_uint16(response, 21);
+    return checksum;
+}
+
+std::vector<QueueJob> Charger::get_queue()
+{
+    std::vector<QueueJob> jobs;
+    QueueJob job;
+    Bytes response;
+    uint8_t cntr;
+
+    response = request(Bytes(1, DATAREQUEST_GET_QUEUE));
+    for(cntr=0; cntr<response[3]; ++cntr)
+    {
+        job.job_id = response.at(5+4*cntr);
+        job.command = response.at(6+4*cntr);
+        job.status = response.at(7+4*cntr);
+        job.result = response.at(8+4*cntr);
+        if(job.status!=QUEUE_STATUS_UNKNOWN)
+        {
+            jobs.push_back(job);
+        }
+    }
+    return jobs;
+}
+
+void Charger::get_queue_progress(uint16_t &steps_done, uint16_t &number_of_steps)
+{
+    Bytes response;
+    size_t index;
+
+    response = request(Bytes(1, DATAREQUEST_GET_QUEUE));
+    index = 5 + 4*response[3];
+    steps_done = _get_uint16(response, index);
+    number_of_steps = _get_uint16(response, index+2);
+}
+
+bool Charger::get_file_details(uint8_t file_number, FileDetails &details)
+{
+    Bytes frame;
+    Bytes response;
+
+    frame.push_back(DATAREQUEST_GET_FILE_DETAILS);
+    frame.push_back(file_number);
+    response = request(frame);
+    if(response[4]!=0x00)
+    {
+        return false;
+    }
+    details.file_number = file_number;
+    details.name = _join_file_name(response, 5);
+    details.attributes = response[16];
+    details.first_cluster = response[31] | (response[32] << 8);
+    details.size = response[33] | (response[34] << 8) | (response[35] << 16) | ((uint32_t) response[36] << 24);
+    return true;
+}
+
+std::vector<FileDetails> Charger::list_files()
+{
+    std::vector<FileDetails> files;
+    FileDetails details;
+    uint8_t file_number;
+
+    for(file_number=0; file_number<ROOT_ENTRIES; ++file_number)
+    {
+        if(get_file_details(file_number, details) && !(details.attributes & 0x08))
+        {
+            files.push_back(details);
+        }
+    }
+    return files;
+}
+
+uint8_t Charger::find_file(const std::string &file_name)
+{
+    Bytes frame;
+
+    frame.push_back(DATAREQUEST_FIND_FILE);
+    _append_file_name(frame, file_name);
+    return request(frame)[3];
+}
+
+Bytes Charger::read_file_chunk(uint8_t file_number, uint32_t start_byte)
+{
+    Bytes frame;
+    Bytes response;
+
+    frame.push_back(DATAREQUEST_READ_FILE);
+    frame.push_back(file_number);
+    _append_uint32(frame, start_byte);
+    response = request(frame);
+    if(response[9]!=0x00)
+    {
+        throw ChargerError(_error("reading file " + std::to_string(file_number) + " failed: " + std::to_string(response[9])));
+    }
+    return Bytes(response.begin()+10, response.begin()+10+std::min<size_t>(response[8], FRAME_SIZE-10));
+}
+
+Bytes Charger::read_buffer(uint16_t start_byte, size_t length)
+{
+    Bytes data;
+    Bytes frame;
+    Bytes response;
+
+    while(data.size()<length)
+    {
+        frame.clear();
+        frame.push_back(DATAREQUEST_READ_BUFFER);
+        _append_uint16(frame, start_byte + data.size());
+        response = request(frame);
+        if(response[5]==0)
+        {
+            break;
+        }
+        data.insert(data.end(), response.begin()+6, response.begin()+6+std::min<size_t>(response[5], FRAME_SIZE-6));
+    }
+    if(data.size()>length)
+    {
+        data.resize(length);
+    }
+    return data;
+}
+
+Bytes Charger::read_file(uint8_t file_number, uint32_t start_byte)
+{
+    Bytes data;
+    Bytes frame;
+    Bytes response;
+    uint8_t sequence = 0;
+    uint8_t length;
+
+    frame.push_back(DATAREQUEST_READ_STREAM_OPEN);
+    frame.push_back(file_number);
+    _append_uint32(frame, start_byte);
+    response = request(frame);
+    while(true)
+    {
+        if(response[3]!=sequence)
+        {
+            //A chunk got lost. Start over from where it should have been
+            sequence = 0;
+            frame.resize(2);
+            _append_uint32(frame, start_byte + data.size());
+            response = request(frame);
+            continue;
+        }
+        if(response[5]!=0x00)
+        {
+            throw ChargerError(_error("reading file " + std::to_string(file_number) + " failed: " + std::to_string(response[5])));
+        }
+        length = std::min<uint8_t>(response[4], STREAM_CHUNK_SIZE);
+        data.insert(data.end(), response.begin()+6, response.begin()+6+length);
+        ++sequence;
+        if(length<STREAM_CHUNK_SIZE)
+        {
+            return data;
+        }
+        response = request(Bytes(1, DATAREQUEST_READ_STREAM_NEXT));
+    }
+}
+
+/*****************************************************************************
+ * Commands                                                                  *
+ *****************************************************************************/
+
+void Charger::reboot()
+{
+    _send_reboot(COMMAND_REBOT);
+}
+
+void Charger::reboot_bootloader_mode()
+{
+    _send_reboot(COMMAND_REBOT_BOOTLOADER_MODE);
+}
+
+void Charger::reboot_normal_mode()
+{
+    _send_reboot(COMMAND_REBOT_NORMAL_MODE);
+}
+
+void Charger::jump_to_main_program()
+{
+    _send_reboot(COMMAND_JUMP_TO_MAIN_PROGRAM);
+}
+
+void Charger::suspend_bootloader()
+{
+    send_commands(Bytes(1, COMMAND_SUSPEND_BOOTLOADER));
+}
+
+void Charger::reset_profiler()
+{
+    send_commands(Bytes(1, COMMAND_RESET_PROFILER));
+}
+
+void Charger::turn_counter_clockwise()
+{
+    send_commands(Bytes(1, COMMAND_ENCODER_CCW));
+}
+
+void Charger::turn_clockwise()
+{
+    send_commands(Bytes(1, COMMAND_ENCODER_CW));
+}
+
+void Charger::press_button()
+{
+    send_commands(Bytes(1, COMMAND_ENCODER_PUSH));
+}
+
+uint8_t Charger::resize_file(uint8_t file_number, uint32_t new_file_size)
+{
+    Bytes frame = {COMMAND_FILE_RESIZE, file_number};
+
+    _append_uint32(frame, new_file_size);
+    frame.push_back(0x4C);
+    frame.push_back(0xEA);
+    return command(frame)[5];
+}
+
+uint8_t Charger::delete_file(uint8_t file_number)
+{
+    return command({COMMAND_FILE_DELETE, file_number, 0x66, 0xA0})[1];
+}
+
+uint8_t Charger::create_file(const std::string &file_name, uint32_t file_size)
+{
+    Bytes frame = {COMMAND_FILE_CREATE};
+    uint8_t file_number;
+
+    _append_file_name(frame, file_name);
+    _append_uint32(frame, file_size);
+    frame.push_back(0xBD);
+    frame.push_back(0x4F);
+    file_number = command(frame)[0];
+    if(file_number>=ROOT_ENTRIES)
+    {
+        throw ChargerError(_error("creating " + file_name + " failed: " + _hex(file_number)));
+    }
+    return file_number;
+}
+
+uint8_t Charger::rename_file(uint8_t file_number, const std::string &file_name)
+{
+    Bytes frame = {COMMAND_FILE_RENAME, file_number};
+
+    _append_file_name(frame, file_name);
+    frame.push_back(0x7E);
+    frame.push_back(0x18);
+    return command(frame)[1];
+}
+
+uint8_t Charger::append_to_file(uint8_t file_number, const Bytes &data)
+{
+    Bytes frame;
+    size_t length;
+
+    length = std::min(data.size(), _transport->frame_size()-6);
+    frame = {COMMAND_FILE_APPEND, file_number, (uint8_t) length, 0xFE, 0x4B};
+    frame.insert(frame.end(), data.begin(), data.begin()+length);
+    return command(frame)[3];
+}
+
+uint8_t Charger::modify_file(uint8_t file_number, uint32_t start_byte, const Bytes &data)
+{
+    Bytes frame = {COMMAND_FILE_MODIFY, file_number};
+    size_t length;
+
+    length = std::min(data.size(), _transport->frame_size()-10);
+    _append_uint32(frame, start_byte);
+    frame.push_back(length);
+    frame.push_back(0x0F);
+    frame.push_back(0x9B);
+    frame.insert(frame.end(), data.begin(), data.begin()+length);
+    return command(frame)[7];
+}
+
+uint8_t Charger::format_drive()
+{
+    return command({COMMAND_FORMAT_DRIVE, 0xDA, 0x22})[0];
+}
+
+uint8_t Charger::sector_to_buffer(uint8_t file_number, uint16_t sector)
+{
+    Bytes frame = {COMMAND_SECTOR_TO_BUFFER, file_number};
+
+    _append_uint16(frame, sector);
+    frame.push_back(0x1B);
+    frame.push_back(0x35);
+    return command(frame)[3];
+}
+
+uint8_t Charger::buffer_to_sector(uint8_t file_number, uint16_t sector)
+{
+    Bytes frame = {COMMAND_BUFFER_TO_SECTOR, file_number};
+
+    _append_uint16(frame, sector);
+    frame.push_back(0x6A);
+    frame.push_back(0x6D);
+    return command(frame)[3];
+}
+
+void Charger::write_buffer(uint16_t start_byte, const Bytes &data)
+{
+    Bytes frame;
+    size_t chunk_size;
+    size_t offset;
+    size_t length;
+
+    chunk_size = _transport->frame_size() - 7;
+    for(offset=0; offset<data.size(); offset+=chunk_size)
+    {
+        length = std::min(chunk_size, data.size()-offset);
+        frame = {COMMAND_WRITE_BUFFER};
+        _append_uint16(frame, start_byte + offset);
+        frame.push_back(length);
+        frame.push_back(0xE2);
+        frame.push_back(0x30);
+        frame.insert(frame.end(), data.begin()+offset, data.begin()+offset+length);
+        command(frame);
+    }
+}
+
+uint8_t Charger::copy_file(uint8_t file_number, const std::string &file_name)
+{
+    Bytes frame = {COMMAND_FILE_COPY, file_number};
+
+    _append_file_name(frame, file_name);
+    frame.push_back(0x54);
+    frame.push_back(0xD9);
+    return command(frame)[1];
+}
+
+void Charger::set_spi_mode(uint8_t mode)
+{
+    command({COMMAND_SET_SPI_MODE, mode, 0x88, 0xE2});
+}
+
+void Charger::set_spi_frequency(uint8_t frequency)
+{
+    command({COMMAND_SET_SPI_FREQUENCY, frequency, 0xAE, 0xA8});
+}
+
+void Charger::set_spi_polarity(uint8_t polarity)
+{
+    command({COMMAND_SET_SPI_POLARITY, polarity, 0x0D, 0xBB});
+}
+
+void Charger::set_i2c_mode(uint8_t mode)
+{
+    command({COMMAND_SET_I2C_MODE, mode, 0xB6, 0xB9});
+}
+
+void Charger::set_i2c_frequency(uint8_t frequency)
+{
+    command({COMMAND_SET_I2C_FREQUENCY, frequency, 0x4E, 0x03});
+}
+
+void Charger::set_i2c_slave_mode_address(uint8_t address)
+{
+    command({COMMAND_SET_I2C_SLAVE_MODE_ADDRESS, address, 0x88, 0xE2});
+}
+
+void Charger::set_i2c_master_mode_address(uint8_t address)
+{
+    command({COMMAND_SET_I2C_MASTER_MODE_ADDRESS, address, 0x54, 0x0D});
+}
+
+void Charger::set_boot_options(uint8_t boot_options)
+{
+    command({COMMAND_SET_BOOT_OPTIONS, boot_options, 0x3F, 0x1C});
+}
+
+uint8_t Charger::queue_command(uint8_t job_id, const Bytes &command)
+{
+    Bytes frame = {COMMAND_QUEUE, job_id, 0xE5, 0xA7};
+
+    frame.insert(frame.end(), command.begin(), command.end());
+    return this->command(frame)[1];
+}
+
+Bytes Charger::wait_for_jobs(const Bytes &job_ids, double timeout)
+{
+    Clock::time_point deadline;
+    std::vector<QueueJob> jobs;
+    Bytes results;
+    size_t cntr;
+    size_t job;
+
+    deadline = _deadline(timeout);
+    while(true)
+    {
+        jobs = get_queue();
+        results.clear();
+        for(cntr=0; cntr<job_ids.size(); ++cntr)
+        {
+            for(job=0; job<jobs.size(); ++job)
+            {
+                if((jobs[job].job_id==job_ids[cntr]) && (jobs[job].status==QUEUE_STATUS_DONE))
+                {
+                    results.push_back(jobs[job].result);
+                    break;
+                }
+            }
+        }
+        if(results.size()==job_ids.size())
+        {
+            return results;
+        }
+        if(Clock::now()>deadline)
+        {
+            throw ChargerError(_error("jobs not done"));
+        }
+        _sleep_ms(10);
+    }
+}
+
+/*****************************************************************************
+ * Checksum and bulk write                                                   *
+ *****************************************************************************/
+
+Checksum Charger::file_checksum(uint8_t file_number, uint32_t start_byte, uint32_t number_of_bytes, double timeout)
+{
+    Bytes frame = {COMMAND_FILE_CHECKSUM, file_number};
+    Clock::time_point deadline;
+    Checksum checksum;
+
+    _append_uint32(frame, start_byte);
+    _append_uint32(frame, number_of_bytes);
+    frame.push_back(0x91);
+    frame.push_back(0xC3);
+    checksum.status = command(frame)[1];
+    deadline = _deadline(timeout);
+    while(checksum.status==CHECKSUM_STATUS_BUSY)
+    {
+        if(Clock::now()>deadline)
+        {
+            throw ChargerError(_error("checksum of file " + std::to_string(file_number) + " timed out"));
+        }
+        _sleep_ms(5);
+        checksum = get_checksum();
+    }
+    if(checksum.status!=CHECKSUM_STATUS_DONE)
+    {
+        throw ChargerError(_error("checksum of file " + std::to_string(file_number) + " failed: " + _hex(checksum.status)));
+    }
+    return checksum;
+}
+
+void Charger::bulk_write_open(uint8_t file_number, uint16_t sector)
+{
+    Bytes frame = {COMMAND_BULK_WRITE_OPEN, file_number};
+
+    _append_uint16(frame, sector);
+    frame.push_back(0xC7);
+    frame.push_back(0xE1);
+    command(frame);
+}
+
+bool Charger::bulk_write_sector(uint16_t sector, uint8_t &sequence, const uint8_t *data, size_t length)
+{
+    Bytes frame;
+    Bytes confirmation;
+    size_t chunk_size;
+    size_t offset;
+    uint8_t chunk;
+    uint16_t crc;
+
+    chunk_size = _transport->frame_size() - 6;
+    for(offset=0; offset<length; offset+=chunk)
+    {
+        chunk = std::min(chunk_size, length-offset);
+        frame = {sequence, chunk};
+        crc = crc16(&frame[0], 2);
+        crc = crc16(&data[offset], chunk, crc);
+        frame = {DATAREQUEST_GET_COMMAND_RESPONSE, COMMAND_BULK_WRITE_DATA, sequence, chunk};
+        _append_uint16(frame, crc);
+        frame.insert(frame.end(), &data[offset], &data[offset+chunk]);
+        //Not confirmed, errors show up when committing
+        _transport->transfer(frame);
+        ++sequence;
+    }
+    frame = {COMMAND_BULK_WRITE_COMMIT};
+    _append_uint16(frame, sector);
+    _append_uint16(frame, crc16(data, length));
+    frame.push_back(0x2A);
+    frame.push_back(0x93);
+    confirmation = command(frame);
+    if(_get_uint16(confirmation, 0)!=sector+1)
+    {
+        return false;
+    }
+    sequence = confirmation[3];
+    return true;
+}
+
+void Charger::write_data(uint8_t file_number, const Bytes &data, unsigned retries)
+{
+    uint16_t sector = 0;
+    uint8_t sequence = 0;
+    unsigned failures = 0;
+    size_t offset;
+
+    bulk_write_open(file_number, 0);
+    while((offset = (size_t) sector * SECTOR_SIZE) < data.size())
+    {
+        if(!bulk_write_sector(sector, sequence, &data[offset], std::min(SECTOR_SIZE, data.size()-offset)))
+        {
+            if(++failures>retries)
+            {
+                throw ChargerError(_error("giving up on sector " + std::to_string(sector)));
+            }
+            //Start over from this sector
+            bulk_write_open(file_number, sector);
+            sequence = 0;
+            continue;
+        }
+        failures = 0;
+        ++sector;
+    }
+}
+
+uint8_t Charger::write_file(const std::string &file_name, const Bytes &data)
+{
+    uint8_t file_number;
+
+    file_number = find_file(file_name);
+    if(file_number!=FILE_NOT_FOUND)
+    {
+        delete_file(file_number);
+    }
+    file_number = create_file(file_name, data.size());
+    write_data(file_number, data);
+    return file_number;
+}
+
+bool Charger::verify_file(uint8_t file_number, const Bytes &data)
+{
+    Checksum checksum;
+
+    checksum = file_checksum(file_number);
+    return (checksum.length==data.size()) && (checksum.crc32==crc32(data.data(), data.size()));
+}
+
+}
@@ -0,0 +1,346 @@
+/*
+ * File:   charger.h
+ *
+ * Native host library for the API of the solar charger bootloader (see api.h),
+ * the C++ counterpart of RaspberryPi/charger.py.
+ *
+ * Charger implements the protocol on top of a Transport. A transport sends one
+ * frame of at most 64 bytes and returns the 64 byte response to it. The
+ * transports are declared in transport.h:
+ *  SpiTransport: Linux spidev, e.g. /dev/spidev0.0 on a Raspberry Pi
+ *  HidTransport: Linux hidraw, i.e. the custom HID interface via USB
+ *  SimulatedTransport: the firmware built for the host (libfirmware.so), in-process
+ *
+ * Example:
+ *  charger::Charger device(new charger::HidTransport(charger::find_hidraw_devices().at(0)));
+ *  charger::Status status = device.get_status();
+ *
+ * Errors (no or invalid response, file system errors...) throw ChargerError.
+ */
+
+#ifndef HOST_CHARGER_H
+#define HOST_CHARGER_H
+
+#include <stdint.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace charger
+{
+
+typedef std::vector<uint8_t> Bytes;
+
+const size_t FRAME_SIZE = 64;
+const size_t SECTOR_SIZE = 512;
+const uint8_t SIGNATURE[2] = {0xC1, 0x25};
+const uint16_t VENDOR_ID = 0x04D8;
+const uint16_t PRODUCT_ID = 0xF08E;
+
+//Number of root entries, i.e. file numbers 0 to 63
+const uint8_t ROOT_ENTRIES = 64;
+const uint8_t FILE_NOT_FOUND = 0xFF;
+
+//Data bytes per chunk of a read stream
+const uint8_t STREAM_CHUNK_SIZE = 58;
+
+//Data requests
+const uint8_t DATAREQUEST_GET_COMMAND_RESPONSE = 0x00;
+const uint8_t DATAREQUEST_GET_STATUS = 0x10;
+const uint8_t DATAREQUEST_GET_DISPLAY_1 = 0x11;
+const uint8_t DATAREQUEST_GET_DISPLAY_2 = 0x12;
+const uint8_t DATAREQUEST_GET_BOOTLOADER_DETAILS = 0x13;
+const uint8_t DATAREQUEST_GET_PROFILER = 0x14;
+const uint8_t DATAREQUEST_GET_CONFIGURATION = 0x15;
+const uint8_t DATAREQUEST_GET_CHECKSUM = 0x16;
+const uint8_t DATAREQUEST_GET_QUEUE = 0x17;
+const uint8_t DATAREQUEST_GET_ECHO = 0x20;
+const uint8_t DATAREQUEST_GET_FILE_DETAILS = 0x80;
+const uint8_t DATAREQUEST_FIND_FILE = 0x81;
+const uint8_t DATAREQUEST_READ_FILE = 0x82;
+const uint8_t DATAREQUEST_READ_BUFFER = 0x83;
+const uint8_t DATAREQUEST_READ_STREAM_OPEN = 0x84;
+const uint8_t DATAREQUEST_READ_STREAM_NEXT = 0x85;
+const uint8_t DATAREQUEST_READ_STREAM_BURST = 0x86;
+const uint8_t DATAREQUEST_GET_PROFILER_ENTRIES = 0x87;
+
+//Commands
+const uint8_t COMMAND_REBOT = 0x20;
+const uint8_t COMMAND_REBOT_BOOTLOADER_MODE = 0x21;
+const uint8_t COMMAND_REBOT_NORMAL_MODE = 0x22;
+const uint8_t COMMAND_JUMP_TO_MAIN_PROGRAM = 0x23;
+const uint8_t COMMAND_SUSPEND_BOOTLOADER = 0x24;
+const uint8_t COMMAND_RESET_PROFILER = 0x25;
+const uint8_t COMMAND_ENCODER_CCW = 0x3C;
+const uint8_t COMMAND_ENCODER_CW = 0x3D;
+const uint8_t COMMAND_ENCODER_PUSH = 0x3E;
+const uint8_t COMMAND_STOP_PARSING = 0x99;
+const uint8_t COMMAND_FILE_RESIZE = 0x50;
+const uint8_t COMMAND_FILE_DELETE = 0x51;
+const uint8_t COMMAND_FILE_CREATE = 0x52;
+const uint8_t COMMAND_FILE_RENAME = 0x53;
+const uint8_t COMMAND_FILE_APPEND = 0x54;
+const uint8_t COMMAND_FILE_MODIFY = 0x55;
+const uint8_t COMMAND_FORMAT_DRIVE = 0x56;
+const uint8_t COMMAND_SECTOR_TO_BUFFER = 0x57;
+const uint8_t COMMAND_BUFFER_TO_SECTOR = 0x58;
+const uint8_t COMMAND_WRITE_BUFFER = 0x59;
+const uint8_t COMMAND_FILE_COPY = 0x5A;
+const uint8_t COMMAND_BULK_WRITE_OPEN = 0x5B;
+const uint8_t COMMAND_BULK_WRITE_DATA = 0x5C;
+const uint8_t COMMAND_BULK_WRITE_COMMIT = 0x5D;
+const uint8_t COMMAND_FILE_CHECKSUM = 0x5E;
+const uint8_t COMMAND_QUEUE = 0x5F;
+const uint8_t COMMAND_SET_SPI_MODE = 0x70;
+const uint8_t COMMAND_SET_SPI_FREQUENCY = 0x71;
+const uint8_t COMMAND_SET_SPI_POLARITY = 0x72;
+const uint8_t COMMAND_SET_I2C_MODE = 0x73;
+const uint8_t COMMAND_SET_I2C_FREQUENCY = 0x74;
+const uint8_t COMMAND_SET_I2C_SLAVE_MODE_ADDRESS = 0x75;
+const uint8_t COMMAND_SET_I2C_MASTER_MODE_ADDRESS = 0x76;
+const uint8_t COMMAND_SET_BOOT_OPTIONS = 0x77;
+
+//apiChecksumStatus_t
+const uint8_t CHECKSUM_STATUS_IDLE = 0x00;
+const uint8_t CHECKSUM_STATUS_BUSY = 0x01;
+const uint8_t CHECKSUM_STATUS_DONE = 0x02;
+
+//apiQueueStatus_t
+const uint8_t QUEUE_STATUS_UNKNOWN = 0x00;
+const uint8_t QUEUE_STATUS_QUEUED = 0x01;
+const uint8_t QUEUE_STATUS_DONE = 0x02;
+const uint8_t QUEUE_STATUS_RUNNING = 0x03;
+const uint8_t QUEUE_STATUS_FULL = 0x80;
+const uint8_t QUEUE_STATUS_INVALID = 0x81;
+
+//bootloaderMode_t (os.h)
+const uint8_t BOOTLOADER_MODE_SEARCH = 0x10;
+const uint8_t BOOTLOADER_MODE_FILE_FOUND = 0x20;
+const uint8_t BOOTLOADER_MODE_FILE_VERIFYING = 0x30;
+const uint8_t BOOTLOADER_MODE_CHECK_COMPLETE = 0x40;
+const uint8_t BOOTLOADER_MODE_CHECK_FAILED = 0x50;
+const uint8_t BOOTLOADER_MODE_PROGRAMMING = 0x60;
+const uint8_t BOOTLOADER_MODE_DONE = 0x70;
+const uint8_t BOOTLOADER_MODE_SUSPENDED = 0x90;
+
+const uint8_t BOOT_OPTIONS_FAST_BOOT = 0xFB;
+
+//Probes of the profiler (os.h)
+const size_t PROFILER_NUMBER_OF_PROBES = 9;
+const size_t PROFILER_PROBES_PER_FRAME = 4;
+extern const char *const PROFILER_PROBES[PROFILER_NUMBER_OF_PROBES];
+
+class ChargerError : public std::runtime_error
+{
+public:
+    explicit ChargerError(const std::string &message) : std::runtime_error(message) {}
+};
+
+//CRC-16 CCITT as the bootloader, CRC-32 as zlib and the file checksum, Fletcher-16
+uint16_t crc16(const uint8_t *data, size_t length, uint16_t crc = 0xFFFF);
+uint32_t crc32(const uint8_t *data, size_t length);
+uint16_t fletcher16(const uint8_t *data, size_t length);
+
+//Pads a frame with zeros to size bytes
+Bytes pad_frame(const Bytes &frame, size_t size = FRAME_SIZE);
+
+//Sends one frame and returns the 64 byte response to it
+class Transport
+{
+public:
+    virtual ~Transport() {}
+    virtual Bytes transfer(const Bytes &frame) = 0;
+    //Largest frame the transport can carry
+    virtual size_t frame_size() const { return FRAME_SIZE; }
+    const std::string &name() const { return _name; }
+
+protected:
+    std::string _name;
+};
+
+struct Status
+{
+    bool flash_busy;
+    uint8_t version[3];
+    uint8_t ui_status;
+    uint8_t encoder_count;
+    uint8_t button_count;
+    uint8_t time_slot;
+    bool done;
+    uint8_t bootloader_mode;
+    uint8_t display_mode;
+    uint16_t boot_time;
+};
+
+struct BootloaderDetails
+{
+    uint32_t file_size;
+    uint16_t entries;
+    uint16_t total_entries;
+    uint8_t error;
+    uint16_t pages_written;
+    uint16_t record_length;
+    uint16_t record_address;
+    uint8_t record_type;
+    uint8_t record_checksum;
+    uint8_t record_checksum_check;
+    Bytes record_data;
+    uint16_t pages_erased;
+    uint16_t blocks_written;
+    uint16_t verify_failed_page;
+    uint8_t verify_retries;
+};
+
+//Count, minimum, maximum and total of a probe, in Timer3 ticks of 8 instruction cycles
+struct ProfilerProbe
+{
+    uint16_t count;
+    uint32_t minimum;
+    uint32_t maximum;
+    uint32_t total;
+};
+
+struct Configuration
+{
+    uint8_t spi_mode;
+    uint8_t spi_frequency;
+    uint8_t spi_polarity;
+    uint8_t i2c_mode;
+    uint8_t i2c_frequency;
+    uint8_t i2c_slave_mode_address;
+    uint8_t i2c_master_mode_address;
+};
+
+struct Checksum
+{
+    uint8_t status;
+    uint8_t file_number;
+    uint32_t start;
+    uint32_t length;
+    uint32_t done;
+    uint32_t crc32;
+    uint16_t fletcher16;
+};
+
+struct QueueJob
+{
+    uint8_t job_id;
+    uint8_t command;
+    uint8_t status;
+    uint8_t result;
+};
+
+struct FileDetails
+{
+    uint8_t file_number;
+    std::string name;
+    uint8_t attributes;
+    uint16_t first_cluster;
+    uint32_t size;
+};
+
+class Charger
+{
+public:
+    //Takes ownership of the transport
+    explicit Charger(Transport *transport);
+    ~Charger();
+
+    Transport &transport() { return *_transport; }
+    const std::string &name() const { return _transport->name(); }
+
+    //Low level
+    //Sends a frame and checks the response's signature
+    Bytes request(const Bytes &frame);
+    //Executes a single command and returns its confirmation (without the command byte)
+    Bytes command(const Bytes &command);
+    //Executes short commands (encoder etc.) that are not confirmed
+    void send_commands(const Bytes &commands);
+
+    //Data requests
+    bool echo(const Bytes &data);
+    Status get_status();
+    //4 lines of 20 characters
+    std::vector<std::string> get_display();
+    BootloaderDetails get_bootloader_details();
+    std::vector<ProfilerProbe> get_profiler();
+    Configuration get_configuration();
+    Checksum get_checksum();
+    //Jobs in the queue, oldest first
+    std::vector<QueueJob> get_queue();
+    //Steps done and number of steps of the format or copy job running, 0 and 0 if none
+    void get_queue_progress(uint16_t &steps_done, uint16_t &number_of_steps);
+    //Returns false if there is no such file
+    bool get_file_details(uint8_t file_number, FileDetails &details);
+    std::vector<FileDetails> list_files();
+    //File number or FILE_NOT_FOUND
+    uint8_t find_file(const std::string &file_name);
+    //0x82: up to 54 bytes
+    Bytes read_file_chunk(uint8_t file_number, uint32_t start_byte);
+    Bytes read_buffer(uint16_t start_byte = 0, size_t length = SECTOR_SIZE);
+    //Read stream: every response carries the next 58 bytes
+    Bytes read_file(uint8_t file_number, uint32_t start_byte = 0);
+
+    //Commands
+    void reboot();
+    void reboot_bootloader_mode();
+    void reboot_normal_mode();
+    void jump_to_main_program();
+    void suspend_bootloader();
+    void reset_profiler();
+    void turn_counter_clockwise();
+    void turn_clockwise();
+    void press_button();
+    uint8_t resize_file(uint8_t file_number, uint32_t new_file_size);
+    uint8_t delete_file(uint8_t file_number);
+    //Returns the new file's number
+    uint8_t create_file(const std::string &file_name, uint32_t file_size);
+    uint8_t rename_file(uint8_t file_number, const std::string &file_name);
+    uint8_t append_to_file(uint8_t file_number, const Bytes &data);
+    uint8_t modify_file(uint8_t file_number, uint32_t start_byte, const Bytes &data);
+    uint8_t format_drive();
+    uint8_t sector_to_buffer(uint8_t file_number, uint16_t sector);
+    uint8_t buffer_to_sector(uint8_t file_number, uint16_t sector);
+    //Writes any amount of data to the buffer, a frame at a time
+    void write_buffer(uint16_t start_byte, const Bytes &data);
+    uint8_t copy_file(uint8_t file_number, const std::string &file_name);
+    void set_spi_mode(uint8_t mode);
+    void set_spi_frequency(uint8_t frequency);
+    void set_spi_polarity(uint8_t polarity);
+    void set_i2c_mode(uint8_t mode);
+    void set_i2c_frequency(uint8_t frequency);
+    void set_i2c_slave_mode_address(uint8_t address);
+    void set_i2c_master_mode_address(uint8_t address);
+    void set_boot_options(uint8_t boot_options);
+    //Returns the job's apiQueueStatus_t
+    uint8_t queue_command(uint8_t job_id, const Bytes &command);
+    //Returns the jobs' results, in the order given, once all of them are done
+    Bytes wait_for_jobs(const Bytes &job_ids, double timeout = 5.0);
+
+    //Checksum and bulk write
+    //CRC-32 (as zlib.crc32) and Fletcher-16 over a range of a file
+    Checksum file_checksum(uint8_t file_number, uint32_t start_byte = 0, uint32_t number_of_bytes = 0xFFFFFFFF, double timeout = 10.0);
+    void bulk_write_open(uint8_t file_number, uint16_t sector);
+    //Sends one sector's data and commits it. Returns false if the sector has to be sent again,
+    //otherwise sequence is the sequence number to continue with
+    bool bulk_write_sector(uint16_t sector, uint8_t &sequence, const uint8_t *data, size_t length);
+    //Overwrites an existing file of the right size, a sector at a time
+    void write_data(uint8_t file_number, const Bytes &data, unsigned retries = 10);
+    //Replaces the file if it exists. Returns the file number
+    uint8_t write_file(const std::string &file_name, const Bytes &data);
+    //Compares the device's CRC-32 of the file with the data's
+    bool verify_file(uint8_t file_number, const Bytes &data);
+
+private:
+    Charger(const Charger &);
+    Charger &operator=(const Charger &);
+
+    void _send_reboot(uint8_t command);
+    std::string _error(const std::string &message) const;
+
+    Transport *_transport;
+};
+
+}
+
+#endif /* HOST_CHARGER_H */
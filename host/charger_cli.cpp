@@ -0,0 +1,373 @@
+/*
+ * File:   charger_cli.cpp
+ *
+ * Command line tool for the charger, based on charger.h. The native counterpart
+ * of RaspberryPi/charger_tool.py
+ *
+ * Usage: charger_cli [TRANSPORT] COMMAND [ARGUMENTS]
+ *
+ * Transports (default: the first charger found via hidraw):
+ *  --hid [PATH]       custom HID interface via /dev/hidrawN
+ *  --spi BUS.DEVICE   spidev, e.g. --spi 0.0
+ *  --speed HZ         SPI clock (default 2000000)
+ *  --sim              simulated device (libfirmware.so), starts out empty
+ *
+ * Commands:
+ *  status                    general status information
+ *  details                   bootloader details
+ *  config                    external communication configuration
+ *  display                   display content
+ *  profiler                  profiler probes
+ *  ls                        list files
+ *  read REMOTE [LOCAL]       read a file, print it or save it to LOCAL
+ *  write LOCAL REMOTE        write a file (replaces REMOTE if it exists)
+ *  rm REMOTE                 delete a file
+ *  checksum REMOTE           CRC-32 and Fletcher-16 of a file
+ *  push                      press the push button
+ *  reboot [normal|bootloader]
+ *  bench [SIZE] [ROUNDS]     measure latency and throughput with a file of SIZE bytes
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <random>
+
+#include "charger.h"
+#include "transport.h"
+
+using namespace charger;
+
+static const char USAGE[] =
+    "Usage: charger_cli [--hid [PATH] | --spi BUS.DEVICE [--speed HZ] | --sim] COMMAND [ARGUMENTS]\n"
+    "Commands: status, details, config, display, profiler, ls, read REMOTE [LOCAL],\n"
+    "          write LOCAL REMOTE, rm REMOTE, checksum REMOTE, push,\n"
+    "          reboot [normal|bootloader], bench [SIZE] [ROUNDS]\n";
+
+typedef std::chrono::steady_clock Clock;
+
+static double _seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static uint8_t _find_file(Charger &device, const std::string &remote_file_name)
+{
+    uint8_t file_number;
+
+    file_number = device.find_file(remote_file_name);
+    if(file_number==FILE_NOT_FOUND)
+    {
+        throw ChargerError("File not found: " + remote_file_name);
+    }
+    return file_number;
+}
+
+static void _print_value(const char *key, unsigned value)
+{
+    printf("%-24s %u (0x%02X)\n", key, value, value);
+}
+
+static void _status(Charger &device)
+{
+    Status status;
+
+    status = device.get_status();
+    _print_value("boot_time", status.boot_time);
+    _print_value("bootloader_mode", status.bootloader_mode);
+    _print_value("button_count", status.button_count);
+    _print_value("display_mode", status.display_mode);
+    _print_value("done", status.done);
+    _print_value("encoder_count", status.encoder_count);
+    _print_value("flash_busy", status.flash_busy);
+    _print_value("time_slot", status.time_slot);
+    _print_value("ui_status", status.ui_status);
+    printf("%-24s %u.%u.%u\n", "version", status.version[0], status.version[1], status.version[2]);
+}
+
+static void _details(Charger &device)
+{
+    BootloaderDetails details;
+
+    details = device.get_bootloader_details();
+    _print_value("blocks_written", details.blocks_written);
+    _print_value("entries", details.entries);
+    _print_value("error", details.error);
+    _print_value("file_size", details.file_size);
+    _print_value("pages_erased", details.pages_erased);
+    _print_value("pages_written", details.pages_written);
+    _print_value("record_address", details.record_address);
+    _print_value("record_checksum", details.record_checksum);
+    _print_value("record_checksum_check", details.record_checksum_check);
+    _print_value("record_length", details.record_length);
+    _print_value("record_type", details.record_type);
+    _print_value("total_entries", details.total_entries);
+    _print_value("verify_failed_page", details.verify_failed_page);
+    _print_value("verify_retries", details.verify_retries);
+}
+
+static void _config(Charger &device)
+{
+    Configuration configuration;
+
+    configuration = device.get_configuration();
+    _print_value("i2c_frequency", configuration.i2c_frequency);
+    _print_value("i2c_master_mode_address", configuration.i2c_master_mode_address);
+    _print_value("i2c_mode", configuration.i2c_mode);
+    _print_value("i2c_slave_mode_address", configuration.i2c_slave_mode_address);
+    _print_value("spi_frequency", configuration.spi_frequency);
+    _print_value("spi_mode", configuration.spi_mode);
+    _print_value("spi_polarity", configuration.spi_polarity);
+}
+
+static void _profiler(Charger &device)
+{
+    std::vector<ProfilerProbe> probes;
+    size_t cntr;
+
+    probes = device.get_profiler();
+    printf("%-12s %6s %10s %10s %10s  (Timer3 ticks)\n", "probe", "count", "minimum", "maximum", "total");
+    for(cntr=0; cntr<probes.size(); ++cntr)
+    {
+        printf("%-12s %6u %10u %10u %10u\n", PROFILER_PROBES[cntr], probes[cntr].count,
+               probes[cntr].minimum, probes[cntr].maximum, probes[cntr].total);
+    }
+}
+
+//Round trip time of a single frame, then write, read and checksum of a file
+static void _bench(Charger &device, size_t size, unsigned rounds)
+{
+    std::mt19937 random(1);
+    Bytes data(size);
+    Bytes read;
+    Checksum checksum;
+    Clock::time_point start;
+    double write_time;
+    double read_time;
+    double checksum_time;
+    uint8_t file_number = FILE_NOT_FOUND;
+    unsigned cntr;
+
+    start = Clock::now();
+    for(cntr=0; cntr<100; ++cntr)
+    {
+        device.get_status();
+    }
+    printf("Round trip: %.2fms per frame\n", _seconds_since(start) * 10);
+
+    for(cntr=0; cntr<size; ++cntr)
+    {
+        data[cntr] = random();
+    }
+    for(cntr=0; cntr<rounds; ++cntr)
+    {
+        start = Clock::now();
+        file_number = device.write_file("BENCH.BIN", data);
+        write_time = _seconds_since(start);
+        start = Clock::now();
+        read = device.read_file(file_number);
+        read_time = _seconds_since(start);
+        start = Clock::now();
+        checksum = device.file_checksum(file_number);
+        checksum_time = _seconds_since(start);
+        if((read!=data) || (checksum.crc32!=crc32(data.data(), data.size())) || (checksum.fletcher16!=fletcher16(data.data(), data.size())))
+        {
+            throw ChargerError("Data read back does not match");
+        }
+        printf("Round %u: write %.1fkB/s, read %.1fkB/s, checksum %.1fkB/s\n", cntr + 1,
+               size / write_time / 1024, size / read_time / 1024, size / checksum_time / 1024);
+    }
+    if(file_number!=FILE_NOT_FOUND)
+    {
+        device.delete_file(file_number);
+    }
+}
+
+static Transport *_open_transport(const std::string &kind, const std::string &argument, uint32_t speed)
+{
+    std::vector<std::string> devices;
+    size_t dot;
+
+    if(kind=="sim")
+    {
+        return new SimulatedTransport();
+    }
+    if(kind=="spi")
+    {
+        dot = argument.find('.');
+        if(dot==std::string::npos)
+        {
+            throw ChargerError("--spi needs BUS.DEVICE, e.g. 0.0");
+        }
+        return new SpiTransport(atoi(argument.substr(0, dot).c_str()), atoi(argument.substr(dot+1).c_str()), speed);
+    }
+    if(!argument.empty())
+    {
+        return new HidTransport(argument);
+    }
+    devices = find_hidraw_devices();
+    if(devices.empty())
+    {
+        throw ChargerError("No charger found");
+    }
+    return new HidTransport(devices[0]);
+}
+
+static int _run(int argc, char **argv)
+{
+    std::string kind("hid");
+    std::string argument;
+    uint32_t speed = 2000000;
+    std::vector<std::string> arguments;
+    std::string command;
+    int index;
+
+    for(index=1; index<argc; ++index)
+    {
+        if(!strcmp(argv[index], "--sim"))
+        {
+            kind = "sim";
+        }
+        else if(!strcmp(argv[index], "--spi") && (index+1<argc))
+        {
+            kind = "spi";
+            argument = argv[++index];
+        }
+        else if(!strcmp(argv[index], "--speed") && (index+1<argc))
+        {
+            speed = strtoul(argv[++index], NULL, 0);
+        }
+        else if(!strcmp(argv[index], "--hid"))
+        {
+            kind = "hid";
+            if((index+1<argc) && !strncmp(argv[index+1], "/dev/", 5))
+            {
+                argument = argv[++index];
+            }
+        }
+        else
+        {
+            arguments.push_back(argv[index]);
+        }
+    }
+    if(arguments.empty())
+    {
+        fputs(USAGE, stderr);
+        return 1;
+    }
+    command = arguments[0];
+    arguments.erase(arguments.begin());
+
+    Charger device(_open_transport(kind, argument, speed));
+    if(command=="status")
+    {
+        _status(device);
+    }
+    else if(command=="details")
+    {
+        _details(device);
+    }
+    else if(command=="config")
+    {
+        _config(device);
+    }
+    else if(command=="display")
+    {
+        std::vector<std::string> lines = device.get_display();
+        for(size_t line=0; line<lines.size(); ++line)
+        {
+            printf("%s\n", lines[line].c_str());
+        }
+    }
+    else if(command=="profiler")
+    {
+        _profiler(device);
+    }
+    else if(command=="ls")
+    {
+        std::vector<FileDetails> files = device.list_files();
+        for(size_t file=0; file<files.size(); ++file)
+        {
+            printf("#%-3u %-12s %8u bytes\n", files[file].file_number, files[file].name.c_str(), files[file].size);
+        }
+    }
+    else if((command=="read") && (arguments.size()>=1))
+    {
+        Bytes data = device.read_file(_find_file(device, arguments[0]));
+        if(arguments.size()>1)
+        {
+            std::ofstream file(arguments[1].c_str(), std::ios::binary);
+            file.write((const char*) data.data(), data.size());
+        }
+        else
+        {
+            fwrite(data.data(), 1, data.size(), stdout);
+        }
+    }
+    else if((command=="write") && (arguments.size()>=2))
+    {
+        std::ifstream file(arguments[0].c_str(), std::ios::binary);
+        if(!file)
+        {
+            throw ChargerError("Can't open " + arguments[0]);
+        }
+        Bytes data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        uint8_t file_number = device.write_file(arguments[1], data);
+        printf("%u bytes written to file #%u\n", (unsigned) data.size(), file_number);
+    }
+    else if((command=="rm") && (arguments.size()>=1))
+    {
+        device.delete_file(_find_file(device, arguments[0]));
+    }
+    else if((command=="checksum") && (arguments.size()>=1))
+    {
+        Checksum checksum = device.file_checksum(_find_file(device, arguments[0]));
+        printf("%u bytes, CRC-32 0x%08X, Fletcher-16 0x%04X\n", checksum.length, checksum.crc32, checksum.fletcher16);
+    }
+    else if(command=="push")
+    {
+        device.press_button();
+    }
+    else if(command=="reboot")
+    {
+        if(!arguments.empty() && (arguments[0]=="normal"))
+        {
+            device.reboot_normal_mode();
+        }
+        else if(!arguments.empty() && (arguments[0]=="bootloader"))
+        {
+            device.reboot_bootloader_mode();
+        }
+        else
+        {
+            device.reboot();
+        }
+    }
+    else if(command=="bench")
+    {
+        _bench(device, arguments.size()>0 ? strtoul(arguments[0].c_str(), NULL, 0) : 65536,
+               arguments.size()>1 ? strtoul(arguments[1].c_str(), NULL, 0) : 3);
+    }
+    else
+    {
+        fputs(USAGE, stderr);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        return _run(argc, argv);
+    }
+    catch(const std::exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,460 @@
+/*
+ * File:   firmware.c
+ *
+ * Host build of the firmware modules behind the API. They are compiled as a
+ * single translation unit, just like hex_test.c pulls in hex.c, so that the
+ * tentative and constant definitions in their headers exist only once.
+ * The modules they call are replaced by the models below:
+ *  flash.c          External flash and its buffer 2 in RAM
+ *  i2c.c            EEPROM in RAM, reads are counted
+ *  internal_flash.c Program memory in RAM. Writes can only clear bits
+ *  os.c             Profiler on the host's clock, delays and reboot() only count
+ *  Port A           The pushbutton is never pressed
+ *  display.c, ui.c  Blank display, user interface off
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "../api.c"
+#include "../fat16.c"
+#include "../hex.c"
+#include "../bootloader.c"
+#include "../ui.c"
+
+#include "firmware.h"
+
+uint8_t host_flash[HOST_FLASH_NUMBER_OF_PAGES][HOST_FLASH_PAGE_SIZE];
+uint8_t host_flash_buffer[HOST_FLASH_PAGE_SIZE];
+uint8_t host_eeprom[HOST_EEPROM_SIZE];
+uint8_t host_program_memory[HOST_PROGRAM_MEMORY_SIZE];
+uint16_t host_reboots;
+uint8_t host_write_faults;
+uint16_t host_boot_delay_ms;
+uint16_t host_eeprom_reads;
+
+volatile LATCbits_t LATCbits;
+volatile LATDbits_t LATDbits;
+volatile PORTAbits_t PORTAbits = {1};
+volatile LATAbits_t LATAbits;
+volatile TRISAbits_t TRISAbits;
+
+static uint8_t host_application_running;
+static uint8_t host_display_unit_settled;
+static uint8_t host_page_buffer[1024];
+static profilerEntry_t host_profiler[PROFILER_NUMBER_OF_PROBES];
+
+
+/* ****************************************************************************
+ * Host interface
+ * ****************************************************************************/
+
+//What system_full_init() does, without the start screen
+static void _host_start_bootloader(void)
+{
+    system_profiler_reset();
+    os.bootloader_mode = BOOTLOADER_MODE_SEARCH;
+    os.display_mode = DISPLAY_MODE_BOOTLOADER_SEARCH;
+    fat_init();
+    ui_init();
+}
+
+void host_init(const uint8_t *configuration_words)
+{
+    memset(host_flash, 0xFF, sizeof(host_flash));
+    memset(host_flash_buffer, 0xFF, sizeof(host_flash_buffer));
+    memset(host_eeprom, 0xFF, sizeof(host_eeprom));
+    memset(host_program_memory, 0xFF, sizeof(host_program_memory));
+    memcpy(&host_program_memory[BOOTLOADER_CONFIGURATIONBITS_ADDRESS_MIN], configuration_words, BOOTLOADER_CONFIGURATIONBITS_SIZE);
+    host_reboots = 0;
+    host_write_faults = 0;
+    _host_start_bootloader();
+}
+
+uint8_t host_boot(void)
+{
+    host_boot_delay_ms = 0;
+    host_eeprom_reads = 0;
+    host_display_unit_settled = 0;
+    //What system_minimal_init() waits for
+    system_delay_ms(BOOT_SETTLE_DELAY_BOARD_MS);
+
+    if(bootloader_normal_mode() && (bootloader_check_image()<=IMAGE_CHECK_RESULT_NO_DESCRIPTOR))
+    {
+        //The main program isn't simulated. The API keeps working, the bootloader doesn't run
+        host_application_running = 1;
+        system_profiler_reset();
+        fat_init();
+        return 1;
+    }
+    _host_start_bootloader();
+    return 0;
+}
+
+void host_transfer(uint8_t *frame, uint8_t length, uint8_t *response)
+{
+    memset(response, 0, 64);
+    api_prepare(frame, response);
+    api_parse(frame, length, response);
+}
+
+void host_main_loop_pass(void)
+{
+    //Every pass is a time slot of its own
+    api_run();
+    if(!host_application_running)
+    {
+        ui_run();
+        if((os.timeSlot&TIMESLOT_MASK)<6)
+        {
+            bootloader_run(os.timeSlot&TIMESLOT_MASK);
+        }
+    }
+    ++os.timeSlot;
+}
+
+uint8_t host_get_bootloader_mode(void)
+{
+    return os.bootloader_mode;
+}
+
+uint8_t host_get_bootloader_file_number(void)
+{
+    return file_number;
+}
+
+
+/* ****************************************************************************
+ * flash.c
+ * ****************************************************************************/
+
+uint8_t flash_is_busy(void)
+{
+    return 0;
+}
+
+void flash_sector_read(uint16_t page, uint8_t *data)
+{
+    uint32_t profile_start = system_profiler_start();
+    memcpy(data, host_flash[page], HOST_FLASH_PAGE_SIZE);
+    system_profiler_stop(PROFILER_PROBE_FLASH_READ, profile_start);
+}
+
+void flash_sector_write(uint16_t page, uint8_t *data)
+{
+    uint32_t profile_start = system_profiler_start();
+    memcpy(host_flash[page], data, HOST_FLASH_PAGE_SIZE);
+    system_profiler_stop(PROFILER_PROBE_FLASH_WRITE, profile_start);
+}
+
+void flash_partial_read(uint16_t page, uint16_t start, uint16_t length, uint8_t *data)
+{
+    uint32_t profile_start = system_profiler_start();
+    memcpy(data, &host_flash[page][start], length);
+    system_profiler_stop(PROFILER_PROBE_FLASH_READ, profile_start);
+}
+
+void flash_partial_write(uint16_t page, uint16_t start, uint16_t length, uint8_t *data)
+{
+    uint32_t profile_start = system_profiler_start();
+    memcpy(&host_flash[page][start], data, length);
+    system_profiler_stop(PROFILER_PROBE_FLASH_WRITE, profile_start);
+}
+
+void flash_copy_page_to_buffer(uint16_t page)
+{
+    memcpy(host_flash_buffer, host_flash[page], HOST_FLASH_PAGE_SIZE);
+}
+
+void flash_write_page_from_buffer(uint16_t page)
+{
+    uint32_t profile_start = system_profiler_start();
+    memcpy(host_flash[page], host_flash_buffer, HOST_FLASH_PAGE_SIZE);
+    system_profiler_stop(PROFILER_PROBE_FLASH_WRITE, profile_start);
+}
+
+void flash_read_from_buffer(uint16_t start, uint16_t length, uint8_t *data)
+{
+    memcpy(data, &host_flash_buffer[start], length);
+}
+
+void flash_write_to_buffer(uint16_t start, uint16_t length, uint8_t *data)
+{
+    memcpy(&host_flash_buffer[start], data, length);
+}
+
+
+/* ****************************************************************************
+ * i2c.c
+ * ****************************************************************************/
+
+void i2c_eeprom_writeByte(uint16_t address, uint8_t data)
+{
+    host_eeprom[address] = data;
+}
+
+uint8_t i2c_eeprom_readByte(uint16_t address)
+{
+    return host_eeprom[address];
+}
+
+void i2c_eeprom_write(uint16_t address, uint8_t *data, uint16_t length)
+{
+    memcpy(&host_eeprom[address], data, length);
+}
+
+void i2c_eeprom_read(uint16_t address, uint8_t *data, uint8_t length)
+{
+    ++host_eeprom_reads;
+    memcpy(data, &host_eeprom[address], length);
+}
+
+void i2c_eeprom_wait_write_complete(void)
+{
+}
+
+
+/* ****************************************************************************
+ * internal_flash.c
+ * ****************************************************************************/
+
+uint8_t* internalFlash_getBuffer(void)
+{
+    return host_page_buffer;
+}
+
+void internalFlash_readPage(uint16_t page)
+{
+    memcpy(host_page_buffer, &host_program_memory[internalFlash_addressFromPage(page)], 1024);
+}
+
+void internalFlash_setBufferByte(uint16_t address_within_page, uint8_t data)
+{
+    host_page_buffer[address_within_page] = data;
+}
+
+//Blocks to write are found by comparing in internalFlash_writePage()
+//Returns one bit per block that differs from program memory
+uint16_t internalFlash_compareBuffer(uint16_t page)
+{
+    uint32_t address = internalFlash_addressFromPage(page);
+    uint16_t cntr;
+    uint16_t dirty_blocks = 0;
+
+    for(cntr=0; cntr<1024; cntr+=64)
+    {
+        if(memcmp(&host_program_memory[address+cntr], &host_page_buffer[cntr], 64)!=0)
+        {
+            dirty_blocks |= (1u << (cntr>>6));
+        }
+    }
+    return dirty_blocks;
+}
+
+void internalFlash_erasePage(uint16_t page)
+{
+    uint32_t address = internalFlash_addressFromPage(page);
+
+    //Same range check as the device
+    if((address<PROG_START) || (address+1023>=INTERNAL_FLASH_SIZE))
+    {
+        return;
+    }
+    memset(&host_program_memory[address], 0xFF, 1024);
+}
+
+//Returns the number of 64 byte blocks that differ from program memory
+uint8_t internalFlash_writePage(uint16_t page)
+{
+    uint32_t address = internalFlash_addressFromPage(page);
+    uint16_t cntr;
+    uint16_t fault = 1024;
+    uint8_t fault_data = 0;
+    uint8_t blocks_written = 0;
+
+    if((address<PROG_START) || (address+1023>=INTERNAL_FLASH_SIZE))
+    {
+        return 0;
+    }
+    for(cntr=0; cntr<1024; cntr+=64)
+    {
+        if(memcmp(&host_program_memory[address+cntr], &host_page_buffer[cntr], 64)!=0)
+        {
+            ++blocks_written;
+        }
+    }
+    if(host_write_faults)
+    {
+        for(cntr=0; (cntr<1024) && (fault==1024); ++cntr)
+        {
+            if(host_program_memory[address+cntr]!=host_page_buffer[cntr])
+            {
+                fault = cntr;
+                fault_data = host_program_memory[address+cntr];
+            }
+        }
+    }
+    //Programming can only clear bits
+    for(cntr=0; cntr<1024; ++cntr)
+    {
+        host_program_memory[address+cntr] &= host_page_buffer[cntr];
+    }
+    if(fault<1024)
+    {
+        --host_write_faults;
+        host_program_memory[address+fault] = fault_data;
+    }
+    return blocks_written;
+}
+
+uint8_t internalFlash_pageNeedsErase(uint16_t page)
+{
+    uint32_t address = internalFlash_addressFromPage(page);
+    uint16_t cntr;
+
+    for(cntr=0; cntr<1024; ++cntr)
+    {
+        if((host_page_buffer[cntr] & host_program_memory[address+cntr]) != host_page_buffer[cntr])
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+uint8_t internalFlash_read(uint32_t address, uint16_t data_length, uint8_t* buffer)
+{
+    if(address >= INTERNAL_FLASH_SIZE)
+    {
+        return 0;
+    }
+    memcpy(buffer, &host_program_memory[address], data_length);
+    return 1;
+}
+
+uint16_t internalFlash_pageFromAddress(uint32_t address)
+{
+    return (uint16_t) (address >> 10);
+}
+
+uint32_t internalFlash_addressFromPage(uint16_t page)
+{
+    return (uint32_t) page << 10;
+}
+
+uint16_t internalFlash_addressWithinPage(uint32_t address, uint16_t page)
+{
+    return (uint16_t) (address - internalFlash_addressFromPage(page));
+}
+
+
+/* ****************************************************************************
+ * os.c
+ * ****************************************************************************/
+
+void system_profiler_reset(void)
+{
+    uint8_t cntr;
+
+    for(cntr=0; cntr<PROFILER_NUMBER_OF_PROBES; ++cntr)
+    {
+        host_profiler[cntr].count = 0;
+        host_profiler[cntr].minimum = 0xFFFF;
+        host_profiler[cntr].maximum = 0;
+        host_profiler[cntr].total = 0;
+    }
+}
+
+//Timer3 ticks: 8 instruction cycles at 12MIPS, i.e. 1.5 ticks per microsecond
+uint32_t system_profiler_start(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) ((uint64_t) now.tv_sec * 1500000 + (uint64_t) now.tv_nsec * 3 / 2000);
+}
+
+void system_profiler_stop(profilerProbe_t probe, uint32_t start)
+{
+    uint32_t ticks;
+    profilerEntry_t *entry;
+
+    ticks = system_profiler_start() - start;
+    entry = &host_profiler[probe];
+    if(entry->count==0xFFFF)
+    {
+        return;
+    }
+    ++entry->count;
+    entry->total += ticks;
+    if(ticks>0xFFFF)
+    {
+        ticks = 0xFFFF;
+    }
+    if(ticks<entry->minimum)
+    {
+        entry->minimum = (uint16_t) ticks;
+    }
+    if(ticks>entry->maximum)
+    {
+        entry->maximum = (uint16_t) ticks;
+    }
+}
+
+profilerEntry_t *system_profiler_get(profilerProbe_t probe)
+{
+    return &host_profiler[probe];
+}
+
+void reboot(void)
+{
+    ++host_reboots;
+}
+
+void system_delay_ms(uint8_t ms)
+{
+    host_boot_delay_ms += ms;
+}
+
+void system_wait_for_display_unit(void)
+{
+    if(!host_display_unit_settled)
+    {
+        system_delay_ms(BOOT_SETTLE_DELAY_DISPLAY_UNIT_MS);
+        host_display_unit_settled = 1;
+    }
+}
+
+
+/* ****************************************************************************
+ * display.c, i2c.c and os.c as far as ui.c uses them
+ * ****************************************************************************/
+
+uint8_t display_get_character(uint8_t line, uint8_t position)
+{
+    return ' ';
+}
+
+void display_invalidate(void)
+{
+}
+
+void i2c_display_send_init_sequence(void)
+{
+}
+
+void i2c_digipot_reset_on(void)
+{
+}
+
+void i2c_digipot_reset_off(void)
+{
+}
+
+void i2c_digipot_backlight(uint8_t level)
+{
+}
+
+void system_encoder_enable(void)
+{
+}
@@ -0,0 +1,55 @@
+/*
+ * File:   firmware.h
+ *
+ * Host build of the firmware modules behind the API (api.c, fat16.c, hex.c,
+ * bootloader.c, ui.c), see firmware.c. The hardware they talk to is modelled in RAM
+ * Also built as a shared library, which charger_sim.py loads once per device
+ */
+
+#ifndef HOST_FIRMWARE_H
+#define HOST_FIRMWARE_H
+
+#include <stdint.h>
+
+#define HOST_FLASH_PAGE_SIZE 512
+#define HOST_FLASH_NUMBER_OF_PAGES 8192
+#define HOST_EEPROM_SIZE 0x10000
+#define HOST_PROGRAM_MEMORY_SIZE 0x20000
+
+//External flash (AT45DB321E), EEPROM and program memory. All erased (0xFF) at start
+extern uint8_t host_flash[HOST_FLASH_NUMBER_OF_PAGES][HOST_FLASH_PAGE_SIZE];
+extern uint8_t host_eeprom[HOST_EEPROM_SIZE];
+extern uint8_t host_program_memory[HOST_PROGRAM_MEMORY_SIZE];
+
+//Number of times reboot() has been called. It returns on the host
+extern uint16_t host_reboots;
+
+//Number of program memory page writes still to fail. Such a write leaves the first byte
+//it should change as it was, the way a block that did not take reads back on the device
+extern uint8_t host_write_faults;
+
+//What the last host_boot() spent: milliseconds waited for the board and the display
+//unit to settle and EEPROM reads. Counted, the host doesn't actually wait
+extern uint16_t host_boot_delay_ms;
+extern uint16_t host_eeprom_reads;
+
+//Erases all memories, sets the device's configuration words and starts the bootloader
+void host_init(const uint8_t *configuration_words);
+
+//What the device does after a reset, with the memories as they are but all other
+//state as it is after loading. Returns 1 if the main program would be started,
+//0 if the bootloader has been started. The main program isn't simulated: the API
+//keeps answering but neither the bootloader nor the user interface run
+uint8_t host_boot(void);
+
+//One frame through the API, the way a HID report is handled
+void host_transfer(uint8_t *frame, uint8_t length, uint8_t *response);
+
+//One pass through the main loop as far as the API and the bootloader are concerned
+void host_main_loop_pass(void);
+
+//The bootloader's state and the file it has found
+uint8_t host_get_bootloader_mode(void);
+uint8_t host_get_bootloader_file_number(void);
+
+#endif /* HOST_FIRMWARE_H */
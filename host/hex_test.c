@@ -0,0 +1,392 @@
+/*
+ * File:   hex_test.c
+ *
+ * Host build of hex.c
+ *  fuzz:  Feeds the records of the given hex files to parseHexFileEntry the way
+ *         the bootloader does, then again with invalid characters and random
+ *         mutations. Invalid characters must be reported as
+ *         RecordErrorInvalidCharacter. Build with sanitizers to catch reads
+ *         past the end of the character buffer
+ *  bench: Times hexDecodeBytes against the comparison chain it replaced
+ *
+ * Usage: hex_test fuzz|bench FILE...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//Pull in the static functions as well
+#include "../hex.c"
+
+//Same as BOOTLOADER_CHARACTER_BUFFER_SIZE in bootloader.c
+#define CHARACTER_BUFFER_SIZE 50
+#define MAXIMUM_WINDOWS 16
+#define FUZZ_ITERATIONS 200000
+#define BENCH_ROUNDS 200
+
+typedef struct
+{
+    char *data;
+    uint32_t size;
+    const char *name;
+} hexFile_t;
+
+typedef struct
+{
+    const hexFile_t *file;
+    uint32_t offset;
+    uint32_t length; //Start code to checksum
+} record_t;
+
+static record_t *records;
+static uint32_t number_of_records;
+
+//Characters that are not hexadecimal digits, including the neighbours of the valid ranges
+static const uint8_t invalid_characters[] = {0x00, '\r', '\n', ' ', '/', ':', '@', 'G', '`', 'g', 'x', 0x7F, 0x80, 0xFF};
+
+static uint32_t random_state = 0x2F6E2B1;
+
+static uint32_t _random(void)
+{
+    //xorshift32
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static void _load_file(const char *name, hexFile_t *file)
+{
+    FILE *f;
+    long size;
+
+    f = fopen(name, "rb");
+    if(f==NULL)
+    {
+        perror(name);
+        exit(2);
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    file->data = malloc(size);
+    if(fread(file->data, 1, size, f)!=(size_t) size)
+    {
+        perror(name);
+        exit(2);
+    }
+    fclose(f);
+    file->size = (uint32_t) size;
+    file->name = name;
+}
+
+//Fills the character buffer like _bootloader_read_record() in bootloader.c does
+//The buffer is allocated with its exact size so that the sanitizer catches any access beyond it
+static char *_read_record(const char *data, uint32_t size, uint32_t offset, uint8_t window)
+{
+    char *buffer;
+    uint32_t position;
+    uint8_t start;
+    uint8_t cntr;
+
+    buffer = malloc(CHARACTER_BUFFER_SIZE);
+    memset(buffer, 0, CHARACTER_BUFFER_SIZE);
+    position = offset;
+    start = 0;
+    if(window>0)
+    {
+        for(cntr=0; (cntr<9) && (offset+cntr<size); ++cntr)
+        {
+            buffer[cntr] = data[offset+cntr];
+        }
+        position += 9 + ((uint16_t) window << 5);
+        start = 9;
+    }
+    for(cntr=start; (cntr<CHARACTER_BUFFER_SIZE) && (position<size); ++cntr, ++position)
+    {
+        buffer[cntr] = data[position];
+    }
+    return buffer;
+}
+
+//Parses all windows of the record at offset. Returns the result of the last window parsed
+static uint32_t _parse_record(const char *data, uint32_t size, uint32_t offset, HexFileEntry_t *entry)
+{
+    uint32_t result;
+    uint8_t window;
+    char *buffer;
+
+    result = RecordContinues;
+    for(window=0; (window<=MAXIMUM_WINDOWS) && (result==RecordContinues); ++window)
+    {
+        buffer = _read_record(data, size, offset, window);
+        result = parseHexFileEntry(buffer, window, entry);
+        free(buffer);
+    }
+    if(result==RecordContinues)
+    {
+        fprintf(stderr, "Record at offset %u has more than %u windows\n", offset, MAXIMUM_WINDOWS);
+        exit(1);
+    }
+    return result;
+}
+
+//Walks through a file the way the bootloader does and collects its records
+//A file that is broken somewhere contributes the records before the error
+static void _collect_records(const hexFile_t *file)
+{
+    HexFileEntry_t entry;
+    uint32_t offset;
+    uint32_t result;
+
+    offset = 0;
+    while(1)
+    {
+        result = _parse_record(file->data, file->size, offset, &entry);
+        if(result>=(uint32_t) RecordErrorNoError)
+        {
+            printf("%s: error 0x%X at offset %u\n", file->name, result & 0xF, offset);
+            return;
+        }
+        records = realloc(records, (number_of_records+1)*sizeof(record_t));
+        records[number_of_records].file = file;
+        records[number_of_records].offset = offset;
+        records[number_of_records].length = 11 + ((uint32_t) entry.recordLength << 1);
+        ++number_of_records;
+        if(result==0)
+        {
+            return;
+        }
+        offset += result;
+    }
+}
+
+//Copy of the record and everything following it, to be mutated
+static char *_copy_record(const record_t *record, uint32_t *size)
+{
+    char *copy;
+
+    *size = record->file->size - record->offset;
+    copy = malloc(*size);
+    memcpy(copy, &record->file->data[record->offset], *size);
+    return copy;
+}
+
+static int _check_result(uint32_t result)
+{
+    switch(result)
+    {
+        case (uint32_t) RecordErrorStartCode:
+        case (uint32_t) RecordErrorChecksum:
+        case (uint32_t) RecordErrorNoNextRecord:
+        case (uint32_t) RecordErrorDataTooLong:
+        case (uint32_t) RecordErrorInvalidCharacter:
+            return 1;
+    }
+    //End of file or offset of the next record within the characters read
+    return result<(11 + 2*255 + 3);
+}
+
+static int _fuzz(void)
+{
+    HexFileEntry_t entry;
+    record_t *record;
+    uint32_t cntr;
+    uint32_t position;
+    uint32_t size;
+    uint32_t result;
+    uint32_t checked;
+    uint8_t character;
+    uint8_t mutations;
+    char *copy;
+
+    //Every character but the start code replaced by each of the invalid characters
+    checked = 0;
+    for(cntr=0; cntr<number_of_records; ++cntr)
+    {
+        record = &records[cntr];
+        for(position=1; position<record->length; ++position)
+        {
+            for(character=0; character<sizeof(invalid_characters); ++character)
+            {
+                copy = _copy_record(record, &size);
+                copy[position] = (char) invalid_characters[character];
+                result = _parse_record(copy, size, 0, &entry);
+                free(copy);
+                if(result!=(uint32_t) RecordErrorInvalidCharacter)
+                {
+                    fprintf(stderr, "%s: offset %u, character 0x%02X at position %u returned 0x%08X\n",
+                            record->file->name, record->offset, invalid_characters[character], position, result);
+                    return 1;
+                }
+                ++checked;
+            }
+        }
+    }
+    printf("Invalid characters: %u records, %u cases, all rejected\n", number_of_records, checked);
+
+    //Random mutations. Whatever the result, it must be one the bootloader knows about
+    for(cntr=0; cntr<FUZZ_ITERATIONS; ++cntr)
+    {
+        record = &records[_random() % number_of_records];
+        copy = _copy_record(record, &size);
+        for(mutations=1+(_random()&3); mutations>0; --mutations)
+        {
+            position = _random() % (record->length + 3);
+            if(position>=size)
+            {
+                continue;
+            }
+            switch(_random()&3)
+            {
+                case 0:
+                    copy[position] = (char) _random();
+                    break;
+                case 1:
+                    copy[position] = "0123456789ABCDEFabcdef"[_random()%22];
+                    break;
+                case 2:
+                    copy[position] = (char) invalid_characters[_random()%sizeof(invalid_characters)];
+                    break;
+                case 3:
+                    copy[position] ^= 1 << (_random()&7);
+                    break;
+            }
+        }
+        result = _parse_record(copy, size, 0, &entry);
+        free(copy);
+        if(!_check_result(result))
+        {
+            fprintf(stderr, "%s: offset %u, mutated record returned 0x%08X\n", record->file->name, record->offset, result);
+            return 1;
+        }
+    }
+    printf("Random mutations: %u records parsed\n", FUZZ_ITERATIONS);
+    return 0;
+}
+
+//The comparison chain hexCharToUint8 used before the table
+static uint8_t hexCharToUint8Chain(char c)
+{
+	uint8_t ascii = (uint8_t)c;
+
+	//a,b,c,d,e,f
+	if (ascii >= 97)
+	{
+		ascii -= 87;
+	}
+	//A,B,C,D,E,F
+	else if (ascii >= 65)
+	{
+		ascii -= 55;
+	}
+	//0,1,2,3,4,5,6,7,8,9
+	else
+	{
+		ascii -= 48;
+	}
+
+	if (ascii > 15)
+	{
+		return 0;
+	}
+	else
+	{
+		return ascii;
+	}
+}
+
+static uint8_t hexDecodeBytesChain(char *data, uint8_t *bytes, uint8_t count, uint8_t *checksum)
+{
+	uint8_t i;
+
+	for (i = 0; i < count; ++i)
+	{
+		bytes[i] = (hexCharToUint8Chain(data[i + i]) << 4) | hexCharToUint8Chain(data[i + i + 1]);
+		*checksum += bytes[i];
+	}
+	return 0;
+}
+
+static double _time_decoder(uint8_t (*decode)(char *, uint8_t *, uint8_t, uint8_t *), uint32_t *bytes_decoded, uint8_t *checksum)
+{
+    struct timespec start;
+    struct timespec end;
+    uint8_t bytes[128];
+    uint32_t round;
+    uint32_t cntr;
+    uint32_t length;
+
+    *bytes_decoded = 0;
+    *checksum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(round=0; round<BENCH_ROUNDS; ++round)
+    {
+        for(cntr=0; cntr<number_of_records; ++cntr)
+        {
+            //All characters between start code and end of line, in pieces of up to 128 bytes
+            length = (records[cntr].length - 1) >> 1;
+            if(length>128)
+            {
+                length = 128;
+            }
+            decode(&records[cntr].file->data[records[cntr].offset+1], bytes, (uint8_t) length, checksum);
+            *bytes_decoded += length;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+static int _bench(void)
+{
+    uint32_t bytes_table;
+    uint32_t bytes_chain;
+    uint8_t checksum_table;
+    uint8_t checksum_chain;
+    double time_table;
+    double time_chain;
+
+    time_chain = _time_decoder(hexDecodeBytesChain, &bytes_chain, &checksum_chain);
+    time_table = _time_decoder(hexDecodeBytes, &bytes_table, &checksum_table);
+    if(checksum_table!=checksum_chain)
+    {
+        fprintf(stderr, "Decoders disagree\n");
+        return 1;
+    }
+    printf("Comparison chain: %.2fns per byte\n", time_chain * 1e9 / bytes_chain);
+    printf("Table:            %.2fns per byte\n", time_table * 1e9 / bytes_table);
+    printf("Speed-up:         %.2fx (host CPU, indicative only)\n", time_chain / time_table);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    hexFile_t *files;
+    int cntr;
+
+    if(argc<3)
+    {
+        fprintf(stderr, "Usage: %s fuzz|bench FILE...\n", argv[0]);
+        return 2;
+    }
+    files = malloc((argc-2)*sizeof(hexFile_t));
+    for(cntr=2; cntr<argc; ++cntr)
+    {
+        _load_file(argv[cntr], &files[cntr-2]);
+        _collect_records(&files[cntr-2]);
+    }
+
+    if(strcmp(argv[1], "fuzz")==0)
+    {
+        return _fuzz();
+    }
+    if(strcmp(argv[1], "bench")==0)
+    {
+        return _bench();
+    }
+    fprintf(stderr, "Unknown mode %s\n", argv[1]);
+    return 2;
+}
@@ -0,0 +1,290 @@
+/*
+ * File:   hid_test.c
+ *
+ * Tests the ping-pong buffer rotation of the custom HID interface
+ * (app_device_custom_hid.c). The USB module's buffer descriptors for the HID
+ * endpoint are modelled the way USBRxOnePacket()/USBTxOnePacket() use them
+ * with full ping-pong: every call arms the next descriptor, even first, and
+ * the host fills and empties them in the same order. A simulated host sends
+ * tagged reports and reads the responses, with the tasks run in between.
+ *
+ * Usage: hid_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+//Keep the USB stack out, the functions the application calls are modelled below
+#define _USB_H_
+#define USB_HANDLE void*
+#include "usb_config.h"
+#include "usb_device_hid.h"
+
+#define CONFIGURED_STATE 0x20
+#define USB_IN_ENABLED 0x02
+#define USB_OUT_ENABLED 0x04
+#define USB_HANDSHAKE_ENABLED 0x10
+#define USB_DISALLOW_SETUP 0x08
+
+uint8_t USBGetDeviceState(void);
+bool USBIsDeviceSuspended(void);
+bool USBHandleBusy(volatile void *handle);
+void USBEnableEndpoint(uint8_t ep, uint8_t options);
+USB_HANDLE USBRxOnePacket(uint8_t ep, uint8_t *data, uint16_t length);
+USB_HANDLE USBTxOnePacket(uint8_t ep, uint8_t *data, uint16_t length);
+
+#include "../app_device_custom_hid.c"
+
+#define STEPS 200000
+
+//A buffer descriptor: owned by the USB module while armed
+typedef struct
+{
+    uint8_t own;
+    uint8_t *data;
+} bufferDescriptor_t;
+
+static bufferDescriptor_t bd_out[2];
+static bufferDescriptor_t bd_in[2];
+//Descriptor the next call arms and the one the host uses next
+static uint8_t arm_out;
+static uint8_t arm_in;
+static uint8_t host_out;
+static uint8_t host_in;
+
+//Tags sent and not yet answered, oldest first
+static uint8_t pending[8];
+static uint8_t pending_count;
+static uint8_t next_tag;
+//Tag the API expects next
+static uint8_t parse_tag;
+static uint32_t reports;
+
+static uint32_t checks;
+
+#define CHECK(condition) _check((condition), #condition, __LINE__)
+
+static void _check(int condition, const char *text, int line)
+{
+    ++checks;
+    if(!condition)
+    {
+        fprintf(stderr, "Line %d, report %u: %s\n", line, reports, text);
+        exit(1);
+    }
+}
+
+uint8_t USBGetDeviceState(void)
+{
+    return CONFIGURED_STATE;
+}
+
+bool USBIsDeviceSuspended(void)
+{
+    return false;
+}
+
+bool USBHandleBusy(volatile void *handle)
+{
+    return (handle!=0) && ((volatile bufferDescriptor_t*) handle)->own;
+}
+
+//Resets the ping-pong pointers, as the USB stack does
+void USBEnableEndpoint(uint8_t ep, uint8_t options)
+{
+    CHECK(ep==CUSTOM_DEVICE_HID_EP);
+    memset(bd_out, 0, sizeof(bd_out));
+    memset(bd_in, 0, sizeof(bd_in));
+    arm_out = 0;
+    arm_in = 0;
+    host_out = 0;
+    host_in = 0;
+}
+
+static USB_HANDLE _arm(bufferDescriptor_t *bd, uint8_t *arm, uint8_t ep, uint8_t *data, uint16_t length)
+{
+    bufferDescriptor_t *next;
+
+    CHECK((ep==CUSTOM_DEVICE_HID_EP) && (length==64));
+    next = &bd[*arm];
+    //Arming a descriptor the USB module still owns would corrupt a transfer
+    CHECK(!next->own);
+    //The other descriptor must not be using the same buffer
+    CHECK(!bd[*arm^1].own || (bd[*arm^1].data!=data));
+    next->data = data;
+    next->own = 1;
+    *arm ^= 1;
+    return next;
+}
+
+USB_HANDLE USBRxOnePacket(uint8_t ep, uint8_t *data, uint16_t length)
+{
+    return _arm(bd_out, &arm_out, ep, data, length);
+}
+
+USB_HANDLE USBTxOnePacket(uint8_t ep, uint8_t *data, uint16_t length)
+{
+    return _arm(bd_in, &arm_in, ep, data, length);
+}
+
+//The API answers with the tag and the tag inverted. Reports must arrive in order
+void api_prepare(uint8_t *inBuffer, uint8_t *outBuffer)
+{
+    memset(outBuffer, 0, 64);
+}
+
+void api_parse(uint8_t *inBuffer, uint8_t length, uint8_t *outBuffer)
+{
+    CHECK(inBuffer[0]==0x10);
+    CHECK(inBuffer[1]==parse_tag);
+    ++parse_tag;
+    outBuffer[0] = 0x55;
+    outBuffer[1] = inBuffer[1];
+    outBuffer[2] = ~inBuffer[1];
+    ++reports;
+}
+
+//Buffer index i always goes with descriptor i, so each handle stays with its own buffer
+static void _check_handles(void)
+{
+    uint8_t cntr;
+
+    for(cntr=0; cntr<2; ++cntr)
+    {
+        CHECK(USBOutHandle[cntr]==&bd_out[cntr]);
+        CHECK(bd_out[cntr].data==ReceivedDataBuffer[cntr]);
+        CHECK((USBInHandle[cntr]==0) || (USBInHandle[cntr]==&bd_in[cntr]));
+        CHECK(!bd_in[cntr].own || (bd_in[cntr].data==ToSendDataBuffer[cntr]));
+    }
+    CHECK(USBOutIndex==arm_out);
+    CHECK(USBInIndex==arm_in);
+}
+
+//The host sends a report. Returns 0 if it has been NAKed
+static uint8_t _send(void)
+{
+    bufferDescriptor_t *bd;
+
+    bd = &bd_out[host_out];
+    if(!bd->own)
+    {
+        return 0;
+    }
+    memset(bd->data, 0, 64);
+    bd->data[0] = 0x10;
+    bd->data[1] = next_tag;
+    bd->own = 0;
+    host_out ^= 1;
+    pending[pending_count++] = next_tag++;
+    return 1;
+}
+
+//The host reads a response. Returns 0 if there is none
+static uint8_t _receive(void)
+{
+    bufferDescriptor_t *bd;
+
+    bd = &bd_in[host_in];
+    if(!bd->own)
+    {
+        return 0;
+    }
+    CHECK(pending_count>0);
+    CHECK(bd->data[0]==0x55);
+    CHECK(bd->data[1]==pending[0]);
+    CHECK(bd->data[2]==(uint8_t) ~pending[0]);
+    --pending_count;
+    memmove(pending, &pending[1], pending_count);
+    bd->own = 0;
+    host_in ^= 1;
+    return 1;
+}
+
+static uint32_t _tasks(void)
+{
+    uint32_t before;
+
+    before = reports;
+    APP_DeviceCustomHIDTasks();
+    _check_handles();
+    return reports - before;
+}
+
+int main(void)
+{
+    uint32_t step;
+    uint32_t nak = 0;
+
+    APP_DeviceCustomHIDInitialize();
+    _check_handles();
+    CHECK(_tasks()==0);
+
+    //One report at a time
+    for(step=0; step<5; ++step)
+    {
+        CHECK(_send());
+        CHECK(_tasks()==1);
+        CHECK(_receive());
+        CHECK(!_receive());
+    }
+    printf("One at a time: answered in turn, buffers alternate\n");
+
+    //Two reports back to back, a third one is NAKed until the tasks have run
+    CHECK(_send());
+    CHECK(_send());
+    CHECK(!_send());
+    CHECK(_tasks()==2);
+    CHECK(_send());
+    CHECK(_receive());
+    CHECK(_receive());
+    CHECK(_tasks()==1);
+    CHECK(_receive());
+    printf("Back to back: two reports per pass of the tasks\n");
+
+    //The host doesn't read: once both IN buffers are full, reports stay where they are
+    CHECK(_send());
+    CHECK(_send());
+    CHECK(_tasks()==2);
+    CHECK(_send());
+    CHECK(_send());
+    CHECK(!_send());
+    CHECK(_tasks()==0);
+    CHECK(_receive());
+    CHECK(_tasks()==1);
+    CHECK(_receive());
+    CHECK(_receive());
+    CHECK(_tasks()==1);
+    CHECK(_receive());
+    CHECK(pending_count==0);
+    printf("Responses not read: the host is NAKed, nothing is overwritten\n");
+
+    //Random order, as the host and the main loop come
+    srand(1);
+    for(step=0; step<STEPS; ++step)
+    {
+        switch(rand()%3)
+        {
+            case 0:
+                nak += !_send();
+                break;
+            case 1:
+                _tasks();
+                break;
+            case 2:
+                _receive();
+                break;
+        }
+    }
+    while(pending_count>0)
+    {
+        _tasks();
+        CHECK(_receive());
+    }
+    printf("Random order: %u reports answered in order, %u NAKs\n", reports, nak);
+
+    printf("%u checks passed\n", checks);
+    return 0;
+}
@@ -0,0 +1,326 @@
+/*
+ * File:   spi_test.c
+ *
+ * Tests the slot bookkeeping for frames received as external SPI slave
+ * (spi_external.c). The DMA and MSSP modules are modelled the way spi.c drives
+ * them and a simulated host clocks bytes through them. Between transfers, the
+ * main loop is run as main.c does: it takes the frames and answers each one.
+ *
+ * Usage: spi_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "spi.h"
+#include "spi_external.h"
+
+#define SLOTS SPI_EXTERNAL_NUMBER_OF_SLOTS
+#define FRAME SPI_EXTERNAL_FRAME_SIZE
+
+//The DMA module: enabling it loads the first byte to be sent into SSP2BUF
+static uint8_t *dma_tx;
+static uint8_t *dma_rx;
+static uint16_t dma_length;
+static uint16_t dma_count;
+static uint8_t dma_running;
+//The MSSP module: its buffer, buffer full and overflow flags and slave select
+static uint8_t ssp_buffer;
+static uint8_t ssp_full;
+static uint8_t ssp_overflow;
+static uint8_t selected;
+
+static uint32_t checks;
+
+#define CHECK(condition) _check((condition), #condition, __LINE__)
+
+static void _check(int condition, const char *text, int line)
+{
+    ++checks;
+    if(!condition)
+    {
+        fprintf(stderr, "Line %d (%u slots): %s\n", line, SLOTS, text);
+        exit(1);
+    }
+}
+
+void spi_external_dma_start(uint8_t *tx, uint8_t *rx, uint16_t length)
+{
+    CHECK(!dma_running);
+    CHECK(!selected);
+    dma_tx = tx;
+    dma_rx = rx;
+    dma_length = length;
+    dma_count = 0;
+    ssp_full = 0;
+    ssp_overflow = 0;
+    ssp_buffer = tx[0];
+    dma_running = 1;
+}
+
+uint16_t spi_external_dma_position(uint8_t *tx)
+{
+    CHECK(tx==dma_tx);
+    return dma_count;
+}
+
+uint8_t spi_external_dma_running(void)
+{
+    return dma_running;
+}
+
+void spi_external_dma_stop(void)
+{
+    dma_running = 0;
+}
+
+uint8_t spi_external_overflow(void)
+{
+    return ssp_full || ssp_overflow;
+}
+
+uint8_t spi_external_selected(void)
+{
+    return selected;
+}
+
+//The host clocks length bytes, with slave select asserted throughout
+static void _transfer(const uint8_t *mosi, uint8_t *miso, uint16_t length)
+{
+    uint16_t cntr;
+
+    selected = 1;
+    for(cntr=0; cntr<length; ++cntr)
+    {
+        miso[cntr] = ssp_buffer;
+        if(dma_running)
+        {
+            dma_rx[dma_count++] = mosi[cntr];
+            if(dma_count==dma_length)
+            {
+                dma_running = 0;
+            }
+            else
+            {
+                ssp_buffer = dma_tx[dma_count];
+            }
+        }
+        else
+        {
+            ssp_overflow |= ssp_full;
+            ssp_full = 1;
+        }
+    }
+    selected = 0;
+}
+
+//Frames carry a tag, the response is the tag and the frame inverted
+static void _frame(uint8_t *frame, uint8_t tag)
+{
+    uint8_t cntr;
+
+    for(cntr=0; cntr<FRAME; ++cntr)
+    {
+        frame[cntr] = (uint8_t) (tag + 3*cntr);
+    }
+    frame[0] = 0x10;
+    frame[1] = tag;
+}
+
+static void _check_response(const uint8_t *response, uint8_t tag)
+{
+    uint8_t frame[FRAME];
+    uint8_t cntr;
+
+    _frame(frame, tag);
+    CHECK(response[0]==0x55);
+    CHECK(response[1]==tag);
+    for(cntr=2; cntr<FRAME; ++cntr)
+    {
+        CHECK(response[cntr]==(uint8_t) ~frame[cntr]);
+    }
+}
+
+static void _check_status(const uint8_t *response, uint8_t status)
+{
+    CHECK((response[0]==SPI_EXTERNAL_RESPONSE_STATUS) && (response[1]==status));
+}
+
+//Takes the frames and answers them as main.c does. With release==0 they are answered
+//but not released, as if the host started the next transfer before the main loop was done
+static uint8_t _main_loop(uint8_t release)
+{
+    uint8_t frames;
+    uint8_t slot;
+    uint8_t *rx;
+    uint8_t *tx;
+    uint8_t cntr;
+
+    frames = spi_get_external_frames();
+    for(slot=0; slot<frames; ++slot)
+    {
+        rx = spi_get_external_rx_buffer(slot);
+        tx = spi_get_external_tx_buffer(slot);
+        tx[0] = 0x55;
+        tx[1] = rx[1];
+        for(cntr=2; cntr<FRAME; ++cntr)
+        {
+            tx[cntr] = ~rx[cntr];
+        }
+    }
+    if(frames && release)
+    {
+        spi_release_external_frames();
+    }
+    return frames;
+}
+
+//Sends the frames with the given tags in one transfer. Returns the responses
+static void _send(const uint8_t *tags, uint8_t number_of_frames, uint8_t *responses)
+{
+    uint8_t frames[(SLOTS+1)*FRAME];
+    uint8_t cntr;
+
+    for(cntr=0; cntr<number_of_frames; ++cntr)
+    {
+        _frame(&frames[cntr*FRAME], tags[cntr]);
+    }
+    _transfer(frames, responses, number_of_frames*FRAME);
+}
+
+static void _send_one(uint8_t tag, uint8_t *response)
+{
+    _send(&tag, 1, response);
+}
+
+int main(void)
+{
+    uint8_t tags[SLOTS+1];
+    uint8_t responses[(SLOTS+1)*FRAME];
+    uint8_t frames[2*FRAME];
+    uint8_t slot;
+
+    //Nothing received yet. Slave mode is entered with the first slot armed
+    spi_external_arm();
+    CHECK(_main_loop(1)==0);
+    CHECK(dma_running);
+
+    //Released before the next transfer: the response comes with that transfer
+    _send_one(0x01, responses);
+    CHECK(_main_loop(1)==1);
+    _send_one(0x02, responses);
+    _check_response(responses, 0x01);
+    CHECK(_main_loop(1)==1);
+    _send_one(0x03, responses);
+    _check_response(responses, 0x02);
+    CHECK(_main_loop(1)==1);
+    printf("Release before the next transfer: responses follow with the next one\n");
+
+    //Nothing received between two passes of the main loop: the responses stay in place
+    CHECK(_main_loop(1)==0);
+    CHECK(_main_loop(1)==0);
+    _send_one(0x09, responses);
+    _check_response(responses, 0x03);
+    CHECK(_main_loop(1)==1);
+
+    //Back to back: as many frames as there are slots in one transfer
+    for(slot=0; slot<SLOTS; ++slot)
+    {
+        tags[slot] = 0x20 + slot;
+    }
+    _send(tags, SLOTS, responses);
+    CHECK(_main_loop(1)==SLOTS);
+    _send(tags, SLOTS, responses);
+    for(slot=0; slot<SLOTS; ++slot)
+    {
+        _check_response(&responses[slot*FRAME], 0x20+slot);
+    }
+    CHECK(_main_loop(1)==SLOTS);
+    //And one transfer per frame without the main loop in between
+    for(slot=0; slot<SLOTS; ++slot)
+    {
+        _send_one(0x30+slot, &responses[slot*FRAME]);
+    }
+    for(slot=0; slot<SLOTS; ++slot)
+    {
+        _check_response(&responses[slot*FRAME], 0x20+slot);
+    }
+    CHECK(_main_loop(1)==SLOTS);
+    _send(tags, 1, responses);
+    _check_response(responses, 0x30);
+    CHECK(_main_loop(1)>0);
+    printf("Back to back: %u frames per transfer, or one transfer each\n", SLOTS);
+
+    //Overflow: one frame more than there are slots. The last slot tells the host
+    for(slot=0; slot<=SLOTS; ++slot)
+    {
+        tags[slot] = 0x40 + slot;
+    }
+    _send(tags, SLOTS+1, responses);
+    CHECK(_main_loop(1)==SLOTS-1);
+    _send(tags, SLOTS, responses);
+    for(slot=0; slot+1<SLOTS; ++slot)
+    {
+        _check_response(&responses[slot*FRAME], 0x40+slot);
+    }
+    _check_status(&responses[(SLOTS-1)*FRAME], SPI_EXTERNAL_RESPONSE_DROPPED);
+    CHECK(_main_loop(1)>0);
+    printf("Overflow: %u of %u frames answered, then DROPPED\n", SLOTS-1, SLOTS+1);
+
+    //Short frames are rejected, together with the rest of the set
+    _transfer(frames, responses, FRAME/2);
+    CHECK(_main_loop(1)==0);
+    _send_one(0x50, responses);
+    _check_status(responses, SPI_EXTERNAL_RESPONSE_REJECTED);
+    CHECK(_main_loop(1)==1);
+    _send_one(0x51, responses);
+    _check_response(responses, 0x50);
+    CHECK(_main_loop(1)==1);
+    //A complete frame followed by a short one
+    if(SLOTS>1)
+    {
+        _frame(frames, 0x52);
+        _transfer(frames, responses, FRAME+10);
+        _check_response(responses, 0x51);
+        CHECK(_main_loop(1)==1);
+        _send(tags, 2, responses);
+        _check_response(responses, 0x52);
+        _check_status(&responses[FRAME], SPI_EXTERNAL_RESPONSE_REJECTED);
+        CHECK(_main_loop(1)==2);
+    }
+    printf("Short frames: REJECTED\n");
+
+    //Slots without a frame carry NONE
+    _send_one(0x60, responses);
+    CHECK(_main_loop(1)==1);
+    _send(tags, SLOTS, responses);
+    _check_response(responses, 0x60);
+    for(slot=1; slot<SLOTS; ++slot)
+    {
+        _check_status(&responses[slot*FRAME], SPI_EXTERNAL_RESPONSE_NONE);
+    }
+    CHECK(_main_loop(1)==SLOTS);
+
+    //Released after the next transfer has been sent: it carries BUSY, the response follows
+    _send_one(0x04, responses);
+    CHECK(_main_loop(0)==1);
+    _send_one(0x05, responses);
+    _check_status(responses, SPI_EXTERNAL_RESPONSE_BUSY);
+    spi_release_external_frames();
+    CHECK(_main_loop(1)==1);
+    _send_one(0x06, responses);
+    _check_response(responses, 0x04);
+    CHECK(_main_loop(1)==1);
+    _send_one(0x07, responses);
+    _check_response(responses, 0x05);
+    CHECK(_main_loop(1)==1);
+    _send_one(0x08, responses);
+    _check_response(responses, 0x06);
+    //From now on each response follows two transfers later
+    printf("Release after the next transfer: BUSY, then the responses in order\n");
+
+    printf("%u checks passed with %u slots per set\n", checks, SLOTS);
+    return 0;
+}
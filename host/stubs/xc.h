@@ -0,0 +1,50 @@
+/*
+ * File:   xc.h
+ *
+ * Stands in for the compiler's device header in host builds
+ * Only the helpers the firmware modules built on the host use
+ */
+
+#ifndef HOST_XC_H
+#define HOST_XC_H
+
+#include <stdint.h>
+
+#define HIGH_BYTE(x) ((uint8_t) ((x)>>8))
+#define LOW_BYTE(x) ((uint8_t) (x))
+#define HIGH_WORD(x) ((uint16_t) ((x)>>16))
+#define LOW_WORD(x) ((uint16_t) (x))
+
+//Ports, with the pins the modules built on the host use
+typedef struct
+{
+    unsigned RA0:1;
+} PORTAbits_t;
+
+typedef struct
+{
+    unsigned LA0:1;
+} LATAbits_t;
+
+typedef struct
+{
+    unsigned TRISA0:1;
+} TRISAbits_t;
+
+typedef struct
+{
+    unsigned LC2:1;
+} LATCbits_t;
+
+typedef struct
+{
+    unsigned LD0:1;
+} LATDbits_t;
+
+extern volatile PORTAbits_t PORTAbits;
+extern volatile LATAbits_t LATAbits;
+extern volatile TRISAbits_t TRISAbits;
+extern volatile LATCbits_t LATCbits;
+extern volatile LATDbits_t LATDbits;
+
+#endif /* HOST_XC_H */
@@ -0,0 +1,392 @@
+/*
+ * File:   transport.cpp
+ *
+ * spidev, hidraw and simulated transports, see transport.h
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "transport.h"
+
+extern "C"
+{
+#include "firmware.h"
+}
+
+namespace charger
+{
+
+static std::string _system_error(const std::string &name, const std::string &what)
+{
+    return name + ": " + what + ": " + strerror(errno);
+}
+
+static std::string _no_response(const std::string &name, uint8_t request)
+{
+    char text[64];
+
+    snprintf(text, sizeof(text), ": no response to 0x%02X", request);
+    return name + text;
+}
+
+/*****************************************************************************
+ * hidraw                                                                    *
+ *****************************************************************************/
+
+std::vector<std::string> find_hidraw_devices(uint16_t vendor_id, uint16_t product_id)
+{
+    std::vector<std::string> devices;
+    char hid_id[32];
+    glob_t uevents;
+    size_t cntr;
+    std::string path;
+    std::string node;
+    std::stringstream content;
+
+    snprintf(hid_id, sizeof(hid_id), "HID_ID=0003:%08X:%08X", vendor_id, product_id);
+    if(glob("/sys/class/hidraw/hidraw*/device/uevent", 0, NULL, &uevents)!=0)
+    {
+        return devices;
+    }
+    //glob() sorts the paths
+    for(cntr=0; cntr<uevents.gl_pathc; ++cntr)
+    {
+        path = uevents.gl_pathv[cntr];
+        std::ifstream uevent(path.c_str());
+        content.str("");
+        content << uevent.rdbuf();
+        std::string text = content.str();
+        for(size_t index=0; index<text.size(); ++index)
+        {
+            text[index] = toupper((unsigned char) text[index]);
+        }
+        if(text.find(hid_id)==std::string::npos)
+        {
+            continue;
+        }
+        //"/sys/class/hidraw/" followed by the node's name
+        node = path.substr(18, path.find('/', 18)-18);
+        devices.push_back("/dev/" + node);
+    }
+    globfree(&uevents);
+    return devices;
+}
+
+HidTransport::HidTransport(const std::string &path, double timeout) : _timeout(timeout)
+{
+    struct pollfd pending;
+    uint8_t report[FRAME_SIZE];
+
+    _name = path;
+    _fd = open(path.c_str(), O_RDWR);
+    if(_fd<0)
+    {
+        throw ChargerError(_system_error(_name, "open"));
+    }
+    //Throw away reports nobody has picked up
+    pending.fd = _fd;
+    pending.events = POLLIN;
+    while((poll(&pending, 1, 0)>0) && (read(_fd, report, sizeof(report))>0))
+    {
+    }
+}
+
+HidTransport::~HidTransport()
+{
+    close(_fd);
+}
+
+Bytes HidTransport::transfer(const Bytes &frame)
+{
+    Bytes report(1, 0x00);
+    Bytes padded;
+    Bytes response(FRAME_SIZE, 0x00);
+    struct pollfd pending;
+    ssize_t length;
+
+    //Report ID 0, i.e. none, followed by the report
+    padded = pad_frame(frame);
+    report.insert(report.end(), padded.begin(), padded.end());
+    if(write(_fd, report.data(), report.size())!=(ssize_t) report.size())
+    {
+        throw ChargerError(_system_error(_name, "write"));
+    }
+    pending.fd = _fd;
+    pending.events = POLLIN;
+    if(poll(&pending, 1, (int) (_timeout * 1000))<=0)
+    {
+        throw ChargerError(_no_response(_name, frame[0]));
+    }
+    length = read(_fd, response.data(), response.size());
+    if(length<0)
+    {
+        throw ChargerError(_system_error(_name, "read"));
+    }
+    return response;
+}
+
+/*****************************************************************************
+ * spidev                                                                    *
+ *****************************************************************************/
+
+SpiTransport::SpiTransport(unsigned bus, unsigned device, uint32_t speed_hz, double timeout) : _speed_hz(speed_hz), _timeout(timeout)
+{
+    uint8_t mode = SPI_MODE_0;
+    uint8_t bits = 8;
+
+    _name = "/dev/spidev" + std::to_string(bus) + "." + std::to_string(device);
+    _fd = open(_name.c_str(), O_RDWR);
+    if(_fd<0)
+    {
+        throw ChargerError(_system_error(_name, "open"));
+    }
+    if((ioctl(_fd, SPI_IOC_WR_MODE, &mode)<0) || (ioctl(_fd, SPI_IOC_WR_BITS_PER_WORD, &bits)<0) ||
+       (ioctl(_fd, SPI_IOC_WR_MAX_SPEED_HZ, &_speed_hz)<0))
+    {
+        std::string message = _system_error(_name, "setup");
+        close(_fd);
+        throw ChargerError(message);
+    }
+}
+
+SpiTransport::~SpiTransport()
+{
+    close(_fd);
+}
+
+//One transfer with slave select asserted throughout
+Bytes SpiTransport::_xfer(const Bytes &frame)
+{
+    Bytes response(frame.size(), 0x00);
+    struct spi_ioc_transfer transfer;
+
+    memset(&transfer, 0, sizeof(transfer));
+    transfer.tx_buf = (unsigned long) frame.data();
+    transfer.rx_buf = (unsigned long) response.data();
+    transfer.len = frame.size();
+    transfer.speed_hz = _speed_hz;
+    transfer.bits_per_word = 8;
+    if(ioctl(_fd, SPI_IOC_MESSAGE(1), &transfer)<0)
+    {
+        throw ChargerError(_system_error(_name, "transfer"));
+    }
+    return response;
+}
+
+Bytes SpiTransport::transfer(const Bytes &frame)
+{
+    Bytes padded;
+    Bytes poll_frame(FRAME_SIZE, 0x00);
+    Bytes response;
+    std::chrono::steady_clock::time_point deadline;
+
+    padded = pad_frame(frame);
+    poll_frame[0] = DATAREQUEST_GET_ECHO;
+    _xfer(padded);
+    deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds((long) (_timeout * 1000));
+    while(true)
+    {
+        response = _xfer(poll_frame);
+        if(padded[0]==DATAREQUEST_GET_ECHO)
+        {
+            if(response==padded)
+            {
+                return response;
+            }
+        }
+        else if((response[0]==padded[0]) && (response[1]==SIGNATURE[0]) && (response[2]==SIGNATURE[1]))
+        {
+            return response;
+        }
+        if(std::chrono::steady_clock::now()>deadline)
+        {
+            throw ChargerError(_no_response(_name, padded[0]));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+/*****************************************************************************
+ * Simulator                                                                 *
+ *****************************************************************************/
+
+//Configuration words of the devices, as in SolarCharger_RevE.hex
+static const uint8_t CONFIGURATION_WORDS[8] = {0xAC, 0xF7, 0x9D, 0xFF, 0x63, 0xFA, 0x81, 0xF9};
+
+struct SimulatedTransport::Library
+{
+    void *handle;
+    void (*host_init)(const uint8_t *configuration_words);
+    uint8_t (*host_boot)(void);
+    void (*host_transfer)(uint8_t *frame, uint8_t length, uint8_t *response);
+    void (*host_main_loop_pass)(void);
+    uint8_t (*host_get_bootloader_mode)(void);
+    uint16_t *host_reboots;
+    //Memories modelled in RAM. They survive a reboot
+    uint8_t *host_flash;
+    uint8_t *host_eeprom;
+    uint8_t *host_program_memory;
+};
+
+static std::string _default_library(void)
+{
+    char path[PATH_MAX];
+    ssize_t length;
+    std::string directory(".");
+
+    length = readlink("/proc/self/exe", path, sizeof(path)-1);
+    if(length>0)
+    {
+        path[length] = 0;
+        directory = path;
+        directory = directory.substr(0, directory.rfind('/'));
+    }
+    return directory + "/libfirmware.so";
+}
+
+template<typename T> static void _symbol(void *handle, const char *name, T &symbol)
+{
+    symbol = (T) dlsym(handle, name);
+    if(symbol==0)
+    {
+        throw ChargerError(std::string("libfirmware.so: ") + name + " not found");
+    }
+}
+
+SimulatedTransport::SimulatedTransport(const std::string &library, const uint8_t *configuration_words) : _library(0), _reboots(0)
+{
+    _name = "simulator";
+    _path = library.empty() ? _default_library() : library;
+    _library = _load();
+    _library->host_init(configuration_words ? configuration_words : CONFIGURATION_WORDS);
+}
+
+SimulatedTransport::~SimulatedTransport()
+{
+    _unload(_library);
+}
+
+//dlopen() returns the library already loaded for the same file, so each load is from a copy of its own
+SimulatedTransport::Library *SimulatedTransport::_load()
+{
+    char path[] = "/tmp/libfirmwareXXXXXX";
+    std::ifstream source(_path.c_str(), std::ios::binary);
+    Library *library;
+    void *handle;
+    int fd;
+
+    if(!source)
+    {
+        throw ChargerError(_path + " not found, build it with make -C host libfirmware.so");
+    }
+    fd = mkstemp(path);
+    if(fd<0)
+    {
+        throw ChargerError(_system_error(_name, "mkstemp"));
+    }
+    close(fd);
+    {
+        std::ofstream copy(path, std::ios::binary);
+        copy << source.rdbuf();
+    }
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    unlink(path);
+    if(handle==0)
+    {
+        throw ChargerError(_name + ": " + dlerror());
+    }
+
+    library = new Library;
+    library->handle = handle;
+    try
+    {
+        _symbol(handle, "host_init", library->host_init);
+        _symbol(handle, "host_boot", library->host_boot);
+        _symbol(handle, "host_transfer", library->host_transfer);
+        _symbol(handle, "host_main_loop_pass", library->host_main_loop_pass);
+        _symbol(handle, "host_get_bootloader_mode", library->host_get_bootloader_mode);
+        _symbol(handle, "host_reboots", library->host_reboots);
+        _symbol(handle, "host_flash", library->host_flash);
+        _symbol(handle, "host_eeprom", library->host_eeprom);
+        _symbol(handle, "host_program_memory", library->host_program_memory);
+    }
+    catch(...)
+    {
+        _unload(library);
+        throw;
+    }
+    return library;
+}
+
+void SimulatedTransport::_unload(Library *library)
+{
+    dlclose(library->handle);
+    delete library;
+}
+
+bool SimulatedTransport::_rebooted()
+{
+    return *_library->host_reboots!=0;
+}
+
+//Everything in RAM is lost, the memories are kept
+void SimulatedTransport::_reboot()
+{
+    Library *library;
+
+    library = _load();
+    memcpy(library->host_flash, _library->host_flash, HOST_FLASH_NUMBER_OF_PAGES*HOST_FLASH_PAGE_SIZE);
+    memcpy(library->host_eeprom, _library->host_eeprom, HOST_EEPROM_SIZE);
+    memcpy(library->host_program_memory, _library->host_program_memory, HOST_PROGRAM_MEMORY_SIZE);
+    _unload(_library);
+    _library = library;
+    ++_reboots;
+    _library->host_boot();
+}
+
+Bytes SimulatedTransport::transfer(const Bytes &frame)
+{
+    Bytes padded;
+    Bytes response(FRAME_SIZE, 0x00);
+
+    padded = pad_frame(frame);
+    _library->host_transfer(padded.data(), frame.size(), response.data());
+    if(_rebooted())
+    {
+        _reboot();
+        return response;
+    }
+    run();
+    return response;
+}
+
+void SimulatedTransport::run()
+{
+    _library->host_main_loop_pass();
+    if(_rebooted())
+    {
+        _reboot();
+    }
+}
+
+uint8_t SimulatedTransport::bootloader_mode()
+{
+    return _library->host_get_bootloader_mode();
+}
+
+}
@@ -0,0 +1,91 @@
+/*
+ * File:   transport.h
+ *
+ * Transports for charger.h: spidev, hidraw and the firmware built for the host
+ */
+
+#ifndef HOST_TRANSPORT_H
+#define HOST_TRANSPORT_H
+
+#include <string>
+#include <vector>
+
+#include "charger.h"
+
+namespace charger
+{
+
+//Paths of all hidraw nodes that belong to a charger, sorted
+std::vector<std::string> find_hidraw_devices(uint16_t vendor_id = VENDOR_ID, uint16_t product_id = PRODUCT_ID);
+
+//The response to a frame is sent back with a later frame, so every frame is
+//followed by echo requests until the response shows up. The echo request does
+//nothing, so the last response the device has prepared is always an echo.
+//Frames are always padded to 64 bytes, the device rejects anything else.
+//Status frames (0x99, reason) are skipped. A frame the device had to drop
+//never gets a response and ends in a timeout.
+class SpiTransport : public Transport
+{
+public:
+    SpiTransport(unsigned bus = 0, unsigned device = 0, uint32_t speed_hz = 2000000, double timeout = 1.0);
+    ~SpiTransport();
+    Bytes transfer(const Bytes &frame);
+
+private:
+    Bytes _xfer(const Bytes &frame);
+
+    int _fd;
+    uint32_t _speed_hz;
+    double _timeout;
+};
+
+//Every report sent gets exactly one report back
+class HidTransport : public Transport
+{
+public:
+    HidTransport(const std::string &path, double timeout = 1.0);
+    ~HidTransport();
+    Bytes transfer(const Bytes &frame);
+
+private:
+    int _fd;
+    double _timeout;
+};
+
+//A device running the firmware built for the host (libfirmware.so, see firmware.h).
+//Every frame goes through api_prepare() and api_parse() the way a HID report does,
+//followed by one pass through the main loop, as charger_sim.py does.
+//Every device loads its own copy of the library. A reboot loads a fresh copy and
+//keeps only the memories: everything in RAM is lost, as on the device.
+class SimulatedTransport : public Transport
+{
+public:
+    //library is the path of libfirmware.so, by default the one next to the executable
+    explicit SimulatedTransport(const std::string &library = "", const uint8_t *configuration_words = 0);
+    ~SimulatedTransport();
+    Bytes transfer(const Bytes &frame);
+
+    //One pass through the main loop
+    void run();
+    uint8_t bootloader_mode();
+    //Number of times the device has been rebooted
+    unsigned reboots() const { return _reboots; }
+
+private:
+    SimulatedTransport(const SimulatedTransport &);
+    SimulatedTransport &operator=(const SimulatedTransport &);
+
+    struct Library;
+    Library *_load();
+    void _unload(Library *library);
+    bool _rebooted();
+    void _reboot();
+
+    std::string _path;
+    Library *_library;
+    unsigned _reboots;
+};
+
+}
+
+#endif /* HOST_TRANSPORT_H */
@@ -25,6 +25,9 @@
 
 i2cFrequency_t i2c_frequency;
 
+//Set after a write has been sent to the EEPROM, cleared once it has acknowledged again
+uint8_t eeprom_write_pending = 0;
+
 #ifdef ANALOG_DIGITAL_CONVERTER_AVAILABLE
     extern calibration_t calibrationParameters[7];
 #endif
@@ -150,7 +153,9 @@ void i2c_set_frequency(i2cFrequency_t frequency)
 static void _i2c_write(uint8_t slave_address, uint8_t *data, uint8_t length)
 {
     uint8_t cntr;
+    uint32_t profile_start;
 
+    profile_start = system_profiler_start();
     _i2c_wait_idle();
     _i2c_start();
     _i2c_wait_idle();
@@ -164,12 +169,15 @@ static void _i2c_write(uint8_t slave_address, uint8_t *data, uint8_t length)
     } 
     
     _i2c_stop();
+    system_profiler_stop(PROFILER_PROBE_I2C, profile_start);
 }
 
 static void _i2c_read(uint8_t slave_address, uint8_t *data, uint8_t length)
 {
     uint8_t cntr;
+    uint32_t profile_start;
 
+    profile_start = system_profiler_start();
     _i2c_wait_idle();
     _i2c_start();
     _i2c_wait_idle();
@@ -185,6 +193,7 @@ static void _i2c_read(uint8_t slave_address, uint8_t *data, uint8_t length)
     _i2c_not_acknowledge();
      
     _i2c_stop();
+    system_profiler_stop(PROFILER_PROBE_I2C, profile_start);
 }
 
 
@@ -377,28 +386,87 @@ void i2c_digipot_set_defaults(void)
  * ****************************************************************************/
 
  
-void i2c_eeprom_writeByte(uint16_t address, uint8_t data)
+//The EEPROM has 16 byte pages. A single write must not cross a page boundary
+#define I2C_EEPROM_PAGE_SIZE 16
+//A write cycle takes at most 5ms. Each poll takes at least 25us at 400kHz
+//so this is plenty. It just makes sure we never hang if the EEPROM is missing
+#define I2C_EEPROM_MAX_POLLS 1000
+
+static uint8_t _i2c_eeprom_slave_address(uint16_t address)
 {
-    uint8_t slave_address;
-    uint8_t dat[2];
+    return I2C_EEPROM_SLAVE_ADDRESS | ((address&0b0000011100000000)>>7);
+}
+
+//Addresses the EEPROM and checks if it acknowledges
+//The EEPROM does not acknowledge while an internal write cycle is in progress
+static uint8_t _i2c_eeprom_acknowledges(void)
+{
+    uint8_t acknowledged;
     
-    slave_address = I2C_EEPROM_SLAVE_ADDRESS | ((address&0b0000011100000000)>>7);
-    dat[0] = address & 0xFF;
-    dat[1] = data;
+    _i2c_wait_idle();
+    _i2c_start();
+    _i2c_wait_idle();
+    _i2c_send(I2C_EEPROM_SLAVE_ADDRESS);
+    _i2c_wait_idle();
+    acknowledged = !SSP1CON2bits.ACKSTAT;
+    _i2c_stop();
     
-    //Set I2C frequency to 400kHz
-    i2c_set_frequency(I2C_FREQUENCY_400kHz);
+    return acknowledged;
+}
+
+//Check (once, without blocking) if the last write has been completed
+eepromWriteStatus_t i2c_eeprom_get_write_status(void)
+{
+    if(eeprom_write_pending)
+    {
+        //Set I2C frequency to 400kHz
+        i2c_set_frequency(I2C_FREQUENCY_400kHz);
+        
+        if(_i2c_eeprom_acknowledges())
+        {
+            eeprom_write_pending = 0;
+        }
+    }
     
-    _i2c_write(slave_address, &dat[0], 2);
+    if(eeprom_write_pending)
+    {
+        return EEPROM_WRITE_STATUS_BUSY;
+    }
+    return EEPROM_WRITE_STATUS_IDLE;
+}
+
+//Wait (by ACK polling) until the last write has been completed
+void i2c_eeprom_wait_write_complete(void)
+{
+    uint16_t polls;
+    
+    for(polls=0; polls<I2C_EEPROM_MAX_POLLS; ++polls)
+    {
+        if(i2c_eeprom_get_write_status()==EEPROM_WRITE_STATUS_IDLE)
+        {
+            return;
+        }
+    }
+    
+    //EEPROM never acknowledged. Don't keep polling forever
+    eeprom_write_pending = 0;
+}
+
+void i2c_eeprom_writeByte(uint16_t address, uint8_t data)
+{
+    i2c_eeprom_write(address, &data, 1);
 }
 
 uint8_t i2c_eeprom_readByte(uint16_t address)
 {
     uint8_t slave_address;
     uint8_t addr;
-    slave_address = I2C_EEPROM_SLAVE_ADDRESS | ((address&0b0000011100000000)>>7);
+    slave_address = _i2c_eeprom_slave_address(address);
     addr = address & 0xFF;
     
+    //EEPROM ignores us while it is still busy writing
+    i2c_eeprom_wait_write_complete();
+    
     //Set I2C frequency to 400kHz
     i2c_set_frequency(I2C_FREQUENCY_400kHz);
     
@@ -407,25 +475,43 @@ uint8_t i2c_eeprom_readByte(uint16_t address)
     return addr;
 }
 
-void i2c_eeprom_write(uint16_t address, uint8_t *data, uint8_t length)
+//Writes any number of bytes, split up at page boundaries
+//Returns as soon as the last page has been sent. Use i2c_eeprom_get_write_status()
+//or i2c_eeprom_wait_write_complete() to find out when the data has actually been written
+void i2c_eeprom_write(uint16_t address, uint8_t *data, uint16_t length)
 {
     uint8_t cntr;
-    uint8_t slave_address;
-    uint8_t dat[17];
-
-    slave_address = I2C_EEPROM_SLAVE_ADDRESS | ((address&0b0000011100000000)>>7);
-    dat[0] = address & 0xFF;
+    uint8_t chunk;
+    uint8_t dat[I2C_EEPROM_PAGE_SIZE+1];
 
-    length &= 0b00001111;
-    for(cntr=0; cntr<length; ++cntr)
+    while(length)
     {
-        dat[cntr+1] = data[cntr];
+        //Write at most until the end of the current page
+        chunk = I2C_EEPROM_PAGE_SIZE - (address & (I2C_EEPROM_PAGE_SIZE-1));
+        if(chunk>length)
+        {
+            chunk = (uint8_t) length;
+        }
+        
+        dat[0] = address & 0xFF;
+        for(cntr=0; cntr<chunk; ++cntr)
+        {
+            dat[cntr+1] = data[cntr];
+        }
+        
+        //Previous page needs to be written before the EEPROM accepts the next one
+        i2c_eeprom_wait_write_complete();
+        
+        //Set I2C frequency to 400kHz
+        i2c_set_frequency(I2C_FREQUENCY_400kHz);
+        
+        _i2c_write(_i2c_eeprom_slave_address(address), &dat[0], chunk+1);
+        eeprom_write_pending = 1;
+        
+        address += chunk;
+        data += chunk;
+        length -= chunk;
     }
-    
-    //Set I2C frequency to 400kHz
-    i2c_set_frequency(I2C_FREQUENCY_400kHz);
-    
-    _i2c_write(slave_address, &dat[0], length+1);
 }
 
 void i2c_eeprom_read(uint16_t address, uint8_t *data, uint8_t length)
@@ -433,9 +519,10 @@ void i2c_eeprom_read(uint16_t address, uint8_t *data, uint8_t length)
     uint8_t slave_address;
     uint8_t addr;
     addr = address & 0xFF;
-    address &= 0b0000011100000000;
-    address >>= 7;
-    slave_address = I2C_EEPROM_SLAVE_ADDRESS | address;
+    slave_address = _i2c_eeprom_slave_address(address);
+    
+    //EEPROM ignores us while it is still busy writing
+    i2c_eeprom_wait_write_complete();
     
     //Set I2C frequency to 400kHz
     i2c_set_frequency(I2C_FREQUENCY_400kHz);
@@ -717,4 +804,4 @@ void i2c_eeprom_tasks()
     }
 }
 
-#endif /*I2C_TASK_SCHEDULING_AVAILABLE*/
\ No newline at end of file
+#endif /*I2C_TASK_SCHEDULING_AVAILABLE*/
\ No newline at end of file
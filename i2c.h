@@ -22,6 +22,12 @@ typedef enum
     I2C_FREQUENCY_400kHz
 } i2cFrequency_t;
 
+typedef enum
+{
+    EEPROM_WRITE_STATUS_IDLE,
+    EEPROM_WRITE_STATUS_BUSY
+} eepromWriteStatus_t;
+
 #ifdef ANALOG_DIGITAL_CONVERTER_AVAILABLE 
 typedef enum
 {
@@ -110,8 +116,10 @@ void i2c_digipot_set_defaults(void);
 
 void i2c_eeprom_writeByte(uint16_t address, uint8_t data);
 uint8_t i2c_eeprom_readByte(uint16_t address);
-void i2c_eeprom_write(uint16_t address, uint8_t *data, uint8_t length);
+void i2c_eeprom_write(uint16_t address, uint8_t *data, uint16_t length);
 void i2c_eeprom_read(uint16_t address, uint8_t *data, uint8_t length);
+eepromWriteStatus_t i2c_eeprom_get_write_status(void);
+void i2c_eeprom_wait_write_complete(void);
 
 
 /* ****************************************************************************
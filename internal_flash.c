@@ -14,6 +14,7 @@
  * Prototypes
  *****************************************************************************/
 static void _internalFlash_unlockAndActivate(uint8_t unlockKey);
+static uint8_t _internalFlash_blockNeedsWrite(uint8_t block);
 
 
 
@@ -29,6 +30,11 @@ const uint8_t *FileAddress = 0;
 
 uint8_t pageBuffer[1024];
 
+//One bit per 64 byte write block of the page buffer that differs from flash
+uint16_t pageDirtyBlocks = 0;
+//Set when the page has been erased since it was read into the buffer
+uint8_t pageErased = 0;
+
 uint8_t* internalFlash_getBuffer(void)
 {
     return pageBuffer;
@@ -39,6 +45,47 @@ void internalFlash_readPage(uint16_t page)
     uint32_t address;
     address = internalFlash_addressFromPage(page);
     internalFlash_read(address, 1024, pageBuffer);
+    
+    //Buffer matches flash
+    pageDirtyBlocks = 0;
+    pageErased = 0;
+}
+
+void internalFlash_setBufferByte(uint16_t address_within_page, uint8_t data)
+{
+    if(pageBuffer[address_within_page] != data)
+    {
+        pageBuffer[address_within_page] = data;
+        pageDirtyBlocks |= (1u << (address_within_page>>6));
+    }
+}
+
+//The page buffer has been filled directly rather than byte by byte
+//Find out which blocks differ from what is in flash. Returns one bit per block that does
+uint16_t internalFlash_compareBuffer(uint16_t page)
+{
+    uint32_t address;
+    uint16_t cntr;
+    uint8_t byte_cntr;
+    uint8_t current[64];
+    
+    address = internalFlash_addressFromPage(page);
+    pageDirtyBlocks = 0;
+    pageErased = 0;
+    
+    for(cntr=0; cntr<1024; cntr+=64)
+    {
+        internalFlash_read(address+cntr, 64, current);
+        for(byte_cntr=0; byte_cntr<64; ++byte_cntr)
+        {
+            if(pageBuffer[cntr+byte_cntr]!=current[byte_cntr])
+            {
+                pageDirtyBlocks |= (1u << (cntr>>6));
+                break;
+            }
+        }
+    }
+    return pageDirtyBlocks;
 }
 
 void internalFlash_erasePage(uint16_t page)
@@ -60,9 +107,11 @@ void internalFlash_erasePage(uint16_t page)
     EECON1bits.FREE = 1;
     
     _internalFlash_unlockAndActivate(INTERNAL_FLASH_UNLOCK_KEY);
+    pageErased = 1;
 }
 
-void internalFlash_writePage(uint16_t page)
+//Returns the number of 64 byte blocks actually written
+uint8_t internalFlash_writePage(uint16_t page)
 {
     uint32_t address;
     uint8_t gie;
@@ -70,6 +119,7 @@ void internalFlash_writePage(uint16_t page)
     uint8_t i;
     uint8_t block_cntr;
     uint8_t byte_cntr;
+    uint8_t blocks_written;
     
     //Calculate address and set it
     address = internalFlash_addressFromPage(page);
@@ -78,13 +128,23 @@ void internalFlash_writePage(uint16_t page)
     //Check if address falls into permitted range
     if((address<PROG_START) || (address+1023>=INTERNAL_FLASH_SIZE)) 
     {
-        return;
+        return 0;
     }
     
-    //Write 16 times 64 bytes
+    //Write up to 16 times 64 bytes
     cntr = 0;
+    blocks_written = 0;
     for(block_cntr=0; block_cntr<16; ++block_cntr)
     {
+        //Skip blocks that already hold the right data
+        //Without an erase, that's every block that has not been changed
+        //After an erase, that's every block that is all 0xFF
+        if(!_internalFlash_blockNeedsWrite(block_cntr))
+        {
+            TBLPTR += 64;
+            cntr += 64;
+            continue;
+        }
         
         //Write a block of the RAM bufferred data to the programming latches
         for(byte_cntr=0; byte_cntr<64; ++byte_cntr)
@@ -104,8 +164,65 @@ void internalFlash_writePage(uint16_t page)
         EECON1 = 0x84;
         _internalFlash_unlockAndActivate(INTERNAL_FLASH_UNLOCK_KEY);
         TBLPTR++; 
+        ++blocks_written;
+    }
+    
+    //Buffer matches flash again
+    pageDirtyBlocks = 0;
+    pageErased = 0;
+    
+    return blocks_written;
+}
+
+static uint8_t _internalFlash_blockNeedsWrite(uint8_t block)
+{
+    uint16_t cntr;
+    
+    if(!pageErased)
+    {
+        return (uint8_t) ((pageDirtyBlocks >> block) & 0x0001);
+    }
+    
+    for(cntr=(block<<6); cntr<((block+1)<<6); ++cntr)
+    {
+        if(pageBuffer[cntr]!=0xFF)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//Returns 1 if the page buffer can only be written after erasing the page
+//Programming can only clear bits. Any bit that has to go from 0 to 1 needs an erase
+uint8_t internalFlash_pageNeedsErase(uint16_t page)
+{
+    uint32_t address;
+    uint16_t cntr;
+    uint8_t byte_cntr;
+    uint8_t current[64];
+    
+    address = internalFlash_addressFromPage(page);
+    
+    for(cntr=0; cntr<1024; cntr+=64)
+    {
+        //Unchanged blocks already match flash
+        if(!((pageDirtyBlocks >> (cntr>>6)) & 0x0001))
+        {
+            continue;
+        }
         
+        internalFlash_read(address+cntr, 64, current);
+        for(byte_cntr=0; byte_cntr<64; ++byte_cntr)
+        {
+            if((pageBuffer[cntr+byte_cntr] & current[byte_cntr]) != pageBuffer[cntr+byte_cntr])
+            {
+                return 1;
+            }
+        }
     }
+    
+    return 0;
 }
 
 //Sample
@@ -17,7 +17,10 @@ uint8_t* internalFlash_getBuffer(void);
 
 void internalFlash_readPage(uint16_t page);
 void internalFlash_erasePage(uint16_t page);
-void internalFlash_writePage(uint16_t page);
+uint8_t internalFlash_writePage(uint16_t page);
+uint8_t internalFlash_pageNeedsErase(uint16_t page);
+void internalFlash_setBufferByte(uint16_t address_within_page, uint8_t data);
+uint16_t internalFlash_compareBuffer(uint16_t page);
 
 uint16_t internalFlash_pageFromAddress(uint32_t address);
 uint32_t internalFlash_addressFromPage(uint16_t page);
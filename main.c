@@ -41,45 +41,41 @@
 #endasm
 
 
-/* ****************************************************************************
- * Static function prototypes
- * ****************************************************************************/
-
-//This function decides if we should start in bootloader mode or not.
-//Returns 0 for bootloader mode, 1 for normal program
-static uint8_t _normal_mode(void);
-
-
 /* ****************************************************************************
  * Main function definition
  * ****************************************************************************/
 void main(void)
 {
-    uint16_t bytes_transmitted;
-    uint16_t tx_start_addr;
+    uint8_t frames;
+    uint8_t slot;
+    uint8_t slots_used;
     
     uint8_t *rx_buffer;
     uint8_t *tx_buffer;
     
+    uint32_t profile_start;
+    
     //Clear watchdog timer
     ClrWdt();
     
-    rx_buffer = spi_get_external_rx_buffer();
-    tx_buffer = spi_get_external_tx_buffer();
-    tx_start_addr = (uint16_t) tx_buffer;
-    
     //Initialize low level hardware so that we have a (minimally) functional system
     //We need that in order to decide in which mode to run (bootloader or normal)
     system_minimal_init();
 
     //Check if we should jump to normal software (i.e. not run bootloader)
-    if(_normal_mode())
+    //Never start an image that is incomplete or corrupted
+    if(bootloader_normal_mode() && (bootloader_check_image()<=IMAGE_CHECK_RESULT_NO_DESCRIPTOR))
     {
         //Undo any initialization prior to starting main program
         system_minimal_init_undo();
+        //Keep reset-to-jump time at BOOT_TIME_RAM_ADDRESS for the main program
+        system_stop_boot_timer();
         jump_to_main_program();
     }
     
+    //Keep reset-to-decision time. Reported via DATAREQUEST_GET_STATUS
+    system_stop_boot_timer();
+    
     //If we are still here, we will operate in bootloader mode
     //Initialize low level hardware so that we have a (fully) functional system
     system_full_init();
@@ -100,9 +96,14 @@ void main(void)
         //We don't have interrupts
         //So we need to keep USB alive by regularly calling these functions
         //This should be done every 1.8ms
+        profile_start = system_profiler_start();
         USBDeviceTasks();
+        system_profiler_stop(PROFILER_PROBE_USB_TASKS, profile_start);
         APP_DeviceMSDTasks();
         APP_DeviceCustomHIDTasks();
+#ifdef USB_VENDOR_INTERFACE_AVAILABLE
+        APP_DeviceVendorTasks();
+#endif
         
         //Take care of timeslots, encoder and done flag
         //Usually, this happens in a timer ISR but we can't use interrupts here
@@ -112,41 +113,27 @@ void main(void)
         if(SPI_SS2_PORT)
         {
             //There is not communication in progress
-            //Calculate the number of bytes transmitted
-            bytes_transmitted = TXADDRH;
-            bytes_transmitted <<= 8;
-            bytes_transmitted |= TXADDRL;
-            --bytes_transmitted;
-            bytes_transmitted -= (uint16_t) spi_get_external_tx_buffer();
-            
-            //If data has been transmitted process that data and reset connection
-            if(bytes_transmitted>0)
+            //Process all frames received, in order. The other slots receive in the meantime
+            frames = spi_get_external_frames();
+            if(frames>0)
             {
-                //Disable DMA module
-                DMACON1bits.DMAEN = 0;
-
-                //Process data
-                api_prepare(rx_buffer, tx_buffer);
-                api_parse(rx_buffer, (uint8_t) bytes_transmitted, tx_buffer);
-                
-                //Set TX buffer address
-                TXADDRH =  HIGH_BYTE((uint16_t) tx_buffer);
-                TXADDRL =  LOW_BYTE((uint16_t) tx_buffer);
-
-                //Set RX buffer address
-                RXADDRH =  HIGH_BYTE((uint16_t) rx_buffer);
-                RXADDRL =  LOW_BYTE((uint16_t) rx_buffer);
-
-                //Set number of bytes to transmit
-                DMABCH = HIGH_BYTE((uint16_t) (64-1));
-                DMABCL = LOW_BYTE((uint16_t) (64-1));
-
-                //Clear interrupt flag
-                PIR3bits.SSP2IF = 0;
-                //Re-enable DMA module
-                DMACON1bits.DMAEN = 1;
+                slot = 0;
+                while(slot<frames)
+                {
+                    //The response goes into the same slot of the next transfer
+                    //A read stream burst also takes up all following slots
+                    rx_buffer = spi_get_external_rx_buffer(slot);
+                    tx_buffer = spi_get_external_tx_buffer(slot);
+                    slots_used = api_prepare_frames(rx_buffer, tx_buffer, frames-slot);
+                    api_parse(rx_buffer, SPI_EXTERNAL_FRAME_SIZE, tx_buffer);
+                    slot += slots_used;
+                }
+                spi_release_external_frames();
             }
         }
+        
+        //Work requested via the API that takes more than one pass
+        api_run();
 
         //Time is divided into 8 timeslots of 8ms each before starting again
         //This can be used to schedule tasks
@@ -198,48 +185,4 @@ void main(void)
             os.done = 1;
         }
     }//end while(1)
-}//end main
-
-
-/* ****************************************************************************
- * Static function implementations
- * ****************************************************************************/
-
-//This function decides if we should start in bootloader mode or not.
-//Returns 0 for bootloader mode, 1 for normal program
-static uint8_t _normal_mode(void)
-{
-    if(i2c_eeprom_readByte(EEPROM_BOOTLOADER_BYTE_ADDRESS)==BOOTLOADER_BYTE_FORCE_BOOTLOADER_MODE)
-    {
-        //Change value so we don't start in bootloader mode indefinitely
-        i2c_eeprom_writeByte(EEPROM_BOOTLOADER_BYTE_ADDRESS, 0x00);
-        //But start in bootloader mode this time
-        return 0;
-    }
-    else if(i2c_eeprom_readByte(EEPROM_BOOTLOADER_BYTE_ADDRESS)==BOOTLOADER_BYTE_FORCE_NORMAL_MODE)
-    {
-        //Change value so we don't start in normal mode indefinitely
-        i2c_eeprom_writeByte(EEPROM_BOOTLOADER_BYTE_ADDRESS, 0x00);
-        //But start in normal mode this time
-        return 1;
-    }
-    
-    //A poor man's pull-up resistor
-    //Force the pushbutton pin high for just an instant before reading it
-    //This has no effect if a display unit is connected 
-    //But it makes sure we start in normal mode if the pin is left floating
-    PUSHBUTTON_LAT = 1;
-    PUSHBUTTON_TRIS = PIN_OUTPUT;
-    PUSHBUTTON_TRIS = PIN_INPUT;
-    
-    if(!PUSHBUTTON_PIN) //Button is pressed
-    {
-        //Bootloader mode if pushbutton is pressed
-        return 0;
-    }
-    else
-    {
-        //Normal program
-        return 1;
-    }
-}
\ No newline at end of file
+}//end main
\ No newline at end of file
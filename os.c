@@ -15,6 +15,17 @@
 #define TIMER0_LOAD_HIGH_48MHZ 0xD1
 #define TIMER0_LOAD_LOW_48MHZ 0x20
 
+//Set once the display unit has had time to power up
+uint8_t display_unit_settled = 0;
+
+//Execution time statistics
+profilerEntry_t profiler[PROFILER_NUMBER_OF_PROBES];
+//Timer3 overflows seen so far. Upper 16 bits of the profiler time
+uint16_t profiler_overflows = 0;
+
+//Boot time handed over to the main program at a fixed RAM address
+uint16_t boot_time_main_program @ BOOT_TIME_RAM_ADDRESS;
+
 
 //There are no interrupts but we still use the timer and interrupt flag
 void timer_pseudo_isr(void)
@@ -70,6 +81,158 @@ void system_delay_ms(uint8_t ms)
     }
 }
 
+//Wait for voltages to have settled on the display unit
+//Only needed before the pushbutton or display is used. Only waits the first time
+void system_wait_for_display_unit(void)
+{
+    if(!display_unit_settled)
+    {
+        system_delay_ms(BOOT_SETTLE_DELAY_DISPLAY_UNIT_MS);
+        display_unit_settled = 1;
+    }
+}
+
+//Timer0 measures the time from reset until we decide where to go
+//Clock source = Fosc/4, prescaler=256, i.e. one tick every 256 instruction cycles (21.3us)
+//Overflows after 1.4s, long enough for the 50ms wait for the display unit
+static void _system_boot_timer_init(void)
+{
+    T0CON = 0x00;
+    TMR0H = 0x00;
+    TMR0L = 0x00;
+    INTCONbits.TMR0IF = 0;
+    //Clock source = Fosc/4
+    T0CONbits.T0CS = 0;
+    //Operate in 16bit mode
+    T0CONbits.T08BIT = 0;
+    //Prescaler=256
+    T0CONbits.T0PS2 = 1;
+    T0CONbits.T0PS1 = 1;
+    T0CONbits.T0PS0 = 1;
+    T0CONbits.PSA = 0;
+    T0CONbits.TMR0ON = 1;
+}
+
+//Stop the boot timer and save the result in os.bootTime and at BOOT_TIME_RAM_ADDRESS
+//Returns the number of ticks (256 instruction cycles each), 0xFFFF if it overflowed
+//Timer0 is left in its reset state, the bootloader re-initializes it for the time slots
+uint16_t system_stop_boot_timer(void)
+{
+    uint16_t ticks;
+    
+    T0CONbits.TMR0ON = 0;
+    //TMR0L must be read first, this latches TMR0H
+    ticks = TMR0L;
+    ticks |= ((uint16_t) TMR0H) << 8;
+    if(INTCONbits.TMR0IF)
+    {
+        ticks = 0xFFFF;
+    }
+    
+    T0CON = 0xFF;
+    TMR0H = 0x00;
+    TMR0L = 0x00;
+    INTCONbits.TMR0IF = 0;
+    
+    os.bootTime = ticks;
+    boot_time_main_program = ticks;
+    return ticks;
+}
+
+//Timer3 measures execution times for the profiler. It runs freely in bootloader mode
+//Clock source = Fosc/4, prescaler=8, i.e. one tick every 8 instruction cycles
+//Overflows every 43.7ms. Flash page writes come close to that, so overflows are counted
+static void _system_profiler_timer_init(void)
+{
+    T3CON = 0x00;
+    TMR3H = 0x00;
+    TMR3L = 0x00;
+    PIR2bits.TMR3IF = 0;
+    profiler_overflows = 0;
+    T3CONbits.TMR3CS1 = 0;
+    T3CONbits.TMR3CS0 = 0;
+    T3CONbits.T3CKPS1 = 1;
+    T3CONbits.T3CKPS0 = 1;
+    T3CONbits.RD16 = 1; //Read TMR3H and TMR3L in one go
+    T3CONbits.TMR3ON = 1;
+}
+
+void system_profiler_reset(void)
+{
+    uint8_t cntr;
+    
+    for(cntr=0; cntr<PROFILER_NUMBER_OF_PROBES; ++cntr)
+    {
+        profiler[cntr].count = 0;
+        profiler[cntr].minimum = 0xFFFF;
+        profiler[cntr].maximum = 0;
+        profiler[cntr].total = 0;
+    }
+}
+
+//Returns the current time, to be passed on to system_profiler_stop()
+//There are no interrupts. An overflow is counted the next time the timer is read
+//This happens at least once per pass through the main loop (USB tasks probe)
+//The timer must be read at least every 87ms (twice the overflow period). Long FAT operations
+//such as copy and format do so through the flash probes they contain
+uint32_t system_profiler_start(void)
+{
+    uint16_t ticks;
+    
+    ticks = TMR3L;
+    ticks |= ((uint16_t) TMR3H) << 8;
+    if(PIR2bits.TMR3IF)
+    {
+        //The timer has wrapped around, possibly just after being read. Read it again
+        PIR2bits.TMR3IF = 0;
+        ++profiler_overflows;
+        ticks = TMR3L;
+        ticks |= ((uint16_t) TMR3H) << 8;
+    }
+    return ((uint32_t) profiler_overflows << 16) | ticks;
+}
+
+void system_profiler_stop(profilerProbe_t probe, uint32_t start)
+{
+    uint32_t ticks;
+    profilerEntry_t *entry;
+    
+    //Not measuring anything before system_full_init()
+    if(!T3CONbits.TMR3ON)
+    {
+        return;
+    }
+    
+    //Overflow count wraps around after 47 minutes, the difference is still right
+    ticks = system_profiler_start() - start;
+    
+    //Stop counting rather than overflow so that the average remains correct
+    entry = &profiler[probe];
+    if(entry->count==0xFFFF)
+    {
+        return;
+    }
+    ++entry->count;
+    entry->total += ticks;
+    if(ticks>0xFFFF)
+    {
+        ticks = 0xFFFF;
+    }
+    if(ticks<entry->minimum)
+    {
+        entry->minimum = (uint16_t) ticks;
+    }
+    if(ticks>entry->maximum)
+    {
+        entry->maximum = (uint16_t) ticks;
+    }
+}
+
+profilerEntry_t *system_profiler_get(profilerProbe_t probe)
+{
+    return &profiler[probe];
+}
+
 
 static void _system_encoder_init(void)
 {
@@ -139,6 +302,9 @@ static void _system_timer0_init(void)
 //Just configure the bare minimum needed to determine if we should jump to main program
 void system_minimal_init(void)
 {
+    //Start measuring how long it takes to boot
+    _system_boot_timer_init();
+    
     //Set board voltage high
     VCC_HIGH_TRIS = PIN_OUTPUT;
     VCC_HIGH_PIN = 1;
@@ -150,13 +316,17 @@ void system_minimal_init(void)
     //Initialize I2C
     i2c_init();
     
-    //Wait for voltages to have settled, also on display unit
-    system_delay_ms(50);
+    //Wait for the board voltage to have settled
+    //The display unit takes much longer but is only waited for if needed
+    system_delay_ms(BOOT_SETTLE_DELAY_BOARD_MS);
 }
 
 //Undo everything the system_minimal_init() did)
 void system_minimal_init_undo(void)
 {
+    //Make sure any pending EEPROM write has been completed
+    i2c_eeprom_wait_write_complete();
+    
     //Reset and disable I2C module
     i2c_reset();
     
@@ -228,6 +398,10 @@ void system_full_init(void)
     os.bootloader_mode = BOOTLOADER_MODE_SEARCH;
     os.display_mode = DISPLAY_MODE_BOOTLOADER_START;
     
+    //Start measuring execution times
+    system_profiler_reset();
+    _system_profiler_timer_init();
+    
     //Initialize SPI / flash
     flash_init();
     
@@ -237,7 +411,8 @@ void system_full_init(void)
     //Set up encoder
     _system_encoder_init();
     
-    //Initialize display
+    //Initialize display. Needs the display unit to be powered up
+    system_wait_for_display_unit();
     ui_init();
 
     //Set up timer0 for timeSlots
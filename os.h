@@ -65,6 +65,31 @@ typedef struct
 } communicationSettings_t;
 
 
+//Code sections whose execution time is measured
+typedef enum
+{
+    PROFILER_PROBE_FLASH_READ = 0,
+    PROFILER_PROBE_FLASH_WRITE = 1,
+    PROFILER_PROBE_FAT_READ = 2,
+    PROFILER_PROBE_HEX_PARSE = 3,
+    PROFILER_PROBE_USB_TASKS = 4,
+    PROFILER_PROBE_I2C = 5,
+    PROFILER_PROBE_FAT_WRITE = 6,
+    PROFILER_PROBE_FAT_COPY = 7,
+    PROFILER_PROBE_FAT_FORMAT = 8,
+    PROFILER_NUMBER_OF_PROBES = 9
+} profilerProbe_t;
+
+//Execution times in Timer3 ticks (8 instruction cycles each)
+//Minimum and maximum saturate at 0xFFFF (43.7ms), the total does not
+typedef struct
+{
+    uint16_t count;
+    uint16_t minimum;
+    uint16_t maximum;
+    uint32_t total;
+} profilerEntry_t;
+
 typedef struct
 {
     int8_t encoderCount;
@@ -74,6 +99,7 @@ typedef struct
     bootloaderMode_t bootloader_mode;
     displayMode_t display_mode;
     communicationSettings_t communicationSettings;
+    uint16_t bootTime;
 } os_t;
 
 
@@ -93,6 +119,12 @@ void system_minimal_init(void);
 void system_minimal_init_undo(void);
 void system_full_init(void);
 void system_delay_ms(uint8_t ms);
+void system_wait_for_display_unit(void);
+uint16_t system_stop_boot_timer(void);
+void system_profiler_reset(void);
+uint32_t system_profiler_start(void);
+void system_profiler_stop(profilerProbe_t probe, uint32_t start);
+profilerEntry_t *system_profiler_get(profilerProbe_t probe);
 void system_encoder_enable(void);
 void jump_to_main_program(void);
 void reboot(void);
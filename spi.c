@@ -5,6 +5,7 @@
 #include "hardware_config.h"
 #include "os.h"
 #include "spi.h"
+#include "spi_external.h"
 
 /*****************************************************************************
  * Global Variables                                                          *
@@ -13,8 +14,6 @@ spiConfigurationDetails_t config_internal;
 spiConfigurationDetails_t config_external;
 spiConfiguration_t active_configuration;
 
-uint8_t _spi_external_tx_buffer[64];
-uint8_t _spi_external_rx_buffer[64];
 static uint8_t tx_buf[8] = {1, 2, 3, 4, 5, 6, 7, 8};
 
 /*****************************************************************************
@@ -73,14 +72,62 @@ static void _switch_slavemode(void)
  * Only these functions are made accessible via spi.h                        *  
  *****************************************************************************/
 
-uint8_t* spi_get_external_tx_buffer(void)
+//The DMA module and the MSSP module as external slave, for spi_external.c
+void spi_external_dma_start(uint8_t *tx, uint8_t *rx, uint16_t length)
 {
-    return _spi_external_tx_buffer;
+    uint8_t dummy;
+    
+    //Set number of bytes to transmit
+    DMABCH = HIGH_BYTE((uint16_t) (length-1));
+    DMABCL = LOW_BYTE((uint16_t) (length-1));
+
+    //Set TX buffer address
+    TXADDRH =  HIGH_BYTE((uint16_t) tx);
+    TXADDRL =  LOW_BYTE((uint16_t) tx);
+
+    //Set RX buffer address
+    RXADDRH =  HIGH_BYTE((uint16_t) rx);
+    RXADDRL =  LOW_BYTE((uint16_t) rx);
+    
+    //Clear buffer full, overflow and interrupt flag
+    dummy = SSP2BUF;
+    SSP2CON1bits.SSPOV = 0;
+    PIR3bits.SSP2IF = 0;
+    
+    DMACON1bits.DMAEN = 1; //Enable DMA module
+}
+
+uint16_t spi_external_dma_position(uint8_t *tx)
+{
+    uint16_t position;
+    
+    //Enabling the DMA module has already loaded the first byte to be sent
+    position = TXADDRH;
+    position <<= 8;
+    position |= TXADDRL;
+    --position;
+    position -= (uint16_t) tx;
+    return position;
+}
+
+uint8_t spi_external_dma_running(void)
+{
+    return DMACON1bits.DMAEN;
+}
+
+void spi_external_dma_stop(void)
+{
+    DMACON1bits.DMAEN = 0; //Disable DMA module
 }
 
-uint8_t* spi_get_external_rx_buffer(void)
+uint8_t spi_external_overflow(void)
 {
-    return _spi_external_rx_buffer;
+    return (SSP2STATbits.BF || SSP2CON1bits.SSPOV);
+}
+
+uint8_t spi_external_selected(void)
+{
+    return !SPI_SS2_PORT;
 }
 
 void spi_set_configurationDetails(spiConfiguration_t configuration, spiConfigurationDetails_t details)
@@ -156,6 +203,11 @@ void spi_set_configuration(spiConfiguration_t configuration)
             //Wait while an external communication is in progress
             while(!SPI_SS2_PORT); //This may fail if no external pull up/down resistors are present
             
+            //Keep what has been received so far. Receiving continues after the next slot
+            if(active_configuration==SPI_CONFIGURATION_EXTERNAL)
+            {
+                spi_external_capture();
+            }
 
             DMACON1bits.DMAEN = 0; //Disable DMA module
             SSP2CON1bits.SSPEN = 0; //Disable SPI module
@@ -253,19 +305,8 @@ void spi_set_configuration(spiConfiguration_t configuration)
             DMACON2bits.DLYCYC = 0b0000; //No timeouts
             DMACON2bits.INTLVL = 0b0000; //Interrupt when transfer is complete
 
-            //Set number of bytes to transmit
-            DMABCH = HIGH_BYTE((uint16_t) (64-1));
-            DMABCL = LOW_BYTE((uint16_t) (64-1));
-
-            //Set TX buffer address
-            TXADDRH =  HIGH_BYTE((uint16_t) _spi_external_tx_buffer);
-            TXADDRL =  LOW_BYTE((uint16_t) _spi_external_tx_buffer);
-
-            //Set RX buffer address
-            RXADDRH =  HIGH_BYTE((uint16_t) _spi_external_rx_buffer);
-            RXADDRL =  LOW_BYTE((uint16_t) _spi_external_rx_buffer);
-            
-            DMACON1bits.DMAEN = 1; //Enable DMA module
+            //Continue with the first free slot. Frames received earlier are kept
+            spi_external_arm();
 
 //            SSP2CON1bits.SSPEN = 0; //Disable SPI module
 //
@@ -493,4 +534,4 @@ void spi_tx_rx(uint8_t *command, uint16_t command_length, uint8_t *data, uint16_
     
     //Disable slave select pin 
     SPI_SS1_PIN = 1;
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -10,6 +10,33 @@
 
 #include <stdint.h>
 
+//Frames received as external SPI slave. Every frame must be exactly 64 bytes long. Frames
+//sent back to back (with or without releasing slave select in between) are captured in
+//consecutive slots. There are two sets of slots. While the frames of one set are processed,
+//the other one receives, so the host does not need to wait. The responses are sent back with
+//the next transfer, in the same slot. The slots are consecutive in memory so a response may
+//continue into the slots that follow.
+//Each slot takes 128 bytes of RAM (receive and transmit), in both sets. There is one slot per
+//set unless the project defines SPI_EXTERNAL_NUMBER_OF_SLOTS. With one slot, a read stream
+//burst (0x86) is answered with a single frame
+//A response frame may carry a status instead: SPI_EXTERNAL_RESPONSE_STATUS followed by
+// NONE:     No frame was received in this slot
+// REJECTED: The frame in this slot was not 64 bytes long. It and all frames after it in the
+//           same set were discarded
+// DROPPED:  More frames were sent than there are slots. The frame in this slot and all frames
+//           after it were discarded
+// BUSY:     The response is not ready yet. The frame sent with this transfer is received and
+//           processed as usual. The response follows with one of the next transfers
+#define SPI_EXTERNAL_FRAME_SIZE 64
+#ifndef SPI_EXTERNAL_NUMBER_OF_SLOTS
+#define SPI_EXTERNAL_NUMBER_OF_SLOTS 1
+#endif
+#define SPI_EXTERNAL_RESPONSE_STATUS 0x99
+#define SPI_EXTERNAL_RESPONSE_NONE 0x99
+#define SPI_EXTERNAL_RESPONSE_REJECTED 0x98
+#define SPI_EXTERNAL_RESPONSE_DROPPED 0x97
+#define SPI_EXTERNAL_RESPONSE_BUSY 0x96
+
 typedef enum
 {
     SPI_CONFIGURATION_INTERNAL,
@@ -53,8 +80,10 @@ void spi_tx(uint8_t *data, uint16_t length);
 void spi_tx_tx(uint8_t *command, uint16_t command_length, uint8_t *data, uint16_t data_length);
 void spi_tx_rx(uint8_t *command, uint16_t command_length, uint8_t *data, uint16_t data_length);
 
-uint8_t* spi_get_external_tx_buffer(void);
-uint8_t* spi_get_external_rx_buffer(void);
+uint8_t* spi_get_external_tx_buffer(uint8_t slot);
+uint8_t* spi_get_external_rx_buffer(uint8_t slot);
+uint8_t spi_get_external_frames(void);
+void spi_release_external_frames(void);
 
 #endif	/* SPI_H */
 
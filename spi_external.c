@@ -0,0 +1,206 @@
+#include <stdint.h>
+#include "spi.h"
+#include "spi_external.h"
+
+/*****************************************************************************
+ * Global Variables                                                          *
+ *****************************************************************************/
+
+//Two sets of slots. The DMA module receives into one set while the frames of the other set are processed
+uint8_t _spi_external_tx_buffer[2][SPI_EXTERNAL_NUMBER_OF_SLOTS*SPI_EXTERNAL_FRAME_SIZE];
+uint8_t _spi_external_rx_buffer[2][SPI_EXTERNAL_NUMBER_OF_SLOTS*SPI_EXTERNAL_FRAME_SIZE];
+//Set received into, set whose responses are sent and set being processed
+uint8_t _spi_external_rx_set = 0;
+uint8_t _spi_external_tx_set = 0;
+uint8_t _spi_external_processed_set = 0;
+//Per set: complete frames received, what happened to the frames after them
+//and whether the responses have yet to be sent
+uint8_t _spi_external_frames[2] = {0, 0};
+uint8_t _spi_external_error[2] = {0, 0};
+uint8_t _spi_external_pending[2] = {0, 0};
+//First slot of the receiving set not used yet. The DMA module has been armed for it
+uint8_t _spi_external_slot = 0;
+uint8_t _spi_external_armed = 0;
+
+/*****************************************************************************
+ * Utility functions                                                         *
+ *****************************************************************************/
+
+//Position of the DMA module within the transmitting set
+static uint16_t _spi_external_position(void)
+{
+    uint16_t offset;
+    uint16_t position;
+
+    offset = _spi_external_slot * SPI_EXTERNAL_FRAME_SIZE;
+    position = offset + spi_external_dma_position(&_spi_external_tx_buffer[_spi_external_tx_set][offset]);
+    if(position>(SPI_EXTERNAL_NUMBER_OF_SLOTS*SPI_EXTERNAL_FRAME_SIZE))
+    {
+        position = SPI_EXTERNAL_NUMBER_OF_SLOTS*SPI_EXTERNAL_FRAME_SIZE;
+    }
+    return position;
+}
+
+//Writes a status instead of a response into all slots of a set from the one given on
+static void _spi_external_mark(uint8_t set, uint8_t slot, uint8_t status)
+{
+    for(; slot<SPI_EXTERNAL_NUMBER_OF_SLOTS; ++slot)
+    {
+        _spi_external_tx_buffer[set][slot*SPI_EXTERNAL_FRAME_SIZE] = SPI_EXTERNAL_RESPONSE_STATUS;
+        _spi_external_tx_buffer[set][slot*SPI_EXTERNAL_FRAME_SIZE+1] = status;
+    }
+}
+
+/*****************************************************************************
+ * Public functions                                                          *
+ *****************************************************************************/
+
+//Closes all slots that complete frames have been received for since the DMA module was armed
+//A frame that is not a multiple of 64 bytes long can't be split reliably. The set is closed
+//and the frame is rejected. So are the frames that arrive after the last slot
+void spi_external_capture(void)
+{
+    uint16_t position;
+    uint16_t start;
+
+    if(_spi_external_armed)
+    {
+        //The DMA module stops by itself once all slots are full
+        position = SPI_EXTERNAL_NUMBER_OF_SLOTS*SPI_EXTERNAL_FRAME_SIZE;
+        if(spi_external_dma_running())
+        {
+            position = _spi_external_position();
+            spi_external_dma_stop();
+        }
+        _spi_external_armed = 0;
+
+        start = _spi_external_slot * SPI_EXTERNAL_FRAME_SIZE;
+        while((position>=start+SPI_EXTERNAL_FRAME_SIZE) && (_spi_external_slot<SPI_EXTERNAL_NUMBER_OF_SLOTS))
+        {
+            ++_spi_external_frames[_spi_external_rx_set];
+            ++_spi_external_slot;
+            start += SPI_EXTERNAL_FRAME_SIZE;
+        }
+        if(position>start)
+        {
+            _spi_external_error[_spi_external_rx_set] = SPI_EXTERNAL_RESPONSE_REJECTED;
+            _spi_external_slot = SPI_EXTERNAL_NUMBER_OF_SLOTS;
+            return;
+        }
+    }
+
+    if((_spi_external_slot>=SPI_EXTERNAL_NUMBER_OF_SLOTS) && spi_external_overflow() && !_spi_external_error[_spi_external_rx_set])
+    {
+        //Data received after all slots were full
+        //The last slot is given up so that its response can tell the host
+        --_spi_external_frames[_spi_external_rx_set];
+        _spi_external_error[_spi_external_rx_set] = SPI_EXTERNAL_RESPONSE_DROPPED;
+    }
+}
+
+//Lets the DMA module receive into the first free slot and all the following ones
+//The responses are sent from the same slots of the transmitting set
+void spi_external_arm(void)
+{
+    uint16_t offset;
+
+    if(_spi_external_slot>=SPI_EXTERNAL_NUMBER_OF_SLOTS)
+    {
+        //This set is closed. Nothing is received until the main loop has taken its frames
+        return;
+    }
+    offset = _spi_external_slot * SPI_EXTERNAL_FRAME_SIZE;
+
+    _spi_external_armed = 1;
+    spi_external_dma_start(&_spi_external_tx_buffer[_spi_external_tx_set][offset], &_spi_external_rx_buffer[_spi_external_rx_set][offset],
+                           SPI_EXTERNAL_NUMBER_OF_SLOTS*SPI_EXTERNAL_FRAME_SIZE-offset);
+}
+
+uint8_t* spi_get_external_tx_buffer(uint8_t slot)
+{
+    return &_spi_external_tx_buffer[_spi_external_processed_set][slot*SPI_EXTERNAL_FRAME_SIZE];
+}
+
+uint8_t* spi_get_external_rx_buffer(uint8_t slot)
+{
+    return &_spi_external_rx_buffer[_spi_external_processed_set][slot*SPI_EXTERNAL_FRAME_SIZE];
+}
+
+//Returns the number of complete frames received, starting with slot 0
+//Only call this while no external communication is in progress
+//The other set is armed right away, so the host may go on sending while these frames are processed
+uint8_t spi_get_external_frames(void)
+{
+    uint8_t set;
+
+    set = _spi_external_rx_set;
+    if((_spi_external_slot==0) && !_spi_external_error[set] && (!_spi_external_armed || (spi_external_dma_running() && (_spi_external_position()==0))))
+    {
+        //Nothing received, keep receiving
+        return 0;
+    }
+
+    spi_external_capture();
+
+    //Whatever the transmitting set contained has been sent now
+    _spi_external_pending[_spi_external_tx_set] = 0;
+
+    //Receive into the other set. It sends its responses unless they have been sent already
+    _spi_external_processed_set = set;
+    set ^= 1;
+    _spi_external_frames[set] = 0;
+    _spi_external_error[set] = 0;
+    if(!_spi_external_pending[set])
+    {
+        _spi_external_mark(set, 0, SPI_EXTERNAL_RESPONSE_BUSY);
+    }
+    _spi_external_rx_set = set;
+    _spi_external_tx_set = set;
+    _spi_external_slot = 0;
+    spi_external_arm();
+
+    if(_spi_external_frames[_spi_external_processed_set]==0)
+    {
+        //Only a rejected frame. Nothing to process
+        spi_release_external_frames();
+    }
+    return _spi_external_frames[_spi_external_processed_set];
+}
+
+//All frames have been processed and their responses are in place
+//They are sent with the next transfer if the host has not started it yet
+void spi_release_external_frames(void)
+{
+    uint8_t set;
+    uint8_t frames;
+
+    set = _spi_external_processed_set;
+    frames = _spi_external_frames[set];
+
+    //Tell the host what happened to the frames after the last one processed
+    //Slots that have not received a frame do not contain a response
+    if(_spi_external_error[set])
+    {
+        _spi_external_mark(set, frames, _spi_external_error[set]);
+        ++frames;
+    }
+    _spi_external_mark(set, frames, SPI_EXTERNAL_RESPONSE_NONE);
+    _spi_external_pending[set] = 1;
+
+    //Send these responses with the next transfer unless there are older ones to be sent
+    if(!_spi_external_armed || !spi_external_dma_running() || _spi_external_pending[_spi_external_tx_set] || (_spi_external_slot!=0))
+    {
+        return;
+    }
+
+    //Only while nothing has been clocked out of the transmitting set. Slave select is checked first:
+    //while it is not asserted, the host can't clock a byte in the meantime
+    if(spi_external_selected() || (_spi_external_position()!=0))
+    {
+        //The next transfer has started. It carries the BUSY status, these responses follow with the one after
+        return;
+    }
+    spi_external_dma_stop();
+    _spi_external_tx_set = set;
+    spi_external_arm();
+}
@@ -0,0 +1,31 @@
+/*
+ * File:   spi_external.h
+ *
+ * Slot bookkeeping for frames received as external SPI slave, see spi.h
+ * It only talks to the DMA and MSSP modules through the functions below, which
+ * spi.c implements. So it can be built and tested on a PC (host/spi_test.c)
+ */
+
+#ifndef SPI_EXTERNAL_H
+#define	SPI_EXTERNAL_H
+
+#include <stdint.h>
+
+//Used by spi.c when switching between internal and external configuration
+void spi_external_capture(void);
+void spi_external_arm(void);
+
+//Implemented by spi.c
+//Receives length bytes into rx while sending the ones from tx
+void spi_external_dma_start(uint8_t *tx, uint8_t *rx, uint16_t length);
+//Number of bytes transferred since spi_external_dma_start() was called with tx
+uint16_t spi_external_dma_position(uint8_t *tx);
+//The DMA module stops by itself once all bytes have been transferred
+uint8_t spi_external_dma_running(void);
+void spi_external_dma_stop(void);
+//Data has been received while the DMA module was stopped
+uint8_t spi_external_overflow(void);
+//The host has asserted slave select, i.e. a transfer is in progress
+uint8_t spi_external_selected(void);
+
+#endif	/* SPI_EXTERNAL_H */
@@ -6,6 +6,7 @@
 #include "i2c.h"
 #include "ui.h"
 #include "internal_flash.h"
+#include "display.h"
 
 /* ****************************************************************************
  * Variables definitions
@@ -81,7 +82,7 @@ static void _ui_encoder(void)
             if(os.buttonCount>0)
             {
                 i2c_eeprom_writeByte(EEPROM_BOOTLOADER_BYTE_ADDRESS, BOOTLOADER_BYTE_FORCE_NORMAL_MODE);
-                system_delay_ms(10); //ensure data has been written before rebooting
+                i2c_eeprom_wait_write_complete(); //ensure data has been written before rebooting
                 reboot();
             }
             break;
@@ -160,6 +161,8 @@ void ui_run(void)
 		case USER_INTERFACE_STATUS_STARTUP_4:
             //Send init sequence
             i2c_display_send_init_sequence();
+            //Display has been cleared, next update needs to rewrite everything
+            display_invalidate();
             //Turn backlight on
             i2c_digipot_backlight(150); 
             //Enable rotary encoder inputs
@@ -34,8 +34,17 @@ please contact mla_licensing@microchip.com
 								// that use EP0 IN or OUT for sending large amounts of
 								// application related data.
 									
-#define USB_MAX_NUM_INT     	2   //Set this number to match the maximum interface number used in the descriptors for this firmware project
+//Vendor specific bulk interface carrying the API (see api.h). It costs about 160 bytes of RAM
+//(buffers, handles and the buffer descriptors of endpoint 3), so it is left out by default
+//#define USB_VENDOR_INTERFACE_AVAILABLE
+
+#ifdef USB_VENDOR_INTERFACE_AVAILABLE
+#define USB_MAX_NUM_INT     	3   //Number of interfaces (HID, MSD, vendor). USBAlternateInterface[] is indexed by interface number
+#define USB_MAX_EP_NUMBER	    3   //Set this number to match the maximum endpoint number used in the descriptors for this firmware project
+#else
+#define USB_MAX_NUM_INT     	2   //Number of interfaces (HID, MSD). USBAlternateInterface[] is indexed by interface number
 #define USB_MAX_EP_NUMBER	    2   //Set this number to match the maximum endpoint number used in the descriptors for this firmware project
+#endif
 
 //Device descriptor - if these two definitions are not defined then
 //  a const USB_DEVICE_DESCRIPTOR variable by the exact name of device_dsc
@@ -178,6 +187,12 @@ please contact mla_licensing@microchip.com
 #define MSD_DATA_IN_EP          2u
 #define MSD_DATA_OUT_EP         2u
 #define MSD_BUFFER_ADDRESS      0x600
+
+/* Vendor (API via bulk endpoints) */
+#define VENDOR_INTF_ID          0x02
+#define VENDOR_DATA_EP          3
+#define VENDOR_EP_SIZE          64u
+#define VENDOR_MESSAGE_TIMEOUT  32u  //Timeslots (8ms) between packets before a message is dropped
 /** DEFINITIONS ****************************************************/
 
 #endif //USBCFG_H
@@ -173,8 +173,13 @@ const uint8_t configDescriptor1[]={
     /* Configuration Descriptor */
     0x09,//sizeof(USB_CFG_DSC),    // Size of this descriptor in bytes
     USB_DESCRIPTOR_CONFIGURATION,                // CONFIGURATION descriptor type
+#ifdef USB_VENDOR_INTERFACE_AVAILABLE
+    0x57,0x00,            // Total length of data for this cfg
+    3,                      // Number of interfaces in this cfg
+#else
     0x40,0x00,            // Total length of data for this cfg
     2,                      // Number of interfaces in this cfg
+#endif
     1,                      // Index value of this configuration
     0,                      // Configuration string index
     _DEFAULT | _SELF,               // Attributes, see usb_device.h
@@ -240,6 +245,34 @@ const uint8_t configDescriptor1[]={
     _BULK,
     MSD_OUT_EP_SIZE,0x00,
     0x01
+    
+#ifdef USB_VENDOR_INTERFACE_AVAILABLE
+    ,
+    /* Interface Descriptor */
+    9,   // Size of this descriptor in bytes
+    USB_DESCRIPTOR_INTERFACE,               // INTERFACE descriptor type
+    VENDOR_INTF_ID,         // Interface Number
+    0,                      // Alternate Setting Number
+    2,                      // Number of endpoints in this intf
+    0xFF,                   // Class code (vendor specific)
+    0,                      // Subclass code
+    0,                      // Protocol code
+    0,                      // Interface string index
+    
+    /* Endpoint Descriptor */
+    7,
+    USB_DESCRIPTOR_ENDPOINT,
+    _EP03_IN,_BULK,
+    VENDOR_EP_SIZE,0x00,
+    0x01,
+    
+    7,
+    USB_DESCRIPTOR_ENDPOINT,
+    _EP03_OUT,
+    _BULK,
+    VENDOR_EP_SIZE,0x00,
+    0x01
+#endif
 };
 
 
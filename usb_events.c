@@ -94,6 +94,9 @@ bool USER_USB_CALLBACK_EVENT_HANDLER(USB_EVENT event, void *pdata, uint16_t size
              * code. */
             APP_DeviceCustomHIDInitialize();
             APP_DeviceMSDInitialize();
+#ifdef USB_VENDOR_INTERFACE_AVAILABLE
+            APP_DeviceVendorInitialize();
+#endif
             break;
 
         case EVENT_SET_DESCRIPTOR: